@@ -31,14 +31,30 @@
 #include "builtin/builtin.h"
 #include "ctrl_server.h"
 #include "global.h"
+#include "io_server.h"
+#include "metrics.h"
 #include "misc.h"
 #include "storage.h"
+#include "trace.h"
+#include <errno.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <string.h>
 
 static const char *g_server = "root";
 
+static int command_ctrl_dump(int (*dump)(const char *, void **, int *), int (*render)(FILE *, const void *, int)) {
+    void *data   = NULL;
+    int   length = 0;
+    int   ret    = dump(g_server, &data, &length);
+    if (!ret) {
+        ret = render(stdout, data, length);
+        if (ret) fprintf(stderr, "fail to parse reply with length %d (%d)\n", length, ret);
+    }
+    free(data);
+    return ret;
+}
+
 static int command_ctrl(int argc, char *argv[]) {
     if (argc >= 2) {
         if (!strcmp(argv[1], "register_child")) {
@@ -53,6 +69,10 @@ static int command_ctrl(int argc, char *argv[]) {
             return ctrl_dump_db_route(g_server, NULL);
         } else if (!strcmp(argv[1], "dump_db_cache")) {
             return ctrl_dump_db_cache(g_server, NULL);
+        } else if (!strcmp(argv[1], "stats")) {
+            return command_ctrl_dump(ctrl_stats, metrics_render);
+        } else if (!strcmp(argv[1], "traces")) {
+            return command_ctrl_dump(ctrl_traces, trace_render);
         }
     }
 
@@ -63,6 +83,8 @@ static int command_ctrl(int argc, char *argv[]) {
     fprintf(stderr, "    unregister_parent {name}\n");
     fprintf(stderr, "    dump_db_route\n");
     fprintf(stderr, "    dump_db_cache\n");
+    fprintf(stderr, "    stats\n");
+    fprintf(stderr, "    traces\n");
     return UINT8_MAX;
 }
 
@@ -72,23 +94,35 @@ static int command_get(int argc, char *argv[]) {
         return UINT8_MAX;
     }
 
-    int           ret     = 0;
-    storage_ctx_t storage = {0};
+    int            ret     = 0;
+    int            num     = argc - 1;
+    const char   **keys    = (const char **)&argv[1];
+    const value_t *values[num];
+    int            results[num];
+    storage_ctx_t  storage = {0};
     if (constructor_unix(&storage, g_server, true)) {
         return -1;
     }
-    for (int i = 1; argv[i]; i++) {
-        const char    *key   = argv[i];
-        const value_t *value = NULL;
-        ret                  = storage_get(&storage, key, &value, NULL);
-        if (ret == 0) {
+    if (num == 1) { /* 单个key不使用批量请求 */
+        values[0]  = NULL;
+        results[0] = storage_get(&storage, keys[0], &values[0], NULL);
+    } else {
+        ret = storage_mget(&storage, num, keys, values, NULL, results);
+    }
+    for (int i = 0; !ret && i < num; i++) {
+        if (results[i] == 0) {
             char buffer[512] = {0};
-            puts(value_fmt(buffer, sizeof(buffer), value, true));
-            free((void *)value);
+            puts(value_fmt(buffer, sizeof(buffer), values[i], true));
+            free((void *)values[i]);
         } else {
-            fprintf(stderr, "fail to get %s (%d)\n", key, ret);
+            fprintf(stderr, "fail to get %s (%d)\n", keys[i], results[i]);
         }
     }
+    if (ret) {
+        fprintf(stderr, "fail to get %d keys (%d)\n", num, ret);
+    } else {
+        ret = results[num - 1];
+    }
     storage_destructor(&storage);
     return ret;
 }
@@ -99,24 +133,45 @@ static int command_set(int argc, char *argv[]) {
         return UINT8_MAX;
     }
 
-    int           ret     = 0;
-    storage_ctx_t storage = {0};
-    if (constructor_unix(&storage, g_server, true)) {
-        return -1;
+    int            ret = 0;
+    int            num = argc / 2;
+    const char    *keys[num];
+    const value_t *values[num];
+    int            results[num];
+    storage_ctx_t  storage = {0};
+    for (int i = 0; i < num; i++) {
+        keys[i]   = argv[1 + 2 * i];
+        values[i] = value_parse(argv[2 + 2 * i]);
+        if (!values[i]) {
+            fprintf(stderr, "invalid value %s of %s\n", argv[2 + 2 * i], keys[i]);
+            ret = EINVAL;
+        }
     }
-    for (int i = 1; argv[i]; i += 2) {
-        const char    *key       = argv[i];
-        const char    *value_str = argv[i + 1];
-        const value_t *value     = value_parse(value_str);
-        ret                      = storage_set(&storage, key, value);
-        if (ret == 0) {
-            fprintf(stderr, "set %s to %s\n", key, value_str);
+    if (ret || constructor_unix(&storage, g_server, true)) {
+        ret = ret ? ret : -1;
+        goto exit;
+    }
+    if (num == 1) {
+        results[0] = storage_set(&storage, keys[0], values[0]);
+    } else {
+        ret = storage_mset(&storage, num, keys, values, results);
+    }
+    for (int i = 0; !ret && i < num; i++) {
+        if (results[i] == 0) {
+            fprintf(stderr, "set %s to %s\n", keys[i], argv[2 + 2 * i]);
         } else {
-            fprintf(stderr, "fail to set %s to %s (%d)\n", key, value_str, ret);
+            fprintf(stderr, "fail to set %s to %s (%d)\n", keys[i], argv[2 + 2 * i], results[i]);
         }
-        free((void *)value);
+    }
+    if (ret) {
+        fprintf(stderr, "fail to set %d keys (%d)\n", num, ret);
+    } else {
+        ret = results[num - 1];
     }
     storage_destructor(&storage);
+exit:
+    for (int i = 0; i < num; i++)
+        free((void *)values[i]);
     return ret;
 }
 
@@ -127,18 +182,68 @@ static int command_del(int argc, char *argv[]) {
     }
 
     int           ret     = 0;
+    int           num     = argc - 1;
+    const char  **keys    = (const char **)&argv[1];
+    int           results[num];
     storage_ctx_t storage = {0};
     if (constructor_unix(&storage, g_server, true)) {
         return -1;
     }
-    for (int i = 1; argv[i]; i++) {
-        const char *key = argv[i];
-        ret             = storage_del(&storage, key);
-        if (ret == 0) {
-            fprintf(stderr, "del %s\n", key);
+    if (num == 1) {
+        results[0] = storage_del(&storage, keys[0]);
+    } else {
+        ret = storage_mdel(&storage, num, keys, results);
+    }
+    for (int i = 0; !ret && i < num; i++) {
+        if (results[i] == 0) {
+            fprintf(stderr, "del %s\n", keys[i]);
         } else {
-            fprintf(stderr, "fail to del %s (%d)\n", key, ret);
+            fprintf(stderr, "fail to del %s (%d)\n", keys[i], results[i]);
+        }
+    }
+    if (ret) {
+        fprintf(stderr, "fail to del %d keys (%d)\n", num, ret);
+    } else {
+        ret = results[num - 1];
+    }
+    storage_destructor(&storage);
+    return ret;
+}
+
+static int command_scan(int argc, char *argv[]) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "scan {prefix} [limit]\n");
+        return UINT8_MAX;
+    }
+
+    int             ret              = 0;
+    const char     *prefix           = argv[1];
+    long            limit            = argc == 3 ? strtol(argv[2], NULL, 0) : 0;
+    long            total            = 0;
+    char            cursor[NAME_MAX] = {0};
+    storage_entry_t entries[IO_BATCH_MAX];
+    storage_ctx_t   storage = {0};
+    if (constructor_unix(&storage, g_server, true)) {
+        return -1;
+    }
+    for (;;) {
+        int page = IO_BATCH_MAX, num = 0;
+        if (limit > 0 && limit - total < page) page = limit - total;
+        if (!page) break;
+
+        ret = storage_scan(&storage, prefix, cursor, page, entries, &num);
+        if (ret) {
+            fprintf(stderr, "fail to scan %s (%d)\n", prefix, ret);
+            break;
+        }
+        for (int i = 0; i < num; i++) {
+            char buffer[512] = {0};
+            printf("%s %s\n", entries[i].key, value_fmt(buffer, sizeof(buffer), entries[i].value, true));
         }
+        total += num;
+        if (num) snprintf(cursor, sizeof(cursor), "%s", entries[num - 1].key);
+        storage_entries_free(entries, num);
+        if (num < page) break;
     }
     storage_destructor(&storage);
     return ret;
@@ -156,7 +261,7 @@ int main(int argc, char *argv[]) {
             g_at = optarg;
             break;
         case 'h':
-            fprintf(stderr, "%s [-t {server}] [-N {socket root path}] ctrl|get|set|del\n", argv[0]);
+            fprintf(stderr, "%s [-t {server}] [-N {socket root path}] ctrl|get|set|del|scan\n", argv[0]);
             exit(0);
             break;
         default:
@@ -177,6 +282,8 @@ int main(int argc, char *argv[]) {
             return command_set(argc, argv);
         } else if (!strcmp(argv[0], "del")) {
             return command_del(argc, argv);
+        } else if (!strcmp(argv[0], "scan")) {
+            return command_scan(argc, argv);
         }
     }
 
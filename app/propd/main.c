@@ -44,6 +44,8 @@ int main(int argc, char *argv[]) {
     propd_config_apply_parser(&config, &unix_parseConfig);
     propd_config_apply_parser(&config, &memory_parseConfig);
     propd_config_apply_parser(&config, &tcp_parseConfig);
+    propd_config_apply_parser(&config, &logstore_parseConfig);
+    propd_config_apply_parser(&config, &btree_parseConfig);
 
     attach_wait("propd_attach", '.', 2);
     propd_config_parse(&config, argc, argv);
@@ -0,0 +1,997 @@
+/**
+ * @file btree.c
+ * @author kioz.wang (never.had@outlook.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright MIT License
+ *
+ *  Copyright (c) 2025 kioz.wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include "builtin.h"
+#include "global.h"
+#include "misc.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define logFmtHead "[storage::(btree)] "
+
+#define BTREE_MAGIC     0x45525442 /* "BTRE" */
+#define BTREE_VERSION   1
+#define BTREE_PAGE_SIZE 4096
+#define BTREE_NODE_MAX  (BTREE_PAGE_SIZE / 4) /* 叶子节点超过此大小时，值存放在溢出页中 */
+#define BTREE_DEPTH_MAX 16
+#ifndef BTREE_GROW_MIN
+#define BTREE_GROW_MIN (1 << 20) /* 文件每次至少增长的大小 */
+#endif
+
+/**
+ * 整个文件由页组成，页0和页1是交替写入的meta，其余是分支页、叶子页或溢出页。
+ *
+ * 写入时从不修改当前树中的页（copy-on-write），而是把修改路径上的页写到空闲页中，最后写入另一个meta完成提交。
+ * 崩溃后，取校验和正确且txnid最大的meta，总能得到某次提交后的完整的树。被新树替换的页，在提交后（不再有读者能
+ * 访问到时）才会被重用。
+ */
+struct meta {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t page_size;
+    uint64_t txnid;
+    uint32_t root; /* 0表示空树 */
+    uint32_t depth;
+    uint32_t num_pages; /* 已使用的页数（高水位） */
+    uint64_t num_keys;
+    uint32_t checksum; /* 之前所有字节的校验和 */
+} __attribute__((packed));
+
+#define P_BRANCH   0x01
+#define P_LEAF     0x02
+#define P_OVERFLOW 0x04
+
+struct page {
+    uint16_t flags;
+    uint16_t num;     /* 节点数 */
+    uint32_t next;    /* 溢出页：下一个溢出页，0表示结束 */
+    uint16_t slots[]; /* 各节点在页内的偏移，按key升序；节点从页尾向前存放 */
+} __attribute__((packed));
+
+/**
+ * 分支节点：第一个节点的key不参与比较（视为负无穷）
+ */
+struct branch_node {
+    uint32_t child;
+    uint16_t key_len;
+    char     key[];
+} __attribute__((packed));
+
+/**
+ * 叶子节点：key | 值（sizeof(value_t) + length），或big时为溢出页号
+ */
+struct leaf_node {
+    uint16_t key_len;
+    uint8_t  big;
+    uint32_t size;
+    char     key[];
+} __attribute__((packed));
+
+struct item {
+    const char *key;
+    uint16_t    key_len;
+    uint8_t     big;
+    uint32_t    size;  /* leaf */
+    const void *data;  /* leaf，!big */
+    uint32_t    ovpg;  /* leaf，big */
+    uint32_t    child; /* branch */
+};
+
+#define ITEMS_MAX ((BTREE_PAGE_SIZE - sizeof(struct page)) / (sizeof(uint16_t) + sizeof(struct branch_node)) + 2)
+
+struct split {
+    uint32_t child; /* 分裂出的右侧页，0表示没有分裂 */
+    uint16_t key_len;
+    char     key[NAME_MAX];
+};
+
+/**
+ * 写事务的状态（由mutex串行化）
+ */
+struct txn {
+    uint32_t  root;
+    uint32_t  depth;
+    uint32_t  num_pages;
+    uint64_t  num_keys;
+    uint32_t *dirty; /* 本事务中分配的页（可以原地修改） */
+    uint32_t  num_dirty;
+    uint32_t *pending; /* 本事务中被替换的页，提交后才能重用 */
+    uint32_t  num_pending;
+    bool      changed;
+};
+
+struct priv {
+    const char *path;
+    int         fd;
+    durable_t   durable;
+
+    pthread_rwlock_t rwlock; /* 读者持有读锁；写者切换meta和扩大映射时持有写锁 */
+    uint8_t         *map;
+    uint32_t         map_pages;
+    struct meta      meta; /* 当前提交的meta */
+
+    pthread_mutex_t mutex; /* 串行化写事务，保护以下所有字段 */
+    bool            failed; /* 写入meta后持久化失败，映射中的meta与priv->meta不再一致，此后拒绝写入 */
+    struct txn      txn;
+    uint32_t       *free; /* 空闲页 */
+    uint32_t        num_free;
+    uint8_t        *dirty_map; /* bitmap of txn.dirty */
+    struct item     items[BTREE_DEPTH_MAX][ITEMS_MAX];
+    uint8_t         scratch[2][BTREE_PAGE_SIZE];
+};
+typedef struct priv priv_t;
+
+#define PAGE(priv, pgno) ((struct page *)((priv)->map + (size_t)(pgno) * BTREE_PAGE_SIZE))
+#define BITMAP_SIZE(n)   (((n) + 7) / 8)
+
+static int key_cmp(const char *a, uint16_t a_len, const char *b, uint16_t b_len) {
+    int ret = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    return ret ? ret : (int)a_len - (int)b_len;
+}
+
+static void page_item(const struct page *page, int i, struct item *item) {
+    const char *node = (const char *)page + page->slots[i];
+
+    if (page->flags & P_BRANCH) {
+        const struct branch_node *branch = (const struct branch_node *)node;
+        item->key                        = branch->key;
+        item->key_len                    = branch->key_len;
+        item->child                      = branch->child;
+    } else {
+        const struct leaf_node *leaf = (const struct leaf_node *)node;
+        item->key                    = leaf->key;
+        item->key_len                = leaf->key_len;
+        item->big                    = leaf->big;
+        item->size                   = leaf->size;
+        if (leaf->big) memcpy(&item->ovpg, leaf->key + leaf->key_len, sizeof(uint32_t));
+        else item->data = leaf->key + leaf->key_len;
+    }
+}
+
+static int page_decode(const struct page *page, struct item items[]) {
+    for (int i = 0; i < page->num; i++)
+        page_item(page, i, &items[i]);
+    return page->num;
+}
+
+/**
+ * @brief 叶子页中第一个不小于key的位置
+ */
+static int leaf_search(const struct page *page, const char *key, uint16_t key_len, bool *found) {
+    int lo = 0, hi = page->num;
+    *found = false;
+    while (lo < hi) {
+        struct item item;
+        int         mid = (lo + hi) / 2;
+        page_item(page, mid, &item);
+        int ret = key_cmp(item.key, item.key_len, key, key_len);
+        if (!ret) {
+            *found = true;
+            return mid;
+        }
+        if (ret < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * @brief 分支页中key所属的子节点
+ */
+static int branch_search(const struct page *page, const char *key, uint16_t key_len) {
+    int lo = 1, hi = page->num;
+    while (lo < hi) {
+        struct item item;
+        int         mid = (lo + hi) / 2;
+        page_item(page, mid, &item);
+        if (key_cmp(item.key, item.key_len, key, key_len) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo - 1;
+}
+
+static size_t node_size(int flags, const struct item *item) {
+    if (flags & P_BRANCH) return sizeof(struct branch_node) + item->key_len;
+    return sizeof(struct leaf_node) + item->key_len + (item->big ? sizeof(uint32_t) : item->size);
+}
+
+static void page_encode(int flags, const struct item items[], int n, void *buffer) {
+    struct page *page  = buffer;
+    uint16_t     upper = BTREE_PAGE_SIZE;
+
+    page->flags  = flags;
+    page->num    = n;
+    page->next   = 0;
+    for (int i = 0; i < n; i++) {
+        const struct item *item = &items[i];
+        upper -= node_size(flags, item);
+        page->slots[i] = upper;
+
+        char *node = (char *)buffer + upper;
+        if (flags & P_BRANCH) {
+            struct branch_node *branch = (struct branch_node *)node;
+            branch->child              = item->child;
+            branch->key_len            = item->key_len;
+            memcpy(branch->key, item->key, item->key_len);
+        } else {
+            struct leaf_node *leaf = (struct leaf_node *)node;
+            leaf->key_len          = item->key_len;
+            leaf->big              = item->big;
+            leaf->size             = item->size;
+            memcpy(leaf->key, item->key, item->key_len);
+            if (item->big) memcpy(leaf->key + item->key_len, &item->ovpg, sizeof(uint32_t));
+            else memcpy(leaf->key + item->key_len, item->data, item->size);
+        }
+    }
+}
+
+static inline bool is_dirty(const priv_t *priv, uint32_t pgno) { return priv->dirty_map[pgno / 8] & (1 << pgno % 8); }
+
+/**
+ * @brief 分配一个空闲页（调用前已通过txn_reserve确保足够）
+ */
+static uint32_t page_alloc(priv_t *priv) {
+    struct txn *txn  = &priv->txn;
+    uint32_t    pgno = priv->num_free ? priv->free[--priv->num_free] : txn->num_pages++;
+
+    if (!is_dirty(priv, pgno)) {
+        priv->dirty_map[pgno / 8] |= 1 << pgno % 8;
+        txn->dirty[txn->num_dirty++] = pgno;
+    }
+    return pgno;
+}
+
+static void page_free(priv_t *priv, uint32_t pgno) {
+    /* 本事务中分配的页不在当前树中，可以立即重用 */
+    if (is_dirty(priv, pgno)) priv->free[priv->num_free++] = pgno;
+    else priv->txn.pending[priv->txn.num_pending++] = pgno;
+}
+
+/**
+ * @brief 取得可以写入的页：本事务中分配的页原地写入，否则换到新的页
+ */
+static uint32_t page_touch(priv_t *priv, uint32_t pgno) {
+    if (pgno && is_dirty(priv, pgno)) return pgno;
+    if (pgno) page_free(priv, pgno);
+    return page_alloc(priv);
+}
+
+#define OVERFLOW_DATA (BTREE_PAGE_SIZE - sizeof(struct page)) /* 每个溢出页存放的字节数 */
+
+static uint32_t overflow_npages(uint32_t size) { return (size + OVERFLOW_DATA - 1) / OVERFLOW_DATA; }
+
+/**
+ * @brief 把值写入一串溢出页（不要求连续，以便重用空闲页）
+ */
+static uint32_t overflow_write(priv_t *priv, const value_t *value, uint32_t size) {
+    const uint8_t *data  = (const uint8_t *)value;
+    uint32_t       first = 0;
+    struct page   *prev  = NULL;
+
+    for (uint32_t offset = 0; offset < size; offset += OVERFLOW_DATA) {
+        uint32_t     pgno   = page_alloc(priv);
+        struct page *page   = PAGE(priv, pgno);
+        uint32_t     length = size - offset < OVERFLOW_DATA ? size - offset : OVERFLOW_DATA;
+
+        if (prev) prev->next = pgno;
+        else first = pgno;
+        page->flags = P_OVERFLOW;
+        page->num   = 0;
+        page->next  = 0;
+        memcpy(page->slots, data + offset, length);
+        prev = page;
+    }
+    return first;
+}
+
+static void overflow_free(priv_t *priv, uint32_t pgno) {
+    while (pgno) {
+        uint32_t next = PAGE(priv, pgno)->next;
+        page_free(priv, pgno);
+        pgno = next;
+    }
+}
+
+/**
+ * @brief 把items写入页，放不下时分裂为两页
+ *
+ * @param pgno 输入为原来的页（0表示没有），输出为写入的页
+ * @param split 输出分裂出的右侧页及其第一个key
+ */
+static void page_write(priv_t *priv, uint32_t *pgno, int flags, const struct item items[], int n,
+                       struct split *split) {
+    size_t total = 0;
+    for (int i = 0; i < n; i++)
+        total += sizeof(uint16_t) + node_size(flags, &items[i]);
+
+    split->child = 0;
+    if (sizeof(struct page) + total <= BTREE_PAGE_SIZE) {
+        page_encode(flags, items, n, priv->scratch[0]);
+        *pgno = page_touch(priv, *pgno);
+        memcpy(PAGE(priv, *pgno), priv->scratch[0], BTREE_PAGE_SIZE);
+        return;
+    }
+
+    size_t left = 0;
+    int    k    = 0;
+    while (k < n - 1 && left + sizeof(uint16_t) + node_size(flags, &items[k]) <= total / 2)
+        left += sizeof(uint16_t) + node_size(flags, &items[k++]);
+    if (!k) k = 1;
+
+    /* items可能引用着原来的页，先全部编码好再写入 */
+    page_encode(flags, items, k, priv->scratch[0]);
+    page_encode(flags, &items[k], n - k, priv->scratch[1]);
+    split->key_len = items[k].key_len;
+    memcpy(split->key, items[k].key, items[k].key_len);
+
+    *pgno = page_touch(priv, *pgno);
+    memcpy(PAGE(priv, *pgno), priv->scratch[0], BTREE_PAGE_SIZE);
+    split->child = page_alloc(priv);
+    memcpy(PAGE(priv, split->child), priv->scratch[1], BTREE_PAGE_SIZE);
+}
+
+static void items_insert(struct item items[], int *n, int i, const struct item *item) {
+    memmove(&items[i + 1], &items[i], (*n - i) * sizeof(struct item));
+    items[i] = *item;
+    (*n)++;
+}
+
+static void items_remove(struct item items[], int *n, int i) {
+    memmove(&items[i], &items[i + 1], (*n - i - 1) * sizeof(struct item));
+    (*n)--;
+}
+
+/**
+ * @brief 在以pgno为根的子树中写入或删除key（copy-on-write）
+ *
+ * @param pgno 输入为子树的根，输出为新的根（0表示子树已空）
+ * @param value NULL表示删除
+ * @return int errno (ENOENT)，出错时没有修改
+ */
+static int tree_put(priv_t *priv, int level, uint32_t *pgno, const char *key, uint16_t key_len,
+                    const value_t *value, struct split *split) {
+    const struct page *page  = PAGE(priv, *pgno);
+    struct item       *items = priv->items[level];
+    int                n     = page_decode(page, items);
+    int                flags = page->flags;
+    int                ret   = 0;
+
+    split->child = 0;
+    if (flags & P_BRANCH) {
+        int      i     = branch_search(page, key, key_len);
+        uint32_t child = items[i].child;
+        if ((ret = tree_put(priv, level + 1, &child, key, key_len, value, split))) return ret;
+
+        if (!child) {
+            items_remove(items, &n, i);
+        } else {
+            items[i].child = child;
+            if (split->child) {
+                struct item item = {.key = split->key, .key_len = split->key_len, .child = split->child};
+                items_insert(items, &n, i + 1, &item);
+            }
+        }
+    } else {
+        bool found;
+        int  i = leaf_search(page, key, key_len, &found);
+        if (!value && !found) return ENOENT;
+
+        if (found) {
+            if (items[i].big) overflow_free(priv, items[i].ovpg);
+            items_remove(items, &n, i);
+        } else priv->txn.num_keys++;
+        if (value) {
+            struct item item = {.key = key, .key_len = key_len, .size = sizeof(value_t) + value->length, .data = value};
+            if (node_size(P_LEAF, &item) > BTREE_NODE_MAX) {
+                item.big  = 1;
+                item.ovpg = overflow_write(priv, value, item.size);
+            }
+            items_insert(items, &n, i, &item);
+        } else priv->txn.num_keys--;
+    }
+
+    if (!n) {
+        page_free(priv, *pgno);
+        *pgno = 0;
+        return 0;
+    }
+    page_write(priv, pgno, flags, items, n, split);
+    return 0;
+}
+
+/**
+ * @brief 扩大文件和映射（must hold mutex）
+ */
+static int grow(priv_t *priv, uint32_t need) {
+    uint32_t map_pages = priv->map_pages + priv->map_pages / 4;
+    if (map_pages < priv->map_pages + BTREE_GROW_MIN / BTREE_PAGE_SIZE)
+        map_pages = priv->map_pages + BTREE_GROW_MIN / BTREE_PAGE_SIZE;
+    if (map_pages < need) map_pages = need;
+    map_pages = (map_pages + 7) & ~7u;
+
+    uint32_t *free = realloc(priv->free, map_pages * sizeof(uint32_t));
+    if (free) priv->free = free;
+    uint32_t *dirty = realloc(priv->txn.dirty, map_pages * sizeof(uint32_t));
+    if (dirty) priv->txn.dirty = dirty;
+    uint32_t *pending = realloc(priv->txn.pending, map_pages * sizeof(uint32_t));
+    if (pending) priv->txn.pending = pending;
+    uint8_t *dirty_map = realloc(priv->dirty_map, BITMAP_SIZE(map_pages));
+    if (dirty_map) {
+        memset(dirty_map + BITMAP_SIZE(priv->map_pages), 0, BITMAP_SIZE(map_pages) - BITMAP_SIZE(priv->map_pages));
+        priv->dirty_map = dirty_map;
+    }
+    if (!free || !dirty || !pending || !dirty_map) return ENOMEM;
+
+    if (ftruncate(priv->fd, (off_t)map_pages * BTREE_PAGE_SIZE)) return errno;
+
+    pthread_rwlock_wrlock(&priv->rwlock);
+    void *map = mremap(priv->map, (size_t)priv->map_pages * BTREE_PAGE_SIZE, (size_t)map_pages * BTREE_PAGE_SIZE,
+                       MREMAP_MAYMOVE);
+    if (map != MAP_FAILED) {
+        priv->map       = map;
+        priv->map_pages = map_pages;
+    }
+    pthread_rwlock_unlock(&priv->rwlock);
+    if (map == MAP_FAILED) return errno;
+
+    logfV(logFmtHead "%s grow to %u pages", priv->path, map_pages);
+    return 0;
+}
+
+/**
+ * @brief 确保下一次tree_put不会因为空间不足而失败
+ */
+static int txn_reserve(priv_t *priv, const value_t *value) {
+    struct txn *txn = &priv->txn;
+
+    if (txn->depth >= BTREE_DEPTH_MAX - 1) return ENOSPC;
+    uint32_t need = 2 * (txn->depth + 2); /* 路径上的每一层都可能分裂，外加新的根 */
+    if (value) need += overflow_npages(sizeof(value_t) + value->length);
+    need = need > priv->num_free ? need - priv->num_free : 0; /* 优先使用空闲页 */
+    if ((uint64_t)txn->num_pages + need > priv->map_pages) return grow(priv, txn->num_pages + need);
+    return 0;
+}
+
+/**
+ * @brief 从根开始标记所有可达的页，其余的页都是空闲的
+ */
+static int mark_reachable(priv_t *priv, uint32_t pgno, uint8_t *map, int level) {
+    if (pgno < 2 || pgno >= priv->meta.num_pages || level >= BTREE_DEPTH_MAX) return EIO;
+
+    const struct page *page = PAGE(priv, pgno);
+    map[pgno / 8] |= 1 << pgno % 8;
+    for (int i = 0; i < page->num; i++) {
+        struct item item;
+        page_item(page, i, &item);
+        if (page->flags & P_BRANCH) {
+            int ret = mark_reachable(priv, item.child, map, level + 1);
+            if (ret) return ret;
+        } else if (item.big) {
+            uint32_t npages = 0;
+            for (uint32_t j = item.ovpg; j; j = PAGE(priv, j)->next, npages++) {
+                if (j < 2 || j >= priv->meta.num_pages) return EIO;
+                map[j / 8] |= 1 << j % 8;
+            }
+            if (npages != overflow_npages(item.size)) return EIO;
+        }
+    }
+    return 0;
+}
+
+static int free_rebuild(priv_t *priv) {
+    uint8_t *map = calloc(BITMAP_SIZE(priv->map_pages), 1);
+    if (!map) return errno;
+
+    int ret = priv->meta.root ? mark_reachable(priv, priv->meta.root, map, 0) : 0;
+    if (!ret) {
+        priv->num_free = 0;
+        for (uint32_t i = priv->meta.num_pages; i-- > 2;) {
+            if (!(map[i / 8] & (1 << i % 8))) priv->free[priv->num_free++] = i;
+        }
+    }
+    free(map);
+    return ret;
+}
+
+/**
+ * @return int errno (EIO 之前的提交失败)
+ */
+static int txn_begin(priv_t *priv) {
+    struct txn *txn = &priv->txn;
+
+    pthread_mutex_lock(&priv->mutex);
+    if (priv->failed) {
+        pthread_mutex_unlock(&priv->mutex);
+        return EIO;
+    }
+    txn->root        = priv->meta.root;
+    txn->depth       = priv->meta.depth;
+    txn->num_pages   = priv->meta.num_pages;
+    txn->num_keys    = priv->meta.num_keys;
+    txn->num_dirty   = 0;
+    txn->num_pending = 0;
+    txn->changed     = false;
+    return 0;
+}
+
+static void txn_end(priv_t *priv) {
+    struct txn *txn = &priv->txn;
+    for (uint32_t i = 0; i < txn->num_dirty; i++)
+        priv->dirty_map[txn->dirty[i] / 8] = 0;
+    pthread_mutex_unlock(&priv->mutex);
+}
+
+static void txn_abort(priv_t *priv) {
+    if (priv->txn.changed) free_rebuild(priv);
+    txn_end(priv);
+}
+
+/**
+ * @brief 提交写事务：先持久化新写入的页，再写入另一个meta
+ *
+ * 写入meta后持久化失败时，新的meta可能已经（或将会）落盘，它引用的页不能被重用，所以不回滚空闲页，而是拒绝此后的
+ * 写入（读者仍然看到提交前的树；重启后取磁盘上有效的meta）
+ */
+static int txn_commit(priv_t *priv) {
+    struct txn *txn = &priv->txn;
+    int         ret = 0;
+
+    if (!txn->changed) goto exit;
+    if ((ret = durable_commit(&priv->durable, priv->fd))) goto exit;
+
+    struct meta meta = priv->meta;
+    meta.txnid++;
+    meta.root      = txn->root;
+    meta.depth     = txn->depth;
+    meta.num_pages = txn->num_pages;
+    meta.num_keys  = txn->num_keys;
+    meta.checksum  = hash_memory(HASH_INIT, &meta, offsetof(struct meta, checksum));
+    memcpy(PAGE(priv, meta.txnid % 2), &meta, sizeof(meta));
+    if ((ret = durable_commit(&priv->durable, priv->fd))) {
+        logfE(logFmtHead "%s fail to commit txn %lu, refuse to write any more" logFmtErrno, priv->path, meta.txnid,
+              logArgErrno_(ret));
+        priv->failed = true;
+        txn_end(priv);
+        return ret;
+    }
+
+    /* 切换之后，不再有读者能访问到被替换的页 */
+    pthread_rwlock_wrlock(&priv->rwlock);
+    priv->meta = meta;
+    pthread_rwlock_unlock(&priv->rwlock);
+    memcpy(&priv->free[priv->num_free], txn->pending, txn->num_pending * sizeof(uint32_t));
+    priv->num_free += txn->num_pending;
+
+exit:
+    if (ret) {
+        logfE(logFmtHead "%s fail to commit" logFmtErrno, priv->path, logArgErrno_(ret));
+        txn_abort(priv);
+    } else txn_end(priv);
+    return ret;
+}
+
+/**
+ * @brief 在写事务中写入或删除一个key
+ */
+static int txn_put(priv_t *priv, const char *key, const value_t *value) {
+    struct txn  *txn     = &priv->txn;
+    size_t       key_len = strlen(key);
+    struct split split;
+    int          ret = 0;
+
+    if (key_len >= NAME_MAX) return ENAMETOOLONG;
+    if (!txn->root && !value) return ENOENT;
+    if ((ret = txn_reserve(priv, value))) return ret;
+
+    if (!txn->root) {
+        struct item item = {.key = key, .key_len = key_len, .size = sizeof(value_t) + value->length, .data = value};
+        if (node_size(P_LEAF, &item) > BTREE_NODE_MAX) {
+            item.big  = 1;
+            item.ovpg = overflow_write(priv, value, item.size);
+        }
+        page_write(priv, &txn->root, P_LEAF, &item, 1, &split);
+        txn->depth    = 1;
+        txn->num_keys = 1;
+        txn->changed  = true;
+        return 0;
+    }
+
+    if ((ret = tree_put(priv, 0, &txn->root, key, key_len, value, &split))) return ret;
+    txn->changed = true;
+
+    if (split.child) {
+        struct item  items[2] = {{.child = txn->root}, {.key = split.key, .key_len = split.key_len, .child = split.child}};
+        struct split unused;
+        uint32_t     root = 0;
+        page_write(priv, &root, P_BRANCH, items, 2, &unused);
+        txn->root = root;
+        txn->depth++;
+    }
+    /* 根只剩一个子节点时，降低树的高度 */
+    while (txn->root && (PAGE(priv, txn->root)->flags & P_BRANCH) && PAGE(priv, txn->root)->num == 1) {
+        uint32_t root = txn->root;
+        struct item item;
+        page_item(PAGE(priv, root), 0, &item);
+        page_free(priv, root);
+        txn->root = item.child;
+        txn->depth--;
+    }
+    if (!txn->root) txn->depth = 0;
+    return 0;
+}
+
+/**
+ * @brief 查找key所在的叶子节点（must hold rdlock）
+ */
+static int tree_get(const priv_t *priv, const char *key, struct item *item) {
+    size_t   key_len = strlen(key);
+    uint32_t pgno    = priv->meta.root;
+    bool     found   = false;
+
+    if (!pgno || key_len >= NAME_MAX) return ENOENT;
+    while (PAGE(priv, pgno)->flags & P_BRANCH) {
+        const struct page *page = PAGE(priv, pgno);
+        page_item(page, branch_search(page, key, key_len), item);
+        pgno = item->child;
+    }
+    int i = leaf_search(PAGE(priv, pgno), key, key_len, &found);
+    if (!found) return ENOENT;
+    page_item(PAGE(priv, pgno), i, item);
+    return 0;
+}
+
+/**
+ * @brief 直接从映射中复制值
+ */
+static void item_copy(const priv_t *priv, const struct item *item, void *value) {
+    if (!item->big) {
+        memcpy(value, item->data, item->size);
+        return;
+    }
+    uint32_t pgno = item->ovpg;
+    for (uint32_t offset = 0; offset < item->size; offset += OVERFLOW_DATA) {
+        const struct page *page = PAGE(priv, pgno);
+        memcpy((uint8_t *)value + offset, page->slots,
+               item->size - offset < OVERFLOW_DATA ? item->size - offset : OVERFLOW_DATA);
+        pgno = page->next;
+    }
+}
+
+static int btree_get(priv_t *priv, const char *key, const value_t **value, timestamp_t *duration) {
+    struct item item;
+
+    pthread_rwlock_rdlock(&priv->rwlock);
+    int ret = tree_get(priv, key, &item);
+    if (!ret) {
+        value_t *_value = malloc(item.size);
+        if (_value) {
+            item_copy(priv, &item, _value);
+            *value    = _value;
+            *duration = 0;
+        } else ret = errno;
+    }
+    pthread_rwlock_unlock(&priv->rwlock);
+    return ret;
+}
+
+static int btree_get_buf(priv_t *priv, const char *key, value_t *value, uint32_t *size, timestamp_t *duration) {
+    struct item item;
+
+    pthread_rwlock_rdlock(&priv->rwlock);
+    int ret = tree_get(priv, key, &item);
+    if (!ret) {
+        if (*size < item.size) ret = ENOBUFS;
+        else item_copy(priv, &item, value);
+        *size = item.size;
+        if (!ret) *duration = 0;
+    }
+    pthread_rwlock_unlock(&priv->rwlock);
+    return ret;
+}
+
+static int btree_set(priv_t *priv, const char *key, const value_t *value) {
+    int ret = txn_begin(priv);
+    if (ret) return ret;
+    ret = txn_put(priv, key, value);
+    if (ret) {
+        txn_abort(priv);
+        return ret;
+    }
+    return txn_commit(priv);
+}
+
+static int btree_del(priv_t *priv, const char *key) { return btree_set(priv, key, NULL); }
+
+/**
+ * @brief 所有key在一个写事务中完成，只提交一次（txn_put出错时没有修改，不影响其他key）
+ */
+static int btree_mset(priv_t *priv, int num, const char *const keys[], const value_t *const values[], int results[]) {
+    int ret = txn_begin(priv);
+    if (ret) return ret;
+    for (int i = 0; i < num; i++)
+        results[i] = txn_put(priv, keys[i], values ? values[i] : NULL);
+    return txn_commit(priv);
+}
+
+static int btree_mdel(priv_t *priv, int num, const char *const keys[], int results[]) {
+    return btree_mset(priv, num, keys, NULL, results);
+}
+
+/**
+ * @brief 从根到叶子的路径，用于有序遍历
+ */
+struct cursor {
+    uint32_t pgno[BTREE_DEPTH_MAX];
+    int      idx[BTREE_DEPTH_MAX];
+    int      level; /* 叶子所在的层，-1表示已结束 */
+};
+
+static void cursor_descend(const priv_t *priv, struct cursor *cursor) {
+    for (;;) {
+        const struct page *page = PAGE(priv, cursor->pgno[cursor->level]);
+        if (!(page->flags & P_BRANCH)) return;
+
+        struct item item;
+        page_item(page, cursor->idx[cursor->level], &item);
+        cursor->level++;
+        cursor->pgno[cursor->level] = item.child;
+        cursor->idx[cursor->level]  = 0;
+    }
+}
+
+/**
+ * @brief 移到下一个叶子节点（当前位置可能已越过叶子的末尾）
+ */
+static void cursor_next(const priv_t *priv, struct cursor *cursor) {
+    cursor->idx[cursor->level]++;
+    while (cursor->level >= 0 && cursor->idx[cursor->level] >= PAGE(priv, cursor->pgno[cursor->level])->num) {
+        if (--cursor->level >= 0) cursor->idx[cursor->level]++;
+    }
+    if (cursor->level >= 0) cursor_descend(priv, cursor);
+}
+
+/**
+ * @brief 定位到第一个不小于key的叶子节点
+ */
+static void cursor_seek(const priv_t *priv, struct cursor *cursor, const char *key, uint16_t key_len) {
+    uint32_t pgno = priv->meta.root;
+    bool     found;
+
+    cursor->level = -1;
+    if (!pgno) return;
+    for (;;) {
+        const struct page *page = PAGE(priv, pgno);
+        cursor->level++;
+        cursor->pgno[cursor->level] = pgno;
+        if (!(page->flags & P_BRANCH)) break;
+
+        struct item item;
+        cursor->idx[cursor->level] = branch_search(page, key, key_len);
+        page_item(page, cursor->idx[cursor->level], &item);
+        pgno = item.child;
+    }
+    cursor->idx[cursor->level] = leaf_search(PAGE(priv, pgno), key, key_len, &found);
+    if (cursor->idx[cursor->level] >= PAGE(priv, pgno)->num) {
+        cursor->idx[cursor->level]--;
+        cursor_next(priv, cursor);
+    }
+}
+
+static int btree_scan(priv_t *priv, const char *prefix, const char *cursor, int limit, storage_entry_t entries[],
+                      int *num) {
+    int           ret        = 0;
+    size_t        prefix_len = strlen(prefix);
+    size_t        cursor_len = strlen(cursor);
+    struct cursor c;
+
+    pthread_rwlock_rdlock(&priv->rwlock);
+    if (strcmp(cursor, prefix) > 0) cursor_seek(priv, &c, cursor, cursor_len);
+    else cursor_seek(priv, &c, prefix, prefix_len);
+
+    for (; c.level >= 0 && *num < limit; cursor_next(priv, &c)) {
+        struct item item;
+        page_item(PAGE(priv, c.pgno[c.level]), c.idx[c.level], &item);
+        if (item.key_len < prefix_len || memcmp(item.key, prefix, prefix_len)) break;
+        if (!key_cmp(item.key, item.key_len, cursor, cursor_len)) continue;
+
+        storage_entry_t *entry = &entries[*num];
+        value_t         *value = malloc(item.size);
+        if (!value) {
+            ret = errno;
+            storage_entries_free(entries, *num);
+            *num = 0;
+            break;
+        }
+        item_copy(priv, &item, value);
+        memcpy(entry->key, item.key, item.key_len);
+        entry->key[item.key_len] = '\0';
+        entry->value             = value;
+        entry->duration          = 0;
+        (*num)++;
+    }
+    pthread_rwlock_unlock(&priv->rwlock);
+    return ret;
+}
+
+static bool meta_valid(const struct meta *meta, uint32_t file_pages) {
+    return meta->magic == BTREE_MAGIC && meta->version == BTREE_VERSION && meta->page_size == BTREE_PAGE_SIZE &&
+           meta->checksum == hash_memory(HASH_INIT, meta, offsetof(struct meta, checksum)) &&
+           meta->num_pages <= file_pages;
+}
+
+/**
+ * @brief 打开（或创建）文件，选取最新的有效meta
+ */
+static int load(priv_t *priv) {
+    struct stat st;
+    int         ret = 0;
+
+    if (fstat(priv->fd, &st)) return errno;
+    bool create = !st.st_size;
+    if (create) {
+        st.st_size = BTREE_GROW_MIN;
+        if (ftruncate(priv->fd, st.st_size)) return errno;
+    } else if (st.st_size % BTREE_PAGE_SIZE || st.st_size < 2 * BTREE_PAGE_SIZE) {
+        logfE(logFmtHead "%s has a bad size %ld", priv->path, (long)st.st_size);
+        return EIO;
+    }
+    priv->map_pages = st.st_size / BTREE_PAGE_SIZE;
+    priv->map       = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, priv->fd, 0);
+    if (priv->map == MAP_FAILED) {
+        priv->map = NULL;
+        return errno;
+    }
+
+    priv->free        = malloc(priv->map_pages * sizeof(uint32_t));
+    priv->txn.dirty   = malloc(priv->map_pages * sizeof(uint32_t));
+    priv->txn.pending = malloc(priv->map_pages * sizeof(uint32_t));
+    priv->dirty_map   = calloc(BITMAP_SIZE(priv->map_pages), 1);
+    if (!priv->free || !priv->txn.dirty || !priv->txn.pending || !priv->dirty_map) return ENOMEM;
+
+    if (create) {
+        struct meta meta = {.magic = BTREE_MAGIC, .version = BTREE_VERSION, .page_size = BTREE_PAGE_SIZE, .num_pages = 2};
+        meta.checksum    = hash_memory(HASH_INIT, &meta, offsetof(struct meta, checksum));
+        memcpy(PAGE(priv, 0), &meta, sizeof(meta));
+        if ((ret = durable_commit(&priv->durable, priv->fd))) return ret;
+    }
+
+    const struct meta *metas[2] = {(const struct meta *)PAGE(priv, 0), (const struct meta *)PAGE(priv, 1)};
+    bool               valid[2] = {meta_valid(metas[0], priv->map_pages), meta_valid(metas[1], priv->map_pages)};
+    if (!valid[0] && !valid[1]) {
+        logfE(logFmtHead "%s has no valid meta", priv->path);
+        return EIO;
+    }
+    int i      = !valid[0] || (valid[1] && metas[1]->txnid > metas[0]->txnid);
+    priv->meta = *metas[i];
+
+    if ((ret = free_rebuild(priv))) {
+        logfE(logFmtHead "%s is corrupted at txn %lu", priv->path, priv->meta.txnid);
+        return ret;
+    }
+    logfI(logFmtHead "%s load txn %lu with %lu keys in %u pages (%u free)", priv->path, priv->meta.txnid,
+          priv->meta.num_keys, priv->meta.num_pages, priv->num_free);
+    return 0;
+}
+
+static void priv_free(priv_t *priv) {
+    if (priv->map) munmap(priv->map, (size_t)priv->map_pages * BTREE_PAGE_SIZE);
+    if (priv->fd >= 0) close(priv->fd);
+    durable_deinit(&priv->durable);
+    pthread_rwlock_destroy(&priv->rwlock);
+    pthread_mutex_destroy(&priv->mutex);
+    free(priv->free);
+    free(priv->txn.dirty);
+    free(priv->txn.pending);
+    free(priv->dirty_map);
+    free((void *)priv->path);
+    free(priv);
+}
+
+static void btree_destructor(priv_t *priv) { priv_free(priv); }
+
+int constructor_btree(storage_ctx_t *ctx, const char *name, const char *path, const char *sync) {
+    int ret = 0;
+
+    priv_t *priv = calloc(1, sizeof(priv_t));
+    if (!priv) {
+        logfE(logFmtHead "fail to allocate priv" logFmtErrno, logArgErrno);
+        return errno;
+    }
+    pthread_rwlock_init(&priv->rwlock, NULL);
+    pthread_mutex_init(&priv->mutex, NULL);
+    priv->fd = -1;
+    if (!(priv->path = strdup(path))) {
+        ret = errno;
+        logfE(logFmtHead "fail to allocate priv" logFmtErrno, logArgErrno);
+        goto exit;
+    }
+    if ((ret = durable_init(&priv->durable, sync, fdatasync))) goto exit;
+    if (priv->durable.mode == _durable_group) {
+        /* 提交必须依次完成：后一个meta会覆盖前前一个meta */
+        logfE(logFmtHead "group commit is not supported");
+        ret = EINVAL;
+        goto exit;
+    }
+
+    priv->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (priv->fd < 0) {
+        ret = errno;
+        logfE(logFmtHead "fail to open %s" logFmtErrno, path, logArgErrno);
+        goto exit;
+    }
+    if ((ret = load(priv))) {
+        logfE(logFmtHead "fail to load %s" logFmtErrno, path, logArgErrno_(ret));
+        goto exit;
+    }
+
+    if (!(ctx->name = strdup(name))) {
+        ret = errno;
+        logfE(logFmtHead "fail to allocate name" logFmtErrno, logArgErrno);
+        goto exit;
+    }
+
+    ctx->priv       = priv;
+    ctx->get        = (typeof(ctx->get))btree_get;
+    ctx->get_buf    = (typeof(ctx->get_buf))btree_get_buf;
+    ctx->set        = (typeof(ctx->set))btree_set;
+    ctx->del        = (typeof(ctx->del))btree_del;
+    ctx->mset       = (typeof(ctx->mset))btree_mset;
+    ctx->mdel       = (typeof(ctx->mdel))btree_mdel;
+    ctx->scan       = (typeof(ctx->scan))btree_scan;
+    ctx->destructor = (typeof(ctx->destructor))btree_destructor;
+    return 0;
+
+exit:
+    priv_free(priv);
+    return ret;
+}
+
+static int parse(storage_ctx_t *ctx, const char *name, const char **args) {
+    return constructor_btree(ctx, name, args[0], args[1]);
+}
+
+storage_parseConfig_t btree_parseConfig = {
+    .name    = "btree",
+    .argName = "<FILE>,[<SYNC>],",
+    .note    = "注册类型为btree的存储（所有key存放在一个mmap的文件中，copy-on-write的B+树）。FILE是其数据文件；SYNC是"
+               "持久化方式，取值none,fsync，默认为none",
+    .argNum  = 2,
+    .parse   = parse,
+};
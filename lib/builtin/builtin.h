@@ -33,15 +33,52 @@
 
 #include "storage.h"
 
+/**
+ * @brief 写入的持久化方式（写入本身总是原子的：临时文件加rename，或追加日志）
+ */
+enum durable_mode {
+    _durable_none = 0, /* 不主动sync */
+    _durable_fsync,    /* 每次写入后fsync */
+    _durable_group,    /* 组提交：合并并发写入的sync，see infra/group_commit.h */
+};
+
+struct durable {
+    enum durable_mode mode;
+    void             *gc; /* group commit */
+};
+typedef struct durable durable_t;
+
+/**
+ * @brief 解析持久化方式：none（或空）、fsync、group[:<US>[:<NUM>]]（默认每1000us或64个写入sync一次）
+ *
+ * @param durable
+ * @param s
+ * @param sync 组提交时对fd调用的sync（如fdatasync、syncfs）
+ * @return int errno (EINVAL ...)
+ */
+int durable_init(durable_t *durable, const char *s, int (*sync)(int fd));
+void durable_deinit(durable_t *durable);
+/**
+ * @brief 按持久化方式提交fd上已完成的写入
+ *
+ * @return int errno
+ */
+int durable_commit(const durable_t *durable, int fd);
+
 int constructor_null(storage_ctx_t *ctx, const char *name);
-int constructor_file(storage_ctx_t *ctx, const char *name, const char *dir);
+int constructor_file(storage_ctx_t *ctx, const char *name, const char *dir, const char *sync);
 int constructor_unix(storage_ctx_t *ctx, const char *name, bool shared);
-int constructor_memory(storage_ctx_t *ctx, const char *name, long phy, const void *layout);
+int constructor_memory(storage_ctx_t *ctx, const char *name, const char *src, const void *layout, const char *mode,
+                       const char *map, unsigned int poll);
 int constructor_tcp(storage_ctx_t *ctx, const char *name, const char *ip, unsigned short port);
+int constructor_logstore(storage_ctx_t *ctx, const char *name, const char *dir, const char *sync);
+int constructor_btree(storage_ctx_t *ctx, const char *name, const char *path, const char *sync);
 
 extern storage_parseConfig_t file_parseConfig;
 extern storage_parseConfig_t unix_parseConfig;
 extern storage_parseConfig_t memory_parseConfig;
 extern storage_parseConfig_t tcp_parseConfig;
+extern storage_parseConfig_t logstore_parseConfig;
+extern storage_parseConfig_t btree_parseConfig;
 
 #endif /* __PROPD_BRIDGE_H */
@@ -0,0 +1,75 @@
+/**
+ * @file durable.c
+ * @author kioz.wang (never.had@outlook.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright MIT License
+ *
+ *  Copyright (c) 2025 kioz.wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "builtin.h"
+#include "global.h"
+#include "infra/group_commit.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int durable_init(durable_t *durable, const char *s, int (*sync)(int fd)) {
+    unsigned int interval = 1000, max_writes = 64;
+
+    durable->gc = NULL;
+    if (!s[0] || !strcmp(s, "none")) {
+        durable->mode = _durable_none;
+    } else if (!strcmp(s, "fsync")) {
+        durable->mode = _durable_fsync;
+    } else if (!strncmp(s, "group", 5) && (!s[5] || sscanf(s + 5, ":%u:%u", &interval, &max_writes) >= 1)) {
+        durable->mode = _durable_group;
+        durable->gc   = group_commit_create(sync, (timestamp_t)interval * 1000, max_writes);
+        if (!durable->gc) {
+            logfE("[storage::durable] fail to create group commit" logFmtErrno, logArgErrno);
+            return errno;
+        }
+    } else {
+        logfE("[storage::durable] unknown mode %s", s);
+        return EINVAL;
+    }
+    return 0;
+}
+
+void durable_deinit(durable_t *durable) {
+    group_commit_destroy(durable->gc);
+    durable->gc = NULL;
+}
+
+int durable_commit(const durable_t *durable, int fd) {
+    switch (durable->mode) {
+    case _durable_fsync:
+        return fsync(fd) ? errno : 0;
+    case _durable_group:
+        return group_commit(durable->gc, fd);
+    default:
+        return 0;
+    }
+}
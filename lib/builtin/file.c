@@ -28,119 +28,593 @@
  *  SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include "builtin.h"
 #include "global.h"
+#include "infra/tree.h"
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <linux/limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/queue.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #define logFmtHead "[storage::(file)] "
 
-static int file_get(const char *root, const char *key, const value_t **value, timestamp_t *duration) {
-    int      ret = 0;
-    value_t  value_head;
-    value_t *_value         = NULL;
-    char     path[PATH_MAX] = {};
-    snprintf(path, sizeof(path), "%s/%s", root, key);
-    FILE *fp = fopen(path, "r");
-    if (!fp) {
-        logfE(logFmtHead "get " logFmtKey " but fail to open %s" logFmtErrno, key, path, logArgErrno);
-        return errno;
+#define TMP_DIR ".tmp" /* 写入时先写临时文件，再rename */
+
+/* 其他进程直接修改根目录中的文件时，需要让fd缓存和propd的cache失效 */
+#define WATCH_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE)
+
+#ifndef FILE_FD_CACHE_MAX
+#define FILE_FD_CACHE_MAX 128 /* 缓存的已打开文件数上限 */
+#endif
+
+/**
+ * 已打开的文件。set会rename出新的文件，所以同一个fd读到的内容（和大小）不会变
+ */
+struct fd_item {
+    const char *key;
+    int         fd;
+    uint32_t    size;
+    unsigned    nref; /* 在缓存中时，缓存持有一个引用 */
+    RB_ENTRY(fd_item) entry;
+    TAILQ_ENTRY(fd_item) lru;
+};
+typedef struct fd_item fd_item_t;
+
+/**
+ * 自身正在进行的rename或unlink。watcher收到与之对应的事件时不再通知（watch只报告其他人的修改）
+ */
+struct self_op {
+    uint32_t mask; /* 预期的事件：IN_MOVED_TO或IN_DELETE */
+    LIST_ENTRY(self_op) entry;
+    char key[];
+};
+
+struct priv {
+    const char *dir;
+    int         dirfd;
+    atomic_uint tmp_seq;
+    durable_t   durable;
+
+    pthread_mutex_t fd_mutex; /* 保护fd缓存和所有fd_item的nref */
+    RB_HEAD(fd_tree, fd_item) fd_tree;
+    TAILQ_HEAD(fd_lru, fd_item) fd_lru; /* 头部是最近使用的 */
+    unsigned int num_fd;
+    uint64_t     fd_gen; /* 每次失效时递增，避免缓存在失效之前打开的fd */
+    LIST_HEAD(, self_op) self_ops; /* protected by fd_mutex */
+
+    int               inotify_fd;
+    int               stop_fd; /* eventfd，通知watcher退出 */
+    pthread_t         watcher;
+    storage_changed_t changed; /* protected by fd_mutex, see file_watch */
+    void             *changed_arg;
+};
+typedef struct priv priv_t;
+
+#if !defined(__uintptr_t_defined) && !defined(__uintptr_t)
+#if defined(__LP64__) || defined(_LP64)
+typedef unsigned long __uintptr_t;
+#else
+typedef unsigned int __uintptr_t;
+#endif
+#define __uintptr_t_defined 1
+#endif
+
+#define __unused __attribute__((unused))
+
+static int fd_cmp(fd_item_t *a, fd_item_t *b) { return strcmp(a->key, b->key); }
+
+RB_GENERATE_STATIC(fd_tree, fd_item, entry, fd_cmp);
+
+/**
+ * @brief must hold fd_mutex
+ */
+static void fd_put(fd_item_t *item) {
+    if (--item->nref) return;
+    close(item->fd);
+    free((void *)item->key);
+    free(item);
+}
+
+/**
+ * @brief must hold fd_mutex
+ */
+static void fd_evict(priv_t *priv, fd_item_t *item) {
+    RB_REMOVE(fd_tree, &priv->fd_tree, item);
+    TAILQ_REMOVE(&priv->fd_lru, item, lru);
+    priv->num_fd--;
+    fd_put(item);
+}
+
+/**
+ * @brief 取得key对应的已打开文件，优先从缓存中取
+ *
+ * @return fd_item_t* 用完后调用fd_release（On error, return NULL and set errno）
+ */
+static fd_item_t *fd_acquire(priv_t *priv, const char *key) {
+    fd_item_t  find = {.key = key};
+    fd_item_t *item;
+
+    pthread_mutex_lock(&priv->fd_mutex);
+    if ((item = RB_FIND(fd_tree, &priv->fd_tree, &find))) {
+        item->nref++;
+        TAILQ_REMOVE(&priv->fd_lru, item, lru);
+        TAILQ_INSERT_HEAD(&priv->fd_lru, item, lru);
+        pthread_mutex_unlock(&priv->fd_mutex);
+        return item;
     }
-    if (1 != fread(&value_head, sizeof(value_t), 1, fp)) {
-        logfE(logFmtHead "get " logFmtKey " but fail to read header of value", key);
-        ret = EIO;
-        goto exit;
+    uint64_t gen = priv->fd_gen;
+    pthread_mutex_unlock(&priv->fd_mutex);
+
+    struct stat st;
+    int         ret = 0;
+    int         fd  = openat(priv->dirfd, key, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        logfE(logFmtHead "get " logFmtKey " but fail to open" logFmtErrno, key, logArgErrno);
+        return NULL;
     }
-    _value = malloc(sizeof(value_t) + value_head.length);
-    if (!_value) {
-        logfE(logFmtHead "get " logFmtKey " but fail to allocate value with length %d" logFmtErrno, key,
-              value_head.length, logArgErrno);
+    if (fstat(fd, &st) || !(item = calloc(1, sizeof(fd_item_t))) || !(item->key = strdup(key))) {
         ret = errno;
-        goto exit;
+        logfE(logFmtHead "get " logFmtKey " but fail to prepare fd" logFmtErrno, key, logArgErrno);
+        free(item);
+        close(fd);
+        errno = ret;
+        return NULL;
+    }
+    item->fd   = fd;
+    item->size = st.st_size;
+    item->nref = 1;
+
+    pthread_mutex_lock(&priv->fd_mutex);
+    if (gen == priv->fd_gen) {
+        fd_item_t *exist = RB_INSERT(fd_tree, &priv->fd_tree, item);
+        if (exist) {
+            fd_put(item);
+            item = exist;
+            TAILQ_REMOVE(&priv->fd_lru, item, lru);
+        } else {
+            priv->num_fd++;
+        }
+        item->nref++;
+        TAILQ_INSERT_HEAD(&priv->fd_lru, item, lru);
+        while (priv->num_fd > FILE_FD_CACHE_MAX)
+            fd_evict(priv, TAILQ_LAST(&priv->fd_lru, fd_lru));
     }
-    memcpy(_value, &value_head, sizeof(value_t));
-    if (1 != fread(_value->data, _value->length, 1, fp)) {
-        logfE(logFmtHead "get " logFmtKey " but fail to read data of value", key);
-        ret = EIO;
+    pthread_mutex_unlock(&priv->fd_mutex);
+    return item;
+}
+
+static void fd_release(priv_t *priv, fd_item_t *item) {
+    pthread_mutex_lock(&priv->fd_mutex);
+    fd_put(item);
+    pthread_mutex_unlock(&priv->fd_mutex);
+}
+
+/**
+ * @param key NULL表示全部
+ */
+static void fd_invalidate(priv_t *priv, const char *key) {
+    fd_item_t  find = {.key = key};
+    fd_item_t *item;
+
+    pthread_mutex_lock(&priv->fd_mutex);
+    priv->fd_gen++;
+    if (!key) {
+        while ((item = TAILQ_FIRST(&priv->fd_lru)))
+            fd_evict(priv, item);
+    } else if ((item = RB_FIND(fd_tree, &priv->fd_tree, &find))) fd_evict(priv, item);
+    pthread_mutex_unlock(&priv->fd_mutex);
+}
+
+/**
+ * @brief 登记一个自身的操作，其事件由watcher消耗
+ *
+ * @return struct self_op* 操作失败时交给self_op_cancel（内存不足时为NULL，只是多一次通知）
+ */
+static struct self_op *self_op_begin(priv_t *priv, const char *key, uint32_t mask) {
+    struct self_op *op = malloc(sizeof(struct self_op) + strlen(key) + 1);
+    if (!op) return NULL;
+    op->mask = mask;
+    strcpy(op->key, key);
+    pthread_mutex_lock(&priv->fd_mutex);
+    LIST_INSERT_HEAD(&priv->self_ops, op, entry);
+    pthread_mutex_unlock(&priv->fd_mutex);
+    return op;
+}
+
+/**
+ * @brief 操作失败，不会有对应的事件
+ *
+ * @param op maybe null
+ */
+static void self_op_cancel(priv_t *priv, struct self_op *op) {
+    if (!op) return;
+    pthread_mutex_lock(&priv->fd_mutex);
+    LIST_REMOVE(op, entry);
+    pthread_mutex_unlock(&priv->fd_mutex);
+    free(op);
+}
+
+/**
+ * @brief 事件是否来自自身的操作（是则消耗掉该操作）
+ */
+static bool self_op_match(priv_t *priv, const struct inotify_event *event) {
+    struct self_op *op;
+
+    pthread_mutex_lock(&priv->fd_mutex);
+    LIST_FOREACH(op, &priv->self_ops, entry) {
+        if ((event->mask & op->mask) && !strcmp(op->key, event->name)) {
+            LIST_REMOVE(op, entry);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&priv->fd_mutex);
+    if (!op) return false;
+    free(op);
+    return true;
+}
+
+/**
+ * @brief 丢弃所有登记的操作（事件队列溢出后，它们的事件可能已经丢失）
+ */
+static void self_ops_clear(priv_t *priv) {
+    struct self_op *op;
+
+    pthread_mutex_lock(&priv->fd_mutex);
+    while ((op = LIST_FIRST(&priv->self_ops))) {
+        LIST_REMOVE(op, entry);
+        free(op);
+    }
+    pthread_mutex_unlock(&priv->fd_mutex);
+}
+
+/**
+ * @brief 一次pread读出整个值，并检查其长度
+ */
+static int fd_read(const fd_item_t *item, const char *key, value_t *value) {
+    ssize_t n = pread(item->fd, value, item->size, 0);
+    if (n != item->size || item->size < sizeof(value_t) || sizeof(value_t) + value->length != item->size) {
+        logfE(logFmtHead "get " logFmtKey " but fail to read value (%zd of %u bytes)", key, n, item->size);
+        return EIO;
+    }
+    return 0;
+}
+
+static int file_get(priv_t *priv, const char *key, const value_t **value, timestamp_t *duration) {
+    int        ret    = 0;
+    value_t   *_value = NULL;
+    fd_item_t *item   = fd_acquire(priv, key);
+    if (!item) {
+        return errno;
+    }
+    _value = malloc(item->size > sizeof(value_t) ? item->size : sizeof(value_t));
+    if (!_value) {
+        logfE(logFmtHead "get " logFmtKey " but fail to allocate value with size %u" logFmtErrno, key, item->size,
+              logArgErrno);
+        ret = errno;
         goto exit;
     }
-    fclose(fp);
+    if ((ret = fd_read(item, key, _value))) goto exit;
+    fd_release(priv, item);
 
     *value    = _value;
     *duration = 0;
     return 0;
 
 exit:
-    fclose(fp);
+    fd_release(priv, item);
     free(_value);
     return ret;
 }
 
-static int file_set(const char *root, const char *key, const value_t *value) {
-    int  ret       = 0;
-    char path[256] = {};
-    snprintf(path, sizeof(path), "%s/%s", root, key);
-    FILE *fp = fopen(path, "w");
-    if (!fp) {
-        logfE(logFmtHead "set " logFmtKey " but fail to open %s" logFmtErrno, key, path, logArgErrno);
+static int file_get_buf(priv_t *priv, const char *key, value_t *value, uint32_t *size, timestamp_t *duration) {
+    int        ret  = 0;
+    fd_item_t *item = fd_acquire(priv, key);
+    if (!item) {
         return errno;
     }
-    if (1 != fwrite(value, sizeof(value_t) + value->length, 1, fp)) {
-        logfE(logFmtHead "set " logFmtKey " but fail to write value", key);
-        ret = EIO;
+    if (*size < item->size || *size < sizeof(value_t)) {
+        *size = item->size;
+        ret   = ENOBUFS;
+        goto exit;
     }
-    fclose(fp);
+    if ((ret = fd_read(item, key, value))) goto exit;
+    *size     = item->size;
+    *duration = 0;
+
+exit:
+    fd_release(priv, item);
     return ret;
 }
 
-static int file_del(const char *root, const char *key) {
-    char path[256] = {};
-    snprintf(path, sizeof(path), "%s/%s", root, key);
-    int ret = unlink(path);
+/**
+ * @brief 写入临时文件后rename，保证读到的总是完整的值
+ */
+static int file_set(priv_t *priv, const char *key, const value_t *value) {
+    int  ret = 0;
+    char tmp[32];
+
+    snprintf(tmp, sizeof(tmp), TMP_DIR "/%u", atomic_fetch_add(&priv->tmp_seq, 1));
+    int fd = openat(priv->dirfd, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        logfE(logFmtHead "set " logFmtKey " but fail to open %s" logFmtErrno, key, tmp, logArgErrno);
+        return errno;
+    }
+    ssize_t n = write(fd, value, sizeof(value_t) + value->length);
+    if (n != (ssize_t)(sizeof(value_t) + value->length)) {
+        ret = n < 0 ? errno : EIO;
+        logfE(logFmtHead "set " logFmtKey " but fail to write value" logFmtErrno, key, logArgErrno_(ret));
+    }
+    /* rename之前数据必须已落盘，否则掉电后可能留下不完整的文件 */
+    if (!ret && priv->durable.mode == _durable_fsync && fdatasync(fd)) ret = errno;
+    close(fd);
+    if (!ret && priv->durable.mode == _durable_group) ret = durable_commit(&priv->durable, priv->dirfd);
     if (!ret) {
-        return 0;
+        struct self_op *op = self_op_begin(priv, key, IN_MOVED_TO);
+        if (renameat(priv->dirfd, tmp, priv->dirfd, key)) {
+            ret = errno;
+            logfE(logFmtHead "set " logFmtKey " but fail to rename" logFmtErrno, key, logArgErrno);
+            self_op_cancel(priv, op);
+        }
+    }
+    if (ret) {
+        unlinkat(priv->dirfd, tmp, 0);
+        return ret;
+    }
+    fd_invalidate(priv, key);
+    return durable_commit(&priv->durable, priv->dirfd);
+}
+
+static int file_del(priv_t *priv, const char *key) {
+    struct self_op *op = self_op_begin(priv, key, IN_DELETE);
+    if (unlinkat(priv->dirfd, key, 0)) {
+        int ret = errno;
+        self_op_cancel(priv, op);
+        return ret;
+    }
+    fd_invalidate(priv, key);
+    return durable_commit(&priv->durable, priv->dirfd);
+}
+
+static int name_cmp(const struct dirent **a, const struct dirent **b) { return strcmp((*a)->d_name, (*b)->d_name); }
+
+/**
+ * @brief 是否普通文件（文件系统不提供d_type时，以fstatat为准）
+ */
+static bool dirent_is_reg(int dirfd, const struct dirent *dirent) {
+    struct stat st;
+
+    if (dirent->d_type != DT_UNKNOWN) return dirent->d_type == DT_REG;
+    return !fstatat(dirfd, dirent->d_name, &st, AT_SYMLINK_NOFOLLOW) && S_ISREG(st.st_mode);
+}
+
+static int file_scan(priv_t *priv, const char *prefix, const char *cursor, int limit, storage_entry_t entries[],
+                     int *num) {
+    struct dirent **namelist   = NULL;
+    size_t          prefix_len = strlen(prefix);
+    int             n          = scandir(priv->dir, &namelist, NULL, name_cmp);
+    if (n < 0) {
+        logfE(logFmtHead "scan " logFmtKey " but fail to scandir %s" logFmtErrno, prefix, priv->dir, logArgErrno);
+        return errno;
+    }
+
+    for (int i = 0; i < n; i++) {
+        const struct dirent *dirent = namelist[i];
+        if (*num >= limit) continue;
+        if (strncmp(dirent->d_name, prefix, prefix_len) || strcmp(dirent->d_name, cursor) <= 0) continue;
+        if (!dirent_is_reg(priv->dirfd, dirent)) continue;
+
+        storage_entry_t *entry = &entries[*num];
+        if (file_get(priv, dirent->d_name, &entry->value, &entry->duration)) continue;
+        snprintf(entry->key, sizeof(entry->key), "%s", dirent->d_name);
+        (*num)++;
     }
-    return errno;
+
+    for (int i = 0; i < n; i++)
+        free(namelist[i]);
+    free(namelist);
+    return 0;
 }
 
-int constructor_file(storage_ctx_t *ctx, const char *name, const char *dir) {
+static int file_watch(priv_t *priv, storage_changed_t changed, void *arg) {
+    pthread_mutex_lock(&priv->fd_mutex);
+    priv->changed     = changed;
+    priv->changed_arg = arg;
+    pthread_mutex_unlock(&priv->fd_mutex);
+    return 0;
+}
+
+/**
+ * @param key NULL表示无法确定哪些文件发生了变化
+ */
+static void file_changed(priv_t *priv, const char *key) {
+    fd_invalidate(priv, key);
+
+    pthread_mutex_lock(&priv->fd_mutex);
+    storage_changed_t changed = priv->changed;
+    void             *arg     = priv->changed_arg;
+    pthread_mutex_unlock(&priv->fd_mutex);
+
+    logfD(logFmtHead "%s " logFmtKey " changed", priv->dir, key ? key : "*");
+    if (changed) changed(arg, key);
+}
+
+/**
+ * @brief 监听根目录中文件的变化（不包括TMP_DIR中的）。自身的set/del触发的事件被self_op_match消耗，不会通知
+ */
+static void *watcher(priv_t *priv) {
+    char          buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2] = {
+        {.fd = priv->inotify_fd, .events = POLLIN},
+        {.fd = priv->stop_fd, .events = POLLIN},
+    };
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            logfE(logFmtHead "%s fail to poll, stop watching" logFmtErrno, priv->dir, logArgErrno);
+            break;
+        }
+        if (fds[1].revents) break;
+
+        ssize_t n = read(priv->inotify_fd, buffer, sizeof(buffer));
+        for (const char *p = buffer; n > 0 && p < buffer + n;) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                logfW(logFmtHead "%s too many changes, invalidate all", priv->dir);
+                self_ops_clear(priv);
+                file_changed(priv, NULL);
+            } else if (event->mask & IN_IGNORED) {
+                logfW(logFmtHead "%s is removed, stop watching", priv->dir);
+            } else if (event->len && !(event->mask & IN_ISDIR) && !self_op_match(priv, event)) {
+                file_changed(priv, event->name);
+            }
+        }
+    }
+    return NULL;
+}
+
+static int watcher_start(priv_t *priv) {
+    int ret = 0;
+
+    priv->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    priv->stop_fd    = eventfd(0, EFD_CLOEXEC);
+    if (priv->inotify_fd < 0 || priv->stop_fd < 0 || inotify_add_watch(priv->inotify_fd, priv->dir, WATCH_MASK) < 0)
+        ret = errno;
+    else ret = pthread_create(&priv->watcher, NULL, (void *(*)(void *))watcher, priv);
+    if (ret) {
+        if (priv->inotify_fd >= 0) close(priv->inotify_fd);
+        if (priv->stop_fd >= 0) close(priv->stop_fd);
+    }
+    return ret;
+}
+
+static void watcher_stop(priv_t *priv) {
+    uint64_t one                       = 1;
+    ssize_t  n __attribute__((unused)) = write(priv->stop_fd, &one, sizeof(one));
+    pthread_join(priv->watcher, NULL);
+    close(priv->inotify_fd);
+    close(priv->stop_fd);
+}
+
+static void file_destructor(priv_t *priv) {
+    watcher_stop(priv);
+    fd_invalidate(priv, NULL);
+    self_ops_clear(priv);
+    pthread_mutex_destroy(&priv->fd_mutex);
+    durable_deinit(&priv->durable);
+    close(priv->dirfd);
+    free((void *)priv->dir);
+    free(priv);
+}
+
+/**
+ * @brief 清理上次退出时残留的临时文件
+ */
+static int tmp_dir_prepare(int dirfd) {
+    if (mkdirat(dirfd, TMP_DIR, 0755) && errno != EEXIST) return errno;
+
+    int fd = openat(dirfd, TMP_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return errno;
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+        return errno;
+    }
+    struct dirent *dirent;
+    while ((dirent = readdir(dir))) {
+        if (dirent_is_reg(fd, dirent)) unlinkat(fd, dirent->d_name, 0);
+    }
+    closedir(dir);
+    return 0;
+}
+
+int constructor_file(storage_ctx_t *ctx, const char *name, const char *dir, const char *sync) {
+    int ret = 0;
+
     if (access(dir, F_OK) == -1) {
-        int ret = mkdir(dir, 0755);
+        ret = mkdir(dir, 0755);
         if (ret) {
             logfE(logFmtHead "fail to create root path %s" logFmtErrno, dir, logArgErrno);
             return errno;
         }
     }
 
-    if (!(ctx->name = strdup(name))) {
-        logfE(logFmtHead "fail to allocate name" logFmtErrno, logArgErrno);
+    priv_t *priv = calloc(1, sizeof(priv_t));
+    if (!priv) {
+        logfE(logFmtHead "fail to allocate priv" logFmtErrno, logArgErrno);
         return errno;
     }
-    if (!(ctx->priv = strdup(dir))) {
+    if (!(priv->dir = strdup(dir))) {
+        ret = errno;
         logfE(logFmtHead "fail to allocate priv" logFmtErrno, logArgErrno);
-        free((void *)ctx->name);
-        return errno;
+        free(priv);
+        return ret;
+    }
+    priv->dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (priv->dirfd < 0 || (ret = tmp_dir_prepare(priv->dirfd))) {
+        ret = ret ? ret : errno;
+        logfE(logFmtHead "fail to open root path %s" logFmtErrno, dir, logArgErrno_(ret));
+        goto exit;
+    }
+    if ((ret = durable_init(&priv->durable, sync, syncfs))) goto exit;
+    pthread_mutex_init(&priv->fd_mutex, NULL);
+    RB_INIT(&priv->fd_tree);
+    TAILQ_INIT(&priv->fd_lru);
+    LIST_INIT(&priv->self_ops);
+    if ((ret = watcher_start(priv))) {
+        logfE(logFmtHead "fail to watch root path %s" logFmtErrno, dir, logArgErrno_(ret));
+        goto exit_durable;
+    }
+
+    if (!(ctx->name = strdup(name))) {
+        ret = errno;
+        logfE(logFmtHead "fail to allocate name" logFmtErrno, logArgErrno);
+        watcher_stop(priv);
+        goto exit_durable;
     }
 
+    ctx->priv       = priv;
     ctx->get        = (typeof(ctx->get))file_get;
+    ctx->get_buf    = (typeof(ctx->get_buf))file_get_buf;
     ctx->set        = (typeof(ctx->set))file_set;
     ctx->del        = (typeof(ctx->del))file_del;
-    ctx->destructor = free;
+    ctx->scan       = (typeof(ctx->scan))file_scan;
+    ctx->watch      = (typeof(ctx->watch))file_watch;
+    ctx->destructor = (typeof(ctx->destructor))file_destructor;
     return 0;
+
+exit_durable:
+    pthread_mutex_destroy(&priv->fd_mutex);
+    durable_deinit(&priv->durable);
+exit:
+    if (priv->dirfd >= 0) close(priv->dirfd);
+    free((void *)priv->dir);
+    free(priv);
+    return ret;
 }
 
 static int parse(storage_ctx_t *ctx, const char *name, const char **args) {
-    return constructor_file(ctx, name, args[0]);
+    return constructor_file(ctx, name, args[0], args[1]);
 }
 
 storage_parseConfig_t file_parseConfig = {
     .name    = "file",
-    .argName = "<DIR>,",
-    .note    = "注册类型为file的存储。DIR是其根目录",
-    .argNum  = 1,
+    .argName = "<DIR>,[<SYNC>],",
+    .note    = "注册类型为file的存储。DIR是其根目录；SYNC是持久化方式，取值none,fsync,group[:<US>[:<NUM>]]，默认为none"
+               "（组提交时使用syncfs）",
+    .argNum  = 2,
     .parse   = parse,
 };
@@ -0,0 +1,975 @@
+/**
+ * @file logstore.c
+ * @author kioz.wang (never.had@outlook.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright MIT License
+ *
+ *  Copyright (c) 2025 kioz.wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "builtin.h"
+#include "global.h"
+#include "misc.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define logFmtHead "[storage::(logstore)] "
+
+#ifndef LOGSTORE_SEGMENT_MAX
+#define LOGSTORE_SEGMENT_MAX (64 << 20) /* 活跃段超过此大小后，切换到新的段 */
+#endif
+#ifndef LOGSTORE_COMPACT_MIN
+#define LOGSTORE_COMPACT_MIN (1 << 20) /* 失效的record不少于此大小，且不少于一半时压缩 */
+#endif
+#define LOGSTORE_COMPACT_INTERVAL 10 /* unit: s */
+
+#define PathFmt_Data "%s/%08u.data"
+#define PathFmt_Hint "%s/%08u.hint"
+
+/**
+ * 数据文件（段）由record依次追加而成：record | key | data
+ */
+struct record {
+    uint32_t checksum; /* 其后所有字节（含key和data）的校验和 */
+    uint64_t seq;      /* 重建索引时，同一个key取seq最大的record */
+    uint16_t key_len;
+    uint8_t  tomb; /* 删除标记 */
+    value_t  value;
+} __attribute__((packed));
+
+/**
+ * hint文件（压缩时生成）：hint_head | 被合并的各段的id | 依次记录段中每个record的位置：hint | key
+ */
+struct hint_head {
+    uint32_t num_merged; /* hint文件存在即表示被合并的段已失效，重建索引时会先删除残留的这些段 */
+} __attribute__((packed));
+
+struct hint {
+    uint64_t seq;
+    uint64_t offset;
+    uint32_t size;
+    uint16_t key_len;
+} __attribute__((packed));
+
+struct segment {
+    uint32_t id;
+    int      fd;
+    uint64_t size; /* 已写入的字节数 */
+    uint64_t dead; /* 失效的record的字节数 */
+    atomic_int nref; /* 正在等待持久化的写者数量，压缩时需等待其归零才能删除 */
+};
+
+struct entry {
+    struct entry *next;
+    uint32_t      seg;
+    uint64_t      offset;
+    uint32_t      size; /* record的总长度 */
+    uint64_t      seq;
+    bool          tomb; /* 仅在重建索引时存在 */
+    char          key[];
+};
+
+struct priv {
+    const char      *dir;
+    pthread_rwlock_t rwlock; /* 保护索引和段列表 */
+    struct entry   **buckets;
+    uint32_t         num_bucket; /* power of 2 */
+    uint32_t         num_entry;
+    struct segment **segments;
+    uint32_t         num_segment;
+
+    pthread_mutex_t mutex; /* 串行化追加写，保护active、next_id和seq */
+    struct segment *active;
+    uint32_t        next_id;
+    uint64_t        seq;
+    durable_t       durable;
+
+    pthread_t       tid; /* compactor */
+    pthread_mutex_t compact_mutex;
+    pthread_cond_t  compact_cond;
+    bool            stop;
+};
+typedef struct priv priv_t;
+
+static uint32_t record_checksum(const struct record *head, const char *key, const void *data) {
+    uint32_t hash = hash_memory(HASH_INIT, (const uint8_t *)head + sizeof(head->checksum),
+                                sizeof(*head) - sizeof(head->checksum));
+    hash          = hash_memory(hash, key, head->key_len);
+    return hash_memory(hash, data, head->value.length);
+}
+
+static struct segment *segment_find(const priv_t *priv, uint32_t id) {
+    for (uint32_t i = 0; i < priv->num_segment; i++) {
+        if (priv->segments[i]->id == id) return priv->segments[i];
+    }
+    return NULL;
+}
+
+/**
+ * @return struct segment* On error, return NULL and set errno
+ */
+static struct segment *segment_open(const priv_t *priv, uint32_t id, bool create) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), PathFmt_Data, priv->dir, id);
+
+    struct segment *seg = calloc(1, sizeof(struct segment));
+    if (!seg) return NULL;
+    seg->id = id;
+    seg->fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0644);
+    if (seg->fd < 0) {
+        int ret = errno;
+        logfE(logFmtHead "fail to open %s" logFmtErrno, path, logArgErrno);
+        free(seg);
+        errno = ret;
+        return NULL;
+    }
+    return seg;
+}
+
+static void segment_unlink(const priv_t *priv, uint32_t id) {
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), PathFmt_Data, priv->dir, id);
+    unlink(path);
+    snprintf(path, sizeof(path), PathFmt_Hint, priv->dir, id);
+    unlink(path);
+}
+
+static void segment_remove(const priv_t *priv, struct segment *seg) {
+    close(seg->fd);
+    segment_unlink(priv, seg->id);
+    free(seg);
+}
+
+/**
+ * @brief must hold wrlock
+ */
+static int segment_add(priv_t *priv, struct segment *seg) {
+    struct segment **segments = realloc(priv->segments, (priv->num_segment + 1) * sizeof(struct segment *));
+    if (!segments) return errno;
+    segments[priv->num_segment++] = seg;
+    priv->segments                = segments;
+    return 0;
+}
+
+/**
+ * @brief 切换到新的活跃段（must hold mutex）
+ */
+static int rotate(priv_t *priv) {
+    struct segment *seg = segment_open(priv, priv->next_id, true);
+    if (!seg) return errno;
+
+    pthread_rwlock_wrlock(&priv->rwlock);
+    int ret = segment_add(priv, seg);
+    pthread_rwlock_unlock(&priv->rwlock);
+    if (ret) {
+        segment_remove(priv, seg);
+        return ret;
+    }
+
+    priv->next_id++;
+    priv->active = seg;
+    logfV(logFmtHead "%s switch to segment %u", priv->dir, seg->id);
+    return 0;
+}
+
+static struct entry **index_slot(const priv_t *priv, const char *key) {
+    struct entry **slot = &priv->buckets[hash_cstring(key) & (priv->num_bucket - 1)];
+    while (*slot && strcmp((*slot)->key, key))
+        slot = &(*slot)->next;
+    return slot;
+}
+
+static int index_grow(priv_t *priv) {
+    uint32_t       num_bucket = priv->num_bucket * 2;
+    struct entry **buckets    = calloc(num_bucket, sizeof(struct entry *));
+    if (!buckets) return errno;
+
+    for (uint32_t i = 0; i < priv->num_bucket; i++) {
+        struct entry *entry, *next;
+        for (entry = priv->buckets[i]; entry; entry = next) {
+            struct entry **bucket = &buckets[hash_cstring(entry->key) & (num_bucket - 1)];
+            next                  = entry->next;
+            entry->next           = *bucket;
+            *bucket               = entry;
+        }
+    }
+    free(priv->buckets);
+    priv->buckets    = buckets;
+    priv->num_bucket = num_bucket;
+    return 0;
+}
+
+/**
+ * @brief 将一个record的位置更新到索引中，seq较小的record视为已失效（must hold wrlock）
+ */
+static int index_apply(priv_t *priv, const char *key, uint32_t seg, uint64_t offset, uint32_t size, uint64_t seq,
+                       bool tomb) {
+    struct entry **slot  = index_slot(priv, key);
+    struct entry  *entry = *slot;
+
+    if (entry && entry->seq > seq) {
+        segment_find(priv, seg)->dead += size;
+        return 0;
+    }
+    if (entry) {
+        segment_find(priv, entry->seg)->dead += entry->size;
+    } else {
+        if (priv->num_entry >= priv->num_bucket * 2 && !index_grow(priv)) slot = index_slot(priv, key);
+        entry = malloc(sizeof(struct entry) + strlen(key) + 1);
+        if (!entry) return errno;
+        strcpy(entry->key, key);
+        entry->next = NULL;
+        *slot       = entry;
+        priv->num_entry++;
+    }
+    entry->seg    = seg;
+    entry->offset = offset;
+    entry->size   = size;
+    entry->seq    = seq;
+    entry->tomb   = tomb;
+    return 0;
+}
+
+/**
+ * @brief 从索引中移除，其record视为已失效（must hold wrlock）
+ */
+static void index_drop(priv_t *priv, struct entry **slot) {
+    struct entry *entry = *slot;
+
+    segment_find(priv, entry->seg)->dead += entry->size;
+    *slot = entry->next;
+    free(entry);
+    priv->num_entry--;
+}
+
+/**
+ * @brief 读取entry对应的record（must hold rdlock）
+ *
+ * @param value 其data的容量应与record一致
+ * @return int errno (EIO)
+ */
+static int record_read(const priv_t *priv, const struct entry *entry, value_t *value) {
+    struct record   head;
+    char            key[NAME_MAX];
+    uint16_t        key_len = strlen(entry->key);
+    uint32_t        length  = entry->size - sizeof(head) - key_len;
+    struct segment *seg     = segment_find(priv, entry->seg);
+    struct iovec    iov[3]  = {
+        {.iov_base = &head, .iov_len = sizeof(head)},
+        {.iov_base = key, .iov_len = key_len},
+        {.iov_base = value->data, .iov_len = length},
+    };
+
+    ssize_t n = preadv(seg->fd, iov, 3, entry->offset);
+    if (n != entry->size || head.key_len != key_len || head.value.length != length ||
+        head.checksum != record_checksum(&head, key, value->data)) {
+        logfE(logFmtHead "get " logFmtKey " but record at %u:%lu is corrupted", entry->key, entry->seg, entry->offset);
+        return EIO;
+    }
+    memcpy(value, &head.value, sizeof(value_t));
+    return 0;
+}
+
+static uint32_t entry_length(const struct entry *entry) {
+    return entry->size - sizeof(struct record) - strlen(entry->key);
+}
+
+static int logstore_get(priv_t *priv, const char *key, const value_t **value, timestamp_t *duration) {
+    int      ret    = 0;
+    value_t *_value = NULL;
+
+    pthread_rwlock_rdlock(&priv->rwlock);
+    const struct entry *entry = *index_slot(priv, key);
+    if (!entry) {
+        ret = ENOENT;
+        goto exit;
+    }
+    _value = malloc(sizeof(value_t) + entry_length(entry));
+    if (!_value) {
+        ret = errno;
+        logfE(logFmtHead "get " logFmtKey " but fail to allocate value" logFmtErrno, key, logArgErrno);
+        goto exit;
+    }
+    ret = record_read(priv, entry, _value);
+    if (ret) {
+        free(_value);
+        goto exit;
+    }
+    *value    = _value;
+    *duration = 0;
+
+exit:
+    pthread_rwlock_unlock(&priv->rwlock);
+    return ret;
+}
+
+static int logstore_get_buf(priv_t *priv, const char *key, value_t *value, uint32_t *size, timestamp_t *duration) {
+    int ret = 0;
+
+    pthread_rwlock_rdlock(&priv->rwlock);
+    const struct entry *entry = *index_slot(priv, key);
+    if (!entry) {
+        ret = ENOENT;
+        goto exit;
+    }
+    uint32_t need = sizeof(value_t) + entry_length(entry);
+    if (*size < need) {
+        *size = need;
+        ret   = ENOBUFS;
+        goto exit;
+    }
+    ret = record_read(priv, entry, value);
+    if (!ret) {
+        *size     = need;
+        *duration = 0;
+    }
+
+exit:
+    pthread_rwlock_unlock(&priv->rwlock);
+    return ret;
+}
+
+/**
+ * @brief 追加一个record，并更新索引
+ *
+ * @param value NULL表示删除
+ * @return int errno (ENOENT ...)
+ */
+static int append(priv_t *priv, const char *key, const value_t *value) {
+    int           ret  = 0;
+    struct record head = {.key_len = strlen(key), .tomb = !value};
+
+    if (value) memcpy(&head.value, value, sizeof(value_t));
+    else head.value.type = _value_undef;
+    uint32_t     size   = sizeof(head) + head.key_len + head.value.length;
+    struct iovec iov[3] = {
+        {.iov_base = &head, .iov_len = sizeof(head)},
+        {.iov_base = (void *)key, .iov_len = head.key_len},
+        {.iov_base = value ? (void *)value->data : NULL, .iov_len = head.value.length},
+    };
+
+    pthread_mutex_lock(&priv->mutex);
+
+    if (!value) {
+        pthread_rwlock_rdlock(&priv->rwlock);
+        bool exist = *index_slot(priv, key);
+        pthread_rwlock_unlock(&priv->rwlock);
+        if (!exist) {
+            ret = ENOENT;
+            goto exit;
+        }
+    }
+    if (priv->active->size >= LOGSTORE_SEGMENT_MAX && (ret = rotate(priv))) goto exit;
+
+    struct segment *seg = priv->active;
+    head.seq            = ++priv->seq;
+    head.checksum       = record_checksum(&head, key, iov[2].iov_base);
+    ssize_t n           = pwritev(seg->fd, iov, 3, seg->size);
+    if (n != size) {
+        ret = n < 0 ? errno : EIO;
+        logfE(logFmtHead "%s " logFmtKey " but fail to append to segment %u" logFmtErrno, value ? "set" : "del", key,
+              seg->id, logArgErrno_(ret));
+        goto exit;
+    }
+
+    pthread_rwlock_wrlock(&priv->rwlock);
+    ret = index_apply(priv, key, seg->id, seg->size, size, head.seq, !value);
+    if (!ret && !value) index_drop(priv, index_slot(priv, key));
+    seg->size += size;
+    pthread_rwlock_unlock(&priv->rwlock);
+    if (ret) goto exit;
+
+    /* 释放mutex后再持久化，让并发的追加写合并到同一次组提交中 */
+    atomic_fetch_add(&seg->nref, 1);
+    pthread_mutex_unlock(&priv->mutex);
+    ret = durable_commit(&priv->durable, seg->fd);
+    atomic_fetch_sub(&seg->nref, 1);
+    if (ret)
+        logfE(logFmtHead "%s " logFmtKey " but fail to sync segment %u" logFmtErrno, value ? "set" : "del", key, seg->id,
+              logArgErrno_(ret));
+    return ret;
+
+exit:
+    pthread_mutex_unlock(&priv->mutex);
+    return ret;
+}
+
+static int logstore_set(priv_t *priv, const char *key, const value_t *value) { return append(priv, key, value); }
+
+static int logstore_del(priv_t *priv, const char *key) { return append(priv, key, NULL); }
+
+static int entry_cmp(const void *a, const void *b) {
+    return strcmp((*(const struct entry **)a)->key, (*(const struct entry **)b)->key);
+}
+
+static int logstore_scan(priv_t *priv, const char *prefix, const char *cursor, int limit, storage_entry_t entries[],
+                         int *num) {
+    int    ret        = 0;
+    size_t prefix_len = strlen(prefix);
+    int    n          = 0;
+
+    pthread_rwlock_rdlock(&priv->rwlock);
+
+    const struct entry **matched = malloc((priv->num_entry + 1) * sizeof(struct entry *));
+    if (!matched) {
+        ret = errno;
+        goto exit;
+    }
+    for (uint32_t i = 0; i < priv->num_bucket; i++) {
+        for (const struct entry *entry = priv->buckets[i]; entry; entry = entry->next) {
+            if (strncmp(entry->key, prefix, prefix_len) || strcmp(entry->key, cursor) <= 0) continue;
+            matched[n++] = entry;
+        }
+    }
+    qsort(matched, n, sizeof(struct entry *), entry_cmp);
+
+    for (int i = 0; i < n && *num < limit; i++) {
+        storage_entry_t *_entry = &entries[*num];
+        value_t         *value  = malloc(sizeof(value_t) + entry_length(matched[i]));
+        if (!value) {
+            ret = errno;
+            storage_entries_free(entries, *num);
+            break;
+        }
+        if ((ret = record_read(priv, matched[i], value))) {
+            free(value);
+            storage_entries_free(entries, *num);
+            break;
+        }
+        snprintf(_entry->key, sizeof(_entry->key), "%s", matched[i]->key);
+        _entry->value    = value;
+        _entry->duration = 0;
+        (*num)++;
+    }
+    free(matched);
+
+exit:
+    pthread_rwlock_unlock(&priv->rwlock);
+    return ret;
+}
+
+static int load_hint(priv_t *priv, struct segment *seg, FILE *fp) {
+    int         ret = 0;
+    struct hint_head head;
+    struct hint      hint;
+    char             key[NAME_MAX];
+    struct stat      st;
+
+    if (1 != fread(&head, sizeof(head), 1, fp) || fseek(fp, head.num_merged * sizeof(uint32_t), SEEK_CUR)) return EIO;
+    while (!ret && 1 == fread(&hint, sizeof(hint), 1, fp)) {
+        if (hint.key_len >= NAME_MAX || (hint.key_len && 1 != fread(key, hint.key_len, 1, fp))) return EIO;
+        key[hint.key_len] = '\0';
+        ret               = index_apply(priv, key, seg->id, hint.offset, hint.size, hint.seq, false);
+        if (priv->seq < hint.seq) priv->seq = hint.seq;
+    }
+    if (fstat(seg->fd, &st)) return errno;
+    seg->size = st.st_size;
+    return ret;
+}
+
+/**
+ * @brief 依次读取段中的record来重建索引，末尾不完整或校验失败的部分将被截断
+ */
+static int load_data(priv_t *priv, struct segment *seg) {
+    int           ret      = 0;
+    uint64_t      offset   = 0;
+    void         *data     = NULL;
+    uint32_t      capacity = 0;
+    struct record head;
+    char          key[NAME_MAX];
+    struct stat   st;
+
+    if (fstat(seg->fd, &st)) return errno;
+    FILE *fp = fdopen(dup(seg->fd), "r");
+    if (!fp) return errno;
+
+    while (1 == fread(&head, sizeof(head), 1, fp)) {
+        uint32_t size = sizeof(head) + head.key_len + head.value.length;
+        if (head.key_len >= NAME_MAX || offset + size > (uint64_t)st.st_size) break;
+        if (head.value.length > capacity) {
+            void *_data = realloc(data, head.value.length);
+            if (!_data) {
+                ret = errno;
+                break;
+            }
+            data     = _data;
+            capacity = head.value.length;
+        }
+        if (head.key_len && 1 != fread(key, head.key_len, 1, fp)) break;
+        if (head.value.length && 1 != fread(data, head.value.length, 1, fp)) break;
+        if (head.checksum != record_checksum(&head, key, data)) break;
+        key[head.key_len] = '\0';
+
+        if ((ret = index_apply(priv, key, seg->id, offset, size, head.seq, head.tomb))) break;
+        if (priv->seq < head.seq) priv->seq = head.seq;
+        offset += size;
+    }
+    fclose(fp);
+    free(data);
+
+    if (!ret && offset < (uint64_t)st.st_size) {
+        logfW(logFmtHead "%s truncate segment %u at %lu (%ld bytes)", priv->dir, seg->id, offset, st.st_size);
+        if (ftruncate(seg->fd, offset)) ret = errno;
+    }
+    seg->size = offset;
+    return ret;
+}
+
+static int id_cmp(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief 删除已被合并的段（压缩在删除旧段时中断的话，残留的段中可能有已被删除的key的record，不能加载）
+ *
+ * @param ids 升序，返回时移除了被删除的段
+ * @param num_id
+ * @return int errno (EIO)
+ */
+static int drop_merged(const priv_t *priv, uint32_t ids[], uint32_t *num_id) {
+    for (uint32_t i = 0; i < *num_id; i++) {
+        char             path[PATH_MAX];
+        struct hint_head head;
+        uint32_t         id;
+
+        snprintf(path, sizeof(path), PathFmt_Hint, priv->dir, ids[i]);
+        FILE *fp = fopen(path, "r");
+        if (!fp) continue;
+        bool ok = 1 == fread(&head, sizeof(head), 1, fp);
+        for (uint32_t j = 0; ok && j < head.num_merged; j++) {
+            if (!(ok = 1 == fread(&id, sizeof(id), 1, fp))) break;
+            for (uint32_t k = 0; k < i; k++) { /* 被合并的段的id总是更小 */
+                if (ids[k] != id) continue;
+                logfW(logFmtHead "%s drop segment %u merged into segment %u", priv->dir, id, ids[i]);
+                segment_unlink(priv, id);
+                memmove(&ids[k], &ids[k + 1], (--*num_id - k) * sizeof(uint32_t));
+                i--;
+                break;
+            }
+        }
+        fclose(fp);
+        if (!ok) return EIO;
+    }
+    return 0;
+}
+
+/**
+ * @brief 按id依次加载各段（有hint文件时只读取hint文件），最后一个段没有hint文件时继续作为活跃段
+ */
+static int rebuild(priv_t *priv) {
+    int            ret      = 0;
+    uint32_t      *ids      = NULL;
+    uint32_t       num_id   = 0;
+    bool           has_hint = true;
+    struct dirent *dirent;
+
+    DIR *dir = opendir(priv->dir);
+    if (!dir) return errno;
+    while ((dirent = readdir(dir))) {
+        unsigned int id;
+        int          n = 0;
+        if (sscanf(dirent->d_name, "%8u.data%n", &id, &n) != 1 || dirent->d_name[n] != '\0') continue;
+        uint32_t *_ids = realloc(ids, (num_id + 1) * sizeof(uint32_t));
+        if (!_ids) {
+            ret = errno;
+            goto exit;
+        }
+        ids           = _ids;
+        ids[num_id++] = id;
+    }
+    qsort(ids, num_id, sizeof(uint32_t), id_cmp);
+    if ((ret = drop_merged(priv, ids, &num_id))) goto exit;
+
+    for (uint32_t i = 0; i < num_id && !ret; i++) {
+        char path[PATH_MAX];
+
+        struct segment *seg = segment_open(priv, ids[i], false);
+        if (!seg || (ret = segment_add(priv, seg))) {
+            ret = ret ? ret : errno;
+            if (seg) free(seg);
+            break;
+        }
+        priv->next_id = ids[i] + 1;
+
+        snprintf(path, sizeof(path), PathFmt_Hint, priv->dir, ids[i]);
+        FILE *fp = fopen(path, "r");
+        has_hint = fp;
+        if (fp) {
+            ret = load_hint(priv, seg, fp);
+            fclose(fp);
+        } else {
+            ret = load_data(priv, seg);
+        }
+    }
+    if (ret) goto exit;
+
+    for (uint32_t i = 0; i < priv->num_bucket; i++) {
+        struct entry **slot = &priv->buckets[i];
+        while (*slot) {
+            if ((*slot)->tomb) index_drop(priv, slot);
+            else slot = &(*slot)->next;
+        }
+    }
+
+    if (!has_hint) priv->active = priv->segments[priv->num_segment - 1];
+    else ret = rotate(priv);
+    if (!ret) {
+        logfI(logFmtHead "%s load %u keys from %u segments", priv->dir, priv->num_entry, priv->num_segment);
+    }
+
+exit:
+    closedir(dir);
+    free(ids);
+    return ret;
+}
+
+struct compact_item {
+    const char *key;
+    uint32_t    seg;
+    uint64_t    offset;
+    uint32_t    size;
+    uint64_t    seq;
+    uint64_t    new_offset;
+};
+
+static int sync_dir(const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return errno;
+    int ret = fsync(fd) ? errno : 0;
+    close(fd);
+    return ret;
+}
+
+/**
+ * @brief 将活跃段之前的各段中仍有效的record复制到一个新的段（并生成hint文件），然后删除这些段
+ *
+ * 复制期间不持有锁；切换索引时，已被覆盖或删除的record不再切换。墓碑不会被复制，所以旧的段必须全部删除：
+ * hint文件中记录了被合并的段，rename到位后即使删除过程中断，重建索引时也会删除余下的段
+ */
+static int compact(priv_t *priv) {
+    int                  ret      = 0;
+    struct compact_item *items    = NULL;
+    uint32_t             num_item = 0;
+    struct segment     **olds     = NULL; /* 不能在锁外访问segments */
+    uint32_t             num_old  = 0;
+    struct segment      *merged   = NULL;
+    FILE                *hint_fp  = NULL;
+    void                *buffer   = NULL;
+    uint32_t             capacity = 0;
+    char                 path[PATH_MAX], hint_path[PATH_MAX];
+
+    /* 切换活跃段，此后旧的段不再变化，且只有compactor会删除段 */
+    pthread_mutex_lock(&priv->mutex);
+    ret                = rotate(priv);
+    uint32_t active_id = priv->active->id;
+    uint32_t merged_id = priv->next_id++;
+    pthread_mutex_unlock(&priv->mutex);
+    if (ret) return ret;
+
+    pthread_rwlock_rdlock(&priv->rwlock);
+    items = malloc((priv->num_entry + 1) * sizeof(struct compact_item));
+    olds  = malloc(priv->num_segment * sizeof(struct segment *));
+    if (!items || !olds) {
+        ret = ENOMEM;
+    } else {
+        for (uint32_t i = 0; i < priv->num_segment; i++) {
+            if (priv->segments[i]->id < active_id) olds[num_old++] = priv->segments[i];
+        }
+        for (uint32_t i = 0; i < priv->num_bucket && !ret; i++) {
+            for (const struct entry *entry = priv->buckets[i]; entry; entry = entry->next) {
+                if (entry->seg >= active_id) continue;
+                struct compact_item *item = &items[num_item];
+                if (!(item->key = strdup(entry->key))) {
+                    ret = errno;
+                    break;
+                }
+                item->seg    = entry->seg;
+                item->offset = entry->offset;
+                item->size   = entry->size;
+                item->seq    = entry->seq;
+                num_item++;
+            }
+        }
+    }
+    pthread_rwlock_unlock(&priv->rwlock);
+    if (ret) goto exit;
+
+    merged = segment_open(priv, merged_id, true);
+    if (!merged) {
+        ret = errno;
+        goto exit;
+    }
+    snprintf(hint_path, sizeof(hint_path), PathFmt_Hint ".tmp", priv->dir, merged_id);
+    hint_fp = fopen(hint_path, "w");
+    if (!hint_fp) {
+        ret = errno;
+        goto exit;
+    }
+    struct hint_head head = {.num_merged = num_old};
+    if (1 != fwrite(&head, sizeof(head), 1, hint_fp)) {
+        ret = EIO;
+        goto exit;
+    }
+    for (uint32_t i = 0; i < num_old; i++) {
+        if (1 != fwrite(&olds[i]->id, sizeof(uint32_t), 1, hint_fp)) {
+            ret = EIO;
+            goto exit;
+        }
+    }
+
+    for (uint32_t i = 0; i < num_item; i++) {
+        struct compact_item *item = &items[i];
+        struct hint          hint = {.seq = item->seq, .offset = merged->size, .size = item->size};
+
+        if (item->size > capacity) {
+            void *_buffer = realloc(buffer, item->size);
+            if (!_buffer) {
+                ret = errno;
+                goto exit;
+            }
+            buffer   = _buffer;
+            capacity = item->size;
+        }
+        int fd = -1;
+        for (uint32_t j = 0; j < num_old; j++) {
+            if (olds[j]->id == item->seg) fd = olds[j]->fd;
+        }
+        if (pread(fd, buffer, item->size, item->offset) != item->size ||
+            pwrite(merged->fd, buffer, item->size, merged->size) != item->size) {
+            ret = EIO;
+            goto exit;
+        }
+        hint.key_len = strlen(item->key);
+        if (1 != fwrite(&hint, sizeof(hint), 1, hint_fp) || 1 != fwrite(item->key, hint.key_len, 1, hint_fp)) {
+            ret = EIO;
+            goto exit;
+        }
+        item->new_offset = merged->size;
+        merged->size += item->size;
+    }
+    if (fsync(merged->fd) || fflush(hint_fp) || fsync(fileno(hint_fp))) {
+        ret = errno;
+        goto exit;
+    }
+    fclose(hint_fp);
+    hint_fp = NULL;
+    snprintf(path, sizeof(path), PathFmt_Hint, priv->dir, merged_id);
+    if (rename(hint_path, path) || (ret = sync_dir(priv->dir))) {
+        ret = ret ? ret : errno;
+        goto exit;
+    }
+
+    pthread_rwlock_wrlock(&priv->rwlock);
+    ret = segment_add(priv, merged);
+    if (!ret) {
+        for (uint32_t i = 0; i < num_item; i++) {
+            const struct compact_item *item  = &items[i];
+            struct entry              *entry = *index_slot(priv, item->key);
+            if (entry && entry->seg == item->seg && entry->offset == item->offset) {
+                entry->seg    = merged_id;
+                entry->offset = item->new_offset;
+            } else {
+                merged->dead += item->size;
+            }
+        }
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < priv->num_segment; i++) {
+            if (priv->segments[i]->id >= active_id) priv->segments[n++] = priv->segments[i];
+        }
+        priv->num_segment = n;
+    }
+    pthread_rwlock_unlock(&priv->rwlock);
+    if (ret) goto exit;
+
+    for (uint32_t i = 0; i < num_old; i++) {
+        while (atomic_load(&olds[i]->nref))
+            usleep(1000);
+        segment_remove(priv, olds[i]);
+    }
+    logfI(logFmtHead "%s compact %u segments into segment %u with %u keys", priv->dir, num_old, merged_id, num_item);
+    merged = NULL;
+
+exit:
+    if (ret) logfE(logFmtHead "%s fail to compact" logFmtErrno, priv->dir, logArgErrno_(ret));
+    if (hint_fp) {
+        fclose(hint_fp);
+        unlink(hint_path);
+    }
+    if (merged) segment_remove(priv, merged);
+    for (uint32_t i = 0; i < num_item; i++)
+        free((void *)items[i].key);
+    free(items);
+    free(olds);
+    free(buffer);
+    return ret;
+}
+
+static bool compact_needed(priv_t *priv) {
+    uint64_t total = 0, dead = 0;
+
+    pthread_rwlock_rdlock(&priv->rwlock);
+    for (uint32_t i = 0; i < priv->num_segment; i++) {
+        total += priv->segments[i]->size;
+        dead += priv->segments[i]->dead;
+    }
+    pthread_rwlock_unlock(&priv->rwlock);
+    return dead >= LOGSTORE_COMPACT_MIN && dead * 2 >= total;
+}
+
+static void *compactor(priv_t *priv) {
+    pthread_mutex_lock(&priv->compact_mutex);
+    while (!priv->stop) {
+        struct timespec ts = timestamp2spec(timestamp(true) + timestamp_from_s(LOGSTORE_COMPACT_INTERVAL));
+        pthread_cond_timedwait(&priv->compact_cond, &priv->compact_mutex, &ts);
+        if (priv->stop) break;
+        pthread_mutex_unlock(&priv->compact_mutex);
+        if (compact_needed(priv)) compact(priv);
+        pthread_mutex_lock(&priv->compact_mutex);
+    }
+    pthread_mutex_unlock(&priv->compact_mutex);
+    return NULL;
+}
+
+static void priv_free(priv_t *priv) {
+    durable_deinit(&priv->durable);
+    for (uint32_t i = 0; i < priv->num_segment; i++) {
+        close(priv->segments[i]->fd);
+        free(priv->segments[i]);
+    }
+    free(priv->segments);
+    for (uint32_t i = 0; i < priv->num_bucket; i++) {
+        struct entry *entry, *next;
+        for (entry = priv->buckets[i]; entry; entry = next) {
+            next = entry->next;
+            free(entry);
+        }
+    }
+    free(priv->buckets);
+    pthread_cond_destroy(&priv->compact_cond);
+    pthread_mutex_destroy(&priv->compact_mutex);
+    pthread_mutex_destroy(&priv->mutex);
+    pthread_rwlock_destroy(&priv->rwlock);
+    free((void *)priv->dir);
+    free(priv);
+}
+
+static void logstore_destructor(priv_t *priv) {
+    pthread_mutex_lock(&priv->compact_mutex);
+    priv->stop = true;
+    pthread_cond_signal(&priv->compact_cond);
+    pthread_mutex_unlock(&priv->compact_mutex);
+    pthread_join(priv->tid, NULL);
+    priv_free(priv);
+}
+
+int constructor_logstore(storage_ctx_t *ctx, const char *name, const char *dir, const char *sync) {
+    int ret = 0;
+
+    if (access(dir, F_OK) == -1) {
+        ret = mkdir(dir, 0755);
+        if (ret) {
+            logfE(logFmtHead "fail to create root path %s" logFmtErrno, dir, logArgErrno);
+            return errno;
+        }
+    }
+
+    priv_t *priv = calloc(1, sizeof(priv_t));
+    if (!priv) {
+        logfE(logFmtHead "fail to allocate priv" logFmtErrno, logArgErrno);
+        return errno;
+    }
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&priv->compact_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&priv->compact_mutex, NULL);
+    pthread_mutex_init(&priv->mutex, NULL);
+    pthread_rwlock_init(&priv->rwlock, NULL);
+    priv->num_bucket = 1024;
+    priv->buckets    = calloc(priv->num_bucket, sizeof(struct entry *));
+    priv->dir        = strdup(dir);
+    if (!priv->buckets || !priv->dir) {
+        ret = errno;
+        logfE(logFmtHead "fail to allocate index" logFmtErrno, logArgErrno);
+        goto exit;
+    }
+    if ((ret = durable_init(&priv->durable, sync, fdatasync))) goto exit;
+
+    ret = rebuild(priv);
+    if (ret) {
+        logfE(logFmtHead "fail to load %s" logFmtErrno, dir, logArgErrno_(ret));
+        goto exit;
+    }
+
+    if (!(ctx->name = strdup(name))) {
+        ret = errno;
+        logfE(logFmtHead "fail to allocate name" logFmtErrno, logArgErrno);
+        goto exit;
+    }
+    ret = pthread_create(&priv->tid, NULL, (void *(*)(void *))compactor, priv);
+    if (ret) {
+        logfE(logFmtHead "fail to create compactor" logFmtRet, ret);
+        free((void *)ctx->name);
+        goto exit;
+    }
+
+    ctx->priv       = priv;
+    ctx->get        = (typeof(ctx->get))logstore_get;
+    ctx->get_buf    = (typeof(ctx->get_buf))logstore_get_buf;
+    ctx->set        = (typeof(ctx->set))logstore_set;
+    ctx->del        = (typeof(ctx->del))logstore_del;
+    ctx->scan       = (typeof(ctx->scan))logstore_scan;
+    ctx->destructor = (typeof(ctx->destructor))logstore_destructor;
+    return 0;
+
+exit:
+    priv_free(priv);
+    return ret;
+}
+
+static int parse(storage_ctx_t *ctx, const char *name, const char **args) {
+    return constructor_logstore(ctx, name, args[0], args[1]);
+}
+
+storage_parseConfig_t logstore_parseConfig = {
+    .name    = "logstore",
+    .argName = "<DIR>,[<SYNC>],",
+    .note    = "注册类型为logstore的存储（追加写的日志文件，内存中的哈希索引，后台压缩）。DIR是其根目录；"
+               "SYNC是持久化方式，取值none,fsync,group[:<US>[:<NUM>]]，默认为none",
+    .argNum  = 2,
+    .parse   = parse,
+};
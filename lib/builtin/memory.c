@@ -28,32 +28,455 @@
  *  SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include "builtin.h"
 #include "cache.h"
 #include "global.h"
 #include "memio/layout.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #define logFmtHead "[storage::(memory)] "
 
+#define WORD       sizeof(uint32_t) /* shadow的粒度 */
+#define WORD_BYTES ((1u << WORD) - 1)  /* 整个字都已暂存 */
+
+enum memory_mode {
+    _memory_ro = 0, /* 只读 */
+    _memory_rw,     /* 写入直接生效 */
+    _memory_wc,     /* 写入暂存，由flusher批量刷出 */
+};
+
+/**
+ * @brief 寄存器组：占用的字有重叠的寄存器属于同一组，共用一把锁，掩码读改写因此不会互相覆盖
+ */
+struct group {
+    pthread_mutex_t mutex;
+    uint32_t        first;   /* 首个字的序号 */
+    uint32_t        last;    /* 末个字的序号 */
+    atomic_bool     pending; /* 有暂存的写入（wc） */
+};
+
+/**
+ * @brief 轮询：定时读出整个区域，与上一次的快照比较，把值有变化的寄存器通知给watch的调用者
+ */
+struct poll {
+    timestamp_t       interval;
+    uint32_t          length;
+    uint8_t          *prev;    /* 上一次的快照 */
+    uint8_t          *cur;     /* 本次的快照 */
+    const pos_t     **pos;     /* 参与比较的寄存器 */
+    uint32_t          num_pos;
+    pos_batch_t      *batch;   /* 从快照中批量读出pos */
+    uint8_t          *decoded; /* 上一次快照中pos的值 */
+    uint8_t          *decoding;
+    storage_changed_t notify;
+    void             *arg;
+    pthread_mutex_t   snapshot; /* 保护prev和stale：取快照与自身的写回互斥 */
+    bool              stale;    /* prev已随自身的写回更新，decoded需要重新解码 */
+    pthread_mutex_t   mutex;
+    pthread_cond_t    cond;
+    bool              stop;
+    bool              started;
+    pthread_t         tid;
+};
+
 struct priv {
-    void        *base;
-    const pos_t *layout;
+    void            *base;
+    const layout_t  *layout;
+    enum memory_mode mode;
+    bool             mmio;     /* 映射的是/dev/mem：读取可能有副作用，只按寄存器本身的宽度访问 */
+    timestamp_t      duration; /* get返回的有效期 */
+    /* 以下仅在可写时有效 */
+    struct group    *groups;
+    uint32_t         num_group;
+    uint32_t        *group_of; /* 以pos在layout中的序号索引 */
+    uint32_t        *shadow;   /* 内存的影子，由所在组的锁保护 */
+    uint8_t         *staged;   /* 每个字中已暂存、待写回的字节（bit i对应第i个字节），由所在组的锁保护 */
+    /* 以下仅在wc时有效 */
+    timestamp_t      interval;
+    pthread_mutex_t  mutex;
+    pthread_cond_t   cond;
+    atomic_bool      dirty; /* 有组待刷出 */
+    bool             stop;
+    pthread_t        flusher;
+    /* 以下仅在poll时有效 */
+    struct poll      poll;
 };
 typedef struct priv priv_t;
 
+static inline struct group *group_of(const priv_t *priv, const pos_t *pos) {
+    return &priv->groups[priv->group_of[pos - priv->layout->pos]];
+}
+
+static inline uint32_t word_first(const pos_t *pos) { return pos->offset / WORD; }
+static inline uint32_t word_last(const pos_t *pos) {
+    return (pos->offset + (pos->length ? pos->length : 1) - 1) / WORD;
+}
+
+/**
+ * @brief 第w个字中属于[begin, end)的字节
+ */
+static inline uint8_t word_bytes(uint32_t w, uint32_t begin, uint32_t end) {
+    uint32_t lo = begin > w * WORD ? begin - w * WORD : 0;
+    uint32_t hi = end < (w + 1) * WORD ? end - w * WORD : WORD;
+    return ((1u << hi) - 1) & ~((1u << lo) - 1);
+}
+
+/**
+ * @brief 把value写入shadow（value为NULL时清零）并标记暂存的字节，调用者持有所在组的锁
+ */
+static int pos_stage(const priv_t *priv, const pos_t *pos, const value_t *value) {
+    static const uint32_t zero   = 0;
+    uint32_t              begin  = pos->offset, end = pos->offset + pos->length;
+    uint8_t              *shadow = (uint8_t *)priv->shadow;
+
+    if (pos->length <= WORD) {
+        /* 掩码写入保留寄存器的其他位，需要先读入（已暂存的字节以shadow为准）；只读寄存器本身占用的字节 */
+        uint8_t staged = 0;
+        for (uint32_t w = word_first(pos); w <= word_last(pos); w++)
+            staged |= priv->staged[w] & word_bytes(w, begin, end);
+        if (!staged) {
+            memcpy(shadow + begin, (const uint8_t *)priv->base + begin, pos->length);
+        } else {
+            for (uint32_t i = begin; i < end; i++) {
+                if (!(priv->staged[i / WORD] & 1u << i % WORD)) shadow[i] = ((volatile uint8_t *)priv->base)[i];
+            }
+        }
+    }
+    int ret = value ? pos_write(pos, priv->shadow, value->data, value->length) : pos_write(pos, priv->shadow, &zero, 0);
+    if (ret) return -ret;
+    for (uint32_t w = word_first(pos); w <= word_last(pos); w++)
+        priv->staged[w] |= word_bytes(w, begin, end);
+    return 0;
+}
+
+/**
+ * @brief 把组中暂存的字节写回内存，调用者持有组的锁
+ *
+ * 只写回暂存的字节（整字、对齐的半字暂存时按字、半字写回），不会覆盖同一个字中其他寄存器被并发写入的值，也不会
+ * 误写写1清零的寄存器。轮询时同时更新快照，自身的写入不会被当作变化通知出去
+ */
+static void group_flush(priv_t *priv, struct group *group) {
+    const uint8_t *shadow = (const uint8_t *)priv->shadow;
+    struct poll   *poll   = priv->poll.interval ? &priv->poll : NULL;
+
+    if (poll) pthread_mutex_lock(&poll->snapshot);
+    for (uint32_t w = group->first; w <= group->last; w++) {
+        uint8_t staged = priv->staged[w];
+        if (staged == WORD_BYTES) {
+            ((volatile uint32_t *)priv->base)[w] = priv->shadow[w];
+        } else if (staged) {
+            for (uint32_t i = w * WORD; i < (w + 1) * WORD; i += sizeof(uint16_t)) {
+                uint8_t half = staged >> i % WORD & 0x3;
+                if (half == 0x3) {
+                    uint16_t value;
+                    memcpy(&value, shadow + i, sizeof(value));
+                    ((volatile uint16_t *)priv->base)[i / sizeof(uint16_t)] = value;
+                } else if (half) {
+                    uint32_t j                          = i + (half == 0x2);
+                    ((volatile uint8_t *)priv->base)[j] = shadow[j];
+                }
+            }
+        }
+        if (poll && staged) {
+            for (uint32_t i = 0; i < WORD; i++) {
+                if (staged & 1u << i) poll->prev[w * WORD + i] = shadow[w * WORD + i];
+            }
+            poll->stale = true;
+        }
+        priv->staged[w] = 0;
+    }
+    if (poll) pthread_mutex_unlock(&poll->snapshot);
+    atomic_store(&group->pending, false);
+}
+
+/**
+ * @brief 组中的写入已暂存，rw时立即写回，wc时交给flusher，调用者持有组的锁
+ */
+static void group_staged(priv_t *priv, struct group *group) {
+    if (priv->mode != _memory_wc) {
+        group_flush(priv, group);
+        return;
+    }
+    atomic_store(&group->pending, true);
+    if (!atomic_exchange(&priv->dirty, true)) {
+        pthread_mutex_lock(&priv->mutex);
+        pthread_cond_signal(&priv->cond);
+        pthread_mutex_unlock(&priv->mutex);
+    }
+}
+
+static void groups_flush(priv_t *priv) {
+    for (uint32_t i = 0; i < priv->num_group; i++) {
+        struct group *group = &priv->groups[i];
+        if (!atomic_load(&group->pending)) continue;
+        pthread_mutex_lock(&group->mutex);
+        if (atomic_load(&group->pending)) group_flush(priv, group);
+        pthread_mutex_unlock(&group->mutex);
+    }
+}
+
+static void *flusher(priv_t *priv) {
+    pthread_mutex_lock(&priv->mutex);
+    for (;;) {
+        while (!priv->stop && !atomic_load(&priv->dirty))
+            pthread_cond_wait(&priv->cond, &priv->mutex);
+        if (priv->stop) break;
+
+        struct timespec deadline = timestamp2spec(timestamp(true) + priv->interval);
+        while (!priv->stop && pthread_cond_timedwait(&priv->cond, &priv->mutex, &deadline) != ETIMEDOUT)
+            ;
+        atomic_store(&priv->dirty, false);
+        pthread_mutex_unlock(&priv->mutex);
+        groups_flush(priv);
+        pthread_mutex_lock(&priv->mutex);
+    }
+    pthread_mutex_unlock(&priv->mutex);
+    return NULL;
+}
+
+struct span {
+    uint32_t first, last, idx;
+};
+
+static int span_cmp(const void *a, const void *b) {
+    const struct span *sa = a, *sb = b;
+    return (sa->first > sb->first) - (sa->first < sb->first);
+}
+
+/**
+ * @brief 按占用的字把寄存器分组，并分配shadow
+ */
+static int groups_init(priv_t *priv, uint32_t length) {
+    const pos_t *pos = priv->layout->pos;
+    uint32_t     num = 0;
+
+    while (pos[num].key != LST_SEARCH_ID_END)
+        num++;
+    struct span *spans = malloc((num ? num : 1) * sizeof(struct span));
+    priv->groups       = calloc(num ? num : 1, sizeof(struct group));
+    priv->group_of     = malloc((num ? num : 1) * sizeof(uint32_t));
+    priv->shadow       = malloc((length + WORD - 1) / WORD * WORD);
+    priv->staged       = calloc((length + WORD - 1) / WORD, 1);
+    if (!spans || !priv->groups || !priv->group_of || !priv->shadow || !priv->staged) {
+        free(spans);
+        free(priv->groups);
+        free(priv->group_of);
+        free(priv->shadow);
+        free(priv->staged);
+        return ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < num; i++) {
+        spans[i] = (struct span){.first = word_first(&pos[i]), .last = word_last(&pos[i]), .idx = i};
+    }
+    qsort(spans, num, sizeof(struct span), span_cmp);
+
+    priv->num_group = 0;
+    for (uint32_t i = 0; i < num; i++) {
+        struct group *group = priv->num_group ? &priv->groups[priv->num_group - 1] : NULL;
+        if (!group || spans[i].first > group->last) {
+            group        = &priv->groups[priv->num_group++];
+            group->first = spans[i].first;
+            group->last  = spans[i].last;
+            pthread_mutex_init(&group->mutex, NULL);
+        } else if (spans[i].last > group->last) {
+            group->last = spans[i].last;
+        }
+        priv->group_of[spans[i].idx] = priv->num_group - 1;
+    }
+    free(spans);
+    logfD(logFmtHead "%u registers in %u groups", num, priv->num_group);
+    return 0;
+}
+
+static void groups_deinit(priv_t *priv) {
+    for (uint32_t i = 0; i < priv->num_group; i++) {
+        pthread_mutex_destroy(&priv->groups[i].mutex);
+    }
+    free(priv->groups);
+    free(priv->group_of);
+    free(priv->shadow);
+    free(priv->staged);
+}
+
+static void poll_diff(priv_t *priv) {
+    struct poll *poll = &priv->poll;
+
+    pthread_mutex_lock(&poll->snapshot);
+    memcpy(poll->cur, priv->base, poll->length); /* 一次读出整个区域 */
+    bool changed = memcmp(poll->prev, poll->cur, poll->length);
+    if (changed) {
+        if (poll->stale) pos_batch_read(poll->batch, poll->prev, poll->decoded);
+        poll->stale = false;
+        pos_batch_read(poll->batch, poll->cur, poll->decoding);
+        uint8_t *prev = poll->prev;
+        poll->prev    = poll->cur;
+        poll->cur     = prev;
+    }
+    pthread_mutex_unlock(&poll->snapshot); /* 通知时不持有锁：回调可能等待正在写入的请求 */
+    if (!changed) return;
+
+    for (uint32_t i = 0; i < poll->num_pos; i++) {
+        const pos_t *pos    = poll->pos[i];
+        uint32_t     offset = pos_batch_offset(poll->batch, i);
+        uint32_t     length = pos->length > sizeof(uint32_t) ? pos->length : sizeof(uint32_t);
+        if (!memcmp(poll->decoded + offset, poll->decoding + offset, length)) continue;
+        logfD(logFmtHead logFmtKey " changed", pos->name);
+        poll->notify(poll->arg, pos->name);
+    }
+
+    uint8_t *decoded = poll->decoded;
+    poll->decoded    = poll->decoding;
+    poll->decoding   = decoded;
+}
+
+static void *poller(priv_t *priv) {
+    struct poll *poll = &priv->poll;
+
+    pthread_mutex_lock(&poll->mutex);
+    while (!poll->stop) {
+        struct timespec deadline = timestamp2spec(timestamp(true) + poll->interval);
+        if (pthread_cond_timedwait(&poll->cond, &poll->mutex, &deadline) != ETIMEDOUT) continue;
+        pthread_mutex_unlock(&poll->mutex);
+        poll_diff(priv);
+        pthread_mutex_lock(&poll->mutex);
+    }
+    pthread_mutex_unlock(&poll->mutex);
+    return NULL;
+}
+
+static void poll_free(struct poll *poll) {
+    free(poll->prev);
+    free(poll->cur);
+    free(poll->pos);
+    pos_batch_destroy(poll->batch);
+    free(poll->decoded);
+    free(poll->decoding);
+}
+
+static int poll_init(priv_t *priv, unsigned int interval, uint32_t length) {
+    struct poll *poll = &priv->poll;
+    const pos_t *pos;
+
+    poll->interval = (timestamp_t)interval * 1000000;
+    poll->length   = length;
+    for (pos = priv->layout->pos; pos->key != LST_SEARCH_ID_END; pos++)
+        poll->num_pos++;
+    poll->prev = malloc(length);
+    poll->cur  = malloc(length);
+    poll->pos  = malloc((poll->num_pos + 1) * sizeof(pos_t *));
+    if (!poll->prev || !poll->cur || !poll->pos) goto exit;
+
+    poll->num_pos = 0;
+    for (pos = priv->layout->pos; pos->key != LST_SEARCH_ID_END; pos++) {
+        if (pos->name && pos->length) poll->pos[poll->num_pos++] = pos;
+    }
+    poll->batch = pos_batch_create(poll->pos, poll->num_pos, length);
+    if (!poll->batch) goto exit;
+    poll->decoded  = malloc(pos_batch_size(poll->batch));
+    poll->decoding = malloc(pos_batch_size(poll->batch));
+    if (!poll->decoded || !poll->decoding) goto exit;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&poll->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&poll->mutex, NULL);
+    pthread_mutex_init(&poll->snapshot, NULL);
+    return 0;
+
+exit:
+    poll_free(poll);
+    return ENOMEM;
+}
+
+static void poll_deinit(priv_t *priv) {
+    struct poll *poll = &priv->poll;
+
+    if (poll->started) {
+        pthread_mutex_lock(&poll->mutex);
+        poll->stop = true;
+        pthread_cond_signal(&poll->cond);
+        pthread_mutex_unlock(&poll->mutex);
+        pthread_join(poll->tid, NULL);
+    }
+    pthread_mutex_destroy(&poll->snapshot);
+    pthread_mutex_destroy(&poll->mutex);
+    pthread_cond_destroy(&poll->cond);
+    poll_free(poll);
+}
+
+/**
+ * @brief 以当前内容为初始快照，启动poller
+ */
+static int memory_watch(priv_t *priv, storage_changed_t changed, void *arg) {
+    struct poll *poll = &priv->poll;
+
+    poll->notify = changed;
+    poll->arg    = arg;
+    pthread_mutex_lock(&poll->snapshot);
+    memcpy(poll->prev, priv->base, poll->length);
+    pos_batch_read(poll->batch, poll->prev, poll->decoded);
+    poll->stale = false;
+    pthread_mutex_unlock(&poll->snapshot);
+    int ret = pthread_create(&poll->tid, NULL, (void *(*)(void *))poller, priv);
+    if (ret) return ret;
+    poll->started = true;
+    logfI(logFmtHead "poll %u bytes every %ldms", poll->length, timestamp_to_ms(poll->interval));
+    return 0;
+}
+
 static void memory_deinit(priv_t *priv) {
-    /* TODO */
-    munmap(priv->base, layout_length(priv->layout));
-    layout_destroy((pos_t *)priv->layout);
+    if (priv->mode == _memory_wc) {
+        pthread_mutex_lock(&priv->mutex);
+        priv->stop = true;
+        pthread_cond_signal(&priv->cond);
+        pthread_mutex_unlock(&priv->mutex);
+        pthread_join(priv->flusher, NULL);
+        pthread_mutex_destroy(&priv->mutex);
+        pthread_cond_destroy(&priv->cond);
+        groups_flush(priv);
+    }
+    if (priv->poll.interval) poll_deinit(priv); /* 在最后一次写回之后 */
+    if (priv->mode != _memory_ro) groups_deinit(priv);
+    munmap(priv->base, layout_length(priv->layout->pos));
+    layout_destroy((layout_t *)priv->layout);
     free(priv);
 }
 
-static int memory_get(const priv_t *priv, const char *key, const value_t **value, timestamp_t *duration) {
-    const pos_t *pos = pos_search_by_name(priv->layout, key);
+/**
+ * @brief wc时先刷出暂存的写入，读到的才是最新值
+ */
+static void pos_sync(priv_t *priv, const pos_t *pos) {
+    if (priv->mode != _memory_wc) return;
+    struct group *group = group_of(priv, pos);
+    if (atomic_load(&group->pending)) {
+        pthread_mutex_lock(&group->mutex);
+        if (atomic_load(&group->pending)) group_flush(priv, group);
+        pthread_mutex_unlock(&group->mutex);
+    }
+}
+
+static void pos_fill(priv_t *priv, const pos_t *pos, value_t *value) {
+    pos_sync(priv, pos);
+    pos_read(pos, priv->base, value->data, pos->length);
+    value->length = pos->length;
+    value->type   = pos->length > sizeof(uint32_t) ? _value_data : _value_u32;
+}
+
+static int memory_get(priv_t *priv, const char *key, const value_t **value, timestamp_t *duration) {
+    const pos_t *pos = layout_search_by_name(priv->layout, key);
     if (!pos) {
         return ENOENT;
     }
@@ -63,62 +486,374 @@ static int memory_get(const priv_t *priv, const char *key, const value_t **value
         return errno;
     }
 
-    pos_read(pos, priv->base, _value->data, pos->length);
-    _value->length = pos->length;
-    _value->type   = pos->length > sizeof(uint32_t) ? _value_data : _value_u32;
-    *value         = _value;
-    *duration      = DURATION_INF;
+    pos_fill(priv, pos, _value);
+    *value    = _value;
+    *duration = priv->duration;
+    return 0;
+}
+
+static int memory_get_buf(priv_t *priv, const char *key, value_t *value, uint32_t *size, timestamp_t *duration) {
+    const pos_t *pos = layout_search_by_name(priv->layout, key);
+    if (!pos) {
+        return ENOENT;
+    }
+
+    uint32_t need = sizeof(value_t) + pos->length;
+    if (*size < need) {
+        *size = need;
+        return ENOBUFS;
+    }
+
+    pos_fill(priv, pos, value);
+    *size     = need;
+    *duration = priv->duration;
+    return 0;
+}
+
+/**
+ * @brief 先查出所有key的位置，再从基址批量读出
+ *
+ * 批量读取会把短的寄存器按32-bit（AVX2时按8个一组gather）整体读出，会读到相邻的字节，所以mmio时按寄存器本身的宽度
+ * 逐个读出
+ */
+static int memory_mget(priv_t *priv, int num, const char *const keys[], const value_t *values[],
+                       timestamp_t durations[], int results[]) {
+    const pos_t **poses = malloc(num * sizeof(pos_t *));
+    int          *idx   = malloc(num * sizeof(int));
+    int           count = 0;
+    if (!poses || !idx) goto exit;
+
+    for (int i = 0; i < num; i++) {
+        const pos_t *pos = layout_search_by_name(priv->layout, keys[i]);
+        if (!pos) {
+            results[i] = ENOENT;
+            continue;
+        }
+        pos_sync(priv, pos);
+        poses[count] = pos;
+        idx[count++] = i;
+    }
+    if (!count) goto done;
+
+    pos_batch_t *batch = pos_batch_create(poses, count, priv->mmio ? 0 : layout_length(priv->layout->pos));
+    uint8_t     *out   = batch ? malloc(pos_batch_size(batch)) : NULL;
+    if (!out) {
+        pos_batch_destroy(batch);
+        goto exit;
+    }
+    pos_batch_read(batch, priv->base, out);
+
+    for (int i = 0; i < count; i++) {
+        const pos_t *pos    = poses[i];
+        value_t     *_value = malloc(sizeof(value_t) + pos->length);
+        if (!_value) {
+            results[idx[i]] = errno;
+            continue;
+        }
+        memcpy(_value->data, out + pos_batch_offset(batch, i), pos->length);
+        _value->length    = pos->length;
+        _value->type      = pos->length > sizeof(uint32_t) ? _value_data : _value_u32;
+        values[idx[i]]    = _value;
+        durations[idx[i]] = priv->duration;
+        results[idx[i]]   = 0;
+    }
+
+    free(out);
+    pos_batch_destroy(batch);
+done:
+    free(poses);
+    free(idx);
     return 0;
+
+exit:
+    free(poses);
+    free(idx);
+    return ENOMEM;
+}
+
+static int pos_name_cmp(const void *a, const void *b) {
+    const pos_t *pa = *(const pos_t *const *)a, *pb = *(const pos_t *const *)b;
+    int          ret = strcmp(pa->name, pb->name);
+    return ret ? ret : (pa > pb) - (pa < pb);
 }
 
-int constructor_memory(storage_ctx_t *ctx, const char *name, long phy, const void *layout) {
+static int memory_scan(priv_t *priv, const char *prefix, const char *cursor, int limit,
+                       storage_entry_t entries[], int *num) {
+    int          count      = 0;
+    size_t       prefix_len = strlen(prefix);
+    const pos_t *pos;
+
+    for (pos = priv->layout->pos; pos->key != LST_SEARCH_ID_END; pos++)
+        count++;
+    const pos_t **matched = malloc((count + 1) * sizeof(pos_t *));
+    if (!matched) return ENOMEM;
+
+    count = 0;
+    for (pos = priv->layout->pos; pos->key != LST_SEARCH_ID_END; pos++) {
+        if (!pos->name || strncmp(pos->name, prefix, prefix_len) || strcmp(pos->name, cursor) <= 0) continue;
+        matched[count++] = pos;
+    }
+    qsort(matched, count, sizeof(pos_t *), pos_name_cmp);
+
+    for (int i = 0; i < count && *num < limit; i++) {
+        if (i && !strcmp(matched[i - 1]->name, matched[i]->name)) continue; /* 与layout_search_by_name一致，取第一个 */
+
+        storage_entry_t *entry  = &entries[*num];
+        value_t         *_value = malloc(sizeof(value_t) + matched[i]->length);
+        if (!_value) {
+            storage_entries_free(entries, *num);
+            free(matched);
+            return ENOMEM;
+        }
+        pos_fill(priv, matched[i], _value);
+        snprintf(entry->key, sizeof(entry->key), "%s", matched[i]->name);
+        entry->value    = _value;
+        entry->duration = priv->duration;
+        (*num)++;
+    }
+
+    free(matched);
+    return 0;
+}
+
+static int memory_set(priv_t *priv, const char *key, const value_t *value) {
+    const pos_t *pos = layout_search_by_name(priv->layout, key);
+    if (!pos) {
+        return ENOENT;
+    }
+
+    struct group *group = group_of(priv, pos);
+    pthread_mutex_lock(&group->mutex);
+    int ret = pos_stage(priv, pos, value);
+    group_staged(priv, group);
+    pthread_mutex_unlock(&group->mutex);
+    return ret;
+}
+
+static int memory_del(priv_t *priv, const char *key) { return memory_set(priv, key, NULL); }
+
+struct write {
+    uint32_t     group;
+    int          idx;
+    const pos_t *pos;
+};
+
+static int write_cmp(const void *a, const void *b) {
+    const struct write *wa = a, *wb = b;
+    if (wa->group != wb->group) return (wa->group > wb->group) - (wa->group < wb->group);
+    return wa->idx - wb->idx; /* 同一个key可能出现多次，保持先后顺序 */
+}
+
+/**
+ * @brief 按组合并写入：每组只加锁一次，暂存的字节只写回一次
+ */
+static int memory_mset(priv_t *priv, int num, const char *const keys[], const value_t *const values[], int results[]) {
+    struct write *writes = malloc(num * sizeof(struct write));
+    int           count  = 0;
+    if (!writes) return ENOMEM;
+
+    for (int i = 0; i < num; i++) {
+        const pos_t *pos = layout_search_by_name(priv->layout, keys[i]);
+        if (!pos) {
+            results[i] = ENOENT;
+            continue;
+        }
+        writes[count++] = (struct write){.group = priv->group_of[pos - priv->layout->pos], .idx = i, .pos = pos};
+    }
+    qsort(writes, count, sizeof(struct write), write_cmp);
+
+    for (int i = 0; i < count;) {
+        struct group *group = &priv->groups[writes[i].group];
+        pthread_mutex_lock(&group->mutex);
+        for (uint32_t g = writes[i].group; i < count && writes[i].group == g; i++) {
+            results[writes[i].idx] = pos_stage(priv, writes[i].pos, values ? values[writes[i].idx] : NULL);
+        }
+        group_staged(priv, group);
+        pthread_mutex_unlock(&group->mutex);
+    }
+
+    free(writes);
+    return 0;
+}
+
+static int memory_mdel(priv_t *priv, int num, const char *const keys[], int results[]) {
+    return memory_mset(priv, num, keys, NULL, results);
+}
+
+static int mode_parse(priv_t *priv, const char *s) {
+    unsigned int interval = 1000;
+
+    if (!s[0] || !strcmp(s, "ro")) {
+        priv->mode = _memory_ro;
+    } else if (!strcmp(s, "rw")) {
+        priv->mode = _memory_rw;
+    } else if (!strncmp(s, "wc", 2) && (!s[2] || sscanf(s + 2, ":%u", &interval) == 1)) {
+        priv->mode     = _memory_wc;
+        priv->interval = (timestamp_t)interval * 1000;
+    } else {
+        logfE(logFmtHead "unknown mode %s", s);
+        return EINVAL;
+    }
+    return 0;
+}
+
+static int map_parse(const char *s, bool *shared) {
+    if (!s[0] || !strcmp(s, "shared")) {
+        *shared = true;
+    } else if (!strcmp(s, "private")) {
+        *shared = false;
+    } else {
+        logfE(logFmtHead "unknown map %s", s);
+        return EINVAL;
+    }
+    return 0;
+}
+
+/**
+ * @brief 打开映射源：<PHY>（/dev/mem中的物理地址）、file:<PATH>、shm:<NAME>（/dev/shm中的对象）、memfd:<NAME>
+ *
+ * @return int fd，失败时为-1并设置errno
+ */
+static int src_open(priv_t *priv, const char *src, uint32_t len, bool shared, off_t *offset) {
+    int         flags = priv->mode != _memory_ro && shared ? O_RDWR : O_RDONLY;
+    char        path[PATH_MAX];
+    struct stat st;
+    int         fd, ret;
+
+    *offset        = 0;
+    priv->duration = DURATION_INF;
+    if (!strncmp(src, "memfd:", 6)) {
+        fd = memfd_create(src + 6, MFD_CLOEXEC);
+        if (fd != -1 && ftruncate(fd, len)) goto exit;
+        return fd;
+    }
+    if (!strncmp(src, "file:", 5)) {
+        snprintf(path, sizeof(path), "%s", src + 5);
+    } else if (!strncmp(src, "shm:", 4)) {
+        snprintf(path, sizeof(path), "/dev/shm/%s", src + 4);
+    } else {
+        *offset    = strtoul(src, NULL, 16);
+        priv->mmio = true;
+        return open("/dev/mem", O_RDWR | O_SYNC);
+    }
+
+    fd = open(path, flags | (flags == O_RDWR ? O_CREAT : 0) | O_CLOEXEC, 0644);
+    if (fd == -1) return -1;
+    if (fstat(fd, &st)) goto exit;
+    if (st.st_size < len) {
+        if (flags != O_RDWR) {
+            logfE(logFmtHead "%s has %ld bytes but layout needs %u", path, st.st_size, len);
+            errno = EINVAL;
+            goto exit;
+        }
+        if (ftruncate(fd, len)) goto exit;
+    }
+    if (shared) priv->duration = 0; /* 其他进程也可能写入，有效期交给cache决定 */
+    return fd;
+
+exit:
+    ret = errno;
+    close(fd);
+    errno = ret;
+    return -1;
+}
+
+int constructor_memory(storage_ctx_t *ctx, const char *name, const char *src, const void *layout, const char *mode,
+                       const char *map, unsigned int poll) {
+    int  ret    = 0;
+    bool shared = true;
+
     if (!(ctx->name = strdup(name))) {
         logfE(logFmtHead "fail to allocate name" logFmtErrno, logArgErrno);
         return errno;
     }
 
-    priv_t *priv = malloc(sizeof(priv_t));
+    priv_t *priv = calloc(1, sizeof(priv_t));
     if (!priv) {
         logfE(logFmtHead "fail to allocate priv" logFmtErrno, logArgErrno);
         free((void *)ctx->name);
         return errno;
     }
+    priv->layout = layout;
+    if ((ret = mode_parse(priv, mode)) || (ret = map_parse(map, &shared))) goto exit_priv;
 
-    int fd = open("/dev/mem", O_RDWR | O_SYNC);
+    off_t    offset = 0;
+    uint32_t len    = layout_length(priv->layout->pos);
+    int      fd     = src_open(priv, src, len, shared, &offset);
     if (fd == -1) {
-        logfE(logFmtHead "fail to open /dev/mem" logFmtErrno, logArgErrno);
-        free(priv);
-        free((void *)ctx->name);
-        return EIO;
+        logfE(logFmtHead "fail to open %s" logFmtErrno, src, logArgErrno);
+        ret = errno;
+        goto exit_priv;
     }
     /* TODO propd_mmap/munmap */
-    uint32_t len = layout_length(layout);
-    priv->base   = mmap(0, len, PROT_READ, MAP_SHARED, fd, phy);
+    priv->base = mmap(0, len, PROT_READ | (priv->mode != _memory_ro ? PROT_WRITE : 0),
+                      shared ? MAP_SHARED : MAP_PRIVATE, fd, offset);
+    ret        = errno;
     close(fd);
-    if (!priv->base) {
-        logfE(logFmtHead "fail to mmap(%lx,%x)" logFmtErrno, phy, len, logArgErrno);
-        free(priv);
-        free((void *)ctx->name);
-        return errno;
+    if (priv->base == MAP_FAILED) {
+        logfE(logFmtHead "fail to mmap(%s,%x)" logFmtErrno, src, len, logArgErrno_(ret));
+        goto exit_priv;
     }
-    priv->layout = layout;
+    ret = 0;
+
+    if (poll) {
+        if ((ret = poll_init(priv, poll, len))) {
+            logfE(logFmtHead "fail to allocate snapshots" logFmtErrno, logArgErrno_(ret));
+            goto exit_mmap;
+        }
+        priv->duration = DURATION_INF; /* 变化由poller通知 */
+    }
+    if (priv->mode != _memory_ro && (ret = groups_init(priv, len))) {
+        logfE(logFmtHead "fail to group registers" logFmtErrno, logArgErrno_(ret));
+        goto exit_poll;
+    }
+    if (priv->mode == _memory_wc) {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&priv->cond, &attr);
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_init(&priv->mutex, NULL);
+        if ((ret = pthread_create(&priv->flusher, NULL, (void *(*)(void *))flusher, priv))) {
+            logfE(logFmtHead "fail to create flusher" logFmtErrno, logArgErrno_(ret));
+            pthread_mutex_destroy(&priv->mutex);
+            pthread_cond_destroy(&priv->cond);
+            groups_deinit(priv);
+            goto exit_poll;
+        }
+    }
+    logfI(logFmtHead "map %s with %u bytes as %s (%s)", src, len, mode[0] ? mode : "ro", shared ? "shared" : "private");
 
     ctx->priv       = priv;
     ctx->get        = (typeof(ctx->get))memory_get;
-    ctx->set        = NULL;
-    ctx->del        = NULL;
+    ctx->set        = priv->mode != _memory_ro ? (typeof(ctx->set))memory_set : NULL;
+    ctx->del        = priv->mode != _memory_ro ? (typeof(ctx->del))memory_del : NULL;
+    ctx->get_buf    = (typeof(ctx->get_buf))memory_get_buf;
+    ctx->mget       = (typeof(ctx->mget))memory_mget;
+    ctx->mset       = priv->mode != _memory_ro ? (typeof(ctx->mset))memory_mset : NULL;
+    ctx->mdel       = priv->mode != _memory_ro ? (typeof(ctx->mdel))memory_mdel : NULL;
+    ctx->scan       = (typeof(ctx->scan))memory_scan;
+    ctx->watch      = poll ? (typeof(ctx->watch))memory_watch : NULL;
     ctx->destructor = (typeof(ctx->destructor))memory_deinit;
     return 0;
+
+exit_poll:
+    if (poll) poll_deinit(priv);
+exit_mmap:
+    munmap(priv->base, len);
+exit_priv:
+    free(priv);
+    free((void *)ctx->name);
+    return ret;
 }
 
 static int parse(storage_ctx_t *ctx, const char *name, const char **args) {
-    int    ret    = 0;
-    long   phy    = strtoul(args[0], NULL, 16);
-    pos_t *layout = layout_parse(args[1]);
+    int       ret    = 0;
+    layout_t *layout = layout_parse(args[1]);
     if (!layout) {
         return EINVAL;
     }
-    ret = constructor_memory(ctx, name, phy, layout);
+    ret = constructor_memory(ctx, name, args[0], layout, args[2], args[3], strtoul(args[4], NULL, 0));
     if (ret) {
         layout_destroy(layout);
     }
@@ -127,8 +862,11 @@ static int parse(storage_ctx_t *ctx, const char *name, const char **args) {
 
 storage_parseConfig_t memory_parseConfig = {
     .name    = "memory",
-    .argName = "<PHY>,<LAYOUT>,",
-    .note    = "注册类型为memory的存储。PHY是内存地址，LAYOUT是描述内存布局的json文件",
-    .argNum  = 2,
+    .argName = "<SRC>,<LAYOUT>,[<MODE>],[<MAP>],[<POLL>],",
+    .note    = "注册类型为memory的存储。SRC是映射源，取值<PHY>（/dev/mem中的物理地址）,file:<PATH>,shm:<NAME>,memfd:<NAME>"
+               "；LAYOUT是描述内存布局的json文件；MODE是访问方式，取值ro,rw,wc[:<US>]，默认为ro（rw时写入立即生效；wc时写入暂"
+               "存，每US微秒批量写回，默认1000）；MAP取值shared,private，默认为shared；POLL是轮询间隔（毫秒），启用cache时定时比"
+               "较快照，让值有变化的寄存器失效，默认不轮询",
+    .argNum  = 5,
     .parse   = parse,
 };
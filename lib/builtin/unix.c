@@ -32,10 +32,15 @@
 #include "global.h"
 #include "io_server.h"
 #include "misc.h"
+#include "trace.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/queue.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -44,15 +49,33 @@
 
 #define logFmtHead "[storage::(unix)] "
 
+struct pending {
+    int            connfd;   /* own, not shared */
+    timestamp_t    deadline; /* 0 means no deadline */
+    storage_done_t done;
+    void          *arg;
+    TAILQ_ENTRY(pending) entry;
+    char key[];
+};
+TAILQ_HEAD(pending_list, pending);
+
+struct async {
+    pthread_t           tid;
+    int                 epfd;
+    int                 evfd; /* 唤醒async_reader，以重新计算epoll_wait的timeout */
+    pthread_mutex_t     mutex;
+    int                 connfd; /* shared, -1 means not connected */
+    struct pending_list fifo;   /* shared, 应答按请求的顺序返回 */
+    struct pending_list temps;  /* not shared, 用于检查超时 */
+};
+
 struct priv {
-    bool shared;
-    union {
-        const char *target; /* not shared */
-        struct {            /* shared */
-            int             connfd;
-            pthread_mutex_t mutex;
-        };
-    };
+    bool            shared;
+    const char     *target;
+    int             connfd; /* shared, -1 means not connected */
+    pthread_mutex_t mutex;  /* shared */
+    pthread_mutex_t async_mutex;
+    struct async   *async;  /* created on first get_async */
 };
 typedef struct priv priv_t;
 
@@ -98,33 +121,100 @@ static void io_disconnect(int connfd) {
     logfI(logFmtHead "disconnect %d", connfd);
 }
 
-static void io_begin(int connfd, io_type_t type, const char *key, const value_t *value) {
-    ssize_t      n __attribute__((unused));
+static timestamp_t io_deadline(void) { return g_io_timeout ? timestamp(true) + timestamp_from_ms(g_io_timeout) : 0; }
+
+/**
+ * @brief 等待connfd就绪，直到deadline
+ *
+ * @param deadline 0 means no deadline
+ * @return int errno (ETIMEDOUT EIO)
+ */
+static int io_wait(int connfd, short events, timestamp_t deadline) {
+    struct pollfd pfd = {.fd = connfd, .events = events};
+
+    for (;;) {
+        int timeout = -1;
+        if (deadline) {
+            timestamp_t remain = deadline - timestamp(true);
+            if (remain <= 0) return ETIMEDOUT;
+            timeout = timestamp_to_ms(remain) + 1;
+        }
+        int n = poll(&pfd, 1, timeout);
+        if (n > 0) return 0; /* POLLERR/POLLHUP 交给之后的send/recv报告 */
+        if (n < 0 && errno != EINTR) return EIO;
+    }
+}
+
+/**
+ * @brief 发送/接收完整的数据，整个过程不超过deadline（而不是每次send/recv）
+ *
+ * @return int errno (ETIMEDOUT 超过deadline；EIO 连接断开或出错)
+ */
+static int send_full(int connfd, const void *buf, size_t len, timestamp_t deadline) {
+    int ret = 0;
+
+    while (len) {
+        ssize_t n = send(connfd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            buf = (const char *)buf + n;
+            len -= n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if ((ret = io_wait(connfd, POLLOUT, deadline))) return ret;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return EIO;
+        }
+    }
+    return 0;
+}
+
+static int recv_full(int connfd, void *buf, size_t len, timestamp_t deadline) {
+    int ret = 0;
+
+    while (len) {
+        ssize_t n = recv(connfd, buf, len, MSG_DONTWAIT);
+        if (n > 0) {
+            buf = (char *)buf + n;
+            len -= n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if ((ret = io_wait(connfd, POLLIN, deadline))) return ret;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return EIO;
+        }
+    }
+    return 0;
+}
+
+static int io_begin(int connfd, io_type_t type, const char *key, const value_t *value, timestamp_t deadline) {
+    int          ret      = 0;
     io_package_t pkg_head = {.type = type, .created = timestamp(true)};
 
+    trace_inject(&pkg_head.trace);
     strncpy(pkg_head.key, key, sizeof(pkg_head.key));
     pkg_head.value.type   = value ? value->type : _value_undef;
     pkg_head.value.length = value ? value->length : 0;
 
-    n = send(connfd, &pkg_head, sizeof(pkg_head), 0);
-    assert(n == sizeof(pkg_head));
+    if ((ret = send_full(connfd, &pkg_head, sizeof(pkg_head), deadline))) return ret;
     logfD(logFmtHead logFmtKey " >>>%d send header of package with type %d", key, connfd, type);
 
     if (value) {
-        n = send(connfd, value->data, value->length, 0);
-        assert(n == value->length);
+        if ((ret = send_full(connfd, value->data, value->length, deadline))) return ret;
         logfD(logFmtHead logFmtKey " >>>%d send data of value with length %d", key, connfd, value->length);
     }
+    return 0;
 }
 
-static int io_end(int connfd, const char *key) {
-    int result = 0;
-
-    if (sizeof(result) != recv(connfd, &result, sizeof(result), 0)) {
-        return EIO;
-    }
-    logfD(logFmtHead logFmtKey " <<<%d recv result" logFmtRet, key, connfd, result);
-    return result;
+/**
+ * @return int errno (ETIMEDOUT EIO)，连接上的错误；对端的结果通过result返回
+ */
+static int io_end(int connfd, const char *key, int *result, timestamp_t deadline) {
+    int ret = recv_full(connfd, result, sizeof(*result), deadline);
+    if (ret) return ret;
+    logfD(logFmtHead logFmtKey " <<<%d recv result" logFmtRet, key, connfd, *result);
+    return 0;
 }
 
 void unix_stream_discard(int connfd) {
@@ -138,126 +228,518 @@ void unix_stream_discard(int connfd) {
     fcntl(connfd, F_SETFL, fl);
 }
 
-static int get(priv_t *priv, const char *key, const value_t **value, timestamp_t *duration) {
-    int         ret    = 0;
-    int         connfd = -1;
+/**
+ * @brief 接收get的应答（duration、value、result）
+ *
+ * @return int errno (ETIMEDOUT EIO ENOMEM)，非0时连接中剩余的数据已不可信
+ */
+static int recv_get_reply(int connfd, const char *key, const value_t **value, timestamp_t *duration, int *result,
+                          timestamp_t deadline) {
+    int         ret = 0;
     timestamp_t _duration;
     value_t     value_head;
     value_t    *_value = NULL;
 
-    if (priv->shared) {
-        connfd = priv->connfd;
-        pthread_mutex_lock(&priv->mutex);
-    } else {
-        ret = io_connect(priv->target, &connfd);
-        if (ret) return ret;
-    }
-
-    io_begin(connfd, _io_get, key, NULL);
-
-    if (sizeof(_duration) != recv(connfd, &_duration, sizeof(_duration), 0)) {
-        ret = EIO;
-        goto exit;
-    }
+    if ((ret = recv_full(connfd, &_duration, sizeof(_duration), deadline))) return ret;
     logfD(logFmtHead logFmtKey " <<<%d recv duration %ld", key, connfd, _duration);
 
-    if (sizeof(value_head) != recv(connfd, &value_head, sizeof(value_head), 0)) {
-        ret = EIO;
-        goto exit;
-    }
+    if ((ret = recv_full(connfd, &value_head, sizeof(value_head), deadline))) return ret;
     logfD(logFmtHead logFmtKey " <<<%d recv header of value with type %d", key, connfd, value_head.type);
 
     _value = malloc(sizeof(value_t) + value_head.length);
-    if (!_value) {
-        ret = errno;
-        goto exit;
-    }
+    if (!_value) return errno;
     memcpy(_value, &value_head, sizeof(value_t));
 
-    if (_value->length != recv(connfd, _value->data, _value->length, 0)) {
-        ret = EIO;
-        goto exit;
-    }
+    if ((ret = recv_full(connfd, _value->data, _value->length, deadline))) goto exit;
     logfD(logFmtHead logFmtKey " <<<%d recv data of value with length %d", key, connfd, _value->length);
 
-    ret = io_end(connfd, key);
-    if (ret) {
-        goto exit;
-    }
+    if ((ret = recv_full(connfd, result, sizeof(*result), deadline))) goto exit;
+    logfD(logFmtHead logFmtKey " <<<%d recv result" logFmtRet, key, connfd, *result);
 
-    if (priv->shared) {
-        pthread_mutex_unlock(&priv->mutex);
-    } else {
-        io_disconnect(connfd);
+    if (*result) {
+        free(_value);
+        return 0;
     }
     *value    = _value;
     *duration = _duration;
     return 0;
 
 exit:
-    unix_stream_discard(connfd);
-    if (priv->shared) {
+    free(_value);
+    return ret;
+}
+
+/**
+ * @brief 获取一个连接：shared时持有priv->mutex（连接已断开时重连），否则建立临时连接
+ */
+static int conn_acquire(priv_t *priv, int *connfd) {
+    int ret = 0;
+
+    if (!priv->shared) return io_connect(priv->target, connfd);
+
+    pthread_mutex_lock(&priv->mutex);
+    if (priv->connfd < 0 && (ret = io_connect(priv->target, &priv->connfd))) {
         pthread_mutex_unlock(&priv->mutex);
-    } else {
+        return ret;
+    }
+    *connfd = priv->connfd;
+    return 0;
+}
+
+/**
+ * @brief 归还conn_acquire获取的连接
+ *
+ * @param error 连接上的错误。非0时连接中剩余的数据已不可信，shared时断开，由下次conn_acquire重连
+ */
+static void conn_release(priv_t *priv, int connfd, int error) {
+    if (!priv->shared) {
         io_disconnect(connfd);
+        return;
     }
-    free(_value);
-    return ret;
+    if (error) {
+        logfW(logFmtHead "connection %d to %s is broken" logFmtErrno, connfd, priv->target, logArgErrno_(error));
+        io_disconnect(connfd);
+        priv->connfd = -1;
+    }
+    pthread_mutex_unlock(&priv->mutex);
 }
 
-static int set(priv_t *priv, const char *key, const value_t *value) {
-    int ret    = 0;
+static int get(priv_t *priv, const char *key, const value_t **value, timestamp_t *duration) {
+    int result = 0;
     int connfd = -1;
+    int ret    = conn_acquire(priv, &connfd);
+    if (ret) return ret;
 
-    if (priv->shared) {
-        connfd = priv->connfd;
-        pthread_mutex_lock(&priv->mutex);
-    } else {
-        ret = io_connect(priv->target, &connfd);
-        if (ret) return ret;
+    timestamp_t deadline = io_deadline();
+    if (!(ret = io_begin(connfd, _io_get, key, NULL, deadline))) {
+        ret = recv_get_reply(connfd, key, value, duration, &result, deadline);
+    }
+
+    conn_release(priv, connfd, ret);
+    return ret ? ret : result;
+}
+
+/**
+ * @brief 断开异步连接，并以error完成所有等待中的请求
+ */
+static void async_reset(struct async *async, int error) {
+    struct pending_list fifo = TAILQ_HEAD_INITIALIZER(fifo);
+    struct pending     *pending;
+
+    pthread_mutex_lock(&async->mutex);
+    if (async->connfd >= 0) {
+        epoll_ctl(async->epfd, EPOLL_CTL_DEL, async->connfd, NULL);
+        io_disconnect(async->connfd);
+        async->connfd = -1;
+    }
+    TAILQ_CONCAT(&fifo, &async->fifo, entry);
+    pthread_mutex_unlock(&async->mutex);
+
+    while ((pending = TAILQ_FIRST(&fifo))) {
+        TAILQ_REMOVE(&fifo, pending, entry);
+        pending->done(pending->arg, error, NULL, 0);
+        free(pending);
     }
+}
+
+static int async_complete(int connfd, struct pending *pending) {
+    const value_t *value    = NULL;
+    timestamp_t    duration = 0;
+    int            result   = 0;
 
-    io_begin(connfd, _io_set, key, value);
-    ret = io_end(connfd, key);
+    int ret = recv_get_reply(connfd, pending->key, &value, &duration, &result, pending->deadline);
+    pending->done(pending->arg, ret ? ret : result, value, duration);
+    free(pending);
+    return ret;
+}
+
+/**
+ * @brief 距离最早的deadline的时间
+ *
+ * @return int epoll_wait的timeout（unit: ms, -1 means infinite）
+ */
+static int async_timeout(struct async *async) {
+    timestamp_t     deadline = 0;
+    struct pending *pending;
+
+    pthread_mutex_lock(&async->mutex);
+    if ((pending = TAILQ_FIRST(&async->fifo))) deadline = pending->deadline;
+    TAILQ_FOREACH(pending, &async->temps, entry) {
+        if (pending->deadline && (!deadline || pending->deadline < deadline)) deadline = pending->deadline;
+    }
+    pthread_mutex_unlock(&async->mutex);
+
+    if (!deadline) return -1;
+    timestamp_t remain = deadline - timestamp(true);
+    return remain > 0 ? timestamp_to_ms(remain) + 1 : 0;
+}
+
+/**
+ * @brief 以ETIMEDOUT完成超过deadline的请求（shared时，队首超时意味着整个连接不可用）
+ */
+static void async_expire(struct async *async) {
+    struct pending_list expired = TAILQ_HEAD_INITIALIZER(expired);
+    struct pending     *pending, *next;
+    timestamp_t         now        = timestamp(true);
+    bool                fifo_stuck = false;
+
+    pthread_mutex_lock(&async->mutex);
+    pending    = TAILQ_FIRST(&async->fifo);
+    fifo_stuck = pending && pending->deadline && pending->deadline <= now;
+    for (pending = TAILQ_FIRST(&async->temps); pending; pending = next) {
+        next = TAILQ_NEXT(pending, entry);
+        if (!pending->deadline || pending->deadline > now) continue;
+        TAILQ_REMOVE(&async->temps, pending, entry);
+        epoll_ctl(async->epfd, EPOLL_CTL_DEL, pending->connfd, NULL);
+        TAILQ_INSERT_TAIL(&expired, pending, entry);
+    }
+    pthread_mutex_unlock(&async->mutex);
+
+    while ((pending = TAILQ_FIRST(&expired))) {
+        TAILQ_REMOVE(&expired, pending, entry);
+        logfW(logFmtHead logFmtKey " <<<%d timeout", pending->key, pending->connfd);
+        io_disconnect(pending->connfd);
+        pending->done(pending->arg, ETIMEDOUT, NULL, 0);
+        free(pending);
+    }
+    if (fifo_stuck) {
+        logfW(logFmtHead "async connection %d timeout", async->connfd);
+        async_reset(async, ETIMEDOUT);
+    }
+}
+
+static void *async_reader(struct async *async) {
+    struct epoll_event events[16];
+
+    for (;;) {
+        int n = epoll_wait(async->epfd, events, sizeof(events) / sizeof(events[0]), async_timeout(async));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            logfE(logFmtHead "fail to epoll_wait" logFmtErrno, logArgErrno);
+            break;
+        }
+
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        for (int i = 0; i < n; i++) {
+            struct pending *pending = events[i].data.ptr;
+
+            if (pending == (void *)async) {
+                uint64_t count;
+                ssize_t  n __attribute__((unused)) = read(async->evfd, &count, sizeof(count));
+                continue;
+            }
+            if (pending) { /* not shared */
+                pthread_mutex_lock(&async->mutex);
+                TAILQ_REMOVE(&async->temps, pending, entry);
+                pthread_mutex_unlock(&async->mutex);
+                epoll_ctl(async->epfd, EPOLL_CTL_DEL, pending->connfd, NULL);
+                int connfd = pending->connfd;
+                async_complete(connfd, pending);
+                io_disconnect(connfd);
+                continue;
+            }
+
+            pthread_mutex_lock(&async->mutex);
+            pending = TAILQ_FIRST(&async->fifo);
+            if (pending) TAILQ_REMOVE(&async->fifo, pending, entry);
+            pthread_mutex_unlock(&async->mutex);
+            if (!pending || async_complete(async->connfd, pending)) {
+                logfW(logFmtHead "async connection %d is broken", async->connfd);
+                async_reset(async, EIO);
+            }
+        }
+        async_expire(async);
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    }
+    return NULL;
+}
+
+static int async_start(priv_t *priv) {
+    int ret = 0;
+
+    pthread_mutex_lock(&priv->async_mutex);
+    if (priv->async) goto exit;
+
+    struct async *async = calloc(1, sizeof(struct async));
+    if (!async) {
+        ret = errno;
+        goto exit;
+    }
+    async->connfd = -1;
+    TAILQ_INIT(&async->fifo);
+    TAILQ_INIT(&async->temps);
+    pthread_mutex_init(&async->mutex, NULL);
+    async->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (async->epfd < 0) {
+        ret = errno;
+        logfE(logFmtHead "fail to epoll_create" logFmtErrno, logArgErrno);
+        free(async);
+        goto exit;
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = async};
+    async->evfd           = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (async->evfd < 0 || epoll_ctl(async->epfd, EPOLL_CTL_ADD, async->evfd, &ev)) {
+        ret = errno;
+        logfE(logFmtHead "fail to create eventfd" logFmtErrno, logArgErrno);
+        if (async->evfd >= 0) close(async->evfd);
+        close(async->epfd);
+        free(async);
+        goto exit;
+    }
+    ret = pthread_create(&async->tid, NULL, (void *(*)(void *))async_reader, async);
+    if (ret) {
+        logfE(logFmtHead "fail to pthread_create" logFmtRet, ret);
+        close(async->evfd);
+        close(async->epfd);
+        free(async);
+        goto exit;
+    }
+    priv->async = async;
+    logfV(logFmtHead "start async reader for %s", priv->target);
+
+exit:
+    pthread_mutex_unlock(&priv->async_mutex);
+    return ret;
+}
+
+static void async_stop(struct async *async) {
+    struct pending *pending;
+
+    if (!async) return;
+    pthread_cancel(async->tid);
+    pthread_join(async->tid, NULL);
+    async_reset(async, EIO);
+    while ((pending = TAILQ_FIRST(&async->temps))) {
+        TAILQ_REMOVE(&async->temps, pending, entry);
+        io_disconnect(pending->connfd);
+        pending->done(pending->arg, EIO, NULL, 0);
+        free(pending);
+    }
+    close(async->evfd);
+    close(async->epfd);
+    pthread_mutex_destroy(&async->mutex);
+    free(async);
+}
+
+/**
+ * @brief 发出请求后立即返回，由async_reader在应答到达或超过deadline时完成
+ *
+ * shared时使用一个独立的连接，并依次发出请求（IO server按顺序应答）；否则每个请求使用一个临时连接
+ */
+static int get_async(priv_t *priv, const char *key, storage_done_t done, void *arg) {
+    int                ret = async_start(priv);
+    struct epoll_event ev  = {.events = EPOLLIN};
+    if (ret) return ret;
+
+    struct async   *async   = priv->async;
+    struct pending *pending = malloc(sizeof(struct pending) + strlen(key) + 1);
+    if (!pending) return errno;
+    pending->connfd   = -1;
+    pending->deadline = io_deadline();
+    pending->done     = done;
+    pending->arg      = arg;
+    strcpy(pending->key, key);
 
     if (priv->shared) {
-        pthread_mutex_unlock(&priv->mutex);
+        pthread_mutex_lock(&async->mutex);
+        if (async->connfd < 0) {
+            ret = io_connect(priv->target, &async->connfd);
+            if (!ret && epoll_ctl(async->epfd, EPOLL_CTL_ADD, async->connfd, &ev)) {
+                ret = errno;
+                io_disconnect(async->connfd);
+                async->connfd = -1;
+            }
+        }
+        /* 先发送再入队：应答在入队前到达时，async_reader会等待async->mutex */
+        if (!ret && !(ret = io_begin(async->connfd, _io_get, key, NULL, pending->deadline))) {
+            TAILQ_INSERT_TAIL(&async->fifo, pending, entry);
+        }
+        pthread_mutex_unlock(&async->mutex);
+        if (ret && ret != ENXIO) async_reset(async, ret);
     } else {
-        io_disconnect(connfd);
+        ret = io_connect(priv->target, &pending->connfd);
+        if (!ret && !(ret = io_begin(pending->connfd, _io_get, key, NULL, pending->deadline))) {
+            ev.data.ptr = pending;
+            pthread_mutex_lock(&async->mutex);
+            TAILQ_INSERT_TAIL(&async->temps, pending, entry);
+            if (epoll_ctl(async->epfd, EPOLL_CTL_ADD, pending->connfd, &ev)) {
+                ret = errno;
+                TAILQ_REMOVE(&async->temps, pending, entry);
+            }
+            pthread_mutex_unlock(&async->mutex);
+        }
+        if (ret && pending->connfd >= 0) io_disconnect(pending->connfd);
     }
-    return ret;
+
+    if (ret) {
+        free(pending);
+        return ret;
+    }
+    if (g_io_timeout) { /* pending可能已被完成，不能再访问 */
+        uint64_t one                       = 1;
+        ssize_t  n __attribute__((unused)) = write(async->evfd, &one, sizeof(one));
+    }
+    return 0;
+}
+
+static int set(priv_t *priv, const char *key, const value_t *value) {
+    int result = 0;
+    int connfd = -1;
+    int ret    = conn_acquire(priv, &connfd);
+    if (ret) return ret;
+
+    timestamp_t deadline = io_deadline();
+    if (!(ret = io_begin(connfd, _io_set, key, value, deadline))) ret = io_end(connfd, key, &result, deadline);
+
+    conn_release(priv, connfd, ret);
+    return ret ? ret : result;
 }
 
 static int del(priv_t *priv, const char *key) {
-    int ret    = 0;
+    int result = 0;
     int connfd = -1;
+    int ret    = conn_acquire(priv, &connfd);
+    if (ret) return ret;
 
-    if (priv->shared) {
-        connfd = priv->connfd;
-        pthread_mutex_lock(&priv->mutex);
-    } else {
-        ret = io_connect(priv->target, &connfd);
-        if (ret) return ret;
+    timestamp_t deadline = io_deadline();
+    if (!(ret = io_begin(connfd, _io_del, key, NULL, deadline))) ret = io_end(connfd, key, &result, deadline);
+
+    conn_release(priv, connfd, ret);
+    return ret ? ret : result;
+}
+
+/**
+ * @return int errno，连接上的错误；对端的结果通过result返回
+ */
+static int batch_chunk(int connfd, io_type_t type, int num, const char *const keys[], const value_t *const in[],
+                       const value_t *out[], timestamp_t durations[], int results[], int *result,
+                       timestamp_t deadline) {
+    int          ret      = 0;
+    io_package_t pkg_head = {.type = type, .created = timestamp(true)};
+
+    trace_inject(&pkg_head.trace);
+    pkg_head.value.type   = _value_undef;
+    pkg_head.value.length = num;
+    if ((ret = send_full(connfd, &pkg_head, sizeof(pkg_head), deadline))) return ret;
+    logfD(logFmtHead ">>>%d send header of batch with type %d and %d keys", connfd, type, num);
+
+    for (int i = 0; i < num; i++) {
+        char key[NAME_MAX] = {0};
+        strncpy(key, keys[i], sizeof(key) - 1);
+        if ((ret = send_full(connfd, key, sizeof(key), deadline))) return ret;
+        if (type == _io_mset && (ret = send_full(connfd, in[i], sizeof(value_t) + in[i]->length, deadline))) return ret;
     }
 
-    io_begin(connfd, _io_del, key, NULL);
-    ret = io_end(connfd, key);
+    for (int i = 0; i < num; i++) {
+        if (type == _io_mget) {
+            value_t value_head;
+
+            if ((ret = recv_full(connfd, &durations[i], sizeof(durations[i]), deadline))) return ret;
+            if ((ret = recv_full(connfd, &value_head, sizeof(value_head), deadline))) return ret;
+            value_t *value = malloc(sizeof(value_t) + value_head.length);
+            if (!value) return ENOMEM;
+            memcpy(value, &value_head, sizeof(value_t));
+            out[i] = value;
+            if ((ret = recv_full(connfd, value->data, value->length, deadline))) return ret;
+        }
+        if ((ret = recv_full(connfd, &results[i], sizeof(results[i]), deadline))) return ret;
+        logfD(logFmtHead logFmtKey " <<<%d recv result in batch" logFmtRet, keys[i], connfd, results[i]);
+        if (type == _io_mget && results[i]) {
+            free((void *)out[i]);
+            out[i] = NULL;
+        }
+    }
 
-    if (priv->shared) {
-        pthread_mutex_unlock(&priv->mutex);
-    } else {
-        io_disconnect(connfd);
+    return io_end(connfd, keys[0], result, deadline);
+}
+
+/**
+ * @brief 按 IO_BATCH_MAX 分块，每块作为一个批量请求下发
+ */
+static int batch(priv_t *priv, io_type_t type, int num, const char *const keys[], const value_t *const in[],
+                 const value_t *out[], timestamp_t durations[], int results[]) {
+    int result = 0;
+    int connfd = -1;
+    int ret    = conn_acquire(priv, &connfd);
+    if (ret) return ret;
+
+    timestamp_t deadline = io_deadline();
+    for (int i = 0; i < num && !ret && !result; i += IO_BATCH_MAX) {
+        int chunk = num - i < IO_BATCH_MAX ? num - i : IO_BATCH_MAX;
+        ret       = batch_chunk(connfd, type, chunk, &keys[i], in ? &in[i] : NULL, out ? &out[i] : NULL,
+                                durations ? &durations[i] : NULL, &results[i], &result, deadline);
     }
+
+    conn_release(priv, connfd, ret);
+    return ret ? ret : result;
+}
+
+static int mget(priv_t *priv, int num, const char *const keys[], const value_t *values[], timestamp_t durations[],
+                int results[]) {
+    return batch(priv, _io_mget, num, keys, NULL, values, durations, results);
+}
+
+static int mset(priv_t *priv, int num, const char *const keys[], const value_t *const values[], int results[]) {
+    return batch(priv, _io_mset, num, keys, values, NULL, NULL, results);
+}
+
+static int mdel(priv_t *priv, int num, const char *const keys[], int results[]) {
+    return batch(priv, _io_mdel, num, keys, NULL, NULL, NULL, results);
+}
+
+static int scan(priv_t *priv, const char *prefix, const char *cursor, int limit, storage_entry_t entries[], int *num) {
+    int result = 0;
+    int connfd = -1;
+    struct {
+        value_t   head;
+        io_scan_t req;
+    } __attribute__((packed)) body = {
+        .head = {.type = _value_data, .length = sizeof(io_scan_t)},
+        .req  = {.limit = limit},
+    };
+    snprintf(body.req.cursor, sizeof(body.req.cursor), "%s", cursor);
+
+    int ret = conn_acquire(priv, &connfd);
+    if (ret) return ret;
+
+    timestamp_t deadline = io_deadline();
+    ret                  = io_begin(connfd, _io_scan, prefix, &body.head, deadline);
+    while (!ret) {
+        char        key[NAME_MAX];
+        timestamp_t duration;
+        int         _result = 0;
+
+        if ((ret = recv_full(connfd, key, sizeof(key), deadline))) break;
+        if (!key[0]) break;
+        key[NAME_MAX - 1] = '\0';
+        if (*num >= limit) {
+            ret = EPROTO;
+            break;
+        }
+
+        storage_entry_t *entry = &entries[*num];
+        ret                    = recv_get_reply(connfd, key, &entry->value, &duration, &_result, deadline);
+        if (ret || _result) continue;
+        snprintf(entry->key, sizeof(entry->key), "%s", key);
+        entry->duration = duration;
+        (*num)++;
+    }
+    if (!ret) ret = io_end(connfd, prefix, &result, deadline);
+
+    conn_release(priv, connfd, ret);
+    if (!ret) ret = result;
+    if (ret) storage_entries_free(entries, *num);
     return ret;
 }
 
 static void destructor(priv_t *priv) {
+    async_stop(priv->async);
+    pthread_mutex_destroy(&priv->async_mutex);
     if (priv->shared) {
-        io_disconnect(priv->connfd);
+        if (priv->connfd >= 0) io_disconnect(priv->connfd);
         pthread_mutex_destroy(&priv->mutex);
-    } else {
-        free((void *)priv->target);
     }
+    free((void *)priv->target);
     free(priv);
 }
 
@@ -273,28 +755,35 @@ int constructor_unix(storage_ctx_t *ctx, const char *name, bool shared) {
         return errno;
     }
     priv->shared = shared;
+    priv->async  = NULL;
+    if (!(priv->target = strdup(name))) {
+        logfE(logFmtHead "fail to allocate target" logFmtErrno, logArgErrno);
+        free(priv);
+        free((void *)ctx->name);
+        return errno;
+    }
 
     if (shared) {
         pthread_mutex_init(&priv->mutex, NULL);
         int ret = io_connect(name, &priv->connfd);
         if (ret) {
+            free((void *)priv->target);
             free(priv);
             free((void *)ctx->name);
             return ret;
         }
-    } else {
-        if (!(priv->target = strdup(name))) {
-            logfE(logFmtHead "fail to allocate target" logFmtErrno, logArgErrno);
-            free(priv);
-            free((void *)ctx->name);
-            return errno;
-        }
     }
+    pthread_mutex_init(&priv->async_mutex, NULL);
 
     ctx->priv       = priv;
     ctx->get        = (typeof(ctx->get))get;
     ctx->set        = (typeof(ctx->set))set;
     ctx->del        = (typeof(ctx->del))del;
+    ctx->mget       = (typeof(ctx->mget))mget;
+    ctx->mset       = (typeof(ctx->mset))mset;
+    ctx->mdel       = (typeof(ctx->mdel))mdel;
+    ctx->get_async  = (typeof(ctx->get_async))get_async;
+    ctx->scan       = (typeof(ctx->scan))scan;
     ctx->destructor = (typeof(ctx->destructor))destructor;
     return 0;
 }
@@ -31,6 +31,8 @@
 #include "cache.h"
 #include "global.h"
 #include "infra/tree.h"
+#include "metrics.h"
+#include "misc.h"
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -45,15 +47,20 @@ struct cache_item {
 };
 typedef struct cache_item cache_item_t;
 
-struct cache {
+struct cache_shard {
     RB_HEAD(cache_tree, cache_item) tree;
-    timestamp_t      min_interval;
-    timestamp_t      max_interval;
-    timestamp_t      default_duration;
-    timestamp_t      min_duration;
     pthread_rwlock_t rwlock;
-    sem_t            clean_notice;
-    pthread_t        cleaner;
+};
+
+struct cache {
+    timestamp_t         min_interval;
+    timestamp_t         max_interval;
+    timestamp_t         default_duration;
+    timestamp_t         min_duration;
+    unsigned short      num_shards;
+    struct cache_shard *shards;
+    sem_t               clean_notice;
+    pthread_t           cleaner;
 };
 typedef struct cache cache_t;
 
@@ -93,6 +100,10 @@ exit:
     return NULL;
 }
 
+static inline struct cache_shard *shard_of(cache_t *cache, const char *key) {
+    return &cache->shards[cache->num_shards > 1 ? hash_cstring(key) % cache->num_shards : 0];
+}
+
 #define duration_is_outdate(item, now) (item)->duration != DURATION_INF && (item)->modified + (item)->duration <= (now)
 
 const char *duration_fmt(char *buffer, size_t length, timestamp_t duration) {
@@ -118,52 +129,86 @@ static void *cache_cleaner(void *_arg) {
             }
         }
 
-        pthread_rwlock_wrlock(&cache->rwlock);
-        cache_item_t *item, *temp;
         last = timestamp(true);
-        RB_FOREACH_SAFE(item, cache_tree, &cache->tree, temp) {
-            if (duration_is_outdate(item, last)) {
-                logfV("[cache::cleaner] clean " logFmtKey, item->key);
-                RB_REMOVE(cache_tree, &cache->tree, item);
-                item_destroy(item);
+        for (int i = 0; i < cache->num_shards; i++) {
+            struct cache_shard *shard = &cache->shards[i];
+            cache_item_t       *item, *temp;
+
+            pthread_rwlock_wrlock(&shard->rwlock);
+            RB_FOREACH_SAFE(item, cache_tree, &shard->tree, temp) {
+                if (duration_is_outdate(item, last)) {
+                    logfV("[cache::cleaner] clean " logFmtKey, item->key);
+                    RB_REMOVE(cache_tree, &shard->tree, item);
+                    item_destroy(item);
+                    metrics_count(_counter_cache_evicted, 1);
+                }
             }
+            pthread_rwlock_unlock(&shard->rwlock);
         }
-        pthread_rwlock_unlock(&cache->rwlock);
     }
     return NULL;
 }
 
 void *cache_create(timestamp_t min_interval, timestamp_t max_interval, timestamp_t default_duration,
-                   timestamp_t min_duration) {
+                   timestamp_t min_duration, unsigned short shards) {
     cache_t *cache = (cache_t *)calloc(1, sizeof(cache_t));
     if (!cache) return NULL;
     int ret = 0;
 
-    RB_INIT(&cache->tree);
+    if (!shards) shards = 1;
+    cache->shards = (struct cache_shard *)calloc(shards, sizeof(struct cache_shard));
+    if (!cache->shards) {
+        free(cache);
+        return NULL;
+    }
     cache->min_interval     = min_interval;
     cache->max_interval     = max_interval;
     cache->default_duration = default_duration;
     cache->min_duration     = min_duration;
 
-    ret = pthread_rwlock_init(&cache->rwlock, NULL);
-    if (ret) {
-        logfE("[cache] fail to pthread_rwlock_init" logFmtRet, ret);
-        free(cache);
-        errno = ret;
-        return NULL;
+    for (; cache->num_shards < shards; cache->num_shards++) {
+        struct cache_shard *shard = &cache->shards[cache->num_shards];
+        RB_INIT(&shard->tree);
+        ret = pthread_rwlock_init(&shard->rwlock, NULL);
+        if (ret) {
+            logfE("[cache] fail to pthread_rwlock_init" logFmtRet, ret);
+            goto exit;
+        }
     }
     sem_init(&cache->clean_notice, 0, 0);
     ret = pthread_create(&cache->cleaner, NULL, cache_cleaner, (void *)cache);
     if (ret) {
         logfE("[cache] fail to pthread_create" logFmtRet, ret);
         sem_destroy(&cache->clean_notice);
-        pthread_rwlock_destroy(&cache->rwlock);
-        free(cache);
-        errno = ret;
-        return NULL;
+        goto exit;
     }
-    logfI("[cache] created");
+    logfI("[cache] created with %d shards", shards);
     return cache;
+
+exit:
+    for (int i = 0; i < cache->num_shards; i++)
+        pthread_rwlock_destroy(&cache->shards[i].rwlock);
+    free(cache->shards);
+    free(cache);
+    errno = ret;
+    return NULL;
+}
+
+void cache_clear(void *_cache) {
+    cache_t *cache = _cache;
+
+    for (int i = 0; i < cache->num_shards; i++) {
+        struct cache_shard *shard = &cache->shards[i];
+        cache_item_t       *item, *temp;
+
+        pthread_rwlock_wrlock(&shard->rwlock);
+        RB_FOREACH_SAFE(item, cache_tree, &shard->tree, temp) {
+            RB_REMOVE(cache_tree, &shard->tree, item);
+            item_destroy(item);
+        }
+        pthread_rwlock_unlock(&shard->rwlock);
+    }
+    logfV("[cache] clear");
 }
 
 void cache_destroy(void *_cache) {
@@ -175,30 +220,44 @@ void cache_destroy(void *_cache) {
 
     sem_destroy(&cache->clean_notice);
 
-    pthread_rwlock_wrlock(&cache->rwlock);
-    cache_item_t *item, *temp;
-    RB_FOREACH_SAFE(item, cache_tree, &cache->tree, temp) {
-        RB_REMOVE(cache_tree, &cache->tree, item);
-        item_destroy(item);
-    }
-    pthread_rwlock_unlock(&cache->rwlock);
-
-    pthread_rwlock_destroy(&cache->rwlock);
+    cache_clear(cache);
+    for (int i = 0; i < cache->num_shards; i++)
+        pthread_rwlock_destroy(&cache->shards[i].rwlock);
+    free(cache->shards);
     free(cache);
     logfI("[cache] destroyed");
 }
 
-int cache_get(void *_cache, const char *key, const value_t **value, timestamp_t *duration) {
-    cache_t      *cache  = _cache;
+int cache_set_affinity(void *_cache, const unsigned short *cpus, unsigned short num) {
+    cache_t *cache = _cache;
+    return thread_bind_cpulist(cache->cleaner, cpus, num);
+}
+
+static timestamp_t item_remain(const cache_t *cache, const cache_item_t *item, timestamp_t now) {
+    timestamp_t remain = item->duration;
+    if (remain != DURATION_INF) {
+        timestamp_t _remain = item->duration - (now - item->modified);
+        remain              = _remain < cache->min_duration ? cache->min_duration : _remain;
+    }
+    return remain;
+}
+
+/**
+ * @brief value为NULL时将值复制到*buffer（容量为*size字节，不足时重新分配），否则复制到新分配的内存中
+ */
+static int item_get(cache_t *cache, const char *key, const value_t **value, value_t **buffer, uint32_t *size,
+                    timestamp_t *duration) {
     int           ret    = 0;
     cache_item_t *item   = NULL;
     cache_item_t  shadow = {.key = key};
 
-    pthread_rwlock_rdlock(&cache->rwlock);
+    struct cache_shard *shard = shard_of(cache, key);
+    pthread_rwlock_rdlock(&shard->rwlock);
 
-    item = RB_FIND(cache_tree, &cache->tree, &shadow);
+    item = RB_FIND(cache_tree, &shard->tree, &shadow);
     if (!item) {
         logfD("[cache] get " logFmtKey " but not found", key);
+        metrics_count(_counter_cache_miss, 1);
         ret = ENOENT;
         goto exit;
     }
@@ -206,31 +265,113 @@ int cache_get(void *_cache, const char *key, const value_t **value, timestamp_t
     if (duration_is_outdate(item, now)) {
         logfD("[cache] get " logFmtKey " but out of date, notice cleaner", key);
         sem_post(&cache->clean_notice);
+        metrics_count(_counter_cache_expired, 1);
         ret = ENOENT;
         goto exit;
     }
 
-    *value = value_dup(item->value);
-    if (!*value) {
-        logfE("[cache] get " logFmtKey " but fail to allocate value" logFmtErrno, key, logArgErrno);
-        ret = errno;
-        goto exit;
+    const value_t *_value = NULL;
+    if (value) {
+        *value = _value = value_dup(item->value);
+        if (!_value) {
+            logfE("[cache] get " logFmtKey " but fail to allocate value" logFmtErrno, key, logArgErrno);
+            ret = errno;
+            goto exit;
+        }
+    } else {
+        uint32_t need = sizeof(value_t) + item->value->length;
+        if (*size < need) {
+            value_t *_buffer = realloc(*buffer, need);
+            if (!_buffer) {
+                logfE("[cache] get " logFmtKey " but fail to allocate buffer" logFmtErrno, key, logArgErrno);
+                ret = errno;
+                goto exit;
+            }
+            *buffer = _buffer;
+            *size   = need;
+        }
+        memcpy(*buffer, item->value, need);
+        _value = *buffer;
     }
 
-    timestamp_t remain = item->duration;
-    if (remain != DURATION_INF) {
-        timestamp_t _remain = item->duration - (now - item->modified);
-        remain              = _remain < cache->min_duration ? cache->min_duration : _remain;
-    }
-    *duration = remain;
+    timestamp_t remain = item_remain(cache, item, now);
+    *duration          = remain;
+    metrics_count(_counter_cache_hit, 1);
 
-    char buffer[256] = {0};
-    char buffer1[32] = {0};
-    logfV("[cache] get " logFmtKey " is " logFmtValue " with duration %s", key,
-          value_fmt(buffer, sizeof(buffer), *value, false), duration_fmt(buffer1, sizeof(buffer1), remain));
+    if (logEnabled(MLOG_VERB)) {
+        char buffer0[256];
+        char buffer1[32];
+        logfV("[cache] get " logFmtKey " is " logFmtValue " with duration %s", key,
+              value_fmt(buffer0, sizeof(buffer0), _value, false), duration_fmt(buffer1, sizeof(buffer1), remain));
+    }
 
 exit:
-    pthread_rwlock_unlock(&cache->rwlock);
+    pthread_rwlock_unlock(&shard->rwlock);
+    return ret;
+}
+
+int cache_get(void *cache, const char *key, const value_t **value, timestamp_t *duration) {
+    return item_get(cache, key, value, NULL, NULL, duration);
+}
+
+int cache_get_buf(void *cache, const char *key, value_t **value, uint32_t *size, timestamp_t *duration) {
+    return item_get(cache, key, NULL, value, size, duration);
+}
+
+/**
+ * @brief 从大于cursor（且不小于prefix）的第一个key开始
+ */
+static cache_item_t *scan_first(struct cache_shard *shard, const char *prefix, const char *cursor) {
+    bool          after  = strcmp(cursor, prefix) >= 0;
+    cache_item_t  shadow = {.key = after ? cursor : prefix};
+    cache_item_t *item   = RB_NFIND(cache_tree, &shard->tree, &shadow);
+    if (item && after && !strcmp(item->key, cursor)) item = RB_NEXT(cache_tree, &shard->tree, item);
+    return item;
+}
+
+int cache_scan(void *_cache, const char *prefix, const char *cursor, int limit, storage_entry_t entries[], int *num) {
+    cache_t      *cache = _cache;
+    int           ret   = 0;
+    cache_item_t *heads[cache->num_shards];
+    size_t        prefix_len = strlen(prefix);
+    timestamp_t   now        = timestamp(true);
+
+    *num = 0;
+    for (int i = 0; i < cache->num_shards; i++) {
+        pthread_rwlock_rdlock(&cache->shards[i].rwlock);
+        heads[i] = scan_first(&cache->shards[i], prefix, cursor);
+    }
+
+    /* 各分片内有序，每次取各分片中最小的key */
+    while (*num < limit) {
+        int min = -1;
+        for (int i = 0; i < cache->num_shards; i++) {
+            if (heads[i] && strncmp(heads[i]->key, prefix, prefix_len)) heads[i] = NULL;
+            if (!heads[i]) continue;
+            if (min < 0 || strcmp(heads[i]->key, heads[min]->key) < 0) min = i;
+        }
+        if (min < 0) break;
+
+        cache_item_t *item = heads[min];
+        heads[min]         = RB_NEXT(cache_tree, &cache->shards[min].tree, item);
+        if (duration_is_outdate(item, now)) continue;
+
+        storage_entry_t *entry = &entries[*num];
+        if (!(entry->value = value_dup(item->value))) {
+            ret = errno;
+            logfE("[cache] scan " logFmtKey " but fail to allocate value" logFmtErrno, item->key, logArgErrno);
+            break;
+        }
+        snprintf(entry->key, sizeof(entry->key), "%s", item->key);
+        entry->duration = item_remain(cache, item, now);
+        (*num)++;
+    }
+
+    for (int i = cache->num_shards - 1; i >= 0; i--)
+        pthread_rwlock_unlock(&cache->shards[i].rwlock);
+
+    if (ret) storage_entries_free(entries, *num);
+    else logfV("[cache] scan " logFmtKey " after " logFmtKey " got %d keys", prefix, cursor, *num);
     return ret;
 }
 
@@ -245,9 +386,10 @@ int cache_set(void *_cache, const char *key, const value_t *value, timestamp_t d
     }
     int ret = 0;
 
-    pthread_rwlock_wrlock(&cache->rwlock);
+    struct cache_shard *shard = shard_of(cache, key);
+    pthread_rwlock_wrlock(&shard->rwlock);
 
-    cache_item_t *old_item = RB_INSERT(cache_tree, &cache->tree, item);
+    cache_item_t *old_item = RB_INSERT(cache_tree, &shard->tree, item);
     if (old_item) {
         item_destroy(item);
         free((void *)old_item->value);
@@ -261,13 +403,15 @@ int cache_set(void *_cache, const char *key, const value_t *value, timestamp_t d
         old_item->duration = _duration;
     }
 
-    char buffer[256] = {0};
-    char buffer1[32] = {0};
-    logfV("[cache] set " logFmtKey " as " logFmtValue " with duration %s", key,
-          value_fmt(buffer, sizeof(buffer), value, false), duration_fmt(buffer1, sizeof(buffer1), _duration));
+    if (logEnabled(MLOG_VERB)) {
+        char buffer[256];
+        char buffer1[32];
+        logfV("[cache] set " logFmtKey " as " logFmtValue " with duration %s", key,
+              value_fmt(buffer, sizeof(buffer), value, false), duration_fmt(buffer1, sizeof(buffer1), _duration));
+    }
 
 exit:
-    pthread_rwlock_unlock(&cache->rwlock);
+    pthread_rwlock_unlock(&shard->rwlock);
     return ret;
 }
 
@@ -277,20 +421,21 @@ int cache_del(void *_cache, const char *key) {
     cache_item_t *item   = NULL;
     cache_item_t  shadow = {.key = key};
 
-    pthread_rwlock_wrlock(&cache->rwlock);
+    struct cache_shard *shard = shard_of(cache, key);
+    pthread_rwlock_wrlock(&shard->rwlock);
 
-    item = RB_FIND(cache_tree, &cache->tree, &shadow);
+    item = RB_FIND(cache_tree, &shard->tree, &shadow);
     if (!item) {
         logfD("[cache] del " logFmtKey " but not found", key);
         ret = ENOENT;
         goto exit;
     }
-    RB_REMOVE(cache_tree, &cache->tree, item);
+    RB_REMOVE(cache_tree, &shard->tree, item);
     item_destroy(item);
 
     logfV("[cache] del " logFmtKey, key);
 
 exit:
-    pthread_rwlock_unlock(&cache->rwlock);
+    pthread_rwlock_unlock(&shard->rwlock);
     return ret;
 }
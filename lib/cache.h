@@ -32,6 +32,7 @@
 #define __PROPD_CACHE_H
 
 #include "infra/timestamp.h"
+#include "storage.h"
 #include "value.h"
 #include <pthread.h>
 #include <semaphore.h>
@@ -48,16 +49,26 @@ const char *duration_fmt(char *buffer, size_t length, timestamp_t duration);
  * @param max_interval 长时间未主动触发过期回收时，将自动执行一次
  * @param default_duration 以下情况中，调整为该值：set时，若传入duration为0
  * @param min_duration 以下情况中，调整为该值：set时，若传入duration不为0且小于；get时，若剩余duration小于
+ * @param shards 按key的哈希值分片，各分片独立加锁（传入0时，等于1）
  * @return void* 缓存对象（On error, return NULL and set errno）
  */
 void *cache_create(timestamp_t min_interval, timestamp_t max_interval, timestamp_t default_duration,
-                   timestamp_t min_duration);
+                   timestamp_t min_duration, unsigned short shards);
 /**
  * @brief Release a cache
  *
  * @param cache 缓存对象（maybe NULL）
  */
 void cache_destroy(void *cache);
+/**
+ * @brief Bind the cleaner to a CPU list
+ *
+ * @param cache 缓存对象
+ * @param cpus
+ * @param num
+ * @return int errno
+ */
+int cache_set_affinity(void *cache, const unsigned short *cpus, unsigned short num);
 /**
  * @brief Get value (allocated) and duration of a key
  *
@@ -68,6 +79,29 @@ void cache_destroy(void *cache);
  * @return int errno (ENOENT ENOMEM)
  */
 int cache_get(void *cache, const char *key, const value_t **value, timestamp_t *duration);
+/**
+ * @brief Get value and duration of a key into caller's buffer (grow the buffer if it is too small)
+ *
+ * @param cache 缓存对象
+ * @param key
+ * @param value 调用者持有的buffer（*size为0时可以为NULL），容量不足时重新分配
+ * @param size *value的容量（字节，包括value_t）
+ * @param duration
+ * @return int errno (ENOENT ENOMEM)
+ */
+int cache_get_buf(void *cache, const char *key, value_t **value, uint32_t *size, timestamp_t *duration);
+/**
+ * @brief Scan keys with prefix in ascending order (ref. storage_scan)
+ *
+ * @param cache 缓存对象
+ * @param prefix
+ * @param cursor 从大于cursor的key开始（""表示从头开始）
+ * @param limit
+ * @param entries 至少limit个
+ * @param num 返回的数量
+ * @return int errno (ENOMEM)
+ */
+int cache_scan(void *cache, const char *prefix, const char *cursor, int limit, storage_entry_t entries[], int *num);
 /**
  * @brief Set a key with value (no ownership transfer) and duraion. Update if exist
  *
@@ -87,5 +121,10 @@ int cache_set(void *cache, const char *key, const value_t *value, timestamp_t du
  * @return int errno (ENOENT)
  */
 int cache_del(void *cache, const char *key);
+/**
+ * @brief Delete all keys
+ * @param cache 缓存对象
+ */
+void cache_clear(void *cache);
 
 #endif /* __PROPD_CACHE_H */
@@ -50,6 +50,7 @@ struct ctrl_context {
     struct sockaddr_un servaddr;
     size_t             package_length;
     ctrl_package_t    *package;
+    ctrl_type_t        type; /* package is released after sent */
 };
 typedef struct ctrl_context ctrl_context_t;
 
@@ -88,7 +89,8 @@ static int ctrl_init(ctrl_context_t *ctx, const char *server, size_t delta_lengt
 }
 
 static int ctrl_update(ctrl_context_t *ctx) {
-    int ret = 0;
+    int ret   = 0;
+    ctx->type = ctx->package->type;
     if ((ssize_t)ctx->package_length != sendto(ctx->sockfd, ctx->package, ctx->package_length, 0,
                                                (const struct sockaddr *)&ctx->servaddr, sizeof(struct sockaddr_un)))
         ret = EIO;
@@ -103,9 +105,11 @@ static int ctrl_final0(ctrl_context_t *ctx, void **data, int *data_length) {
     int     ret                       = 0;
     ssize_t n __attribute__((unused)) = 0;
 
-    switch (ctx->package->type) {
+    switch (ctx->type) {
     case _ctrl_dump_db_route:
-    case _ctrl_dump_db_cache: {
+    case _ctrl_dump_db_cache:
+    case _ctrl_stats:
+    case _ctrl_traces: {
         assert(data && data_length);
 
         int length = 0;
@@ -241,3 +245,15 @@ int ctrl_dump_db_cache(const char *server, void **db) {
     return ctrl_generic1(server, _ctrl_dump_db_cache, db, &db_length);
     /* TODO what's format of db? cstring or complex structure? */
 }
+
+int ctrl_stats(const char *server, void **stats, int *length) {
+    int ret = ctrl_generic1(server, _ctrl_stats, stats, length);
+    if (ret) logfE(logFmtHead "fail to get stats of <%s>" logFmtRet, server, ret);
+    return ret;
+}
+
+int ctrl_traces(const char *server, void **traces, int *length) {
+    int ret = ctrl_generic1(server, _ctrl_traces, traces, length);
+    if (ret) logfE(logFmtHead "fail to get traces of <%s>" logFmtRet, server, ret);
+    return ret;
+}
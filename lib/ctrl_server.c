@@ -33,9 +33,11 @@
 #include "global.h"
 #include "infra/thread_pool.h"
 #include "io.h"
+#include "metrics.h"
 #include "misc.h"
 #include "route.h"
 #include "storage.h"
+#include "trace.h"
 #include <assert.h>
 #include <errno.h>
 #include <pthread.h>
@@ -51,6 +53,7 @@
 #define logFmtHead "[server::ctrl] "
 
 struct worker_arg {
+    void                 *thread_pool;
     const io_ctx_t       *io_ctx;
     const char           *name;
     const char          **cache_now;
@@ -126,6 +129,30 @@ static int dump_db_cache(int sockfd, const struct sockaddr_un *cliaddr) {
     return ret;
 }
 
+/**
+ * @brief 依次发送长度和数据（ref. ctrl_final0）
+ *
+ * @param data own，为NULL时表示获取数据失败（errno），只发送长度0
+ * @return int errno
+ */
+static int send_data(const worker_arg_t *arg, void *data, int length) {
+    int ret = data ? 0 : errno;
+    if (!data) length = 0;
+
+    ssize_t n = sendto(arg->sockfd, &length, sizeof(length), 0, (const struct sockaddr *)&arg->cliaddr,
+                       sizeof(arg->cliaddr));
+    if (n != sizeof(length)) ret = EIO;
+    else if (length) {
+        n = sendto(arg->sockfd, data, length, 0, (const struct sockaddr *)&arg->cliaddr, sizeof(arg->cliaddr));
+        if (n != length) {
+            logfE(logFmtHead "fail to send data with length %d" logFmtErrno, length, logArgErrno);
+            ret = EIO;
+        }
+    }
+    free(data);
+    return ret;
+}
+
 static void worker_cleanup(worker_arg_t *arg) {
     logfD(logFmtHead "cleanup worker");
     free((void *)arg->package);
@@ -156,6 +183,16 @@ static int worker(worker_arg_t *arg) {
     case _ctrl_dump_db_cache: {
         ret = dump_db_cache(arg->sockfd, &arg->cliaddr);
     } break;
+    case _ctrl_stats: {
+        int   length = 0;
+        void *data   = metrics_snapshot(arg->io_ctx->route, arg->thread_pool, &length);
+        ret          = send_data(arg, data, length);
+    } break;
+    case _ctrl_traces: {
+        int   length = 0;
+        void *data   = trace_dump(&length);
+        ret          = send_data(arg, data, length);
+    } break;
     default:
         logfD(logFmtHead "unknown package type %d", arg->package->type);
         goto exit;
@@ -226,15 +263,24 @@ static void *server(ctx_t *ctx) {
         pthread_cleanup_pop(false);
         pthread_cleanup_pop(false);
 
-        arg->io_ctx    = ctx->io_ctx;
-        arg->name      = ctx->name;
-        arg->cache_now = ctx->cache_now;
-        arg->prefix    = ctx->prefix;
-        arg->package   = pkg; /* take ownership */
-        arg->sockfd    = ctx->sockfd;
-        arg->cliaddr   = cliaddr;
-
-        thread_pool_submit(ctx->thread_pool, (int (*)(void *))worker, arg, false);
+        arg->thread_pool = ctx->thread_pool;
+        arg->io_ctx      = ctx->io_ctx;
+        arg->name        = ctx->name;
+        arg->cache_now   = ctx->cache_now;
+        arg->prefix      = ctx->prefix;
+        arg->package     = pkg; /* take ownership */
+        arg->sockfd      = ctx->sockfd;
+        arg->cliaddr     = cliaddr;
+
+        if (thread_pool_try_submit(ctx->thread_pool, _prio_low, (int (*)(void *))worker, arg)) {
+            int result = EBUSY;
+
+            ssize_t n __attribute__((unused)) =
+                sendto(ctx->sockfd, &result, sizeof(result), 0, (const struct sockaddr *)&cliaddr, sizeof(cliaddr));
+            logfW(logFmtHead "shed package with type %d", pkg->type);
+            free(arg);
+            free(pkg);
+        }
     } while (true);
 
     pthread_cleanup_pop(true);
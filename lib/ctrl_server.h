@@ -44,6 +44,8 @@ enum ctrl_type {
     _ctrl_unregister_parent,  /* parent */
     _ctrl_dump_db_route,      /* - */
     _ctrl_dump_db_cache,      /* - */
+    _ctrl_stats,              /* - */
+    _ctrl_traces,             /* - */
 };
 typedef uint8_t ctrl_type_t;
 
@@ -115,6 +117,24 @@ int ctrl_dump_db_route(const char *server, void **db);
  * @return int errno
  */
 int ctrl_dump_db_cache(const char *server, void **db);
+/**
+ * @brief Get metrics of a server (ref. metrics_snapshot, metrics_render)
+ *
+ * @param server server节点名
+ * @param stats 返回编码后的metrics（allocated）
+ * @param length
+ * @return int errno
+ */
+int ctrl_stats(const char *server, void **stats, int *length);
+/**
+ * @brief Get recent traces of a server (ref. trace_dump, trace_render)
+ *
+ * @param server server节点名
+ * @param traces 返回编码后的追踪记录（allocated）
+ * @param length
+ * @return int errno
+ */
+int ctrl_traces(const char *server, void **traces, int *length);
 
 /* Server APIs */
 
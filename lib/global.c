@@ -31,7 +31,8 @@
 #include "global.h"
 #include <stdlib.h>
 
-const char *g_at = "/tmp";
+const char *g_at         = "/tmp";
+int         g_io_timeout = 3000;
 
 void __attribute__((constructor)) __propd_env_parse(void) {
     const char *namespace_s = getenv("propd_namespace");
@@ -40,4 +41,5 @@ void __attribute__((constructor)) __propd_env_parse(void) {
     }
 }
 
-mlogger_t g_logger;
+mlogger_t    g_logger;
+mlog_level_t g_loglevel = MLOG_DEBG;
@@ -35,15 +35,29 @@
 #include <errno.h>
 #include <string.h>
 
-extern mlogger_t g_logger;
+extern mlogger_t    g_logger;
+extern mlog_level_t g_loglevel; /* 高于该等级的日志不求值参数，直接跳过（最终由g_logger过滤） */
 
-#define logfE(fmt, ...) mlogf(&g_logger, MLOG_ERRO, fmt, ##__VA_ARGS__)
-#define logfW(fmt, ...) mlogf(&g_logger, MLOG_WARN, fmt, ##__VA_ARGS__)
-#define logfI(fmt, ...) mlogf(&g_logger, MLOG_INFO, fmt, ##__VA_ARGS__)
-#define logfV(fmt, ...) mlogf(&g_logger, MLOG_VERB, fmt, ##__VA_ARGS__)
-#define logfD(fmt, ...) mlogf(&g_logger, MLOG_DEBG, fmt, ##__VA_ARGS__)
+/* 编译进来的最高日志等级，高于该等级的日志在编译时被去掉（如Release构建中的VERB、DEBG） */
+#ifndef LOGLEVEL_FLOOR
+#define LOGLEVEL_FLOOR MLOG_DEBG
+#endif
+
+#define logEnabled(level) ((level) <= LOGLEVEL_FLOOR && (level) <= g_loglevel)
+
+#define logf_(level, fmt, ...)                                                                                         \
+    do {                                                                                                               \
+        if (logEnabled(level)) mlogf(&g_logger, level, fmt, ##__VA_ARGS__);                                            \
+    } while (0)
+
+#define logfE(fmt, ...) logf_(MLOG_ERRO, fmt, ##__VA_ARGS__)
+#define logfW(fmt, ...) logf_(MLOG_WARN, fmt, ##__VA_ARGS__)
+#define logfI(fmt, ...) logf_(MLOG_INFO, fmt, ##__VA_ARGS__)
+#define logfV(fmt, ...) logf_(MLOG_VERB, fmt, ##__VA_ARGS__)
+#define logfD(fmt, ...) logf_(MLOG_DEBG, fmt, ##__VA_ARGS__)
 
 extern const char *g_at;
+extern int         g_io_timeout; /* 与其他propd通信时单次收发的超时（unit: ms, 0 means no timeout） */
 
 #define PathFmt_CtrlServer "%s/propd.%s.ctrl"
 #define PathFmt_IOServer   "%s/propd.%s.io"
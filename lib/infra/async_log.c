@@ -0,0 +1,308 @@
+/**
+ * @file async_log.c
+ * @author kioz.wang (never.had@outlook.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright MIT License
+ *
+ *  Copyright (c) 2025 kioz.wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "async_log.h"
+#include "global.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BATCH_SIZE (64 * 1024) /* 一次交给sink的最大字节数 */
+#define IDLE_MS    10          /* 没有日志时，后台线程最多睡眠的时长 */
+
+/**
+ * @brief 单生产者（所属线程）单消费者（后台线程）的ring，每条日志为长度加内容
+ */
+struct ring {
+    atomic_uint_fast64_t head;   /* 消费者读到的位置 */
+    atomic_uint_fast64_t tail;   /* 生产者写到的位置 */
+    atomic_bool          closed;  /* 所属线程已退出，取空后释放 */
+    atomic_bool          writing; /* 生产者正在写入，see `async_log_stop` */
+    struct ring         *next;
+    char                 data[];
+};
+
+static struct {
+    mlog_f                sink;
+    enum async_log_policy policy;
+    uint32_t              size; /* 每个ring的字节数，2的幂 */
+    pthread_key_t         key;
+    pthread_mutex_t       mutex; /* 保护rings，以及后台线程和生产者的等待 */
+    pthread_cond_t        cond;  /* 唤醒后台线程 */
+    pthread_cond_t        space; /* 后台线程腾出了空间，或写入ring的生产者已全部完成 */
+    struct ring          *rings;
+    atomic_bool           running;
+    atomic_bool           sleeping;
+    bool                  stop;
+    atomic_uint_fast64_t  dropped;
+    pthread_t             tid;
+    char                  batch[BATCH_SIZE + 1];
+} g_async = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static __thread struct ring *t_ring;
+static __thread bool         t_exiting; /* 线程退出时ring已关闭（可能随即被释放），此后的日志直接交给sink */
+
+/* 在退出的线程上调用 */
+static void ring_close(struct ring *ring) {
+    t_ring    = NULL;
+    t_exiting = true;
+    atomic_store(&ring->closed, true);
+}
+
+static struct ring *ring_get(void) {
+    if (t_ring) return t_ring;
+    if (t_exiting) return NULL;
+
+    struct ring *ring = calloc(1, sizeof(struct ring) + g_async.size);
+    if (!ring) return NULL;
+    pthread_mutex_lock(&g_async.mutex);
+    ring->next    = g_async.rings;
+    g_async.rings = ring;
+    pthread_mutex_unlock(&g_async.mutex);
+    pthread_setspecific(g_async.key, ring);
+    return t_ring = ring;
+}
+
+static void ring_copy(char *dst, const struct ring *ring, uint64_t pos, uint32_t len) {
+    uint32_t off = pos & (g_async.size - 1), n = g_async.size - off;
+    if (n > len) n = len;
+    memcpy(dst, &ring->data[off], n);
+    memcpy(dst + n, &ring->data[0], len - n);
+}
+
+static void ring_put(struct ring *ring, uint64_t pos, const void *src, uint32_t len) {
+    uint32_t off = pos & (g_async.size - 1), n = g_async.size - off;
+    if (n > len) n = len;
+    memcpy(&ring->data[off], src, n);
+    memcpy(&ring->data[0], (const char *)src + n, len - n);
+}
+
+static void wakeup(void) {
+    if (!atomic_load(&g_async.sleeping)) return;
+    pthread_mutex_lock(&g_async.mutex);
+    pthread_cond_signal(&g_async.cond);
+    pthread_mutex_unlock(&g_async.mutex);
+}
+
+static uint32_t ring_free(const struct ring *ring, uint64_t tail) {
+    return g_async.size - (tail - atomic_load_explicit(&ring->head, memory_order_acquire));
+}
+
+/**
+ * @brief 等待后台线程腾出need字节（_async_log_block）
+ *
+ * @return bool false表示已开始停止，应同步输出
+ */
+static bool ring_wait(const struct ring *ring, uint64_t tail, uint32_t need) {
+    bool running = true;
+
+    pthread_mutex_lock(&g_async.mutex);
+    while (ring_free(ring, tail) < need && (running = atomic_load(&g_async.running))) {
+        pthread_cond_signal(&g_async.cond);
+        pthread_cond_wait(&g_async.space, &g_async.mutex);
+    }
+    pthread_mutex_unlock(&g_async.mutex);
+    return running;
+}
+
+static void ring_done(struct ring *ring) {
+    atomic_store(&ring->writing, false);
+    if (atomic_load(&g_async.running)) return;
+    pthread_mutex_lock(&g_async.mutex);
+    pthread_cond_broadcast(&g_async.space);
+    pthread_mutex_unlock(&g_async.mutex);
+}
+
+void async_log(const char *msg) {
+    struct ring *ring = atomic_load(&g_async.running) ? ring_get() : NULL;
+    if (!ring) {
+        g_async.sink(msg);
+        return;
+    }
+
+    /* 先标记再检查running（与async_log_stop相反），开始停止后不再写入ring，不会留下最后一次drain之后的日志 */
+    atomic_store(&ring->writing, true);
+    if (!atomic_load(&g_async.running)) goto sync;
+
+    uint32_t len = strlen(msg);
+    uint32_t max = g_async.size / 2 < BATCH_SIZE ? g_async.size / 2 : BATCH_SIZE;
+    if (len > max) len = max; /* 截断过长的日志，保证能放入ring和batch */
+    uint32_t need = sizeof(len) + len;
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    if (ring_free(ring, tail) < need) {
+        if (g_async.policy != _async_log_block) {
+            atomic_fetch_add(&g_async.dropped, 1);
+            ring_done(ring);
+            return;
+        }
+        if (!ring_wait(ring, tail, need)) goto sync;
+    }
+    ring_put(ring, tail, &len, sizeof(len));
+    ring_put(ring, tail + sizeof(len), msg, len);
+    atomic_store_explicit(&ring->tail, tail + need, memory_order_release);
+    ring_done(ring);
+    wakeup();
+    return;
+
+sync:
+    ring_done(ring);
+    g_async.sink(msg);
+}
+
+static void batch_flush(uint32_t *used) {
+    if (!*used) return;
+    g_async.batch[*used] = '\0';
+    g_async.sink(g_async.batch);
+    *used = 0;
+}
+
+/**
+ * @brief 取出所有ring中的日志，释放已关闭且取空的ring
+ *
+ * @return uint32_t 取出的日志数
+ */
+static uint32_t drain(void) {
+    uint32_t count = 0, used = 0;
+
+    pthread_mutex_lock(&g_async.mutex);
+    for (struct ring **pring = &g_async.rings; *pring;) {
+        struct ring *ring   = *pring;
+        bool         closed = atomic_load(&ring->closed);
+        uint64_t     head   = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        uint64_t     tail   = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+        while (head != tail) {
+            uint32_t len;
+            ring_copy((char *)&len, ring, head, sizeof(len));
+            if (used + len > BATCH_SIZE) batch_flush(&used);
+            ring_copy(&g_async.batch[used], ring, head + sizeof(len), len);
+            used += len;
+            head += sizeof(len) + len;
+            atomic_store_explicit(&ring->head, head, memory_order_release);
+            count++;
+        }
+        if (closed) {
+            *pring = ring->next;
+            free(ring);
+        } else {
+            pring = &ring->next;
+        }
+    }
+    if (count) pthread_cond_broadcast(&g_async.space);
+    pthread_mutex_unlock(&g_async.mutex);
+
+    batch_flush(&used);
+    return count;
+}
+
+static void *consumer(void *arg) {
+    (void)arg;
+    for (;;) {
+        if (drain()) continue;
+
+        pthread_mutex_lock(&g_async.mutex);
+        if (g_async.stop) {
+            pthread_mutex_unlock(&g_async.mutex);
+            break;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += IDLE_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        atomic_store(&g_async.sleeping, true);
+        pthread_cond_timedwait(&g_async.cond, &g_async.mutex, &deadline);
+        atomic_store(&g_async.sleeping, false);
+        pthread_mutex_unlock(&g_async.mutex);
+    }
+    drain();
+    return NULL;
+}
+
+int async_log_init(mlog_f sink, enum async_log_policy policy, uint32_t ring_size) {
+    uint32_t size = 256;
+    while (size < ring_size)
+        size <<= 1;
+
+    g_async.sink   = sink;
+    g_async.policy = policy;
+    g_async.size   = size;
+    int ret        = pthread_key_create(&g_async.key, (void (*)(void *))ring_close);
+    if (ret) return ret;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_async.cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&g_async.space, NULL);
+    return 0;
+}
+
+int async_log_start(void) {
+    g_async.stop = false;
+    int ret      = pthread_create(&g_async.tid, NULL, consumer, NULL);
+    if (ret) return ret;
+    atomic_store(&g_async.running, true);
+    return 0;
+}
+
+void async_log_stop(void) {
+    if (!atomic_exchange(&g_async.running, false)) return;
+
+    pthread_mutex_lock(&g_async.mutex);
+    g_async.stop = true;
+    pthread_cond_signal(&g_async.cond);
+    pthread_cond_broadcast(&g_async.space); /* 等待空间的生产者改为同步输出 */
+    /* 此后开始写入的生产者同步输出；等待已在写入的完成，它们的日志由最后一次drain取出 */
+    for (struct ring *ring = g_async.rings; ring;) {
+        if (atomic_load(&ring->writing)) {
+            pthread_cond_wait(&g_async.space, &g_async.mutex);
+            ring = g_async.rings; /* 等待期间ring可能已被后台线程释放 */
+        } else {
+            ring = ring->next;
+        }
+    }
+    pthread_mutex_unlock(&g_async.mutex);
+    pthread_join(g_async.tid, NULL);
+    drain();
+
+    uint64_t dropped = atomic_load(&g_async.dropped);
+    if (dropped) logfW("[async_log] %lu logs dropped because ring is full", dropped);
+}
+
+uint64_t async_log_dropped(void) { return atomic_load(&g_async.dropped); }
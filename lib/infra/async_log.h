@@ -0,0 +1,78 @@
+/**
+ * @file async_log.h
+ * @author kioz.wang (never.had@outlook.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright MIT License
+ *
+ *  Copyright (c) 2025 kioz.wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#ifndef __ASYNC_LOG_H
+#define __ASYNC_LOG_H
+
+#include "mlogger/logger.h"
+#include <stdint.h>
+
+/**
+ * @brief 线程的ring满时的处理方式
+ */
+enum async_log_policy {
+    _async_log_off = 0, /* 不使用异步日志 */
+    _async_log_drop,    /* 丢弃并计数 */
+    _async_log_block,   /* 等待后台线程腾出空间 */
+};
+
+/**
+ * @brief 初始化异步日志（不启动后台线程，此前的日志同步输出）
+ *
+ * 每个线程第一次输出日志时分配自己的ring（单生产者单消费者，无锁），后台线程取出各ring中的日志，拼接后批量交给sink
+ *
+ * @param sink 如fputs(stdout)
+ * @param policy
+ * @param ring_size 每个线程的ring的字节数，向上取2的幂
+ * @return int errno
+ */
+int async_log_init(mlog_f sink, enum async_log_policy policy, uint32_t ring_size);
+/**
+ * @brief 启动后台线程（fork之后调用）
+ *
+ * @return int errno
+ */
+int async_log_start(void);
+/**
+ * @brief 输出剩余的日志，停止后台线程（开始停止后的日志同步输出，不会丢失）
+ */
+void async_log_stop(void);
+/**
+ * @brief mlog_f: 把日志放入当前线程的ring
+ *
+ * @param msg
+ */
+void async_log(const char *msg);
+/**
+ * @brief 因ring满而丢弃的日志数
+ */
+uint64_t async_log_dropped(void);
+
+#endif /* __ASYNC_LOG_H */
@@ -0,0 +1,185 @@
+/**
+ * @file group_commit.c
+ * @author kioz.wang (never.had@outlook.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright MIT License
+ *
+ *  Copyright (c) 2025 kioz.wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "group_commit.h"
+#include "global.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct group_commit {
+    int (*sync)(int fd);
+    timestamp_t     interval;
+    unsigned short  max_writes;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond_flush; /* 唤醒flusher */
+    pthread_cond_t  cond_done;  /* 唤醒等待中的提交 */
+    int            *fds;        /* 当前批次中的fd（去重） */
+    int            *flushing;   /* 正在sync的fd */
+    unsigned short  num_fd;
+    unsigned short  num_write; /* 当前批次中的提交数 */
+    timestamp_t     since;     /* 当前批次中第一个提交的时刻 */
+    uint64_t        batch;     /* 当前批次的序号 */
+    uint64_t        flushed;   /* 已完成的批次数 */
+    int             error;     /* sticky */
+    bool            stop;
+    pthread_t       tid;
+};
+typedef struct group_commit group_commit_t;
+
+static void *flusher(group_commit_t *gc) {
+    pthread_mutex_lock(&gc->mutex);
+    for (;;) {
+        if (!gc->num_write) {
+            if (gc->stop) break;
+            pthread_cond_wait(&gc->cond_flush, &gc->mutex);
+            continue;
+        }
+
+        struct timespec deadline = timestamp2spec(gc->since + gc->interval);
+        while (!gc->stop && gc->num_write < gc->max_writes && timestamp(true) < gc->since + gc->interval) {
+            pthread_cond_timedwait(&gc->cond_flush, &gc->mutex, &deadline);
+        }
+
+        int           *fds       = gc->fds;
+        unsigned short num_fd    = gc->num_fd;
+        unsigned short num_write = gc->num_write;
+        uint64_t       batch     = gc->batch++;
+        gc->fds                  = gc->flushing;
+        gc->flushing             = fds;
+        gc->num_fd               = 0;
+        gc->num_write            = 0;
+        pthread_cond_broadcast(&gc->cond_done); /* 唤醒等待空批次的提交 */
+        pthread_mutex_unlock(&gc->mutex);
+
+        int ret = 0;
+        for (unsigned short i = 0; i < num_fd; i++) {
+            if (gc->sync(fds[i])) ret = errno;
+        }
+        logfD("[group_commit] batch%lu with %u writes on %u fds done" logFmtRet, batch, num_write, num_fd, ret);
+
+        pthread_mutex_lock(&gc->mutex);
+        if (ret && !gc->error) {
+            logfE("[group_commit] fail to sync" logFmtErrno, logArgErrno_(ret));
+            gc->error = ret;
+        }
+        gc->flushed = batch + 1;
+        pthread_cond_broadcast(&gc->cond_done);
+    }
+    pthread_mutex_unlock(&gc->mutex);
+    return NULL;
+}
+
+void *group_commit_create(int (*sync)(int fd), timestamp_t interval, unsigned short max_writes) {
+    group_commit_t *gc = calloc(1, sizeof(group_commit_t));
+    if (!gc) return NULL;
+
+    gc->sync       = sync;
+    gc->interval   = interval;
+    gc->max_writes = max_writes ? max_writes : 1;
+    gc->fds        = calloc(gc->max_writes, sizeof(int));
+    gc->flushing   = calloc(gc->max_writes, sizeof(int));
+    if (!gc->fds || !gc->flushing) goto exit;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&gc->cond_flush, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&gc->cond_done, NULL);
+    pthread_mutex_init(&gc->mutex, NULL);
+
+    errno = pthread_create(&gc->tid, NULL, (void *(*)(void *))flusher, gc);
+    if (errno) {
+        pthread_mutex_destroy(&gc->mutex);
+        pthread_cond_destroy(&gc->cond_done);
+        pthread_cond_destroy(&gc->cond_flush);
+        goto exit;
+    }
+    logfI("[group_commit] created with interval %ldus and at most %u writes", interval / 1000, gc->max_writes);
+    return gc;
+
+exit:
+    free(gc->fds);
+    free(gc->flushing);
+    free(gc);
+    return NULL;
+}
+
+void group_commit_destroy(void *_gc) {
+    group_commit_t *gc = _gc;
+    if (!gc) return;
+
+    pthread_mutex_lock(&gc->mutex);
+    gc->stop = true;
+    pthread_cond_signal(&gc->cond_flush);
+    pthread_mutex_unlock(&gc->mutex);
+    pthread_join(gc->tid, NULL);
+
+    pthread_mutex_destroy(&gc->mutex);
+    pthread_cond_destroy(&gc->cond_done);
+    pthread_cond_destroy(&gc->cond_flush);
+    free(gc->fds);
+    free(gc->flushing);
+    free(gc);
+}
+
+int group_commit(void *_gc, int fd) {
+    group_commit_t *gc = _gc;
+    int             ret;
+
+    pthread_mutex_lock(&gc->mutex);
+    while (!gc->error && gc->num_write >= gc->max_writes) {
+        pthread_cond_wait(&gc->cond_done, &gc->mutex);
+    }
+    if ((ret = gc->error)) goto exit;
+
+    unsigned short i = 0;
+    while (i < gc->num_fd && gc->fds[i] != fd)
+        i++;
+    if (i == gc->num_fd) gc->fds[gc->num_fd++] = fd;
+    if (!gc->num_write++) {
+        gc->since = timestamp(true);
+        pthread_cond_signal(&gc->cond_flush);
+    } else if (gc->num_write >= gc->max_writes) {
+        pthread_cond_signal(&gc->cond_flush);
+    }
+
+    uint64_t batch = gc->batch;
+    while (gc->flushed <= batch)
+        pthread_cond_wait(&gc->cond_done, &gc->mutex);
+    ret = gc->error;
+
+exit:
+    pthread_mutex_unlock(&gc->mutex);
+    return ret;
+}
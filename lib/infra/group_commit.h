@@ -0,0 +1,65 @@
+/**
+ * @file group_commit.h
+ * @author kioz.wang (never.had@outlook.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright MIT License
+ *
+ *  Copyright (c) 2025 kioz.wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#ifndef __GROUP_COMMIT_H
+#define __GROUP_COMMIT_H
+
+#include "timestamp.h"
+
+/**
+ * @brief Create a group committer
+ *
+ * 并发的提交被合并为一个批次，批次中的第一个提交经过interval，或提交数达到max_writes时，由后台线程对批次中的每个fd（去重）
+ * 调用一次sync，然后一起返回
+ *
+ * @param sync 如fdatasync、syncfs
+ * @param interval unit: ns
+ * @param max_writes 传入0时，等于1
+ * @return void* 组提交对象（On error, return NULL and set errno）
+ */
+void *group_commit_create(int (*sync)(int fd), timestamp_t interval, unsigned short max_writes);
+/**
+ * @brief Destroy a group committer（不能再有进行中的提交）
+ *
+ * @param gc maybe NULL
+ */
+void group_commit_destroy(void *gc);
+/**
+ * @brief 提交fd上已完成的写入，等待其所在的批次sync后返回
+ *
+ * sync失败后，无法确定哪些写入已经落盘，此后的提交都返回该错误
+ *
+ * @param gc
+ * @param fd 在返回前必须保持打开
+ * @return int errno (EIO ...)
+ */
+int group_commit(void *gc, int fd);
+
+#endif /* __GROUP_COMMIT_H */
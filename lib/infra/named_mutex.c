@@ -29,6 +29,10 @@
  */
 
 #include "named_mutex.h"
+#include "metrics.h"
+#include "misc.h"
+#include "timestamp.h"
+#include "trace.h"
 #include "tree.h"
 #include <assert.h>
 #include <errno.h>
@@ -44,10 +48,15 @@ struct named_mutex {
 };
 typedef struct named_mutex nmtx_t;
 
-struct named_mutex_namespace {
+struct named_mutex_shard {
     RB_HEAD(nmtx_tree, named_mutex) tree;
     pthread_mutex_t mutex;
 };
+
+struct named_mutex_namespace {
+    unsigned short           num;
+    struct named_mutex_shard shards[];
+};
 typedef struct named_mutex_namespace nmtx_namespace_t;
 
 #if !defined(__uintptr_t_defined) && !defined(__uintptr_t)
@@ -84,12 +93,21 @@ static void named_mutex_destroy(nmtx_t *nmtx) {
     free(nmtx);
 }
 
-void *named_mutex_create_namespace(void) {
-    nmtx_namespace_t *ns = (nmtx_namespace_t *)malloc(sizeof(nmtx_namespace_t));
+static inline struct named_mutex_shard *shard_of(nmtx_namespace_t *ns, const char *name) {
+    return &ns->shards[ns->num > 1 ? hash_cstring(name) % ns->num : 0];
+}
+
+void *named_mutex_create_namespace(unsigned short shards) {
+    if (!shards) shards = 1;
+    nmtx_namespace_t *ns =
+        (nmtx_namespace_t *)malloc(sizeof(nmtx_namespace_t) + shards * sizeof(struct named_mutex_shard));
     if (!ns) return NULL;
 
-    RB_INIT(&ns->tree);
-    pthread_mutex_init(&ns->mutex, NULL);
+    ns->num = shards;
+    for (int i = 0; i < shards; i++) {
+        RB_INIT(&ns->shards[i].tree);
+        pthread_mutex_init(&ns->shards[i].mutex, NULL);
+    }
     return ns;
 }
 
@@ -97,18 +115,21 @@ void named_mutex_destroy_namespace(void *_ns) {
     if (!_ns) return;
     nmtx_namespace_t *ns = _ns;
 
-    pthread_mutex_lock(&ns->mutex);
-    assert(RB_EMPTY(&ns->tree));
-    pthread_mutex_unlock(&ns->mutex);
+    for (int i = 0; i < ns->num; i++) {
+        struct named_mutex_shard *shard = &ns->shards[i];
 
-    pthread_mutex_destroy(&ns->mutex); /* TODO EBUSY */
+        pthread_mutex_lock(&shard->mutex);
+        assert(RB_EMPTY(&shard->tree));
+        pthread_mutex_unlock(&shard->mutex);
+
+        pthread_mutex_destroy(&shard->mutex); /* TODO EBUSY */
+    }
     free(ns);
 }
 
-int named_mutex_lock(void *_ns, const char *name) {
+static nmtx_t *named_mutex_ref(struct named_mutex_shard *ns, const char *name) {
     nmtx_t *nmtx = named_mutex_create(name);
-    if (!nmtx) return errno;
-    nmtx_namespace_t *ns = _ns;
+    if (!nmtx) return NULL;
 
     pthread_mutex_lock(&ns->mutex);
     nmtx_t *old_item = RB_INSERT(nmtx_tree, &ns->tree, nmtx);
@@ -118,15 +139,48 @@ int named_mutex_lock(void *_ns, const char *name) {
     }
     nmtx->nref++;
     pthread_mutex_unlock(&ns->mutex);
+    return nmtx;
+}
+
+static void named_mutex_deref(struct named_mutex_shard *ns, nmtx_t *nmtx) {
+    pthread_mutex_lock(&ns->mutex);
+    if (--nmtx->nref == 0) {
+        RB_REMOVE(nmtx_tree, &ns->tree, nmtx);
+        named_mutex_destroy(nmtx);
+    }
+    pthread_mutex_unlock(&ns->mutex);
+}
 
-    pthread_mutex_lock(&nmtx->mutex);
+int named_mutex_lock(void *_ns, const char *name) {
+    struct named_mutex_shard *ns   = shard_of(_ns, name);
+    nmtx_t                   *nmtx = named_mutex_ref(ns, name);
+    if (!nmtx) return errno;
+
+    if (pthread_mutex_trylock(&nmtx->mutex)) {
+        timestamp_t start = timestamp(true);
+        pthread_mutex_lock(&nmtx->mutex);
+        metrics_record(_hist_lock_wait, timestamp(true) - start);
+        trace_add(_trace_lock, start);
+    }
+    return 0;
+}
+
+int named_mutex_trylock(void *_ns, const char *name) {
+    struct named_mutex_shard *ns   = shard_of(_ns, name);
+    nmtx_t                   *nmtx = named_mutex_ref(ns, name);
+    if (!nmtx) return errno;
+
+    if (pthread_mutex_trylock(&nmtx->mutex)) {
+        named_mutex_deref(ns, nmtx);
+        return EBUSY;
+    }
     return 0;
 }
 
 int named_mutex_unlock(void *_ns, const char *name) {
-    nmtx_t           *nmtx   = NULL;
-    nmtx_t            shadow = {.name = name};
-    nmtx_namespace_t *ns     = _ns;
+    nmtx_t                   *nmtx   = NULL;
+    nmtx_t                    shadow = {.name = name};
+    struct named_mutex_shard *ns     = shard_of(_ns, name);
 
     pthread_mutex_lock(&ns->mutex);
     nmtx = RB_FIND(nmtx_tree, &ns->tree, &shadow);
@@ -137,12 +191,6 @@ int named_mutex_unlock(void *_ns, const char *name) {
     pthread_mutex_unlock(&ns->mutex);
 
     pthread_mutex_unlock(&nmtx->mutex);
-
-    pthread_mutex_lock(&ns->mutex);
-    if (--nmtx->nref == 0) {
-        RB_REMOVE(nmtx_tree, &ns->tree, nmtx);
-        named_mutex_destroy(nmtx);
-    }
-    pthread_mutex_unlock(&ns->mutex);
+    named_mutex_deref(ns, nmtx);
     return 0;
 }
@@ -34,9 +34,10 @@
 /**
  * @brief Create a namespace of named_mutexs
  *
+ * @param shards 按名字的哈希值分片，各分片独立加锁（传入0时，等于1）
  * @return void* 命名互斥锁命名空间对象（On error, return NULL and set errno）
  */
-void *named_mutex_create_namespace(void);
+void *named_mutex_create_namespace(unsigned short shards);
 /**
  * @brief Destroy a namespce of named_mutex
  *
@@ -51,6 +52,14 @@ void named_mutex_destroy_namespace(void *ns);
  * @return int errno (ENOMEM)
  */
 int named_mutex_lock(void *ns, const char *name);
+/**
+ * @brief Lock a name without waiting
+ *
+ * @param ns
+ * @param name
+ * @return int errno (ENOMEM EBUSY)
+ */
+int named_mutex_trylock(void *ns, const char *name);
 /**
  * @brief Unlock a name
  *
@@ -30,6 +30,8 @@
 
 #include "thread_pool.h"
 #include "global.h"
+#include "metrics.h"
+#include "misc.h"
 #include "timestamp.h"
 #include <assert.h>
 #include <errno.h>
@@ -38,6 +40,7 @@
 #include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 struct task {
@@ -50,26 +53,46 @@ struct task {
 };
 typedef struct task task_t;
 
+struct lane {
+    task_t        *queue;
+    unsigned short head, tail, count;
+    uint64_t       rejected;
+    pthread_cond_t not_full;
+};
+
 struct task_queue {
-    unsigned short  num;
-    task_t         *queue;
-    unsigned short  head, tail, count;
+    unsigned short  num; /* 每个优先级队列的长度 */
+    struct lane     lanes[_prio_num];
     pthread_mutex_t mutex;
-    pthread_cond_t  not_empty;
-    pthread_cond_t  not_full;
+    pthread_cond_t  not_empty; /* CLOCK_MONOTONIC */
 };
 typedef struct task_queue task_queue_t;
 
 static int task_queue_init(task_queue_t *queue, unsigned short num) {
-    task_t *_queue = (task_t *)calloc(num, sizeof(task_t));
-    if (!_queue) return errno;
+    for (int i = 0; i < _prio_num; i++) {
+        queue->lanes[i].queue = (task_t *)calloc(num, sizeof(task_t));
+        if (!queue->lanes[i].queue) {
+            int ret = errno;
+            while (i--)
+                free(queue->lanes[i].queue);
+            return ret;
+        }
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
 
-    queue->num   = num;
-    queue->queue = _queue;
-    queue->head = queue->tail = queue->count = 0;
+    queue->num = num;
+    for (int i = 0; i < _prio_num; i++) {
+        struct lane *lane = &queue->lanes[i];
+        lane->head = lane->tail = lane->count = 0;
+        pthread_cond_init(&lane->not_full, NULL);
+    }
     pthread_mutex_init(&queue->mutex, NULL);
-    pthread_cond_init(&queue->not_empty, NULL);
-    pthread_cond_init(&queue->not_full, NULL);
+    pthread_cond_init(&queue->not_empty, &attr);
+
+    pthread_condattr_destroy(&attr);
     return 0;
 }
 
@@ -77,74 +100,294 @@ static void task_queue_deinit(task_queue_t *queue) {
     if (queue->num) {
         pthread_mutex_destroy(&queue->mutex);    /* TODO EBUSY */
         pthread_cond_destroy(&queue->not_empty); /* TODO EBUSY */
-        pthread_cond_destroy(&queue->not_full);  /* TODO EBUSY */
+        for (int i = 0; i < _prio_num; i++) {
+            pthread_cond_destroy(&queue->lanes[i].not_full); /* TODO EBUSY */
+            free(queue->lanes[i].queue);
+        }
         queue->num = 0;
-        free(queue->queue);
     }
 }
 
-static void task_queue_push(task_queue_t *queue, task_t task) {
+static int task_queue_push(task_queue_t *queue, thread_pool_prio_t prio, task_t task, bool block) {
+    struct lane *lane = &queue->lanes[prio];
+
     pthread_mutex_lock(&queue->mutex);
 
-    while (queue->count >= queue->num) {
-        pthread_cond_wait(&queue->not_full, &queue->mutex);
+    if (!block && lane->count >= queue->num) {
+        lane->rejected++;
+        pthread_mutex_unlock(&queue->mutex);
+        logfD("[thread_pool] task@%lx rejected since queue%d is full", task.created, prio);
+        return EAGAIN;
+    }
+    while (lane->count >= queue->num) {
+        pthread_cond_wait(&lane->not_full, &queue->mutex);
     }
 
-    task._id                  = queue->tail;
-    queue->queue[queue->tail] = task;
-    queue->tail               = (queue->tail + 1) % queue->num;
-    queue->count++;
+    task._id                = lane->tail;
+    lane->queue[lane->tail] = task;
+    lane->tail              = (lane->tail + 1) % queue->num;
+    lane->count++;
 
     pthread_cond_signal(&queue->not_empty);
     pthread_mutex_unlock(&queue->mutex);
 
-    logfD("[thread_pool] task%d@%lx ready", task._id, task.created);
+    logfD("[thread_pool] task%d.%d@%lx ready", prio, task._id, task.created);
+    return 0;
 }
 
-static task_t task_queue_pop(task_queue_t *queue) {
-    pthread_mutex_lock(&queue->mutex);
+/* Require holding queue->mutex and queue->lanes[prio].count > 0 */
+static task_t task_queue_take(task_queue_t *queue, thread_pool_prio_t prio) {
+    struct lane *lane = &queue->lanes[prio];
+    task_t       task = lane->queue[lane->head];
+    lane->head        = (lane->head + 1) % queue->num;
+    lane->count--;
 
-    while (queue->count == 0) {
-        pthread_cond_wait(&queue->not_empty, &queue->mutex);
-    }
+    pthread_cond_signal(&lane->not_full);
+    return task;
+}
 
-    task_t task = queue->queue[queue->head];
-    queue->head = (queue->head + 1) % queue->num;
-    queue->count--;
+/* Require holding queue->mutex */
+static unsigned short task_queue_count(const task_queue_t *queue) {
+    unsigned short count = 0;
+    for (int i = 0; i < _prio_num; i++)
+        count += queue->lanes[i].count;
+    return count;
+}
 
-    pthread_cond_signal(&queue->not_full);
-    pthread_mutex_unlock(&queue->mutex);
-    return task;
+struct thread_pool;
+
+struct worker {
+    struct thread_pool *tpool;
+    pthread_t           tid;
+    int                 cpu; /* -1 means no affinity */
+};
+typedef struct worker worker_t;
+
+/* Except for the monitor, all fields are protected by task_queue.mutex */
+struct thread_pool {
+    task_queue_t   task_queue;
+    unsigned short num;         /* 当前线程数 */
+    unsigned short idle;        /* 等待任务的线程数 */
+    unsigned short min;         /* 线程数下限 */
+    unsigned short max;         /* 线程数上限（容量） */
+    worker_t     **workers;     /* capacity: max */
+    worker_t     **retired;     /* 已自行退出，等待回收的线程；capacity: max */
+    unsigned short num_retired;
+
+    timestamp_t wait_threshold; /* 0 means not elastic */
+    timestamp_t idle_timeout;
+    pthread_t   monitor;
+
+    unsigned short reserved; /* 只执行高优先级任务的线程数 */
+    unsigned short busy_low; /* 正在执行低优先级任务的线程数 */
+    timestamp_t    aging;    /* 低优先级任务的排队时长超过此值时，优先于高优先级任务（0 means disable） */
+
+    unsigned short *cpus; /* 依次分配给各线程；NULL means no affinity */
+    unsigned short  num_cpus;
+    unsigned int    next_cpu;
+
+    uint64_t    completed;
+    timestamp_t wait_last;
+    timestamp_t wait_max;
+    timestamp_t wait_total;
+};
+typedef struct thread_pool thread_pool_t;
+
+static void worker_cleanup(thread_pool_t *tpool) {
+    tpool->idle--;
+    pthread_mutex_unlock(&tpool->task_queue.mutex);
+}
+
+/* Require holding queue->mutex */
+static bool worker_should_retire(thread_pool_t *tpool) {
+    return tpool->wait_threshold && tpool->num > tpool->min;
+}
+
+/**
+ * @brief Require holding queue->mutex
+ *
+ * 低优先级任务最多占用(num - reserved)个线程；排队过久的低优先级任务优先于高优先级任务，避免饿死
+ *
+ * @param tpool
+ * @return int 可以取出的任务的优先级；没有时返回-1
+ */
+static int worker_pick(const thread_pool_t *tpool) {
+    const struct lane *high = &tpool->task_queue.lanes[_prio_high];
+    const struct lane *low  = &tpool->task_queue.lanes[_prio_low];
+    unsigned short     cap  = tpool->num > tpool->reserved ? tpool->num - tpool->reserved : 1;
+    bool               ok   = low->count && tpool->busy_low < cap;
+
+    if (ok && tpool->aging && timestamp(true) - low->queue[low->head].created > tpool->aging) return _prio_low;
+    if (high->count) return _prio_high;
+    if (ok) return _prio_low;
+    return -1;
+}
+
+/* Require holding queue->mutex */
+static void worker_retire(thread_pool_t *tpool, worker_t *self) {
+    for (int i = 0; i < tpool->num; i++) {
+        if (tpool->workers[i] == self) {
+            tpool->workers[i] = tpool->workers[tpool->num - 1];
+            break;
+        }
+    }
+    tpool->num--;
+    tpool->retired[tpool->num_retired++] = self;
 }
 
-static void cleanup(task_queue_t *queue) { pthread_mutex_unlock(&queue->mutex); }
+static void *thread_pool_worker(worker_t *self) {
+    thread_pool_t *tpool = self->tpool;
+    task_queue_t  *queue = &tpool->task_queue;
 
-static void *thread_pool_worker(task_queue_t *queue) {
     while (true) {
-        task_t task;
-        pthread_cleanup_push((void (*)(void *))cleanup, queue);
-        task = task_queue_pop(queue);
+        task_t      task;
+        bool        retire = false;
+        int         prio   = -1;
+        timestamp_t wait   = 0;
+
+        pthread_mutex_lock(&queue->mutex);
+        pthread_cleanup_push((void (*)(void *))worker_cleanup, tpool);
+        tpool->idle++;
+        while ((prio = worker_pick(tpool)) < 0) {
+            if (worker_should_retire(tpool)) {
+                struct timespec ts = timestamp2spec(timestamp(true) + tpool->idle_timeout);
+                if (pthread_cond_timedwait(&queue->not_empty, &queue->mutex, &ts) == ETIMEDOUT &&
+                    !task_queue_count(queue) && worker_should_retire(tpool)) {
+                    retire = true;
+                    break;
+                }
+            } else {
+                pthread_cond_wait(&queue->not_empty, &queue->mutex);
+            }
+        }
+        tpool->idle--;
+        if (retire) {
+            worker_retire(tpool, self);
+        } else {
+            task = task_queue_take(queue, prio);
+            if (prio == _prio_low) tpool->busy_low++;
+
+            wait = timestamp(true) - task.created;
+            tpool->completed++;
+            tpool->wait_last = wait;
+            tpool->wait_total += wait;
+            if (wait > tpool->wait_max) tpool->wait_max = wait;
+        }
         pthread_cleanup_pop(false);
-        logfD("[thread_pool] task%d@%lx running", task._id, task.created);
+        pthread_mutex_unlock(&queue->mutex);
+
+        if (retire) {
+            logfV("[thread_pool] retire a thread after idle %ldms", timestamp_to_ms(tpool->idle_timeout));
+            break;
+        }
+        metrics_record(_hist_queue_wait, wait);
+        logfD("[thread_pool] task%d.%d@%lx running", prio, task._id, task.created);
 
         int result = task.routine(task.arg);
-        if (result) logfE("[thread_pool] task%d@%lx done with result %d", task._id, task.created, result);
-        else logfD("[thread_pool] task%d@%lx done", task._id, task.created);
+        if (result) logfE("[thread_pool] task%d.%d@%lx done with result %d", prio, task._id, task.created, result);
+        else logfD("[thread_pool] task%d.%d@%lx done", prio, task._id, task.created);
 
         if (task.result) {
             *task.result = result;
             sem_post(task.done);
         }
+
+        if (prio == _prio_low) {
+            pthread_mutex_lock(&queue->mutex);
+            tpool->busy_low--;
+            if (queue->lanes[_prio_low].count) pthread_cond_signal(&queue->not_empty);
+            pthread_mutex_unlock(&queue->mutex);
+        }
     }
     return NULL;
 }
 
-struct thread_pool {
-    unsigned short num;
-    pthread_t     *pool;
-    void          *task_queue;
-};
-typedef struct thread_pool thread_pool_t;
+/* Require holding task_queue.mutex */
+static void worker_bind(thread_pool_t *tpool, worker_t *worker) {
+    worker->cpu = tpool->cpus[tpool->next_cpu++ % tpool->num_cpus];
+
+    int ret = thread_bind_cpulist(worker->tid, &(unsigned short){worker->cpu}, 1);
+    if (ret) logfW("[thread_pool] fail to bind thread to cpu%d" logFmtRet, worker->cpu, ret);
+}
+
+/* Require holding task_queue.mutex */
+static int worker_spawn(thread_pool_t *tpool) {
+    worker_t *worker = malloc(sizeof(worker_t));
+    if (!worker) return errno;
+    worker->tpool = tpool;
+    worker->cpu   = -1;
+
+    int ret = pthread_create(&worker->tid, NULL, (void *(*)(void *))thread_pool_worker, worker);
+    if (ret) {
+        free(worker);
+        return ret;
+    }
+    if (tpool->cpus) worker_bind(tpool, worker);
+    tpool->workers[tpool->num++] = worker;
+    return 0;
+}
+
+static void reap(worker_t **workers, unsigned short num) {
+    for (int i = 0; i < num; i++) {
+        pthread_join(workers[i]->tid, NULL);
+        free(workers[i]);
+    }
+}
+
+static void *thread_pool_monitor(thread_pool_t *tpool) {
+    task_queue_t   *queue    = &tpool->task_queue;
+    timestamp_t     interval = tpool->wait_threshold / 2;
+    struct timespec ts       = timestamp2spec(interval < timestamp_from_ms(1) ? timestamp_from_ms(1) : interval);
+
+    worker_t **retired = calloc(tpool->max, sizeof(worker_t *));
+    if (!retired) {
+        logfE("[thread_pool::monitor] fail to allocate" logFmtErrno, logArgErrno);
+        return NULL;
+    }
+    pthread_cleanup_push(free, retired);
+
+    for (;;) {
+        unsigned short num_retired = 0;
+        int            oldstate;
+
+        nanosleep(&ts, NULL);
+
+        /* 从取出退休的线程到回收完毕不能被取消，否则它们不会再被回收 */
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+        pthread_mutex_lock(&queue->mutex);
+
+        num_retired = tpool->num_retired;
+        for (int i = 0; i < num_retired; i++) {
+            retired[i] = tpool->retired[i];
+        }
+        tpool->num_retired = 0;
+
+        if (tpool->num < tpool->max) {
+            timestamp_t now = timestamp(true), wait = 0;
+            for (int i = 0; i < _prio_num; i++) {
+                const struct lane *lane = &queue->lanes[i];
+                if (lane->count && now - lane->queue[lane->head].created > wait)
+                    wait = now - lane->queue[lane->head].created;
+            }
+            /* 有空闲线程时仍在排队，只可能是低优先级任务受限于预留线程 */
+            if (wait > tpool->wait_threshold) {
+                int ret = worker_spawn(tpool);
+                if (ret) logfE("[thread_pool::monitor] fail to grow" logFmtRet, ret);
+                else
+                    logfV("[thread_pool::monitor] grow to %d threads since task waits %ldms", tpool->num,
+                          timestamp_to_ms(wait));
+            }
+        }
+
+        pthread_mutex_unlock(&queue->mutex);
+
+        reap(retired, num_retired);
+        pthread_setcancelstate(oldstate, NULL);
+    }
+
+    pthread_cleanup_pop(true);
+    return NULL;
+}
 
 void *thread_pool_create(unsigned short thread_num, unsigned short min_if_auto, unsigned short max_if_auto,
                          unsigned short task_num) {
@@ -164,25 +407,30 @@ void *thread_pool_create(unsigned short thread_num, unsigned short min_if_auto,
 
     thread_pool_t *tpool = calloc(1, sizeof(thread_pool_t));
     if (!tpool) goto exit;
-    tpool->pool = calloc(thread_num, sizeof(pthread_t));
-    if (!tpool->pool) goto exit;
-    tpool->task_queue = calloc(1, sizeof(task_queue_t));
-    if (!tpool->task_queue) {
+    tpool->min = tpool->max = thread_num;
+    tpool->workers = calloc(thread_num, sizeof(worker_t *));
+    if (!tpool->workers) goto exit;
+    tpool->retired = calloc(thread_num, sizeof(worker_t *));
+    if (!tpool->retired) goto exit;
+    ret = task_queue_init(&tpool->task_queue, task_num);
+    if (ret) {
+        errno = ret;
         goto exit;
     }
-    ret = task_queue_init(tpool->task_queue, task_num);
-    if (ret) goto exit;
 
+    pthread_mutex_lock(&tpool->task_queue.mutex);
     for (int i = 0; i < thread_num; i++) {
-        ret = pthread_create(&tpool->pool[i], NULL, (void *(*)(void *))thread_pool_worker, tpool->task_queue);
+        ret = worker_spawn(tpool);
         if (ret) {
-            tpool->num = i;
-            errno      = ret;
             logfE("[thread_pool] fail to create thread[%d] (%d)", i, ret);
-            goto exit;
+            break;
         }
     }
-    tpool->num = thread_num;
+    pthread_mutex_unlock(&tpool->task_queue.mutex);
+    if (ret) {
+        errno = ret;
+        goto exit;
+    }
 
     logfI("[thread_pool] created %d threads and a task_queue with depth %d", thread_num, task_num);
     return tpool;
@@ -196,27 +444,35 @@ void thread_pool_destroy(void *_tpool) {
     thread_pool_t *tpool = (thread_pool_t *)_tpool;
     if (!tpool) return;
 
-    if (tpool->pool) {
-        for (int i = 0; i < tpool->num; i++) {
-            pthread_cancel(tpool->pool[i]);
-        }
-        for (int i = 0; i < tpool->num; i++) {
-            pthread_join(tpool->pool[i], NULL);
-        }
-        tpool->num = 0;
-        free(tpool->pool);
+    if (tpool->wait_threshold) {
+        pthread_cancel(tpool->monitor);
+        pthread_join(tpool->monitor, NULL);
+    }
 
-        if (tpool->task_queue) {
-            task_queue_deinit(tpool->task_queue);
-            free(tpool->task_queue);
-        }
+    if (tpool->workers && tpool->retired) {
+        task_queue_t *queue = &tpool->task_queue;
+
+        /* 监视线程已退出，关闭弹性后不再有线程退休或新建，两个数组不再变化 */
+        if (queue->num) pthread_mutex_lock(&queue->mutex);
+        tpool->wait_threshold = 0;
+        if (queue->num) pthread_mutex_unlock(&queue->mutex);
+
+        for (int i = 0; i < tpool->num; i++)
+            pthread_cancel(tpool->workers[i]->tid);
+        reap(tpool->workers, tpool->num);
+        reap(tpool->retired, tpool->num_retired);
+        tpool->num = tpool->num_retired = 0;
     }
+    free(tpool->workers);
+    free(tpool->retired);
+    free(tpool->cpus);
+    task_queue_deinit(&tpool->task_queue);
 
     free(tpool);
     logfI("[thread_pool] destroyed");
 }
 
-int thread_pool_submit(void *tpool, int (*routine)(void *), void *arg, bool sync) {
+int thread_pool_submit(void *tpool, thread_pool_prio_t prio, int (*routine)(void *), void *arg, bool sync) {
     assert(tpool);
     assert(routine);
     int    result = 0;
@@ -232,7 +488,7 @@ int thread_pool_submit(void *tpool, int (*routine)(void *), void *arg, bool sync
         task.result = &result;
         task.done   = &done;
     }
-    task_queue_push(((thread_pool_t *)tpool)->task_queue, task);
+    task_queue_push(&((thread_pool_t *)tpool)->task_queue, prio, task, true);
     if (sync) {
         sem_wait(&done);
         sem_destroy(&done);
@@ -240,3 +496,126 @@ int thread_pool_submit(void *tpool, int (*routine)(void *), void *arg, bool sync
     }
     return 0;
 }
+
+int thread_pool_try_submit(void *tpool, thread_pool_prio_t prio, int (*routine)(void *), void *arg) {
+    assert(tpool);
+    assert(routine);
+    task_t task = {
+        .routine = routine,
+        .arg     = arg,
+        .created = timestamp(true),
+    };
+
+    return task_queue_push(&((thread_pool_t *)tpool)->task_queue, prio, task, false);
+}
+
+int thread_pool_set_elastic(void *_tpool, unsigned short max, timestamp_t wait_threshold, timestamp_t idle_timeout) {
+    thread_pool_t *tpool = (thread_pool_t *)_tpool;
+    task_queue_t  *queue = &tpool->task_queue;
+    int            ret   = 0;
+
+    if (!wait_threshold || !idle_timeout) return EINVAL;
+
+    pthread_mutex_lock(&queue->mutex);
+
+    if (tpool->wait_threshold) {
+        ret = EALREADY;
+        goto exit;
+    }
+    if (max < tpool->num) {
+        ret = EINVAL;
+        goto exit;
+    }
+
+    worker_t **workers = realloc(tpool->workers, max * sizeof(worker_t *));
+    if (!workers) {
+        ret = errno;
+        goto exit;
+    }
+    tpool->workers = workers;
+
+    worker_t **retired = realloc(tpool->retired, max * sizeof(worker_t *));
+    if (!retired) {
+        ret = errno;
+        goto exit;
+    }
+    tpool->retired = retired;
+    tpool->max     = max;
+
+    tpool->idle_timeout   = idle_timeout;
+    tpool->wait_threshold = wait_threshold;
+    ret                   = pthread_create(&tpool->monitor, NULL, (void *(*)(void *))thread_pool_monitor, tpool);
+    if (ret) {
+        tpool->wait_threshold = 0;
+        goto exit;
+    }
+
+    logfI("[thread_pool] elastic in [%d,%d] threads, grow if wait %ldms, shrink if idle %ldms", tpool->min, max,
+          timestamp_to_ms(wait_threshold), timestamp_to_ms(idle_timeout));
+
+exit:
+    pthread_mutex_unlock(&queue->mutex);
+    return ret;
+}
+
+int thread_pool_set_priority(void *_tpool, unsigned short reserved, timestamp_t aging) {
+    thread_pool_t *tpool = (thread_pool_t *)_tpool;
+    task_queue_t  *queue = &tpool->task_queue;
+    int            ret   = 0;
+
+    pthread_mutex_lock(&queue->mutex);
+    if (reserved >= tpool->min) {
+        ret = EINVAL;
+    } else {
+        tpool->reserved = reserved;
+        tpool->aging    = aging;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    if (!ret)
+        logfI("[thread_pool] reserve %d threads for high priority, promote low priority task if wait %ldms", reserved,
+              timestamp_to_ms(aging));
+    return ret;
+}
+
+int thread_pool_set_affinity(void *_tpool, const unsigned short *cpus, unsigned short num) {
+    thread_pool_t *tpool = (thread_pool_t *)_tpool;
+    task_queue_t  *queue = &tpool->task_queue;
+
+    if (!cpus || !num) return EINVAL;
+    unsigned short *_cpus = calloc(num, sizeof(unsigned short));
+    if (!_cpus) return errno;
+    memcpy(_cpus, cpus, num * sizeof(unsigned short));
+
+    pthread_mutex_lock(&queue->mutex);
+    free(tpool->cpus);
+    tpool->cpus     = _cpus;
+    tpool->num_cpus = num;
+    tpool->next_cpu = 0;
+    for (int i = 0; i < tpool->num; i++) {
+        worker_bind(tpool, tpool->workers[i]);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    logfI("[thread_pool] bind threads to %d cpus in turn", num);
+    return 0;
+}
+
+void thread_pool_stats(void *_tpool, thread_pool_stats_t *stats) {
+    thread_pool_t *tpool = (thread_pool_t *)_tpool;
+    task_queue_t  *queue = &tpool->task_queue;
+
+    pthread_mutex_lock(&queue->mutex);
+    stats->num       = tpool->num;
+    stats->idle      = tpool->idle;
+    stats->min       = tpool->min;
+    stats->max       = tpool->max;
+    stats->queued    = task_queue_count(queue);
+    stats->depth     = queue->num;
+    stats->completed = tpool->completed;
+    stats->rejected  = queue->lanes[_prio_high].rejected + queue->lanes[_prio_low].rejected;
+    stats->wait_last = tpool->wait_last;
+    stats->wait_max  = tpool->wait_max;
+    stats->wait_avg  = tpool->completed ? tpool->wait_total / (timestamp_t)tpool->completed : 0;
+    pthread_mutex_unlock(&queue->mutex);
+}
@@ -31,7 +31,31 @@
 #ifndef __THREAD_POOL_H
 #define __THREAD_POOL_H
 
+#include "timestamp.h"
 #include <stdbool.h>
+#include <stdint.h>
+
+enum thread_pool_prio {
+    _prio_high = 0, /* 数据面 */
+    _prio_low,      /* 控制面、后台任务 */
+    _prio_num,
+};
+typedef enum thread_pool_prio thread_pool_prio_t;
+
+struct thread_pool_stats {
+    unsigned short num;       /* 当前线程数 */
+    unsigned short idle;      /* 空闲线程数 */
+    unsigned short min;       /* 线程数下限 */
+    unsigned short max;       /* 线程数上限（未使能弹性时，等于min） */
+    unsigned short queued;    /* 排队中的任务数 */
+    unsigned short depth;     /* 任务队列长度 */
+    uint64_t       completed; /* 已出队的任务数 */
+    uint64_t       rejected;  /* 因队列已满而被拒绝的任务数 */
+    timestamp_t    wait_last; /* 最近一个任务的排队时长 */
+    timestamp_t    wait_max;  /* 最大排队时长 */
+    timestamp_t    wait_avg;  /* 平均排队时长 */
+};
+typedef struct thread_pool_stats thread_pool_stats_t;
 
 /**
  * @brief Allocate and initialize a thread-pool
@@ -39,7 +63,7 @@
  * @param thread_num 线程数。传入0时，根据CPU数自动选择
  * @param min_if_auto 自动选择的线程数不能低于此
  * @param max_if_auto 自动选择的线程数不能高于此
- * @param task_num 任务队列长度。传入0时，等于线程数
+ * @param task_num 任务队列长度（每个优先级各自独立）。传入0时，等于线程数
  * @return void* 线程池对象（On error, return NULL and set errno）
  */
 void *thread_pool_create(unsigned short thread_num, unsigned short min_if_auto, unsigned short max_if_auto,
@@ -54,11 +78,65 @@ void thread_pool_destroy(void *tpool);
  * @brief Submit a task
  *
  * @param tpool 线程池对象
+ * @param prio 优先级
  * @param routine
  * @param arg
  * @param sync
  * @return int 当sync为true时，同步等待routine执行完毕并返回其返回值；否则始终返回0
  */
-int thread_pool_submit(void *tpool, int (*routine)(void *), void *arg, bool sync);
+int thread_pool_submit(void *tpool, thread_pool_prio_t prio, int (*routine)(void *), void *arg, bool sync);
+/**
+ * @brief Submit a task without blocking
+ *
+ * 任务队列已满时立即返回，由调用者决定如何处理（例如拒绝请求）
+ *
+ * @param tpool 线程池对象
+ * @param prio 优先级
+ * @param routine
+ * @param arg
+ * @return int errno (EAGAIN)
+ */
+int thread_pool_try_submit(void *tpool, thread_pool_prio_t prio, int (*routine)(void *), void *arg);
+/**
+ * @brief Enable elastic mode: grow when tasks wait too long, shrink when threads idle too long
+ *
+ * 创建时的线程数作为下限；由后台监视线程负责扩容，空闲线程自行退出
+ *
+ * @param tpool 线程池对象
+ * @param max 线程数上限（不能低于当前线程数）
+ * @param wait_threshold 队首任务的排队时长超过此值时，新增一个线程
+ * @param idle_timeout 线程空闲超过此值，且线程数高于下限时，退出该线程
+ * @return int errno (EINVAL EALREADY ENOMEM)
+ */
+int thread_pool_set_elastic(void *tpool, unsigned short max, timestamp_t wait_threshold, timestamp_t idle_timeout);
+/**
+ * @brief Reserve threads for high priority tasks, and protect low priority tasks from starvation
+ *
+ * 默认不预留线程，且低优先级任务只在没有高优先级任务时执行
+ *
+ * @param tpool 线程池对象
+ * @param reserved 只执行高优先级任务的线程数（必须低于线程数下限）
+ * @param aging 低优先级任务的排队时长超过此值时，优先于高优先级任务执行（传入0时，不提升）
+ * @return int errno (EINVAL)
+ */
+int thread_pool_set_priority(void *tpool, unsigned short reserved, timestamp_t aging);
+/**
+ * @brief Bind threads to CPUs round-robin
+ *
+ * 每个线程只绑定一个CPU：已有线程立即重新分配，之后扩容的线程继续轮转
+ *
+ * @param tpool 线程池对象
+ * @param cpus CPU编号列表（no ownership transfer）
+ * @param num
+ * @return int errno (EINVAL ENOMEM)
+ */
+int thread_pool_set_affinity(void *tpool, const unsigned short *cpus, unsigned short num);
+/**
+ * @brief Get statistics of a thread-pool
+ *
+ * @param tpool 线程池对象
+ * @param stats
+ */
+void thread_pool_stats(void *tpool, thread_pool_stats_t *stats);
 
 #endif /* __THREAD_POOL_H */
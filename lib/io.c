@@ -32,11 +32,32 @@
 #include "cache.h"
 #include "global.h"
 #include "infra/named_mutex.h"
+#include "misc.h"
 #include "route.h"
 #include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GENERATION_SLOTS 256
+
+/**
+ * 按key的哈希值分槽的写入代数：写者持有key的锁，在更新缓存之后递增（清空缓存时例外，见io_changed）
+ *
+ * 异步get不持有key的锁，完成时仅当代数未变（期间没有写入）才写入缓存
+ */
+static atomic_uint g_generations[GENERATION_SLOTS];
+
+static inline atomic_uint *generation_of(const char *key) {
+    return &g_generations[hash_cstring(key) % GENERATION_SLOTS];
+}
+
+/* Require holding the lock of key */
+static inline void generation_bump(const char *key) { atomic_fetch_add(generation_of(key), 1); }
 
 struct cleanup_ctx {
     void                *nmtx_ns;
+    void                *route;
     const storage_ctx_t *storage;
     const char          *key;
 };
@@ -44,12 +65,12 @@ typedef struct cleanup_ctx cleanup_ctx_t;
 
 static void cleanup(cleanup_ctx_t *ctx) {
     if (ctx->key) named_mutex_unlock(ctx->nmtx_ns, ctx->key);
-    if (ctx->storage) route_deref(ctx->storage);
+    if (ctx->storage) route_deref(ctx->route, ctx->storage);
 }
 
 int io_get(const io_ctx_t *io, const char *key, const value_t **value, timestamp_t *duration) {
     int           ret         = 0;
-    cleanup_ctx_t cleanup_ctx = {.nmtx_ns = io->nmtx_ns};
+    cleanup_ctx_t cleanup_ctx = {.nmtx_ns = io->nmtx_ns, .route = io->route};
 
     if (io->cache) {
         ret = cache_get(io->cache, key, value, duration);
@@ -69,6 +90,47 @@ int io_get(const io_ctx_t *io, const char *key, const value_t **value, timestamp
     cleanup_ctx.key = key;
 
     ret = storage_get(cleanup_ctx.storage, key, value, duration);
+    route_report(io->route, cleanup_ctx.storage, ret);
+    if (!ret) {
+        if (io->cache) cache_set(io->cache, key, *value, *duration);
+    }
+
+exit:
+    pthread_cleanup_pop(true);
+    return ret;
+}
+
+int io_get_buf(const io_ctx_t *io, const char *key, value_t **value, uint32_t *size, timestamp_t *duration,
+               const storage_ctx_t **storage) {
+    int           ret         = 0;
+    cleanup_ctx_t cleanup_ctx = {.nmtx_ns = io->nmtx_ns, .route = io->route};
+
+    if (io->cache) {
+        ret = cache_get_buf(io->cache, key, value, size, duration);
+        if (ret != ENOENT) return ret;
+    }
+
+    pthread_cleanup_push((void (*)(void *))cleanup, &cleanup_ctx);
+
+    ret = route_match(io->route, key, &cleanup_ctx.storage);
+    if (ret) goto exit;
+    if (cleanup_ctx.storage->get_async) {
+        /* 引用随存储交给io_get_async */
+        *storage            = cleanup_ctx.storage;
+        cleanup_ctx.storage = NULL;
+        ret                 = EAGAIN;
+        goto exit;
+    }
+
+    ret = named_mutex_lock(io->nmtx_ns, key);
+    if (ret) {
+        logfE("[server::?] fail to lock " logFmtKey " to get" logFmtRet, key, ret);
+        goto exit;
+    }
+    cleanup_ctx.key = key;
+
+    ret = storage_get_buf(cleanup_ctx.storage, key, value, size, duration);
+    route_report(io->route, cleanup_ctx.storage, ret);
     if (!ret) {
         if (io->cache) cache_set(io->cache, key, *value, *duration);
     }
@@ -78,6 +140,68 @@ exit:
     return ret;
 }
 
+struct get_async_ctx {
+    const io_ctx_t      *io;
+    const storage_ctx_t *storage;
+    unsigned int         generation; /* 提交get时key的写入代数 */
+    storage_done_t       done;
+    void                *arg;
+    char                 key[];
+};
+typedef struct get_async_ctx get_async_ctx_t;
+
+/**
+ * @brief 异步get完成时写入缓存：不等待key的锁，期间有写入（或正在写入）时放弃
+ */
+static void get_async_fill(get_async_ctx_t *ctx, const value_t *value, timestamp_t duration) {
+    const io_ctx_t *io = ctx->io;
+
+    if (named_mutex_trylock(io->nmtx_ns, ctx->key)) {
+        logfD("[server::?] skip to cache " logFmtKey " while it is being written", ctx->key);
+        return;
+    }
+    if (atomic_load(generation_of(ctx->key)) == ctx->generation) cache_set(io->cache, ctx->key, value, duration);
+    else logfD("[server::?] skip to cache " logFmtKey " written during get", ctx->key);
+    named_mutex_unlock(io->nmtx_ns, ctx->key);
+}
+
+static void get_async_done(get_async_ctx_t *ctx, int result, const value_t *value, timestamp_t duration) {
+    if (!result && ctx->io->cache) get_async_fill(ctx, value, duration);
+    route_report(ctx->io->route, ctx->storage, result);
+    route_deref(ctx->io->route, ctx->storage);
+    ctx->done(ctx->arg, result, value, duration);
+    free(ctx);
+}
+
+void io_get_async(const io_ctx_t *io, const char *key, const storage_ctx_t *storage, storage_done_t done, void *arg) {
+    int              ret = 0;
+    get_async_ctx_t *ctx = malloc(sizeof(get_async_ctx_t) + strlen(key) + 1);
+
+    if (!ctx) {
+        ret = errno;
+        route_report(io->route, storage, EAGAIN);
+        goto exit_inline;
+    }
+    ctx->io         = io;
+    ctx->storage    = storage;
+    ctx->generation = atomic_load(generation_of(key));
+    ctx->done       = done;
+    ctx->arg        = arg;
+    strcpy(ctx->key, key);
+
+    ret = storage_get_async(storage, key, (storage_done_t)get_async_done, ctx);
+    if (ret) {
+        route_report(io->route, storage, ret);
+        free(ctx);
+        goto exit_inline;
+    }
+    return;
+
+exit_inline:
+    route_deref(io->route, storage);
+    done(arg, ret, NULL, 0);
+}
+
 int io_update(const io_ctx_t *io, const char *key, const storage_ctx_t *storage) {
     int            ret   = 0;
     const value_t *value = NULL;
@@ -99,15 +223,36 @@ int io_update(const io_ctx_t *io, const char *key, const storage_ctx_t *storage)
     if (!ret) {
         cache_set(io->cache, key, value, duration);
     }
+    generation_bump(key);
 
 exit:
     pthread_cleanup_pop(true);
     return ret;
 }
 
+void io_changed(const io_ctx_t *io, const char *key) {
+    if (!io->cache) return;
+    if (!key) {
+        /* 不持有key的锁，须先递增代数：此后完成的异步get不再写入，之前写入的随后被清除 */
+        for (int i = 0; i < GENERATION_SLOTS; i++)
+            atomic_fetch_add(&g_generations[i], 1);
+        cache_clear(io->cache);
+        return;
+    }
+
+    int ret = named_mutex_lock(io->nmtx_ns, key);
+    if (ret) {
+        logfE("[server::?] fail to lock " logFmtKey " to evict" logFmtRet, key, ret);
+        return;
+    }
+    cache_del(io->cache, key);
+    generation_bump(key);
+    named_mutex_unlock(io->nmtx_ns, key);
+}
+
 int io_set(const io_ctx_t *io, const char *key, const value_t *value) {
     int           ret         = 0;
-    cleanup_ctx_t cleanup_ctx = {.nmtx_ns = io->nmtx_ns};
+    cleanup_ctx_t cleanup_ctx = {.nmtx_ns = io->nmtx_ns, .route = io->route};
 
     pthread_cleanup_push((void (*)(void *))cleanup, &cleanup_ctx);
 
@@ -122,9 +267,11 @@ int io_set(const io_ctx_t *io, const char *key, const value_t *value) {
     cleanup_ctx.key = key;
 
     ret = storage_set(cleanup_ctx.storage, key, value);
+    route_report(io->route, cleanup_ctx.storage, ret);
     if (!ret) {
         if (io->cache) cache_set(io->cache, key, value, 0);
     }
+    generation_bump(key);
 
 exit:
     pthread_cleanup_pop(true);
@@ -133,7 +280,7 @@ exit:
 
 int io_del(const io_ctx_t *io, const char *key) {
     int           ret         = 0;
-    cleanup_ctx_t cleanup_ctx = {.nmtx_ns = io->nmtx_ns};
+    cleanup_ctx_t cleanup_ctx = {.nmtx_ns = io->nmtx_ns, .route = io->route};
 
     pthread_cleanup_push((void (*)(void *))cleanup, &cleanup_ctx);
 
@@ -148,11 +295,297 @@ int io_del(const io_ctx_t *io, const char *key) {
     cleanup_ctx.key = key;
 
     ret = storage_del(cleanup_ctx.storage, key);
+    route_report(io->route, cleanup_ctx.storage, ret);
     if (!ret) {
         if (io->cache) cache_del(io->cache, key);
     }
+    generation_bump(key);
 
 exit:
     pthread_cleanup_pop(true);
     return ret;
 }
+
+enum batch_type {
+    _batch_get = 0,
+    _batch_set,
+    _batch_del,
+};
+
+struct batch_item {
+    const storage_ctx_t *storage;
+    const char          *key;
+    int                  idx; /* index in arguments */
+};
+typedef struct batch_item batch_item_t;
+
+struct batch_ctx {
+    void         *nmtx_ns;
+    void         *route;
+    batch_item_t *items;
+    int           num;
+    int           locked_begin, locked_end; /* items[locked_begin, locked_end) are locked (skip duplicates) */
+};
+typedef struct batch_ctx batch_ctx_t;
+
+static int batch_item_cmp(const void *_a, const void *_b) {
+    const batch_item_t *a = _a, *b = _b;
+    if (a->storage != b->storage) return a->storage < b->storage ? -1 : 1;
+    return strcmp(a->key, b->key);
+}
+
+static void batch_unlock(batch_ctx_t *ctx) {
+    for (int i = ctx->locked_begin; i < ctx->locked_end; i++) {
+        if (i > ctx->locked_begin && !strcmp(ctx->items[i - 1].key, ctx->items[i].key)) continue;
+        named_mutex_unlock(ctx->nmtx_ns, ctx->items[i].key);
+    }
+    ctx->locked_begin = ctx->locked_end = 0;
+}
+
+static void batch_cleanup(batch_ctx_t *ctx) {
+    batch_unlock(ctx);
+    for (int i = 0; i < ctx->num; i++) {
+        if (i && ctx->items[i - 1].storage == ctx->items[i].storage) continue; /* 每组只引用一次 */
+        route_deref(ctx->route, ctx->items[i].storage);
+    }
+    free(ctx->items);
+}
+
+/**
+ * @brief 依次对每组（相同storage）的key加锁后作为一个batch下发
+ *
+ * 每组只匹配一次路由（占用一个进行中的请求、一次探测机会）。组内按key排序加锁，且同一时刻只持有一组的锁，避免与其他batch死锁
+ */
+static int io_batch(const io_ctx_t *io, enum batch_type type, int num, const char *const keys[],
+                    const value_t *const in[], const value_t *out[], timestamp_t durations[], int results[]) {
+    int         ret = 0;
+    batch_ctx_t ctx = {.nmtx_ns = io->nmtx_ns, .route = io->route};
+
+    ctx.items = calloc(num, sizeof(batch_item_t));
+    if (!ctx.items) return errno;
+
+    const char          **g_keys     = calloc(num, sizeof(char *));
+    const value_t       **g_in       = calloc(num, sizeof(value_t *));
+    const value_t       **g_out      = calloc(num, sizeof(value_t *));
+    timestamp_t          *g_duration = calloc(num, sizeof(timestamp_t));
+    int                  *g_results  = calloc(num, sizeof(int));
+    const storage_ctx_t **g_storages = calloc(num, sizeof(storage_ctx_t *));
+    if (!g_keys || !g_in || !g_out || !g_duration || !g_results || !g_storages) {
+        ret = errno;
+        free(ctx.items);
+        goto exit;
+    }
+
+    pthread_cleanup_push((void (*)(void *))batch_cleanup, &ctx);
+
+    int num_match = 0;
+    for (int i = 0; i < num; i++) {
+        if (type == _batch_get) {
+            out[i]       = NULL;
+            durations[i] = 0;
+            if (io->cache) {
+                results[i] = cache_get(io->cache, keys[i], &out[i], &durations[i]);
+                if (results[i] != ENOENT) continue;
+            }
+        }
+        g_keys[num_match]          = keys[i];
+        ctx.items[num_match++].idx = i;
+    }
+    route_match_batch(io->route, num_match, g_keys, g_storages, g_results);
+    for (int k = 0; k < num_match; k++) {
+        int i = ctx.items[k].idx; /* 原地压缩，ctx.num <= k */
+
+        results[i] = g_results[k];
+        if (results[i]) continue;
+        ctx.items[ctx.num].storage = g_storages[k];
+        ctx.items[ctx.num].key     = keys[i];
+        ctx.items[ctx.num].idx     = i;
+        ctx.num++;
+    }
+    qsort(ctx.items, ctx.num, sizeof(batch_item_t), batch_item_cmp);
+
+    for (int begin = 0, end = 0; begin < ctx.num; begin = end) {
+        const storage_ctx_t *storage = ctx.items[begin].storage;
+        int                  _ret    = 0;
+
+        for (end = begin; end < ctx.num && ctx.items[end].storage == storage; end++)
+            ;
+
+        ctx.locked_begin = ctx.locked_end = begin;
+        for (int i = begin; i < end; i++) {
+            const batch_item_t *item = &ctx.items[i];
+            if (i == begin || strcmp(ctx.items[i - 1].key, item->key)) {
+                _ret = named_mutex_lock(io->nmtx_ns, item->key);
+                if (_ret) {
+                    logfE("[server::?] fail to lock " logFmtKey " in batch" logFmtRet, item->key, _ret);
+                    break;
+                }
+            }
+            ctx.locked_end    = i + 1;
+            g_keys[i - begin] = item->key;
+            if (type == _batch_set) g_in[i - begin] = in[item->idx];
+        }
+
+        if (!_ret) {
+            switch (type) {
+            case _batch_get:
+                _ret = storage_mget(storage, end - begin, g_keys, g_out, g_duration, g_results);
+                break;
+            case _batch_set:
+                _ret = storage_mset(storage, end - begin, g_keys, g_in, g_results);
+                break;
+            case _batch_del:
+                _ret = storage_mdel(storage, end - begin, g_keys, g_results);
+                break;
+            }
+            route_report(io->route, storage, _ret);
+        } else {
+            route_report(io->route, storage, EAGAIN);
+        }
+
+        for (int i = begin; i < end; i++) {
+            const batch_item_t *item = &ctx.items[i];
+            int                 j    = i - begin;
+
+            results[item->idx] = _ret ? _ret : g_results[j];
+            if (results[item->idx]) continue;
+            if (type == _batch_get) {
+                out[item->idx]       = g_out[j];
+                durations[item->idx] = g_duration[j];
+            }
+            if (io->cache) {
+                if (type == _batch_get) cache_set(io->cache, item->key, g_out[j], g_duration[j]);
+                else if (type == _batch_set) cache_set(io->cache, item->key, in[item->idx], 0);
+                else cache_del(io->cache, item->key);
+            }
+        }
+        if (type != _batch_get) {
+            for (int i = begin; i < end; i++)
+                generation_bump(ctx.items[i].key);
+        }
+
+        batch_unlock(&ctx);
+    }
+
+    pthread_cleanup_pop(true);
+
+exit:
+    free(g_keys);
+    free(g_in);
+    free(g_out);
+    free(g_duration);
+    free(g_results);
+    free(g_storages);
+    return ret;
+}
+
+#define SCAN_STORAGE_MAX 16
+
+struct scan_source {
+    storage_entry_t *entries;
+    int              num;
+    int              pos;
+};
+
+struct scan_ctx {
+    void                *route;
+    const storage_ctx_t *storages[SCAN_STORAGE_MAX];
+    int                  num_storages;
+    int                  num_sources;
+    struct scan_source   sources[SCAN_STORAGE_MAX + 1]; /* 依次是各存储和cache */
+    storage_entry_t     *block;
+};
+
+static void scan_cleanup(struct scan_ctx *ctx) {
+    for (int i = 0; i < ctx->num_sources; i++) {
+        struct scan_source *source = &ctx->sources[i];
+        storage_entries_free(&source->entries[source->pos], source->num - source->pos);
+    }
+    /* 没有扫描到的存储（前一个存储失败或被取消）归还可能的探测机会 */
+    for (int i = ctx->num_sources; i < ctx->num_storages; i++)
+        route_report(ctx->route, ctx->storages[i], EAGAIN);
+    for (int i = 0; i < ctx->num_storages; i++)
+        route_deref(ctx->route, ctx->storages[i]);
+    free(ctx->block);
+}
+
+/**
+ * @brief 合并cache和各存储的扫描结果，同一个key优先取路由在前的存储，其次是cache
+ */
+int io_scan(const io_ctx_t *io, const char *prefix, const char *cursor, int limit, storage_entry_t entries[],
+            int *num) {
+    int             ret = 0;
+    struct scan_ctx ctx = {.route = io->route};
+
+    *num = 0;
+    if (limit <= 0) return 0;
+
+    ret = route_match_prefix(io->route, prefix, ctx.storages, SCAN_STORAGE_MAX, &ctx.num_storages);
+    if (ret && ret != ENOENT) return ret;
+    ret             = 0;
+    int num_sources = ctx.num_storages + (io->cache ? 1 : 0);
+    ctx.block       = calloc((size_t)num_sources * limit, sizeof(storage_entry_t));
+    if (num_sources && !ctx.block) {
+        ret = errno;
+        for (int i = 0; i < ctx.num_storages; i++) {
+            route_report(io->route, ctx.storages[i], EAGAIN);
+            route_deref(io->route, ctx.storages[i]);
+        }
+        return ret;
+    }
+
+    pthread_cleanup_push((void (*)(void *))scan_cleanup, &ctx);
+
+    for (int i = 0; i < num_sources; i++, ctx.num_sources++) {
+        struct scan_source *source = &ctx.sources[i];
+        source->entries            = &ctx.block[i * limit];
+        if (i < ctx.num_storages) {
+            int _ret = storage_scan(ctx.storages[i], prefix, cursor, limit, source->entries, &source->num);
+            route_report(io->route, ctx.storages[i], _ret == EOPNOTSUPP ? EAGAIN : _ret);
+            if (_ret == EOPNOTSUPP) continue;
+            if (_ret) {
+                /* 不返回缺少一个存储的结果，否则调用者会误以为扫描已完成 */
+                ret = _ret;
+                ctx.num_sources++;
+                break;
+            }
+        } else {
+            cache_scan(io->cache, prefix, cursor ? cursor : "", limit, source->entries, &source->num);
+        }
+    }
+
+    while (!ret && *num < limit) {
+        struct scan_source *min = NULL;
+        for (int i = 0; i < ctx.num_sources; i++) {
+            struct scan_source *source = &ctx.sources[i];
+            if (source->pos >= source->num) continue;
+            if (!min || strcmp(source->entries[source->pos].key, min->entries[min->pos].key) < 0) min = source;
+        }
+        if (!min) break;
+
+        storage_entry_t *entry = &entries[(*num)++];
+        *entry                 = min->entries[min->pos++];
+        for (int i = 0; i < ctx.num_sources; i++) {
+            struct scan_source *source = &ctx.sources[i];
+            while (source->pos < source->num && !strcmp(source->entries[source->pos].key, entry->key)) {
+                storage_entries_free(&source->entries[source->pos++], 1);
+            }
+        }
+    }
+
+    pthread_cleanup_pop(true);
+    return ret;
+}
+
+int io_mget(const io_ctx_t *io, int num, const char *const keys[], const value_t *values[], timestamp_t durations[],
+            int results[]) {
+    return io_batch(io, _batch_get, num, keys, NULL, values, durations, results);
+}
+
+int io_mset(const io_ctx_t *io, int num, const char *const keys[], const value_t *const values[], int results[]) {
+    return io_batch(io, _batch_set, num, keys, values, NULL, NULL, results);
+}
+
+int io_mdel(const io_ctx_t *io, int num, const char *const keys[], int results[]) {
+    return io_batch(io, _batch_del, num, keys, NULL, NULL, NULL, results);
+}
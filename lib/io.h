@@ -50,6 +50,31 @@ typedef struct io_ctx io_ctx_t;
  * @return int errno
  */
 int io_get(const io_ctx_t *io, const char *key, const value_t **value, timestamp_t *duration);
+/**
+ * @brief Get key on server end into caller's buffer
+ *
+ * @param io
+ * @param key
+ * @param value 调用者持有的buffer（*size为0时可以为NULL），容量不足时重新分配
+ * @param size *value的容量（字节，包括value_t）
+ * @param duration
+ * @param storage 存储支持异步时，返回已匹配（并引用）的存储，应交给io_get_async
+ * @return int errno (ENOMEM ...)；EAGAIN表示存储支持异步，应使用io_get_async
+ */
+int io_get_buf(const io_ctx_t *io, const char *key, value_t **value, uint32_t *size, timestamp_t *duration,
+               const storage_ctx_t **storage);
+/**
+ * @brief Get key on server end asynchronously
+ *
+ * 不在等待存储的过程中持有key锁，完成时更新cache。不再查找cache和路由（由io_get_buf完成）
+ *
+ * @param io
+ * @param key
+ * @param storage io_get_buf返回EAGAIN时交出的存储（接管其引用）
+ * @param done 总会被调用一次（可能在返回前，也可能在其他线程）
+ * @param arg
+ */
+void io_get_async(const io_ctx_t *io, const char *key, const storage_ctx_t *storage, storage_done_t done, void *arg);
 /**
  * @brief Update key cache on server end (Only used in register_child of ctrl server)
  *
@@ -59,6 +84,15 @@ int io_get(const io_ctx_t *io, const char *key, const value_t **value, timestamp
  * @return int errno
  */
 int io_update(const io_ctx_t *io, const char *key, const storage_ctx_t *storage);
+/**
+ * @brief Evict key cache on server end when a storage reports it changed outside (storage_changed_t, see storage_watch)
+ *
+ * 持有key锁时删除，确保进行中的读取不会把旧值写回cache
+ *
+ * @param io
+ * @param key NULL时清空cache
+ */
+void io_changed(const io_ctx_t *io, const char *key);
 /**
  * @brief Set key on server end
  *
@@ -76,5 +110,52 @@ int io_set(const io_ctx_t *io, const char *key, const value_t *value);
  * @return int errno
  */
 int io_del(const io_ctx_t *io, const char *key);
+/**
+ * @brief Scan keys with prefix on server end (merge results of cache and all storages may hold such keys)
+ *
+ * @param io
+ * @param prefix
+ * @param cursor 从大于cursor的key开始（NULL或""表示从头开始）
+ * @param limit
+ * @param entries 至少limit个，value需要通过storage_entries_free释放
+ * @param num 返回的数量，小于limit时表示已经没有更多
+ * @return int errno (ENOMEM ...)；有存储无法扫描（ref. route_match_prefix，或存储返回错误）时失败，不返回部分结果
+ */
+int io_scan(const io_ctx_t *io, const char *prefix, const char *cursor, int limit, storage_entry_t entries[],
+            int *num);
+/**
+ * @brief Get keys in batch on server end (keys are grouped by route, each group is dispatched as one batch)
+ *
+ * @param io
+ * @param num
+ * @param keys
+ * @param values 返回每个key的值（失败的为NULL）
+ * @param durations
+ * @param results 返回每个key的errno
+ * @return int errno (ENOMEM)，为0时以results为准
+ */
+int io_mget(const io_ctx_t *io, int num, const char *const keys[], const value_t *values[], timestamp_t durations[],
+            int results[]);
+/**
+ * @brief Set keys in batch on server end
+ *
+ * @param io
+ * @param num
+ * @param keys
+ * @param values
+ * @param results 返回每个key的errno
+ * @return int errno (ENOMEM)，为0时以results为准
+ */
+int io_mset(const io_ctx_t *io, int num, const char *const keys[], const value_t *const values[], int results[]);
+/**
+ * @brief Del keys in batch on server end
+ *
+ * @param io
+ * @param num
+ * @param keys
+ * @param results 返回每个key的errno
+ * @return int errno (ENOMEM)，为0时以results为准
+ */
+int io_mdel(const io_ctx_t *io, int num, const char *const keys[], int results[]);
 
 #endif /* __PROPD_IO_H */
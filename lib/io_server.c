@@ -32,16 +32,30 @@
 #include "io_server.h"
 #include "global.h"
 #include "infra/thread_pool.h"
+#include "metrics.h"
+#include "misc.h"
+#include "trace.h"
 #include <errno.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
 #define logFmtHead "[server::io] "
 
+#define GET_BUF_SIZE    1024 /* 连接上get的buffer的初始容量（字节，包括value_t） */
+#define RESUME_RETRY_MS 1    /* 任务队列已满时，resumer重新提交的间隔（unit: ms） */
+#define SHED_WAIT_MS    100  /* 拒绝连接时，等待请求头到达、发送应答的时限（unit: ms） */
+#define SHED_MAX        64   /* 等待拒绝的连接数上限，超出时直接断开 */
+
 static int cred_check(const void *credbook, const struct ucred *cred, io_type_t type, const char *key) {
     int ret = 0;
     /* TODO */
@@ -50,47 +64,195 @@ static int cred_check(const void *credbook, const struct ucred *cred, io_type_t
 
 extern void unix_stream_discard(int connfd);
 
+enum conn_state {
+    _conn_busy = 0, /* 正在处理请求 */
+    _conn_parked,   /* worker已返回，等待get完成 */
+    _conn_done,     /* get已完成 */
+};
+
+struct worker_arg;
+
+/**
+ * 恢复暂停连接的队列：任务队列已满时，由专门的线程重试提交，完成get的线程不等待
+ */
+struct resumer {
+    void              *thread_pool;
+    pthread_mutex_t    mutex;
+    pthread_cond_t     not_empty;
+    struct worker_arg *head, *tail;
+    pthread_t          tid;
+};
+
+/**
+ * 等待拒绝的连接的队列：线程池繁忙时，由专门的线程等待请求头并以EBUSY应答，accept不等待
+ */
+struct shedder {
+    pthread_mutex_t    mutex;
+    pthread_cond_t     not_empty;
+    struct worker_arg *head, *tail;
+    unsigned int       num;
+    pthread_t          tid;
+};
+
 struct worker_arg {
+    void           *thread_pool;
+    struct resumer *resumer;
     const void     *credbook;
     const io_ctx_t *io_ctx;
     int             connfd; /* own */
     struct ucred    cred;   /* own */
+    int             cpu;    /* -1 means not pinned */
+    atomic_int      state;
+    char            key[NAME_MAX]; /* key of the outstanding get */
+    const value_t  *reply;         /* own, value of the completed get */
+    timestamp_t     reply_duration;
+    int             reply_result;
+    value_t        *buf;           /* own, reused by get */
+    uint32_t        buf_size;
+    timestamp_t     started; /* 收到当前请求头的时刻 */
+    trace_t         trace;   /* 当前请求的追踪记录 */
+
+    struct worker_arg *next; /* in resumer or shedder */
 };
 typedef struct worker_arg worker_arg_t;
 
-static int get(const worker_arg_t *arg, int connfd, const char *key) {
-    int            ret = 0;
-    ssize_t        n;
-    const value_t *value    = NULL;
-    timestamp_t    duration = 0;
+static int worker(worker_arg_t *arg);
 
-    ret = cred_check(arg->credbook, &arg->cred, _io_get, key);
-
-    if (!ret) {
-        ret = io_get(arg->io_ctx, key, &value, &duration);
-    }
+static int send_get_reply(int connfd, const char *key, const value_t *value, timestamp_t duration, int result) {
+    ssize_t n;
+    value_t undef = {.type = _value_undef, .length = 0};
 
+    if (result) value = &undef;
     n = send(connfd, &duration, sizeof(duration), MSG_NOSIGNAL);
-    if (n != sizeof(duration)) goto exit;
-    logfD(logFmtHead logFmtKey " >>>%d send duration %ld", key, connfd, duration);
+    if (n != sizeof(duration)) return EIO;
+    n = send(connfd, value, sizeof(value_t) + value->length, MSG_NOSIGNAL);
+    if (n != (ssize_t)(sizeof(value_t) + value->length)) return EIO;
+    n = send(connfd, &result, sizeof(result), MSG_NOSIGNAL);
+    if (n != sizeof(result)) return EIO;
+    logfD(logFmtHead logFmtKey " >>>%d send value with type %d length %d and duration %ld" logFmtRet, key, connfd,
+          value->type, value->length, duration, result);
+    return 0;
+}
 
-    if (!ret) {
-        n = send(connfd, value, sizeof(value_t) + value->length, MSG_NOSIGNAL);
-        if (n != (ssize_t)(sizeof(value_t) + value->length)) goto exit;
-        logfD(logFmtHead logFmtKey " >>>%d send value with type %d length %d", key, connfd, value->type, value->length);
-    } else {
-        value_t undef = {.type = _value_undef, .length = 0};
-        n             = send(connfd, &undef, sizeof(undef), MSG_NOSIGNAL);
-        if (n != sizeof(undef)) goto exit;
-        logfD(logFmtHead logFmtKey " >>>%d send undef value", key, connfd);
+static void resumer_cleanup(struct resumer *r) { pthread_mutex_unlock(&r->mutex); }
+
+/**
+ * @brief 断开未能恢复的连接（不再发送已完成的get的应答）
+ */
+static void resume_drop(worker_arg_t *arg) {
+    logfW(logFmtHead "<<<%d drop parked connection", arg->connfd);
+    close(arg->connfd);
+    free((void *)arg->reply);
+    free(arg->buf);
+    free(arg);
+}
+
+static void *resumer(struct resumer *r) {
+    const struct timespec ts = {.tv_sec = 0, .tv_nsec = RESUME_RETRY_MS * 1000000L};
+
+    for (;;) {
+        worker_arg_t *arg = NULL;
+
+        pthread_mutex_lock(&r->mutex);
+        pthread_cleanup_push((void (*)(void *))resumer_cleanup, r);
+        while (!r->head)
+            pthread_cond_wait(&r->not_empty, &r->mutex);
+        arg = r->head;
+        if (!(r->head = arg->next)) r->tail = NULL;
+        pthread_cleanup_pop(true);
+
+        /* 不阻塞提交：线程池停止后队列不再消耗，阻塞会使resumer无法被取消。只在重试的间隔中响应取消 */
+        pthread_cleanup_push((void (*)(void *))resume_drop, arg);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        while (thread_pool_try_submit(r->thread_pool, _prio_high, (int (*)(void *))worker, arg)) {
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+            nanosleep(&ts, NULL);
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        }
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        pthread_cleanup_pop(false);
     }
+    return NULL;
+}
 
-    free((void *)value);
-    return ret;
+/**
+ * @brief 将暂停的连接重新提交给线程池
+ *
+ * 运行在完成get的线程上（可能是存储的事件线程），不能阻塞：任务队列已满时交给resumer
+ */
+static void resume(worker_arg_t *arg) {
+    struct resumer *r = arg->resumer;
+
+    logfD(logFmtHead "<<<%d resume", arg->connfd);
+    if (!thread_pool_try_submit(arg->thread_pool, _prio_high, (int (*)(void *))worker, arg)) return;
+
+    arg->next = NULL;
+    pthread_mutex_lock(&r->mutex);
+    if (r->tail) r->tail->next = arg;
+    else r->head = arg;
+    r->tail = arg;
+    pthread_cond_signal(&r->not_empty);
+    pthread_mutex_unlock(&r->mutex);
+}
 
-exit:
-    free((void *)value);
-    return EIO;
+/**
+ * @brief 保存get的结果；连接已暂停时恢复它，由恢复后的worker发送应答
+ */
+static void get_done(worker_arg_t *arg, int result, const value_t *value, timestamp_t duration) {
+    trace_async_done(&arg->trace);
+    arg->reply          = value;
+    arg->reply_result   = result;
+    arg->reply_duration = duration;
+    if (atomic_exchange(&arg->state, _conn_done) == _conn_parked) resume(arg);
+}
+
+/**
+ * @brief 发送异步get的应答
+ *
+ * @return int errno (EIO)
+ */
+static int get_reply(worker_arg_t *arg) {
+    timestamp_t since = trace_since();
+    int         err   = send_get_reply(arg->connfd, arg->key, arg->reply, arg->reply_duration, arg->reply_result);
+    trace_add(_trace_send, since);
+    free((void *)arg->reply);
+    arg->reply = NULL;
+    trace_end(&arg->trace, arg->reply_result);
+    return err;
+}
+
+/**
+ * @brief 读取到连接的buffer中；存储支持异步时，未能立即完成则暂停连接并释放worker
+ *
+ * @return int errno (EIO)；EINPROGRESS表示连接已暂停，之后不能再访问arg
+ */
+static int get(worker_arg_t *arg, const char *key) {
+    int                  connfd   = arg->connfd;
+    int                  ret      = 0;
+    timestamp_t          duration = 0;
+    const storage_ctx_t *storage  = NULL;
+
+    snprintf(arg->key, sizeof(arg->key), "%s", key);
+
+    ret = cred_check(arg->credbook, &arg->cred, _io_get, arg->key);
+    if (!ret) ret = io_get_buf(arg->io_ctx, arg->key, &arg->buf, &arg->buf_size, &duration, &storage);
+    if (ret != EAGAIN) {
+        timestamp_t since = trace_since();
+        int         err   = send_get_reply(connfd, arg->key, arg->buf, duration, ret);
+        trace_add(_trace_send, since);
+        trace_end(&arg->trace, ret);
+        return err;
+    }
+
+    atomic_store(&arg->state, _conn_busy);
+    trace_async_begin(&arg->trace);
+    io_get_async(arg->io_ctx, arg->key, storage, (storage_done_t)get_done, arg);
+    if (atomic_exchange(&arg->state, _conn_parked) == _conn_busy) {
+        trace_detach(); /* 追踪记录随连接交由完成get的线程 */
+        logfD(logFmtHead logFmtKey " <<<%d park", key, connfd);
+        return EINPROGRESS;
+    }
+    return get_reply(arg);
 }
 
 static int set(const worker_arg_t *arg, int connfd, const char *key, const value_t *value_head) {
@@ -135,9 +297,205 @@ static int del(const worker_arg_t *arg, const char *key) {
     return ret;
 }
 
+static int batch(const worker_arg_t *arg, int connfd, io_type_t type, uint32_t num) {
+    int            ret     = 0;
+    ssize_t        n;
+    char         (*_keys)[NAME_MAX] = NULL;
+    const char   **keys             = NULL;
+    const value_t **values          = NULL;
+    timestamp_t   *durations        = NULL;
+    int           *results          = NULL;
+
+    _keys     = calloc(num, NAME_MAX);
+    keys      = calloc(num, sizeof(char *));
+    values    = calloc(num, sizeof(value_t *));
+    durations = calloc(num, sizeof(timestamp_t));
+    results   = calloc(num, sizeof(int));
+    if (!_keys || !keys || !values || !durations || !results) {
+        logfE(logFmtHead "<<<%d no memory to recv batch with %d keys, discard it", connfd, num);
+        unix_stream_discard(connfd);
+        ret = ENOMEM;
+        goto exit;
+    }
+
+    for (uint32_t i = 0; i < num; i++) {
+        n = recv(connfd, _keys[i], NAME_MAX, MSG_WAITALL);
+        if (n != NAME_MAX) goto exit_io;
+        _keys[i][NAME_MAX - 1] = '\0';
+        keys[i]                = _keys[i];
+
+        if (type == _io_mset) {
+            value_t value_head;
+            n = recv(connfd, &value_head, sizeof(value_head), MSG_WAITALL);
+            if (n != sizeof(value_head)) goto exit_io;
+            value_t *value = malloc(sizeof(value_t) + value_head.length);
+            if (!value) {
+                logfE(logFmtHead logFmtKey " <<<%d no memory to recv data of value, discard batch", keys[i], connfd);
+                unix_stream_discard(connfd);
+                ret = ENOMEM;
+                goto exit;
+            }
+            memcpy(value, &value_head, sizeof(value_t));
+            values[i] = value;
+            n         = recv(connfd, value->data, value->length, MSG_WAITALL);
+            if (n != value->length) goto exit_io;
+        }
+    }
+    logfD(logFmtHead "<<<%d recv batch with type %d and %d keys", connfd, type, num);
+
+    /* 将通过权限检查的key依次前移，批量请求后再分散回原位置 */
+    uint32_t allowed = 0;
+    for (uint32_t i = 0; i < num; i++) {
+        results[i] = cred_check(arg->credbook, &arg->cred, type - _io_mget, keys[i]);
+        if (results[i]) {
+            free((void *)values[i]);
+            values[i] = NULL;
+            continue;
+        }
+        keys[allowed]   = keys[i];
+        values[allowed] = values[i];
+        if (allowed != i) values[i] = NULL;
+        allowed++;
+    }
+
+    if (allowed) {
+        int sub_results[allowed];
+        switch (type) {
+        case _io_mget:
+            ret = io_mget(arg->io_ctx, allowed, keys, values, durations, sub_results);
+            break;
+        case _io_mset:
+            ret = io_mset(arg->io_ctx, allowed, keys, values, sub_results);
+            break;
+        case _io_mdel:
+            ret = io_mdel(arg->io_ctx, allowed, keys, sub_results);
+            break;
+        }
+        for (uint32_t i = num, j = allowed; i-- > 0;) {
+            if (results[i]) continue;
+            j--;
+            results[i] = ret ? ret : sub_results[j];
+            if (j != i) {
+                values[i]    = values[j];
+                durations[i] = durations[j];
+                values[j]    = NULL;
+                durations[j] = 0;
+            }
+        }
+        ret = 0;
+    }
+
+exit:
+    /* ret非0时（可能有数组未分配）不访问各数组，仍逐个应答以便对端解析 */
+    for (uint32_t i = 0; i < num; i++) {
+        int result = ret ? ret : results[i];
+        if (type == _io_mget) {
+            const char    *key      = _keys ? _keys[i] : "";
+            const value_t *value    = ret ? NULL : values[i];
+            timestamp_t    duration = ret ? 0 : durations[i];
+            if (send_get_reply(connfd, key, value, duration, result)) goto exit_io;
+        } else {
+            n = send(connfd, &result, sizeof(result), MSG_NOSIGNAL);
+            if (n != sizeof(result)) goto exit_io;
+        }
+    }
+    goto exit_free;
+
+exit_io:
+    ret = EIO;
+exit_free:
+    if (values) {
+        for (uint32_t i = 0; i < num; i++)
+            free((void *)values[i]);
+    }
+    free(_keys);
+    free(keys);
+    free(values);
+    free(durations);
+    free(results);
+    return ret;
+}
+
+/**
+ * @brief 按页（IO_BATCH_MAX）扫描，边扫描边发送
+ */
+static int scan(const worker_arg_t *arg, int connfd, const char *prefix, const value_t *value_head) {
+    int              ret = 0;
+    ssize_t          n;
+    io_scan_t        req;
+    storage_entry_t *entries       = NULL;
+    uint32_t         sent          = 0;
+    char             end[NAME_MAX] = {0};
+
+    if (value_head->length != sizeof(req)) {
+        logfE(logFmtHead logFmtKey " <<<%d scan with invalid length %d, discard it", prefix, connfd,
+              value_head->length);
+        unix_stream_discard(connfd);
+        ret = EPROTO;
+        goto exit;
+    }
+    n = recv(connfd, &req, sizeof(req), MSG_WAITALL);
+    if (n != sizeof(req)) return EIO;
+    req.cursor[NAME_MAX - 1] = '\0';
+    logfD(logFmtHead logFmtKey " <<<%d recv scan after " logFmtKey " limit %d", prefix, connfd, req.cursor, req.limit);
+
+    entries = calloc(IO_BATCH_MAX, sizeof(storage_entry_t));
+    if (!entries) {
+        ret = ENOMEM;
+        goto exit;
+    }
+
+    for (;;) {
+        int limit = IO_BATCH_MAX, num = 0;
+        if (req.limit && req.limit - sent < (uint32_t)limit) limit = req.limit - sent;
+        if (!limit) break;
+
+        ret = io_scan(arg->io_ctx, prefix, req.cursor, limit, entries, &num);
+        if (ret) break;
+
+        for (int i = 0; i < num; i++) {
+            int result = cred_check(arg->credbook, &arg->cred, _io_get, entries[i].key);
+            if (send(connfd, entries[i].key, NAME_MAX, MSG_NOSIGNAL) != NAME_MAX ||
+                send_get_reply(connfd, entries[i].key, entries[i].value, entries[i].duration, result)) {
+                storage_entries_free(entries, num);
+                free(entries);
+                return EIO;
+            }
+        }
+        sent += num;
+        if (num) snprintf(req.cursor, sizeof(req.cursor), "%s", entries[num - 1].key);
+        storage_entries_free(entries, num);
+        if (num < limit) break;
+    }
+    logfD(logFmtHead logFmtKey " >>>%d send %d keys in scan", prefix, connfd, sent);
+
+exit:
+    free(entries);
+    n = send(connfd, end, sizeof(end), MSG_NOSIGNAL);
+    if (n != sizeof(end)) return EIO;
+    return ret;
+}
+
 static int worker(worker_arg_t *arg) {
-    int ret    = 0;
-    int connfd = arg->connfd;
+    int       ret    = 0;
+    int       connfd = arg->connfd;
+    int       cpu    = arg->cpu;
+    cpu_set_t saved;
+
+    if (cpu >= 0) {
+        pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved);
+        thread_bind_cpulist(pthread_self(), &(unsigned short){cpu}, 1);
+        logfD(logFmtHead "<<<%d pinned on cpu%d", connfd, cpu);
+    }
+
+    if (atomic_load(&arg->state) == _conn_done) {
+        /* 恢复暂停的连接，先发送完成的get的应答 */
+        atomic_store(&arg->state, _conn_busy);
+        trace_attach(&arg->trace);
+        ret = get_reply(arg);
+        metrics_record(_hist_io_get, timestamp(true) - arg->started);
+        if (ret) goto exit;
+    }
 
     for (;;) {
         io_package_t pkg_head;
@@ -155,20 +513,45 @@ static int worker(worker_arg_t *arg) {
         }
         logfD(logFmtHead logFmtKey " <<<%d recv header of package with type %d, created at %lxms", pkg_head.key, connfd,
               pkg_head.type, timestamp_to_ms(pkg_head.created));
+        arg->started = timestamp(true);
+        trace_begin(&arg->trace, &pkg_head, arg->started);
 
         switch (pkg_head.type) {
         case _io_get:
-            result = get(arg, connfd, pkg_head.key);
-            break;
+            /* get自行发送result */
+            ret = get(arg, pkg_head.key);
+            if (ret == EINPROGRESS) goto parked;
+            metrics_record(_hist_io_get, timestamp(true) - arg->started);
+            if (ret) goto exit;
+            continue;
         case _io_set:
             result = set(arg, connfd, pkg_head.key, &pkg_head.value);
             break;
         case _io_del:
             result = del(arg, pkg_head.key);
             break;
+        case _io_mget:
+        case _io_mset:
+        case _io_mdel:
+            if (!pkg_head.value.length || pkg_head.value.length > IO_BATCH_MAX) {
+                logfE(logFmtHead "<<<%d batch with %d keys is out of range", connfd, pkg_head.value.length);
+                ret = EPROTO;
+                goto exit;
+            }
+            result = batch(arg, connfd, pkg_head.type, pkg_head.value.length);
+            break;
+        case _io_scan:
+            pkg_head.key[NAME_MAX - 1] = '\0';
+            result                     = scan(arg, connfd, pkg_head.key, &pkg_head.value);
+            break;
         }
 
-        n = send(connfd, &result, sizeof(result), MSG_NOSIGNAL);
+        timestamp_t since = trace_since();
+        n                 = send(connfd, &result, sizeof(result), MSG_NOSIGNAL);
+        trace_add(_trace_send, since);
+        if (pkg_head.type <= _io_scan)
+            metrics_record((enum metrics_histogram)(_hist_io_get + pkg_head.type), timestamp(true) - arg->started);
+        trace_end(&arg->trace, result);
         if (n != sizeof(result)) {
             ret = EIO;
             break;
@@ -176,24 +559,221 @@ static int worker(worker_arg_t *arg) {
         logfD(logFmtHead logFmtKey " >>>%d send result" logFmtRet, pkg_head.key, connfd, result);
     }
 
-    close(arg->connfd);
+exit:
+    trace_end(&arg->trace, ret);
+    if (cpu >= 0) {
+        pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+    }
+    close(connfd);
+    free(arg->buf);
     free(arg);
     return ret;
+
+parked:
+    /* 连接在get完成后恢复，不能再访问arg */
+    if (cpu >= 0) {
+        pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+    }
+    return 0;
+}
+
+/**
+ * @brief 接收并丢弃len个字节（对端尚未发完请求时断开，会使其发送失败而收不到应答）
+ *
+ * @return int errno (EIO)
+ */
+static int shed_discard(int connfd, size_t len) {
+    char discard[256];
+
+    while (len) {
+        ssize_t n = recv(connfd, discard, len < sizeof(discard) ? len : sizeof(discard), 0);
+        if (n <= 0) return EIO;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief 以EBUSY应答连接上的首个请求，然后断开
+ *
+ * 至多等待SHED_WAIT_MS让请求头到达，并收完整个请求；应答与正常处理时格式相同（批量请求逐个key应答，扫描以空key结束）
+ *
+ * @param arg
+ */
+static void shed(worker_arg_t *arg) {
+    int            connfd = arg->connfd;
+    int            result = EBUSY;
+    int            err    = 0;
+    io_package_t   pkg_head;
+    ssize_t        n   = 0;
+    struct pollfd  pfd = {.fd = connfd, .events = POLLIN};
+    struct timeval tv  = {.tv_sec = 0, .tv_usec = SHED_WAIT_MS * 1000};
+
+    if (poll(&pfd, 1, SHED_WAIT_MS) > 0) n = recv(connfd, &pkg_head, sizeof(pkg_head), MSG_DONTWAIT);
+    if (n != sizeof(pkg_head)) {
+        logfW(logFmtHead "<<<%d shed without request", connfd);
+        goto exit;
+    }
+    setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(connfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    switch (pkg_head.type) {
+    case _io_get:
+        /* get的应答已包含result */
+        err = send_get_reply(connfd, pkg_head.key, NULL, 0, result);
+        goto exit_log;
+    case _io_set:
+        err = shed_discard(connfd, pkg_head.value.length);
+        break;
+    case _io_del:
+        break;
+    case _io_mget:
+    case _io_mset:
+    case _io_mdel:
+        if (!pkg_head.value.length || pkg_head.value.length > IO_BATCH_MAX) {
+            logfE(logFmtHead "<<<%d batch with %d keys is out of range", connfd, pkg_head.value.length);
+            goto exit;
+        }
+        for (uint32_t i = 0; i < pkg_head.value.length && !err; i++) {
+            value_t value_head;
+
+            err = shed_discard(connfd, NAME_MAX);
+            if (!err && pkg_head.type == _io_mset) {
+                if (recv(connfd, &value_head, sizeof(value_head), MSG_WAITALL) != sizeof(value_head)) err = EIO;
+                else err = shed_discard(connfd, value_head.length);
+            }
+        }
+        for (uint32_t i = 0; i < pkg_head.value.length && !err; i++) {
+            if (pkg_head.type == _io_mget) {
+                err = send_get_reply(connfd, "", NULL, 0, result);
+            } else if (send(connfd, &result, sizeof(result), MSG_NOSIGNAL) != sizeof(result)) {
+                err = EIO;
+            }
+        }
+        break;
+    case _io_scan: {
+        char end[NAME_MAX] = {0};
+
+        err = shed_discard(connfd, pkg_head.value.length);
+        if (!err && send(connfd, end, sizeof(end), MSG_NOSIGNAL) != sizeof(end)) err = EIO;
+    } break;
+    default:
+        logfE(logFmtHead "<<<%d shed request with unknown type %d", connfd, pkg_head.type);
+        goto exit;
+    }
+    if (!err && send(connfd, &result, sizeof(result), MSG_NOSIGNAL) != sizeof(result)) err = EIO;
+
+exit_log:
+    logfW(logFmtHead logFmtKey " <<<%d %s request with type %d", pkg_head.key, connfd, err ? "fail to shed" : "shed",
+          pkg_head.type);
+
+exit:
+    close(connfd);
+    free(arg->buf);
+    free(arg);
+}
+
+static void shedder_cleanup(struct shedder *s) { pthread_mutex_unlock(&s->mutex); }
+
+static void *shedder(struct shedder *s) {
+    for (;;) {
+        worker_arg_t *arg = NULL;
+
+        pthread_mutex_lock(&s->mutex);
+        pthread_cleanup_push((void (*)(void *))shedder_cleanup, s);
+        while (!s->head)
+            pthread_cond_wait(&s->not_empty, &s->mutex);
+        arg = s->head;
+        if (!(s->head = arg->next)) s->tail = NULL;
+        s->num--;
+        pthread_cleanup_pop(true);
+
+        /* 耗时至多几个SHED_WAIT_MS */
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        shed(arg);
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    }
+    return NULL;
+}
+
+/**
+ * @brief 线程池繁忙时，把连接交给shedder拒绝；shedder积压过多时直接断开
+ */
+static void shed_later(struct shedder *s, worker_arg_t *arg) {
+    pthread_mutex_lock(&s->mutex);
+    if (s->num >= SHED_MAX) {
+        pthread_mutex_unlock(&s->mutex);
+        logfW(logFmtHead "<<<%d shed without waiting for request", arg->connfd);
+        close(arg->connfd);
+        free(arg->buf);
+        free(arg);
+        return;
+    }
+    arg->next = NULL;
+    if (s->tail) s->tail->next = arg;
+    else s->head = arg;
+    s->tail = arg;
+    s->num++;
+    pthread_cond_signal(&s->not_empty);
+    pthread_mutex_unlock(&s->mutex);
 }
 
 struct ctx {
     void              *thread_pool;
     const void        *credbook;
     const io_ctx_t    *io_ctx;
+    unsigned short    *cpus;     /* own, NULL means not pinned */
+    unsigned short     num_cpus;
+    unsigned int       next_cpu;
     int                sockfd;   /* own */
     struct sockaddr_un servaddr; /* own */
+    struct resumer     resumer;  /* own */
+    struct shedder     shedder;  /* own */
 };
 typedef struct ctx ctx_t;
 
+/**
+ * @brief 停止resumer，断开仍在等待恢复的连接
+ */
+static void resumer_stop(struct resumer *r) {
+    pthread_cancel(r->tid);
+    pthread_join(r->tid, NULL);
+    while (r->head) {
+        worker_arg_t *arg = r->head;
+        r->head           = arg->next;
+        resume_drop(arg);
+    }
+    r->tail = NULL;
+    pthread_cond_destroy(&r->not_empty);
+    pthread_mutex_destroy(&r->mutex);
+}
+
+/**
+ * @brief 停止shedder，断开仍在等待拒绝的连接
+ */
+static void shedder_stop(struct shedder *s) {
+    pthread_cancel(s->tid);
+    pthread_join(s->tid, NULL);
+    while (s->head) {
+        worker_arg_t *arg = s->head;
+        s->head           = arg->next;
+        close(arg->connfd);
+        free(arg->buf);
+        free(arg);
+    }
+    s->tail = NULL;
+    s->num  = 0;
+    pthread_cond_destroy(&s->not_empty);
+    pthread_mutex_destroy(&s->mutex);
+}
+
 static void server_cleanup(ctx_t *ctx) {
     logfD(logFmtHead "cleanup server");
+    shedder_stop(&ctx->shedder);
+    resumer_stop(&ctx->resumer);
     unlink(ctx->servaddr.sun_path);
     close(ctx->sockfd);
+    free(ctx->cpus);
     free(ctx);
 }
 
@@ -209,8 +789,16 @@ static void *server(ctx_t *ctx) {
             break;
         }
 
-        arg->credbook = ctx->credbook;
-        arg->io_ctx   = ctx->io_ctx;
+        arg->thread_pool = ctx->thread_pool;
+        arg->resumer     = &ctx->resumer;
+        arg->credbook    = ctx->credbook;
+        arg->io_ctx      = ctx->io_ctx;
+        arg->cpu         = ctx->cpus ? ctx->cpus[ctx->next_cpu++ % ctx->num_cpus] : -1;
+        arg->buf         = NULL;
+        arg->buf_size    = 0;
+        arg->reply       = NULL;
+        arg->trace.id    = 0;
+        atomic_init(&arg->state, _conn_busy);
 
         pthread_cleanup_push(free, arg);
         arg->connfd = accept(ctx->sockfd, (struct sockaddr *)&cliaddr, &(socklen_t){sizeof(cliaddr)});
@@ -222,17 +810,23 @@ static void *server(ctx_t *ctx) {
         }
         pthread_cleanup_pop(false);
 
+        /* 预先分配，多数get不必扩容；分配失败时由get按需分配 */
+        if ((arg->buf = malloc(GET_BUF_SIZE))) arg->buf_size = GET_BUF_SIZE;
+
         getsockopt(arg->connfd, SOL_SOCKET, SO_PEERCRED, &arg->cred, &(socklen_t){sizeof(arg->cred)});
         logfV(logFmtHead "accept p%d,u%d,g%d path %s as %d", arg->cred.pid, arg->cred.uid, arg->cred.gid,
               cliaddr.sun_path[0] ? cliaddr.sun_path : "?", arg->connfd);
-        thread_pool_submit(ctx->thread_pool, (int (*)(void *))worker, arg, false);
+        if (thread_pool_try_submit(ctx->thread_pool, _prio_high, (int (*)(void *))worker, arg)) {
+            shed_later(&ctx->shedder, arg);
+        }
     }
 
     pthread_cleanup_pop(true);
     return NULL;
 }
 
-int start_io_server(const char *name, void *thread_pool, const void *credbook, const io_ctx_t *io_ctx, pthread_t *tid) {
+int start_io_server(const char *name, void *thread_pool, const void *credbook, const io_ctx_t *io_ctx,
+                    const unsigned short *cpus, unsigned short num_cpus, pthread_t *tid) {
     int    ret = 0;
     ctx_t *ctx = calloc(1, sizeof(ctx_t));
     if (!ctx) return errno;
@@ -241,6 +835,13 @@ int start_io_server(const char *name, void *thread_pool, const void *credbook, c
     ctx->credbook    = credbook;
     ctx->io_ctx      = io_ctx;
 
+    if (cpus && num_cpus) {
+        ctx->cpus = calloc(num_cpus, sizeof(unsigned short));
+        if (!ctx->cpus) goto exit_ctx;
+        memcpy(ctx->cpus, cpus, num_cpus * sizeof(unsigned short));
+        ctx->num_cpus = num_cpus;
+    }
+
     ctx->sockfd = socket(AF_LOCAL, SOCK_STREAM, 0);
     if (ctx->sockfd == -1) {
         logfE(logFmtHead "fail to get socket" logFmtErrno, logArgErrno);
@@ -263,11 +864,35 @@ int start_io_server(const char *name, void *thread_pool, const void *credbook, c
     }
     logfI(logFmtHead "listen at %s", servaddr->sun_path);
 
+    ctx->resumer.thread_pool = thread_pool;
+    pthread_mutex_init(&ctx->resumer.mutex, NULL);
+    pthread_cond_init(&ctx->resumer.not_empty, NULL);
+    ret = pthread_create(&ctx->resumer.tid, NULL, (void *(*)(void *))resumer, &ctx->resumer);
+    if (ret) {
+        logfE(logFmtHead "fail to pthread_create resumer" logFmtRet, ret);
+        errno = ret;
+        goto exit_resumer;
+    }
+
+    pthread_mutex_init(&ctx->shedder.mutex, NULL);
+    pthread_cond_init(&ctx->shedder.not_empty, NULL);
+    ret = pthread_create(&ctx->shedder.tid, NULL, (void *(*)(void *))shedder, &ctx->shedder);
+    if (ret) {
+        logfE(logFmtHead "fail to pthread_create shedder" logFmtRet, ret);
+        errno = ret;
+        pthread_cond_destroy(&ctx->shedder.not_empty);
+        pthread_mutex_destroy(&ctx->shedder.mutex);
+        resumer_stop(&ctx->resumer);
+        goto exit_sun_path;
+    }
+
     pthread_t _tid;
     ret = pthread_create(&_tid, NULL, (void *(*)(void *))server, ctx);
     if (ret) {
         logfE(logFmtHead "fail to pthread_create" logFmtRet, ret);
         errno = ret;
+        shedder_stop(&ctx->shedder);
+        resumer_stop(&ctx->resumer);
         goto exit_sun_path;
     }
 
@@ -275,11 +900,15 @@ int start_io_server(const char *name, void *thread_pool, const void *credbook, c
     else pthread_join(_tid, NULL);
     return 0;
 
+exit_resumer:
+    pthread_cond_destroy(&ctx->resumer.not_empty);
+    pthread_mutex_destroy(&ctx->resumer.mutex);
 exit_sun_path:
     unlink(ctx->servaddr.sun_path);
 exit_listenfd:
     close(ctx->sockfd);
 exit_ctx:
+    free(ctx->cpus);
     free(ctx);
     return errno;
 }
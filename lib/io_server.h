@@ -41,12 +41,45 @@ enum io_type {
     _io_get = 0,
     _io_set,
     _io_del,
+    _io_mget,
+    _io_mset,
+    _io_mdel,
+    _io_scan,
 };
 typedef uint8_t io_type_t;
 
+/**
+ * 批量请求（_io_mget/_io_mset/_io_mdel）：
+ * - 请求头中 key 不使用，value.length 为 key 的数量（不超过 IO_BATCH_MAX）
+ * - 随后依次是每个 key（char[NAME_MAX]），_io_mset 时每个 key 后紧跟其 value
+ * - 应答依次是每个 key 的应答（与单个 get/set/del 相同），最后是整个批量请求的 result
+ */
+#define IO_BATCH_MAX 256
+
+/**
+ * 扫描请求（_io_scan）：
+ * - 请求头中 key 为前缀，value.length 为 sizeof(io_scan_t)，随后是 io_scan_t
+ * - 应答依次是每个 key（char[NAME_MAX]）及其应答（与单个 get 相同），以空 key 结束，最后是整个请求的 result
+ */
+struct io_scan {
+    uint32_t limit;            /* 0 means no limit */
+    char     cursor[NAME_MAX]; /* 从大于cursor的key开始（""表示从头开始） */
+} __attribute__((packed));
+typedef struct io_scan io_scan_t;
+
+/**
+ * 追踪上下文（ref. trace.h）：id为0表示不追踪；父节点转发给子节点时，hop加1
+ */
+struct io_trace {
+    uint64_t id;
+    uint8_t  hop;
+} __attribute__((packed));
+typedef struct io_trace io_trace_t;
+
 struct io_package {
     io_type_t   type;
     timestamp_t created;
+    io_trace_t  trace;
     char        key[NAME_MAX];
     value_t     value;
 } __attribute__((packed));
@@ -61,9 +94,12 @@ typedef struct io_package io_package_t;
  * @param thread_pool
  * @param credbook
  * @param io_ctx
+ * @param cpus 每个连接依次固定在其中一个CPU上处理；传入NULL时，不固定
+ * @param num_cpus
  * @param tid 返回IO server线程id，用于终止；传入NULL时，阻塞等待
  * @return int errno
  */
-int start_io_server(const char *name, void *thread_pool, const void *credbook, const io_ctx_t *io_ctx, pthread_t *tid);
+int start_io_server(const char *name, void *thread_pool, const void *credbook, const io_ctx_t *io_ctx,
+                    const unsigned short *cpus, unsigned short num_cpus, pthread_t *tid);
 
 #endif /* __PROPD_IO_SERVER_H */
@@ -96,7 +96,14 @@ static int parse_pos(const cJSON *item, pos_t *pos) {
     return 0;
 }
 
-pos_t *layout_parse(const char *config) {
+static void pos_destroy(pos_t *pos) {
+    for (int i = 0; pos[i].key != LST_SEARCH_ID_END; i++) {
+        free((void *)pos[i].name);
+    }
+    free(pos);
+}
+
+layout_t *layout_parse(const char *config) {
     void *data = file_read(config);
     if (!data) return NULL;
 
@@ -108,40 +115,49 @@ pos_t *layout_parse(const char *config) {
         return NULL;
     }
 
-    int    length = cJSON_GetArraySize(json);
-    pos_t *layout = (pos_t *)calloc(length + 1, sizeof(pos_t));
-    if (!layout) {
+    int       length = cJSON_GetArraySize(json);
+    layout_t *layout = (layout_t *)malloc(sizeof(layout_t));
+    pos_t    *pos    = (pos_t *)calloc(length + 1, sizeof(pos_t));
+    if (!layout || !pos) {
         logfE("fail to alloc layout contains %d pos", length);
+        free(layout);
+        free(pos);
         cJSON_Delete(json);
         free(data);
         return NULL;
     }
 
-    layout[length].key = LST_SEARCH_ID_END;
+    pos[length].key = LST_SEARCH_ID_END;
     for (int i = 0; i < length; i++) {
-        if (parse_pos(cJSON_GetArrayItem(json, i), &layout[i])) {
+        if (parse_pos(cJSON_GetArrayItem(json, i), &pos[i])) {
             logfE("fail to parse %dth pos", i);
-            for (int j = 0; j < i; j++) {
-                free((void *)layout[j].name);
-            }
+            pos[i].key = LST_SEARCH_ID_END;
+            pos_destroy(pos);
             free(layout);
             cJSON_Delete(json);
             free(data);
             return NULL;
         }
-        layout[i].key = i;
+        pos[i].key = i;
     }
-
     cJSON_Delete(json);
     free(data);
+
+    layout->pos   = pos;
+    layout->index = lst_index_create(pos, sizeof(pos_t));
+    if (!layout->index) {
+        logfE("fail to index layout contains %d pos", length);
+        pos_destroy(pos);
+        free(layout);
+        return NULL;
+    }
     return layout;
 }
 
-void layout_destroy(pos_t *layout) {
+void layout_destroy(layout_t *layout) {
     if (!layout) return;
-    for (int i = 0; layout[i].key != LST_SEARCH_ID_END; i++) {
-        free((void *)layout[i].name);
-    }
+    lst_index_destroy(layout->index);
+    pos_destroy(layout->pos);
     free(layout);
 }
 
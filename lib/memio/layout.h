@@ -37,9 +37,21 @@
 extern "C" {
 #endif
 
-extern pos_t   *layout_parse(const char *config);
-extern void     layout_destroy(pos_t *layout);
-extern uint32_t layout_length(const pos_t *layout);
+typedef struct {
+    pos_t       *pos;   /* 以LST_SEARCH_ID_END结尾 */
+    lst_index_t *index; /* pos的索引 */
+} layout_t;
+
+extern layout_t *layout_parse(const char *config);
+extern void      layout_destroy(layout_t *layout);
+extern uint32_t  layout_length(const pos_t *layout);
+
+static inline const pos_t *layout_search(const layout_t *layout, uint32_t key) {
+    return lst_index_search_id(key, layout->index, pos_t);
+}
+static inline const pos_t *layout_search_by_name(const layout_t *layout, const char *name) {
+    return lst_index_search_st(name, layout->index, pos_t);
+}
 
 #ifdef __cplusplus
 }
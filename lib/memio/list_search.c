@@ -29,6 +29,7 @@
  */
 
 #include "list_search.h"
+#include <stdlib.h>
 #include <string.h>
 
 typedef struct {
@@ -59,3 +60,80 @@ const void *__lst_search(bool by_id, const void *idx, const void *lst, uint32_t
 
     return NULL;
 }
+
+struct lst_index {
+    const void *lst;
+    uint32_t    itmsz;
+    uint32_t    mask;  /* 槽位数减一，槽位数是2的幂 */
+    uint32_t   *by_id; /* 槽位保存表项序号加一，0表示空槽 */
+    uint32_t   *by_st;
+};
+
+static inline uint32_t hash_id(uint32_t id) { return id * 0x9e3779b1u; }
+
+static inline uint32_t hash_st(const char *st) {
+    uint32_t h = 2166136261u; /* FNV-1a */
+    while (*st) {
+        h ^= (uint8_t)*st++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static inline bool lst_idx_match(bool by_id, const void *idx, const index_t *idxp) {
+    return by_id ? idxp->id == *(uint32_t *)idx : !strcmp(idxp->st, (const char *)idx);
+}
+
+static uint32_t *lst_index_probe(const lst_index_t *index, bool by_id, const void *idx) {
+    uint32_t *slots = by_id ? index->by_id : index->by_st;
+    uint32_t  h     = by_id ? hash_id(*(uint32_t *)idx) : hash_st((const char *)idx);
+
+    for (uint32_t i = h & index->mask;; i = (i + 1) & index->mask) {
+        if (!slots[i] || lst_idx_match(by_id, idx, lst_idx_of(index->lst, index->itmsz, slots[i] - 1)))
+            return &slots[i];
+    }
+}
+
+lst_index_t *lst_index_create(const void *lst, uint32_t itmsz) {
+    uint32_t num   = 0;
+    uint32_t slots = 8;
+
+    while (((const index_t *)lst_idx_of(lst, itmsz, num))->id != LST_SEARCH_ID_END)
+        num++;
+    while (slots < num * 2) /* 装载率不超过1/2 */
+        slots <<= 1;
+
+    lst_index_t *index = malloc(sizeof(lst_index_t));
+    if (!index) return NULL;
+    index->lst   = lst;
+    index->itmsz = itmsz;
+    index->mask  = slots - 1;
+    index->by_id = calloc(slots, sizeof(uint32_t));
+    index->by_st = calloc(slots, sizeof(uint32_t));
+    if (!index->by_id || !index->by_st) {
+        lst_index_destroy(index);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < num; i++) {
+        const index_t *idxp = (const index_t *)lst_idx_of(lst, itmsz, i);
+        uint32_t      *slot = lst_index_probe(index, true, &idxp->id);
+        if (!*slot) *slot = i + 1;
+        if (!idxp->st) continue;
+        slot = lst_index_probe(index, false, idxp->st);
+        if (!*slot) *slot = i + 1;
+    }
+    return index;
+}
+
+void lst_index_destroy(lst_index_t *index) {
+    if (!index) return;
+    free(index->by_id);
+    free(index->by_st);
+    free(index);
+}
+
+const void *__lst_index_search(const lst_index_t *index, bool by_id, const void *idx) {
+    uint32_t *slot = lst_index_probe(index, by_id, idx);
+    return *slot ? lst_idx_of(index->lst, index->itmsz, *slot - 1) : NULL;
+}
@@ -58,6 +58,27 @@ static inline const void *__lst_search_st(const char *st, const void *lst, uint3
 #define lst_search_id(id, lst, tp) (tp *)__lst_search_id(id, lst, sizeof(tp))
 #define lst_search_st(st, lst, tp) (tp *)__lst_search_st(st, lst, sizeof(tp))
 
+/**
+ * @brief 列表的散列索引，按编号和名称查找的期望复杂度为O(1)
+ * @note 索引只引用列表，列表须在索引销毁前保持不变。编号或名称重复时，与线性查找一致，取第一个；名称为NULL的表项
+ * 不参与按名称索引
+ */
+typedef struct lst_index lst_index_t;
+
+extern lst_index_t *lst_index_create(const void *lst, uint32_t itmsz);
+extern void         lst_index_destroy(lst_index_t *index);
+extern const void  *__lst_index_search(const lst_index_t *index, bool by_id, const void *idx);
+
+static inline const void *__lst_index_search_id(uint32_t id, const lst_index_t *index) {
+    return __lst_index_search(index, true, (const void *)&id);
+}
+static inline const void *__lst_index_search_st(const char *st, const lst_index_t *index) {
+    return __lst_index_search(index, false, (const void *)st);
+}
+
+#define lst_index_search_id(id, index, tp) (tp *)__lst_index_search_id(id, index)
+#define lst_index_search_st(st, index, tp) (tp *)__lst_index_search_st(st, index)
+
 #ifdef __cplusplus
 }
 #endif
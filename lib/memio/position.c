@@ -30,7 +30,11 @@
 
 #include "position.h"
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 static inline uint32_t MaskShift(uint32_t mask) { return __builtin_ffs(mask) - 1; }
 static inline uint32_t MaskMax(uint32_t mask) { return mask >> MaskShift(mask); }
@@ -39,9 +43,10 @@ static inline uint32_t MaskWrite(uint32_t mask, uint32_t data, uint32_t value) {
     return (data & ~mask) | ((value << MaskShift(mask)) & mask);
 }
 
-static uint32_t MaskLength(uint32_t mask) {
-    uint32_t v = MaskMax(mask) >> 8;
-    return v ? (1 + MaskLength(v)) : 1;
+/* MaskMax(mask)所占的字节数（比特 1 不连续时，按最高位计算） */
+static inline uint32_t MaskLength(uint32_t mask) {
+    uint32_t v = MaskMax(mask);
+    return v ? (32 - __builtin_clz(v) + 7) / 8 : 1;
 }
 
 int32_t pos_read(const pos_t *pos, const void *_base, void *data, uint32_t length) {
@@ -87,3 +92,99 @@ int32_t pos_write(const pos_t *pos, void *_base, const void *data, uint32_t leng
     }
     return 0;
 }
+
+struct pos_batch {
+    uint32_t      num;
+    uint32_t      num_word; /* 按32-bit整体读取、掩码、移位的位置数，在输出的开头 */
+    uint32_t      size;
+    uint32_t     *offset; /* [num_word] */
+    uint32_t     *mask;   /* [num_word] */
+    uint32_t     *shift;  /* [num_word] */
+    const pos_t **rest;   /* [num - num_word] 其余位置，逐个pos_read */
+    uint32_t     *out;    /* [num] 每个位置在输出中的偏移 */
+};
+
+static inline bool pos_by_word(const pos_t *pos, uint32_t limit) {
+    return pos->length && pos->length <= sizeof(uint32_t) && pos->mask && pos->offset + sizeof(uint32_t) <= limit;
+}
+
+pos_batch_t *pos_batch_create(const pos_t *const pos[], uint32_t num, uint32_t limit) {
+    pos_batch_t *batch = calloc(1, sizeof(pos_batch_t));
+    if (!batch) return NULL;
+
+    for (uint32_t i = 0; i < num; i++) {
+        if (pos_by_word(pos[i], limit)) batch->num_word++;
+    }
+    batch->num    = num;
+    batch->offset = malloc((batch->num_word + 1) * sizeof(uint32_t));
+    batch->mask   = malloc((batch->num_word + 1) * sizeof(uint32_t));
+    batch->shift  = malloc((batch->num_word + 1) * sizeof(uint32_t));
+    batch->rest   = malloc((num - batch->num_word + 1) * sizeof(pos_t *));
+    batch->out    = malloc((num + 1) * sizeof(uint32_t));
+    if (!batch->offset || !batch->mask || !batch->shift || !batch->rest || !batch->out) {
+        pos_batch_destroy(batch);
+        return NULL;
+    }
+
+    uint32_t word = 0, rest = 0, size = batch->num_word * sizeof(uint32_t);
+    for (uint32_t i = 0; i < num; i++) {
+        const pos_t *p = pos[i];
+        if (pos_by_word(p, limit)) {
+            /* 只有低length字节属于该位置 */
+            uint32_t bytes      = p->length == sizeof(uint32_t) ? UINT32_MAX : (1u << (p->length * 8)) - 1;
+            batch->offset[word] = p->offset;
+            batch->mask[word]   = p->mask & bytes;
+            batch->shift[word]  = MaskShift(p->mask);
+            batch->out[i]       = word++ * sizeof(uint32_t);
+        } else {
+            batch->rest[rest++] = p;
+            batch->out[i]       = size;
+            size += p->length > sizeof(uint32_t) ? (p->length + 3) & ~3u : sizeof(uint32_t);
+        }
+    }
+    batch->size = size;
+    return batch;
+}
+
+void pos_batch_destroy(pos_batch_t *batch) {
+    if (!batch) return;
+    free(batch->offset);
+    free(batch->mask);
+    free(batch->shift);
+    free(batch->rest);
+    free(batch->out);
+    free(batch);
+}
+
+uint32_t pos_batch_size(const pos_batch_t *batch) { return batch->size; }
+
+uint32_t pos_batch_offset(const pos_batch_t *batch, uint32_t idx) { return batch->out[idx]; }
+
+void pos_batch_read(const pos_batch_t *batch, const void *_base, void *out) {
+    const uint8_t *base  = (const uint8_t *)_base;
+    uint32_t      *words = (uint32_t *)out;
+    uint32_t       i     = 0;
+
+#ifdef __AVX2__
+    for (; i + 8 <= batch->num_word; i += 8) {
+        __m256i offset = _mm256_loadu_si256((const __m256i *)&batch->offset[i]);
+        __m256i raw    = _mm256_i32gather_epi32((const int *)base, offset, 1);
+        raw            = _mm256_and_si256(raw, _mm256_loadu_si256((const __m256i *)&batch->mask[i]));
+        raw            = _mm256_srlv_epi32(raw, _mm256_loadu_si256((const __m256i *)&batch->shift[i]));
+        _mm256_storeu_si256((__m256i *)&words[i], raw);
+    }
+#endif
+    for (; i < batch->num_word; i++) {
+        uint32_t raw;
+        memcpy(&raw, base + batch->offset[i], sizeof(raw));
+        words[i] = (raw & batch->mask[i]) >> batch->shift[i];
+    }
+
+    uint8_t *data = (uint8_t *)out + batch->num_word * sizeof(uint32_t);
+    for (i = 0; i < batch->num - batch->num_word; i++) {
+        const pos_t *pos    = batch->rest[i];
+        uint32_t     length = pos->length > sizeof(uint32_t) ? (pos->length + 3) & ~3u : sizeof(uint32_t);
+        if (pos_read(pos, base, data, length)) memset(data, 0, length);
+        data += length;
+    }
+}
@@ -56,6 +56,40 @@ typedef struct {
 extern int32_t pos_read(const pos_t *pos, const void *_base, void *data, uint32_t length);
 extern int32_t pos_write(const pos_t *pos, void *_base, const void *data, uint32_t length);
 
+/**
+ * @brief 批量读取的预编译表：一次从同一基址读出一组位置
+ * @note 输出中，每个`length <= 4`的位置占4字节（小端的uint32_t，与`pos_read(pos, base, data, 4)`一致），其余位置占
+ * `length`向上对齐到4的字节数
+ */
+typedef struct pos_batch pos_batch_t;
+
+/**
+ * @brief
+ *
+ * @param pos 位置列表
+ * @param num
+ * @param limit 基址起可读的字节数（用于判断能否按32-bit整体读取；传入0时都按位置本身的长度读取，适用于读取有副作用的内存）
+ * @return pos_batch_t* NULL表示内存不足
+ */
+extern pos_batch_t *pos_batch_create(const pos_t *const pos[], uint32_t num, uint32_t limit);
+extern void         pos_batch_destroy(pos_batch_t *batch);
+/**
+ * @brief 输出的总字节数
+ */
+extern uint32_t pos_batch_size(const pos_batch_t *batch);
+/**
+ * @brief 第idx个位置在输出中的偏移
+ */
+extern uint32_t pos_batch_offset(const pos_batch_t *batch, uint32_t idx);
+/**
+ * @brief 按表从基址读出所有位置
+ *
+ * @param batch
+ * @param _base
+ * @param out 4字节对齐，至少pos_batch_size字节
+ */
+extern void pos_batch_read(const pos_batch_t *batch, const void *_base, void *out);
+
 static inline const pos_t *pos_search(const pos_t *layout, uint32_t key) { return lst_search_id(key, layout, pos_t); }
 static inline const pos_t *pos_search_by_name(const pos_t *layout, const char *name) {
     return lst_search_st(name, layout, pos_t);
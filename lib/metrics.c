@@ -0,0 +1,364 @@
+/**
+ * @file metrics.c
+ * @author kioz.wang (never.had@outlook.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright MIT License
+ *
+ *  Copyright (c) 2025 kioz.wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "metrics.h"
+#include "infra/thread_pool.h"
+#include "route.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SUB_BITS   3
+#define MAX_BITS   40 /* 不小于2^40ns（约18分钟）的时长都计入最后一个桶 */
+#define NUM_BUCKET ((MAX_BITS - SUB_BITS + 1) << SUB_BITS)
+
+#define METRICS_MAGIC   0x4d505250 /* "PRPM" */
+#define METRICS_VERSION 1
+
+struct histogram {
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t sum;
+    atomic_uint_fast64_t max;
+    atomic_uint_fast64_t buckets[NUM_BUCKET];
+};
+
+/**
+ * @brief 每个线程一个分片，只有所属线程写入，汇总时读取
+ */
+struct shard {
+    atomic_uint_fast64_t counters[_counter_num];
+    struct histogram     hists[_hist_num];
+    struct shard        *next;
+};
+
+static struct {
+    pthread_mutex_t mutex; /* 保护shards和retired */
+    pthread_once_t  once;
+    pthread_key_t   key;
+    struct shard   *shards;
+    struct shard    retired; /* 已退出线程的分片合并于此 */
+} g_metrics = {.mutex = PTHREAD_MUTEX_INITIALIZER, .once = PTHREAD_ONCE_INIT};
+
+static __thread struct shard *t_shard;
+
+static const char *const g_counter_names[_counter_num] = {
+    "cache.hit", "cache.miss", "cache.expired", "cache.evicted", "route.miss",
+};
+static const char *const g_hist_names[_hist_num] = {
+    "io.get", "io.set", "io.del", "io.mget", "io.mset", "io.mdel", "io.scan", "lock.wait", "queue.wait",
+};
+static const char *const g_gauge_names[] = {
+    "pool.threads", "pool.idle", "pool.queued", "pool.depth", "pool.completed", "pool.rejected",
+};
+#define NUM_GAUGE (sizeof(g_gauge_names) / sizeof(g_gauge_names[0]))
+
+struct metrics_head {
+    uint32_t magic;
+    uint8_t  version;
+    uint8_t  num_counter;
+    uint8_t  num_gauge;
+    uint8_t  num_hist;
+    uint32_t num_route;
+} __attribute__((packed));
+
+/* 之后依次是：uint64_t counters[]; uint64_t gauges[]; 每个直方图的count, sum, max, uint16_t num_bucket, 和num_bucket个
+ * {uint16_t index; uint64_t n;}（只含非空的桶）；每个路由表项的uint8_t length, char name[length], uint64_t matches */
+
+static inline void relaxed_add(atomic_uint_fast64_t *p, uint64_t n) {
+    atomic_store_explicit(p, atomic_load_explicit(p, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline uint64_t relaxed_load(const atomic_uint_fast64_t *p) {
+    return atomic_load_explicit((atomic_uint_fast64_t *)p, memory_order_relaxed);
+}
+
+static void shard_merge(struct shard *dst, const struct shard *src) {
+    for (int i = 0; i < _counter_num; i++)
+        relaxed_add(&dst->counters[i], relaxed_load(&src->counters[i]));
+    for (int i = 0; i < _hist_num; i++) {
+        struct histogram       *d = &dst->hists[i];
+        const struct histogram *s = &src->hists[i];
+        if (!relaxed_load(&s->count)) continue;
+        relaxed_add(&d->count, relaxed_load(&s->count));
+        relaxed_add(&d->sum, relaxed_load(&s->sum));
+        if (relaxed_load(&s->max) > relaxed_load(&d->max))
+            atomic_store_explicit(&d->max, relaxed_load(&s->max), memory_order_relaxed);
+        for (int j = 0; j < NUM_BUCKET; j++)
+            relaxed_add(&d->buckets[j], relaxed_load(&s->buckets[j]));
+    }
+}
+
+static void shard_retire(struct shard *shard) {
+    pthread_mutex_lock(&g_metrics.mutex);
+    for (struct shard **pshard = &g_metrics.shards; *pshard; pshard = &(*pshard)->next) {
+        if (*pshard == shard) {
+            *pshard = shard->next;
+            break;
+        }
+    }
+    shard_merge(&g_metrics.retired, shard);
+    pthread_mutex_unlock(&g_metrics.mutex);
+    free(shard);
+}
+
+static void key_create(void) { pthread_key_create(&g_metrics.key, (void (*)(void *))shard_retire); }
+
+static struct shard *shard_get(void) {
+    if (t_shard) return t_shard;
+
+    pthread_once(&g_metrics.once, key_create);
+    struct shard *shard = calloc(1, sizeof(struct shard));
+    if (!shard) return NULL;
+    pthread_mutex_lock(&g_metrics.mutex);
+    shard->next      = g_metrics.shards;
+    g_metrics.shards = shard;
+    pthread_mutex_unlock(&g_metrics.mutex);
+    pthread_setspecific(g_metrics.key, shard);
+    return t_shard = shard;
+}
+
+void metrics_count(enum metrics_counter counter, uint64_t n) {
+    struct shard *shard = shard_get();
+    if (shard) relaxed_add(&shard->counters[counter], n);
+}
+
+static inline unsigned int bucket_index(uint64_t v) {
+    if (v < (1UL << SUB_BITS)) return v;
+    unsigned int msb = 63 - __builtin_clzl(v);
+    if (msb >= MAX_BITS) return NUM_BUCKET - 1;
+    return ((msb - SUB_BITS + 1) << SUB_BITS) + ((v >> (msb - SUB_BITS)) & ((1UL << SUB_BITS) - 1));
+}
+
+/**
+ * @brief 桶的上界（包含）
+ */
+static uint64_t bucket_upper(unsigned int index) {
+    if (index < (1U << SUB_BITS)) return index;
+    unsigned int msb = (index >> SUB_BITS) + SUB_BITS - 1;
+    uint64_t     sub = index & ((1U << SUB_BITS) - 1);
+    return (((1UL << SUB_BITS) + sub + 1) << (msb - SUB_BITS)) - 1;
+}
+
+void metrics_record(enum metrics_histogram hist, timestamp_t t) {
+    struct shard *shard = shard_get();
+    if (!shard) return;
+
+    uint64_t          v = t > 0 ? t : 0;
+    struct histogram *h = &shard->hists[hist];
+    relaxed_add(&h->count, 1);
+    relaxed_add(&h->sum, v);
+    if (v > relaxed_load(&h->max)) atomic_store_explicit(&h->max, v, memory_order_relaxed);
+    relaxed_add(&h->buckets[bucket_index(v)], 1);
+}
+
+struct buffer {
+    char  *data;
+    size_t used;
+    size_t capacity;
+    int    error;
+};
+
+static void buffer_put(struct buffer *buf, const void *src, size_t n) {
+    if (buf->error) return;
+    if (buf->used + n > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity : 4096;
+        while (capacity < buf->used + n)
+            capacity *= 2;
+        char *data = realloc(buf->data, capacity);
+        if (!data) {
+            buf->error = errno;
+            return;
+        }
+        buf->data     = data;
+        buf->capacity = capacity;
+    }
+    memcpy(&buf->data[buf->used], src, n);
+    buf->used += n;
+}
+
+#define buffer_put_u64(buf, v) buffer_put(buf, &(uint64_t){v}, sizeof(uint64_t))
+
+static void route_put(struct buffer *buf, const char *name, uint64_t matches) {
+    uint8_t length = strnlen(name, UINT8_MAX);
+    buffer_put(buf, &length, sizeof(length));
+    buffer_put(buf, name, length);
+    buffer_put_u64(buf, matches);
+    ((struct metrics_head *)buf->data)->num_route++;
+}
+
+void *metrics_snapshot(void *route, void *thread_pool, int *length) {
+    struct buffer       buf  = {0};
+    struct metrics_head head = {
+        .magic       = METRICS_MAGIC,
+        .version     = METRICS_VERSION,
+        .num_counter = _counter_num,
+        .num_gauge   = NUM_GAUGE,
+        .num_hist    = _hist_num,
+        .num_route   = 0,
+    };
+    struct shard *total = calloc(1, sizeof(struct shard));
+    if (!total) return NULL;
+
+    pthread_mutex_lock(&g_metrics.mutex);
+    shard_merge(total, &g_metrics.retired);
+    for (struct shard *shard = g_metrics.shards; shard; shard = shard->next)
+        shard_merge(total, shard);
+    pthread_mutex_unlock(&g_metrics.mutex);
+
+    buffer_put(&buf, &head, sizeof(head));
+    for (int i = 0; i < _counter_num; i++)
+        buffer_put_u64(&buf, relaxed_load(&total->counters[i]));
+
+    thread_pool_stats_t stats = {0};
+    if (thread_pool) thread_pool_stats(thread_pool, &stats);
+    buffer_put_u64(&buf, stats.num);
+    buffer_put_u64(&buf, stats.idle);
+    buffer_put_u64(&buf, stats.queued);
+    buffer_put_u64(&buf, stats.depth);
+    buffer_put_u64(&buf, stats.completed);
+    buffer_put_u64(&buf, stats.rejected);
+
+    for (int i = 0; i < _hist_num; i++) {
+        const struct histogram *h          = &total->hists[i];
+        uint16_t                num_bucket = 0;
+        for (int j = 0; j < NUM_BUCKET; j++)
+            if (relaxed_load(&h->buckets[j])) num_bucket++;
+        buffer_put_u64(&buf, relaxed_load(&h->count));
+        buffer_put_u64(&buf, relaxed_load(&h->sum));
+        buffer_put_u64(&buf, relaxed_load(&h->max));
+        buffer_put(&buf, &num_bucket, sizeof(num_bucket));
+        for (uint16_t j = 0; j < NUM_BUCKET; j++) {
+            uint64_t n = relaxed_load(&h->buckets[j]);
+            if (!n) continue;
+            buffer_put(&buf, &j, sizeof(j));
+            buffer_put_u64(&buf, n);
+        }
+    }
+    free(total);
+
+    if (route && !buf.error) route_foreach_matches(route, (void (*)(void *, const char *, uint64_t))route_put, &buf);
+
+    if (buf.error) {
+        free(buf.data);
+        errno = buf.error;
+        return NULL;
+    }
+    *length = buf.used;
+    return buf.data;
+}
+
+struct reader {
+    const char *data;
+    int         left;
+};
+
+static bool reader_get(struct reader *rd, void *dst, int n) {
+    if (rd->left < n) return false;
+    memcpy(dst, rd->data, n);
+    rd->data += n;
+    rd->left -= n;
+    return true;
+}
+
+static uint64_t percentile(const uint64_t buckets[], uint64_t count, uint64_t max, double p) {
+    uint64_t rank = count * p, seen = 0;
+    if (rank >= count) rank = count - 1;
+    for (unsigned int i = 0; i < NUM_BUCKET; i++) {
+        seen += buckets[i];
+        if (seen > rank) {
+            if (i == NUM_BUCKET - 1) return max;
+            uint64_t upper = bucket_upper(i);
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+const char *latency_fmt(char *buffer, size_t length, timestamp_t ns) {
+    if (ns < 10000L) snprintf(buffer, length, "%ldns", ns);
+    else if (ns < 10000000L) snprintf(buffer, length, "%.1fus", ns / 1e3);
+    else if (ns < 10000000000L) snprintf(buffer, length, "%.1fms", ns / 1e6);
+    else snprintf(buffer, length, "%.1fs", ns / 1e9);
+    return buffer;
+}
+
+int metrics_render(FILE *fp, const void *data, int length) {
+    struct reader       rd = {.data = data, .left = length};
+    struct metrics_head head;
+    uint64_t            v;
+
+    if (!reader_get(&rd, &head, sizeof(head)) || head.magic != METRICS_MAGIC || head.version != METRICS_VERSION)
+        return EPROTO;
+
+    for (int i = 0; i < head.num_counter + head.num_gauge; i++) {
+        if (!reader_get(&rd, &v, sizeof(v))) return EPROTO;
+        const char *name = i < head.num_counter ? (i < _counter_num ? g_counter_names[i] : "?")
+                                                : (i - head.num_counter < (int)NUM_GAUGE
+                                                       ? g_gauge_names[i - head.num_counter]
+                                                       : "?");
+        fprintf(fp, "%-16s %lu\n", name, v);
+    }
+
+    for (int i = 0; i < head.num_hist; i++) {
+        uint64_t count, sum, max, buckets[NUM_BUCKET] = {0};
+        uint16_t num_bucket;
+        if (!reader_get(&rd, &count, sizeof(count)) || !reader_get(&rd, &sum, sizeof(sum)) ||
+            !reader_get(&rd, &max, sizeof(max)) || !reader_get(&rd, &num_bucket, sizeof(num_bucket)))
+            return EPROTO;
+        for (uint16_t j = 0; j < num_bucket; j++) {
+            uint16_t index;
+            if (!reader_get(&rd, &index, sizeof(index)) || !reader_get(&rd, &v, sizeof(v))) return EPROTO;
+            if (index < NUM_BUCKET) buckets[index] = v;
+        }
+        if (!count) continue;
+
+        char b[5][16];
+        fprintf(fp, "%-16s count %lu avg %s p50 %s p99 %s p999 %s max %s\n", i < _hist_num ? g_hist_names[i] : "?",
+                count, latency_fmt(b[0], sizeof(b[0]), sum / count),
+                latency_fmt(b[1], sizeof(b[1]), percentile(buckets, count, max, 0.5)),
+                latency_fmt(b[2], sizeof(b[2]), percentile(buckets, count, max, 0.99)),
+                latency_fmt(b[3], sizeof(b[3]), percentile(buckets, count, max, 0.999)),
+                latency_fmt(b[4], sizeof(b[4]), max));
+    }
+
+    for (uint32_t i = 0; i < head.num_route; i++) {
+        uint8_t name_length;
+        char    name[UINT8_MAX + 1];
+        if (!reader_get(&rd, &name_length, sizeof(name_length)) || !reader_get(&rd, name, name_length) ||
+            !reader_get(&rd, &v, sizeof(v)))
+            return EPROTO;
+        name[name_length] = '\0';
+        fprintf(fp, "route.%-10s %lu\n", name, v);
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file metrics.h
+ * @author kioz.wang (never.had@outlook.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright MIT License
+ *
+ *  Copyright (c) 2025 kioz.wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#ifndef __PROPD_METRICS_H
+#define __PROPD_METRICS_H
+
+#include "infra/timestamp.h"
+#include <stdint.h>
+#include <stdio.h>
+
+enum metrics_counter {
+    _counter_cache_hit = 0,
+    _counter_cache_miss,    /* 不存在 */
+    _counter_cache_expired, /* 存在但已过期 */
+    _counter_cache_evicted, /* 被cleaner回收 */
+    _counter_route_miss,    /* 没有匹配的表项 */
+    _counter_num,
+};
+
+enum metrics_histogram {
+    _hist_io_get = 0, /* 与enum io_type一一对应，从收到请求头到发出结果 */
+    _hist_io_set,
+    _hist_io_del,
+    _hist_io_mget,
+    _hist_io_mset,
+    _hist_io_mdel,
+    _hist_io_scan,
+    _hist_lock_wait,  /* 等待named mutex的时长（不含无竞争的加锁） */
+    _hist_queue_wait, /* 任务在线程池中的排队时长 */
+    _hist_num,
+};
+
+/**
+ * @brief 计数（写入当前线程的分片，无锁）
+ *
+ * @param counter
+ * @param n
+ */
+void metrics_count(enum metrics_counter counter, uint64_t n);
+/**
+ * @brief 记录一个时长（写入当前线程的分片，无锁）
+ *
+ * 桶按2的幂划分，每段再等分为8个子桶，相对误差不超过12.5%
+ *
+ * @param hist
+ * @param t unit: ns
+ */
+void metrics_record(enum metrics_histogram hist, timestamp_t t);
+/**
+ * @brief 汇总所有线程的分片，编码为紧凑的二进制格式
+ *
+ * @param route 路由表对象，附带各表项的命中次数 (maybe null)
+ * @param thread_pool 线程池对象，附带线程池的状态 (maybe null)
+ * @param length 返回编码后的长度
+ * @return void* On error, return NULL and set errno
+ */
+void *metrics_snapshot(void *route, void *thread_pool, int *length);
+/**
+ * @brief 将metrics_snapshot的结果渲染为文本
+ *
+ * @param fp
+ * @param data
+ * @param length
+ * @return int errno (EPROTO)
+ */
+int metrics_render(FILE *fp, const void *data, int length);
+/**
+ * @brief 以合适的单位（ns|us|ms|s）格式化时长
+ *
+ * @param buffer
+ * @param length
+ * @param t unit: ns
+ * @return const char* buffer
+ */
+const char *latency_fmt(char *buffer, size_t length, timestamp_t t);
+
+#endif /* __PROPD_METRICS_H */
@@ -33,6 +33,8 @@
 #include "infra/timestamp.h"
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -233,6 +235,80 @@ bool prefix_match(const char *prefix, const char *str) {
     return c1 == '*';
 }
 
+uint32_t hash_cstring(const char *s) {
+    uint32_t hash = HASH_INIT;
+    while (*s) {
+        hash ^= (uint8_t)*s++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint32_t hash_memory(uint32_t hash, const void *data, size_t length) {
+    const uint8_t *p = data;
+    while (length--) {
+        hash ^= *p++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+unsigned short *cpulist_parse(const char *s, unsigned short *num) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    for (const char *p = s; *p;) {
+        char         *end;
+        unsigned long first = strtoul(p, &end, 10), last = first;
+        if (end == p) goto error;
+        if (*end == '-') {
+            p    = end + 1;
+            last = strtoul(p, &end, 10);
+            if (end == p || last < first) goto error;
+        }
+        if (last >= CPU_SETSIZE) goto error;
+        for (unsigned long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, &set);
+        if (*end == ',' && end[1]) end++;
+        else if (*end) goto error;
+        p = end;
+    }
+    if (!CPU_COUNT(&set)) goto error;
+
+    unsigned short *cpus = calloc(CPU_COUNT(&set), sizeof(unsigned short));
+    if (!cpus) return NULL;
+    *num = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &set)) cpus[(*num)++] = cpu;
+    }
+    return cpus;
+
+error:
+    errno = EINVAL;
+    return NULL;
+}
+
+unsigned short *cpulist_allowed(unsigned short *num) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set)) return NULL;
+
+    unsigned short *cpus = calloc(CPU_COUNT(&set), sizeof(unsigned short));
+    if (!cpus) return NULL;
+    *num = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &set)) cpus[(*num)++] = cpu;
+    }
+    return cpus;
+}
+
+int thread_bind_cpulist(pthread_t tid, const unsigned short *cpus, unsigned short num) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < num; i++)
+        CPU_SET(cpus[i], &set);
+    return pthread_setaffinity_np(tid, sizeof(set), &set);
+}
+
 void attach_wait(const char *envname __attribute__((unused)), char c __attribute__((unused)),
                  int unit __attribute__((unused))) {
 #ifndef NDEBUG
@@ -326,6 +402,21 @@ static void TEST_hexmem(void) {
     assert(!strcmp("", hexmem(buffer1, 1, buffer0, hex0_len, false)));
 }
 
+static void TEST_cpulist(void) {
+    fprintf(stderr, "\n %s\n\n", __func__);
+    unsigned short  num  = 0;
+    unsigned short *cpus = cpulist_parse("6,0-2,1", &num);
+    assert(cpus);
+    assert(num == 4);
+    assert(cpus[0] == 0 && cpus[1] == 1 && cpus[2] == 2 && cpus[3] == 6);
+    free(cpus);
+
+    assert(!cpulist_parse("", &num) && errno == EINVAL);
+    assert(!cpulist_parse("3-1", &num) && errno == EINVAL);
+    assert(!cpulist_parse("1,", &num) && errno == EINVAL);
+    assert(!cpulist_parse("a", &num) && errno == EINVAL);
+}
+
 int main(int argc, char *argv[]) {
     for (int i = 0; i < 100; i++)
         TEST_random_alnum();
@@ -333,6 +424,8 @@ int main(int argc, char *argv[]) {
     TEST_cstring_array();
 
     TEST_hexmem();
+
+    TEST_cpulist();
 }
 
 #endif /* __TEST_MISC */
@@ -31,7 +31,9 @@
 #ifndef __PROPD_MISC_H
 #define __PROPD_MISC_H
 
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 void random_alnum(char *addr, size_t length);
@@ -91,6 +93,49 @@ void *hex2mem(void *addr, size_t *len, const char *str);
 
 bool prefix_match(const char *prefix, const char *str);
 
+/**
+ * @brief Hash a cstring (FNV-1a)
+ *
+ * @param s
+ * @return uint32_t
+ */
+uint32_t hash_cstring(const char *s);
+/**
+ * @brief Hash a memory block (FNV-1a)，可以分段累积
+ *
+ * @param hash 初值为HASH_INIT，或上一段的结果
+ * @param data
+ * @param length
+ * @return uint32_t
+ */
+uint32_t hash_memory(uint32_t hash, const void *data, size_t length);
+#define HASH_INIT 2166136261u
+
+/**
+ * @brief Parse and allocate a CPU list, such as "0-3,6"
+ *
+ * @param s 以逗号隔开的CPU编号或闭区间
+ * @param num 返回解析出的CPU数量
+ * @return unsigned short* （On error, return NULL and set errno）
+ */
+unsigned short *cpulist_parse(const char *s, unsigned short *num);
+/**
+ * @brief Allocate a CPU list which the calling process is allowed to run on
+ *
+ * @param num 返回CPU数量
+ * @return unsigned short* （On error, return NULL and set errno）
+ */
+unsigned short *cpulist_allowed(unsigned short *num);
+/**
+ * @brief Bind a thread to a CPU list
+ *
+ * @param tid
+ * @param cpus
+ * @param num
+ * @return int errno
+ */
+int thread_bind_cpulist(pthread_t tid, const unsigned short *cpus, unsigned short num);
+
 /**
  * @brief
  *
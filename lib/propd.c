@@ -32,17 +32,21 @@
 #include "cache.h"
 #include "ctrl_server.h"
 #include "global.h"
+#include "infra/async_log.h"
 #include "infra/named_mutex.h"
 #include "infra/thread_pool.h"
 #include "io_server.h"
 #include "misc.h"
 #include "route.h"
 #include "storage.h"
+#include "trace.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -51,13 +55,39 @@ void propd_config_default(propd_config_t *config) {
     config->loglevel = MLOG_WARN;
     config->logger   = NULL;
 
+    config->async_log      = _async_log_off;
+    config->async_log_ring = 64;
+
     config->namespace = NULL;
 
     config->thread_num             = 0;
     config->thread_num_max_if_auto = 16;
+    config->thread_num_max_elastic = 0;
+    config->thread_wait_threshold  = 10;
+    config->thread_idle_timeout    = 5;
+    config->task_num               = 0;
+    config->thread_num_reserved    = 1;
+    config->task_aging             = 100;
 
     config->cache_interval         = 0;
     config->cache_default_duration = 1;
+    config->shards                 = 0;
+
+    config->io_timeout           = 3000;
+    config->breaker_ratio        = 50;
+    config->breaker_min_requests = 10;
+    config->breaker_window       = 10000;
+    config->breaker_cooldown     = 5000;
+    config->bulkhead_max         = 0;
+    config->bulkhead_wait        = 0;
+
+    config->cpus_io        = NULL;
+    config->cpus_ctrl      = NULL;
+    config->cpus_cache     = NULL;
+    config->cpus_worker    = NULL;
+    config->pin_connection = false;
+
+    config->trace_every = 0;
 
     LIST_INIT(&config->local_route);
 
@@ -82,7 +112,7 @@ static void help_message(const propd_config_t *config) {
     const char            *message;
 
     // clang-format off
-    fputs("propd [--loglevel <LOGLEVEL>] [--namespace <DIR>] [--enable-cache <INTERVAL>] [--default-duration <INTERVAL>] [--name <NAME>] [--caches <KEYS>] [--prefixes <PREFIXES>] [--children <NAMES>] [--parents <NAMES>] [-D|--daemon]", stderr);
+    fputs("propd [--loglevel <LOGLEVEL>] [--async-log <POLICY>] [--namespace <DIR>] [--enable-cache <INTERVAL>] [--default-duration <INTERVAL>] [--shards <NUM>] [--io-timeout <INTERVAL>] [--breaker <PERCENT>] [--breaker-cooldown <INTERVAL>] [--bulkhead <NUM>] [--bulkhead-wait <INTERVAL>] [--elastic <MAX>] [--elastic-wait <INTERVAL>] [--elastic-idle <INTERVAL>] [--queue-depth <NUM>] [--reserved <NUM>] [--aging <INTERVAL>] [--cpus-io <CPUS>] [--cpus-ctrl <CPUS>] [--cpus-cache <CPUS>] [--cpus-worker <CPUS>] [--pin-connection] [--trace <NUM>] [--name <NAME>] [--caches <KEYS>] [--prefixes <PREFIXES>] [--children <NAMES>] [--parents <NAMES>] [-D|--daemon]", stderr);
     // clang-format on
 
     LIST_FOREACH(parseConfig, &config->io_parseConfigs, entry) {
@@ -92,10 +122,29 @@ static void help_message(const propd_config_t *config) {
     // clang-format off
     message =
         "\n\n"
-        "  --loglevel <LOGLEVEL>         指定日志等级（取值（大小写不敏感）：ERRO|WARN|INFO|VERB|DEBG；默认：INFO）\n"
+        "  --loglevel <LOGLEVEL>         指定日志等级（取值（大小写不敏感）：ERRO|WARN|INFO|VERB|DEBG；默认：INFO；Release构建不含VERB|DEBG）\n"
+        "  --async-log <POLICY>          由后台线程批量输出日志，取值drop|block[:<KB>]：每个线程的ring满时丢弃或等待，ring大小（默认：不使能；64；单位：KiB）\n"
         "  --namespace <DIR>             指定Unix域套接字的根路径（默认：/tmp）\n"
         "  --enable-cache <INTERVAL>     使能cache，并设定过期回收的间隔（默认：0 不使能；单位：秒）\n"
         "  --default-duration <INTERVAL> 设定默认的cache有效期（默认：1；单位：秒）\n"
+        "  --shards <NUM>                按key的哈希值将cache和key锁分片，各分片独立加锁（默认：0 等于CPU数）\n"
+        "  --io-timeout <INTERVAL>       与其他propd（子节点、unix存储）通信时一次请求（从发出到收完应答）的超时，超时返回ETIMEDOUT（默认：3000；单位：毫秒；0 不超时）\n"
+        "  --breaker <PERCENT>           10秒内不少于10个请求，且超时、连接错误等的比例达到该值时，熔断对应的路由表项，以EHOSTDOWN快速失败（默认：50；0 不熔断）\n"
+        "  --breaker-cooldown <INTERVAL> 熔断后经过该时长，放行一个探测请求，成功则恢复（默认：5000；单位：毫秒）\n"
+        "  --bulkhead <NUM>              限制每个路由表项进行中的请求数，避免一个慢的存储占满线程池（默认：0 不限制）\n"
+        "  --bulkhead-wait <INTERVAL>    请求数达到上限时排队等待的时长，超过后以EBUSY拒绝（默认：0 立即拒绝；单位：毫秒）\n"
+        "  --elastic <MAX>               使能弹性线程池，并设定线程数上限（默认：0 不使能）\n"
+        "  --elastic-wait <INTERVAL>     任务排队超过该时长时扩容（默认：10；单位：毫秒）\n"
+        "  --elastic-idle <INTERVAL>     线程空闲超过该时长时缩容（默认：5；单位：秒）\n"
+        "  --queue-depth <NUM>           设定任务队列长度，队列满时以EBUSY拒绝新的请求（默认：0 等于线程数）\n"
+        "  --reserved <NUM>              设定只处理IO请求的线程数，ctrl请求等低优先级任务不占用（默认：1，至多为线程数减1）\n"
+        "  --aging <INTERVAL>            低优先级任务排队超过该时长时，优先于IO请求执行（默认：100；单位：毫秒；0 不提升）\n"
+        "  --cpus-io <CPUS>              将IO server线程绑定到CPU列表，如0-3,6（默认：不绑定）\n"
+        "  --cpus-ctrl <CPUS>            将ctrl server线程绑定到CPU列表（默认：不绑定）\n"
+        "  --cpus-cache <CPUS>           将cache回收线程绑定到CPU列表（默认：不绑定）\n"
+        "  --cpus-worker <CPUS>          将线程池中的线程依次绑定到CPU列表中的一个CPU（默认：不绑定）\n"
+        "  --pin-connection              每个连接固定在一个CPU上处理，依次取自--cpus-worker（默认：所有可用CPU）\n"
+        "  --trace <NUM>                 每NUM个请求追踪一个，记录各跳的排队、等锁、存储、发送时长，可通过prop ctrl traces查看（默认：0 不追踪；上一跳已追踪的请求总是继续追踪）\n"
         "  --name <NAME>                 指定自身的名字（默认：root）\n"
         "  --caches <KEYS>               作为子节点时，注册到父节点后需要立即缓存的key列表（默认：无）\n"
         "  --prefixes <PREFIXES>         作为子节点时，注册到父节点后支持的prefix列表（默认：*）\n"
@@ -125,9 +174,28 @@ static void help_message(const propd_config_t *config) {
 static const struct option g_longopts[] = {
     // clang-format off
     {"loglevel", required_argument, 0, 'l'},
+    {"async-log", required_argument, 0, 'L'},
     {"namespace", required_argument, 0, 'N'},
     {"enable-cache", required_argument, 0, 'C'},
     {"default-duration", required_argument, 0, 'd'},
+    {"shards", required_argument, 0, 'S'},
+    {"io-timeout", required_argument, 0, 'T'},
+    {"breaker", required_argument, 0, 'B'},
+    {"breaker-cooldown", required_argument, 0, 'O'},
+    {"bulkhead", required_argument, 0, 'H'},
+    {"bulkhead-wait", required_argument, 0, 'Y'},
+    {"elastic", required_argument, 0, 'E'},
+    {"elastic-wait", required_argument, 0, 'W'},
+    {"elastic-idle", required_argument, 0, 'I'},
+    {"queue-depth", required_argument, 0, 'Q'},
+    {"reserved", required_argument, 0, 'R'},
+    {"aging", required_argument, 0, 'A'},
+    {"cpus-io", required_argument, 0, 'o'},
+    {"cpus-ctrl", required_argument, 0, 't'},
+    {"cpus-cache", required_argument, 0, 'k'},
+    {"cpus-worker", required_argument, 0, 'w'},
+    {"pin-connection", no_argument, 0, 'P'},
+    {"trace", required_argument, 0, 'r'},
     {"name", required_argument, 0, 'n'},
     {"caches", required_argument, 0, 'c'},
     {"prefixes", required_argument, 0, 'p'},
@@ -180,6 +248,17 @@ void propd_config_parse(propd_config_t *config, int argc, char *argv[]) {
         case 'v':
             config->loglevel++;
             break;
+        case 'L': {
+            char *ring = strchr(optarg, ':');
+            if (ring) *ring++ = '\0';
+            if (!strcmp(optarg, "drop")) config->async_log = _async_log_drop;
+            else if (!strcmp(optarg, "block")) config->async_log = _async_log_block;
+            else {
+                fprintf(stderr, "unknown policy of async log: %s\n", optarg);
+                goto error;
+            }
+            if (ring) config->async_log_ring = strtoul(ring, NULL, 0);
+        } break;
         case 'N':
             config->namespace = optarg;
             break;
@@ -189,6 +268,64 @@ void propd_config_parse(propd_config_t *config, int argc, char *argv[]) {
         case 'd':
             config->cache_default_duration = strtoul(optarg, NULL, 0);
             break;
+        case 'S':
+            config->shards = strtoul(optarg, NULL, 0);
+            break;
+        case 'T':
+            config->io_timeout = strtoul(optarg, NULL, 0);
+            break;
+        case 'B':
+            config->breaker_ratio = strtoul(optarg, NULL, 0);
+            break;
+        case 'O':
+            config->breaker_cooldown = strtoul(optarg, NULL, 0);
+            break;
+        case 'H':
+            config->bulkhead_max = strtoul(optarg, NULL, 0);
+            break;
+        case 'Y':
+            config->bulkhead_wait = strtoul(optarg, NULL, 0);
+            break;
+        case 'E':
+            config->thread_num_max_elastic = strtoul(optarg, NULL, 0);
+            break;
+        case 'W':
+            config->thread_wait_threshold = strtoul(optarg, NULL, 0);
+            break;
+        case 'I':
+            config->thread_idle_timeout = strtoul(optarg, NULL, 0);
+            break;
+        case 'Q':
+            config->task_num = strtoul(optarg, NULL, 0);
+            break;
+        case 'R':
+            config->thread_num_reserved = strtoul(optarg, NULL, 0);
+            break;
+        case 'A':
+            config->task_aging = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+        case 't':
+        case 'k':
+        case 'w': {
+            unsigned short  num;
+            unsigned short *cpus = cpulist_parse(optarg, &num);
+            if (!cpus) {
+                fprintf(stderr, "fail to parse cpu list" logFmtErrno "\n", logArgErrno);
+                goto error;
+            }
+            free(cpus);
+            if (opt == 'o') config->cpus_io = optarg;
+            else if (opt == 't') config->cpus_ctrl = optarg;
+            else if (opt == 'k') config->cpus_cache = optarg;
+            else config->cpus_worker = optarg;
+        } break;
+        case 'P':
+            config->pin_connection = true;
+            break;
+        case 'r':
+            config->trace_every = strtoul(optarg, NULL, 0);
+            break;
         case 'n':
             config->name = optarg;
             break;
@@ -290,8 +427,40 @@ error:
 
 static void nop(int _) { (void)_; }
 
+/**
+ * 存储的watch回调经此转发给io_changed：注销时仍被引用的表项不会被释放，其watcher会比io_ctx（和cache）活得更久，
+ * 所以在销毁cache之前断开
+ */
+static struct {
+    pthread_rwlock_t rwlock;
+    const io_ctx_t  *io_ctx; /* NULL means disconnected */
+} g_watch = {.rwlock = PTHREAD_RWLOCK_INITIALIZER};
+
+static void watch_changed(void *arg, const char *key) {
+    (void)arg;
+    pthread_rwlock_rdlock(&g_watch.rwlock);
+    if (g_watch.io_ctx) io_changed(g_watch.io_ctx, key);
+    pthread_rwlock_unlock(&g_watch.rwlock);
+}
+
+static void watch_disconnect(void) {
+    pthread_rwlock_wrlock(&g_watch.rwlock); /* 等待进行中的回调 */
+    g_watch.io_ctx = NULL;
+    pthread_rwlock_unlock(&g_watch.rwlock);
+}
+
 #define logFmtHead "[propd::%s] "
 
+static int bind_thread(const char *name, const char *what, pthread_t tid, const char *cpus_s) {
+    unsigned short  num;
+    unsigned short *cpus = cpulist_parse(cpus_s, &num);
+    int             ret  = cpus ? thread_bind_cpulist(tid, cpus, num) : errno;
+    free(cpus);
+    if (ret) logfE(logFmtHead "fail to bind %s to cpus %s" logFmtErrno, name, what, cpus_s, logArgErrno_(ret));
+    else logfV(logFmtHead "bind %s to cpus %s", name, what, cpus_s);
+    return ret;
+}
+
 static int __propd_run(const propd_config_t *config, int *syncfd) {
     int      ret    = 0;
     void    *tpool  = NULL;
@@ -299,7 +468,18 @@ static int __propd_run(const propd_config_t *config, int *syncfd) {
 
     const char *name = config->name ? config->name : "root";
 
-    g_at = config->namespace ? config->namespace : "/tmp";
+    /* 后台线程不能跨越fork，故在此启动 */
+    if (config->async_log != _async_log_off) {
+        ret = async_log_start();
+        if (ret) {
+            logfW(logFmtHead "fail to start async log, fallback to synchronous" logFmtErrno, name, logArgErrno_(ret));
+            ret = 0;
+        }
+    }
+
+    g_at         = config->namespace ? config->namespace : "/tmp";
+    g_io_timeout = config->io_timeout;
+    trace_set_sampling(config->trace_every);
     if (!ret) {
         if (access(g_at, F_OK) == -1) {
             ret = mkdir(g_at, 0755);
@@ -310,7 +490,7 @@ static int __propd_run(const propd_config_t *config, int *syncfd) {
     }
 
     if (!ret) {
-        tpool = thread_pool_create(config->thread_num, 5, config->thread_num_max_if_auto, 0);
+        tpool = thread_pool_create(config->thread_num, 5, config->thread_num_max_if_auto, config->task_num);
         if (!tpool) {
             logfE(logFmtHead "fail to create thread pool" logFmtErrno, name, logArgErrno);
             ret = -1;
@@ -318,7 +498,49 @@ static int __propd_run(const propd_config_t *config, int *syncfd) {
     }
 
     if (!ret) {
-        io_ctx.nmtx_ns = named_mutex_create_namespace();
+        thread_pool_stats_t stats;
+        unsigned short      reserved = config->thread_num_reserved;
+
+        /* 至少留一个线程给低优先级任务 */
+        thread_pool_stats(tpool, &stats);
+        if (reserved >= stats.min) {
+            reserved = stats.min - 1;
+            logfW(logFmtHead "only %d threads, reserve %d of them for IO", name, stats.min, reserved);
+        }
+        ret = thread_pool_set_priority(tpool, reserved, timestamp_from_ms(config->task_aging));
+        if (ret) {
+            logfE(logFmtHead "fail to reserve threads for IO" logFmtErrno, name, logArgErrno_(ret));
+        }
+    }
+
+    if (!ret && config->cpus_worker) {
+        unsigned short  num;
+        unsigned short *cpus = cpulist_parse(config->cpus_worker, &num);
+        ret                  = cpus ? thread_pool_set_affinity(tpool, cpus, num) : errno;
+        free(cpus);
+        if (ret) {
+            logfE(logFmtHead "fail to bind thread pool to cpus %s" logFmtErrno, name, config->cpus_worker,
+                  logArgErrno_(ret));
+        }
+    }
+
+    if (!ret && config->thread_num_max_elastic) {
+        ret = thread_pool_set_elastic(tpool, config->thread_num_max_elastic,
+                                      timestamp_from_ms(config->thread_wait_threshold),
+                                      timestamp_from_s(config->thread_idle_timeout));
+        if (ret) {
+            logfE(logFmtHead "fail to make thread pool elastic" logFmtErrno, name, logArgErrno_(ret));
+        }
+    }
+
+    unsigned short shards = config->shards;
+    if (!shards) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        shards    = ncpu > 0 ? (unsigned short)ncpu : 1;
+    }
+
+    if (!ret) {
+        io_ctx.nmtx_ns = named_mutex_create_namespace(shards);
         if (!io_ctx.nmtx_ns) {
             logfE(logFmtHead "fail to create namespace of named mutexes" logFmtErrno, name, logArgErrno);
             ret = -1;
@@ -327,13 +549,24 @@ static int __propd_run(const propd_config_t *config, int *syncfd) {
 
     if (!ret && config->cache_interval) {
         io_ctx.cache = cache_create(timestamp_from_ms(500), timestamp_from_s(config->cache_interval),
-                                    timestamp_from_s(config->cache_default_duration), timestamp_from_ms(100));
+                                    timestamp_from_s(config->cache_default_duration), timestamp_from_ms(100), shards);
         if (!io_ctx.cache) {
             logfE(logFmtHead "fail to enable cache" logFmtErrno, name, logArgErrno);
             ret = -1;
         }
     }
 
+    if (!ret && io_ctx.cache && config->cpus_cache) {
+        unsigned short  num;
+        unsigned short *cpus = cpulist_parse(config->cpus_cache, &num);
+        ret                  = cpus ? cache_set_affinity(io_ctx.cache, cpus, num) : errno;
+        free(cpus);
+        if (ret) {
+            logfE(logFmtHead "fail to bind cache cleaner to cpus %s" logFmtErrno, name, config->cpus_cache,
+                  logArgErrno_(ret));
+        }
+    }
+
     if (!ret) {
         io_ctx.route = route_create();
         if (!io_ctx.route) {
@@ -343,7 +576,17 @@ static int __propd_run(const propd_config_t *config, int *syncfd) {
     }
 
     if (!ret) {
+        if (io_ctx.cache) {
+            route_item_t *item;
+            g_watch.io_ctx = &io_ctx;
+            LIST_FOREACH(item, &config->local_route, entry) {
+                storage_watch(&item->storage, watch_changed, NULL);
+            }
+        }
         route_init(io_ctx.route, config->local_route);
+        route_set_breaker(io_ctx.route, config->breaker_ratio, config->breaker_min_requests, config->breaker_window,
+                          config->breaker_cooldown);
+        route_set_bulkhead(io_ctx.route, config->bulkhead_max, config->bulkhead_wait);
     }
 
     pthread_t  ctrl_tid, io_tid;
@@ -351,10 +594,27 @@ static int __propd_run(const propd_config_t *config, int *syncfd) {
     pthread_t *io_tid_p   = NULL;
 
     if (!ret) {
-        ret = start_io_server(name, tpool, NULL, &io_ctx, &io_tid);
-        if (ret) {
-            logfE(logFmtHead "fail to start io server" logFmtErrno, name, logArgErrno);
-        } else io_tid_p = &io_tid;
+        unsigned short  num_cpus = 0;
+        unsigned short *cpus     = NULL;
+
+        if (config->pin_connection) {
+            cpus = config->cpus_worker ? cpulist_parse(config->cpus_worker, &num_cpus) : cpulist_allowed(&num_cpus);
+            if (!cpus) {
+                ret = errno;
+                logfE(logFmtHead "fail to get cpus to pin connections" logFmtErrno, name, logArgErrno);
+            }
+        }
+        if (!ret) {
+            ret = start_io_server(name, tpool, NULL, &io_ctx, cpus, num_cpus, &io_tid);
+            if (ret) {
+                logfE(logFmtHead "fail to start io server" logFmtErrno, name, logArgErrno);
+            } else io_tid_p = &io_tid;
+        }
+        free(cpus);
+    }
+
+    if (!ret && config->cpus_io) {
+        ret = bind_thread(name, "io server", io_tid, config->cpus_io);
     }
 
     if (!ret) {
@@ -365,6 +625,10 @@ static int __propd_run(const propd_config_t *config, int *syncfd) {
         } else ctrl_tid_p = &ctrl_tid;
     }
 
+    if (!ret && config->cpus_ctrl) {
+        ret = bind_thread(name, "ctrl server", ctrl_tid, config->cpus_ctrl);
+    }
+
     if (!ret && config->children) {
         for (int i = 0; config->children[i]; i++) {
             ret = ctrl_register_parent(config->children[i], name);
@@ -410,6 +674,7 @@ static int __propd_run(const propd_config_t *config, int *syncfd) {
         pthread_cancel(*io_tid_p);
         pthread_join(*io_tid_p, NULL);
     }
+    watch_disconnect();
     if (io_ctx.route) {
         if (config->parents) {
             for (int i = 0; config->parents[i]; i++) {
@@ -422,6 +687,7 @@ static int __propd_run(const propd_config_t *config, int *syncfd) {
     route_destroy(io_ctx.route);
     cache_destroy(io_ctx.cache);
     named_mutex_destroy_namespace(io_ctx.nmtx_ns);
+    async_log_stop();
 
     if (syncfd && ret) {
         write(*syncfd, &ret, sizeof(ret));
@@ -430,9 +696,25 @@ static int __propd_run(const propd_config_t *config, int *syncfd) {
     return ret;
 }
 
+static void log2stdout(const char *msg) {
+    fputs(msg, stdout);
+    fflush(stdout);
+}
+
 int propd_run(const propd_config_t *config) {
-    int ret = 0;
-    mlog_set_logger(&g_logger, config->loglevel, config->logger);
+    int    ret    = 0;
+    mlog_f logger = config->logger;
+    if (config->async_log != _async_log_off) {
+        ret = async_log_init(logger ? logger : log2stdout, config->async_log, config->async_log_ring * 1024);
+        if (ret) {
+            fprintf(stderr, "fail to initialize async log" logFmtErrno "\n", logArgErrno_(ret));
+            return ret;
+        }
+        logger = async_log;
+    }
+    mlog_set_logger(&g_logger, config->loglevel, logger);
+    /* 环境变量可能改变mlogger的等级，此时不跳过任何日志，交给mlogger过滤 */
+    g_loglevel = getenv("propd_loglevel") ? MLOG_DEBG : config->loglevel;
     mlog_init(&g_logger, "propd_loglevel", "propd_log2stderr", MLOG_FMT_NEWLINE,
               MLOG_FMT_COLOR | MLOG_FMT_TIMESTAMP | MLOG_FMT_LEVEL_HEAD | MLOG_FMT_NEWLINE);
 
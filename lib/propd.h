@@ -40,13 +40,39 @@ struct propd_config {
     mlog_level_t loglevel; /* MLOG_WARN default */
     mlog_f       logger;   /* fputs(stdout) default */
 
+    uint8_t  async_log;      /* 0 default (0 means synchronous), see enum async_log_policy */
+    uint32_t async_log_ring; /* 64 default, unit: KiB, per thread */
+
     const char *namespace; /* Unix Sockets root path. /tmp default */
 
     unsigned short thread_num;             /* 0 default (0 means auto)  */
     unsigned short thread_num_max_if_auto; /* 16 default */
+    unsigned short thread_num_max_elastic; /* 0 default (0 means disable) */
+    unsigned short task_num;               /* 0 default (0 means same as thread_num) */
+    unsigned short thread_num_reserved;    /* 1 default, reserved for IO */
+    timestamp_t    task_aging;             /* 100 default, unit: ms (0 means disable) */
+    timestamp_t    thread_wait_threshold;  /* 10 default, unit: ms */
+    timestamp_t    thread_idle_timeout;    /* 5 default, unit: s */
+
+    timestamp_t    cache_interval;         /* 0 default, unit: s (0 means disable) */
+    timestamp_t    cache_default_duration; /* 1 default, unit: s */
+    unsigned short shards;                 /* 0 default (0 means number of cpus), of cache and named mutexes */
+
+    timestamp_t io_timeout;           /* 3000 default, unit: ms (0 means no timeout), of unix storages */
+    uint8_t     breaker_ratio;        /* 50 default, unit: % (0 means disable) */
+    uint32_t    breaker_min_requests; /* 10 default */
+    timestamp_t breaker_window;       /* 10000 default, unit: ms */
+    timestamp_t breaker_cooldown;     /* 5000 default, unit: ms */
+    uint32_t    bulkhead_max;         /* 0 default, max requests in flight per route item (0 means no limit) */
+    timestamp_t bulkhead_wait;        /* 0 default, unit: ms (0 means reject immediately) */
+
+    const char *cpus_io;        /* NULL default (NULL means no affinity), such as "0-3,6" */
+    const char *cpus_ctrl;      /* NULL default (NULL means no affinity) */
+    const char *cpus_cache;     /* NULL default (NULL means no affinity) */
+    const char *cpus_worker;    /* NULL default (NULL means no affinity), one cpu per worker in turn */
+    bool        pin_connection; /* false default, pin each connection on one of cpus_worker (or allowed cpus) */
 
-    timestamp_t cache_interval;         /* 0 default, unit: s (0 means disable) */
-    timestamp_t cache_default_duration; /* 1 default, unit: s */
+    uint32_t trace_every; /* 0 default (0 means disable), trace one of every N requests, see trace.h */
 
     struct route_list local_route;
 
@@ -30,6 +30,7 @@
 
 #include "route.h"
 #include "global.h"
+#include "metrics.h"
 #include "misc.h"
 #include <assert.h>
 #include <errno.h>
@@ -48,11 +49,28 @@ route_item_t *route_item_create(const storage_ctx_t *storage, uint32_t num_prefi
     };
     item->storage = *storage;
     item->nref    = 0;
+    item->matches = 0;
+    memset(&item->breaker, 0, sizeof(item->breaker));
+    pthread_mutex_init(&item->breaker.mutex, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&item->bulkhead.cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&item->bulkhead.mutex, NULL);
+    item->bulkhead.waiters = 0;
     return item;
 }
 
 void route_item_destroy(route_item_t *item) {
     if (!item) return;
+    /* 等待route_deref释放锁 */
+    pthread_mutex_lock(&item->bulkhead.mutex);
+    pthread_mutex_unlock(&item->bulkhead.mutex);
+    pthread_mutex_destroy(&item->bulkhead.mutex);
+    pthread_cond_destroy(&item->bulkhead.cond);
+    pthread_mutex_destroy(&item->breaker.mutex);
     arrayfree_cstring(item->prefix);
     storage_destructor(&item->storage);
     free(item);
@@ -61,11 +79,21 @@ void route_item_destroy(route_item_t *item) {
 struct route {
     struct route_list list;
     pthread_rwlock_t  rwlock;
+    struct {
+        uint8_t     ratio; /* 0 means disable */
+        uint32_t    min_requests;
+        timestamp_t window;
+        timestamp_t cooldown;
+    } breaker;
+    struct {
+        uint32_t    max; /* 0 means no limit */
+        timestamp_t wait;
+    } bulkhead;
 };
 typedef struct route route_t;
 
 void *route_create(void) {
-    route_t *route = malloc(sizeof(route_t));
+    route_t *route = calloc(1, sizeof(route_t));
     if (!route) return NULL;
 
     LIST_INIT(&route->list);
@@ -94,6 +122,76 @@ void route_destroy(void *_route) {
     logfI("[route] destroyed");
 }
 
+void route_set_breaker(void *_route, uint8_t ratio, uint32_t min_requests, timestamp_t window, timestamp_t cooldown) {
+    route_t *route = _route;
+
+    route->breaker.ratio        = ratio;
+    route->breaker.min_requests = min_requests;
+    route->breaker.window       = timestamp_from_ms(window);
+    route->breaker.cooldown     = timestamp_from_ms(cooldown);
+    if (ratio) {
+        logfI("[route] breaker opens at %u%% failure of %u requests in %ldms, cooldown %ldms", ratio, min_requests,
+              window, cooldown);
+    }
+}
+
+void route_set_bulkhead(void *_route, uint32_t max, timestamp_t wait) {
+    route_t *route = _route;
+
+    route->bulkhead.max  = max;
+    route->bulkhead.wait = timestamp_from_ms(wait);
+    if (max) logfI("[route] at most %u requests in flight per item, wait %ldms", max, wait);
+}
+
+/**
+ * @brief 增加表项的引用计数，受限于进行中的请求数
+ *
+ * Require holding route->rwlock for read. 等待前释放读锁，返回前重新获取；等待期间由waiters阻止表项被注销
+ *
+ * @param wait 达到上限时是否等待
+ * @return int errno (EBUSY)
+ */
+static int bulkhead_acquire(route_t *route, route_item_t *item, bool wait) {
+    struct route_bulkhead *bulkhead = &item->bulkhead;
+    int                    ret      = 0;
+
+    if (!route->bulkhead.max) {
+        atomic_fetch_add(&item->nref, 1);
+        return 0;
+    }
+
+    /* 等待至多bulkhead.wait，期间不能被取消（会遗留bulkhead->mutex和waiters） */
+    int oldstate;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+    pthread_mutex_lock(&bulkhead->mutex);
+    bool waited = false;
+    if ((uint32_t)atomic_load(&item->nref) >= route->bulkhead.max && wait && route->bulkhead.wait &&
+        atomic_load(&bulkhead->waiters) < route->bulkhead.max) {
+        struct timespec deadline = timestamp2spec(timestamp(true) + route->bulkhead.wait);
+        atomic_fetch_add(&bulkhead->waiters, 1);
+        pthread_rwlock_unlock(&route->rwlock);
+        while ((uint32_t)atomic_load(&item->nref) >= route->bulkhead.max && ret != ETIMEDOUT) {
+            ret = pthread_cond_timedwait(&bulkhead->cond, &bulkhead->mutex, &deadline);
+        }
+        waited = true;
+    }
+    if ((uint32_t)atomic_load(&item->nref) >= route->bulkhead.max) {
+        ret = EBUSY;
+    } else {
+        atomic_fetch_add(&item->nref, 1);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&bulkhead->mutex);
+
+    if (waited) {
+        /* 不能在持有bulkhead->mutex时获取读锁（注销时持有写锁再获取bulkhead->mutex） */
+        pthread_rwlock_rdlock(&route->rwlock);
+        atomic_fetch_sub(&bulkhead->waiters, 1);
+    }
+    pthread_setcancelstate(oldstate, NULL);
+    return ret;
+}
+
 void route_init(void *_route, struct route_list list) {
     route_t *route = _route;
 
@@ -146,8 +244,9 @@ int __route_unregister(struct route_list *list, const char *name) {
     }
 
     int nref = atomic_load(&item->nref);
-    if (nref) {
-        logfE("[route] unregister %s but busy (%d refs)", item->storage.name, nref);
+    if (nref || atomic_load(&item->bulkhead.waiters)) {
+        logfE("[route] unregister %s but busy (%d refs, %u waiters)", item->storage.name, nref,
+              atomic_load(&item->bulkhead.waiters));
         return EBUSY;
     }
 
@@ -175,6 +274,153 @@ int route_unregister(void *_route, const char *name) {
     return ret;
 }
 
+/**
+ * @brief 熔断器是否放行一个请求（open经过cooldown后转为half_open并放行一个探测请求；探测丢失时，再经过cooldown后重新放行）
+ */
+static bool breaker_allow(const route_t *route, route_item_t *item) {
+    struct route_breaker *breaker = &item->breaker;
+    bool                  allow   = true;
+
+    if (!route->breaker.ratio) return true;
+
+    pthread_mutex_lock(&breaker->mutex);
+    if (breaker->state != _breaker_closed) {
+        timestamp_t now = timestamp(true);
+        if ((breaker->state == _breaker_open || breaker->probing) && now - breaker->since < route->breaker.cooldown) {
+            allow = false;
+        } else {
+            if (breaker->state == _breaker_open) logfI("[route] breaker of %s half-open", item->storage.name);
+            breaker->state   = _breaker_half_open;
+            breaker->probing = true;
+            breaker->since   = now;
+        }
+    }
+    pthread_mutex_unlock(&breaker->mutex);
+    return allow;
+}
+
+/**
+ * @brief 是否是存储不可用（而非key本身）导致的失败
+ */
+static bool breaker_failure(int result) {
+    switch (result) {
+    case ETIMEDOUT:
+    case EIO:
+    case ENXIO:
+    case ECONNREFUSED:
+    case ECONNRESET:
+    case EPIPE:
+    case EPROTO:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void route_report(void *_route, const storage_ctx_t *storage, int result) {
+    route_t              *route   = _route;
+    route_item_t         *item    = (route_item_t *)((char *)storage - offsetof(route_item_t, storage));
+    struct route_breaker *breaker = &item->breaker;
+    bool                  failure = breaker_failure(result);
+
+    if (!route->breaker.ratio) return;
+
+    pthread_mutex_lock(&breaker->mutex);
+    timestamp_t now = timestamp(true);
+    switch (breaker->state) {
+    case _breaker_closed:
+        if (result == EAGAIN) break;
+        if (now - breaker->since > route->breaker.window) {
+            breaker->since  = now;
+            breaker->total  = 0;
+            breaker->failed = 0;
+        }
+        breaker->total++;
+        if (failure) breaker->failed++;
+        if (breaker->total >= route->breaker.min_requests &&
+            breaker->failed * 100 >= (uint32_t)route->breaker.ratio * breaker->total) {
+            logfW("[route] breaker of %s open (%u/%u failed)", item->storage.name, breaker->failed, breaker->total);
+            breaker->state = _breaker_open;
+            breaker->since = now;
+        }
+        break;
+    case _breaker_half_open:
+        if (result == EAGAIN) {
+            breaker->probing = false;
+        } else if (failure) {
+            logfW("[route] breaker of %s reopen" logFmtErrno, item->storage.name, logArgErrno_(result));
+            breaker->state   = _breaker_open;
+            breaker->probing = false;
+            breaker->since   = now;
+        } else {
+            logfI("[route] breaker of %s closed", item->storage.name);
+            breaker->state   = _breaker_closed;
+            breaker->probing = false;
+            breaker->since   = now;
+            breaker->total   = 0;
+            breaker->failed  = 0;
+        }
+        break;
+    case _breaker_open: /* 打开前已发出的请求 */
+        break;
+    }
+    pthread_mutex_unlock(&breaker->mutex);
+}
+
+/**
+ * @brief 查找匹配key的表项（Require holding route->rwlock for read）
+ *
+ * @return route_item_t* NULL表示没有匹配的表项
+ */
+static route_item_t *route_find(route_t *route, const char *key, const char **prefix) {
+    route_item_t *item = NULL;
+
+    LIST_FOREACH(item, &route->list, entry) {
+        for (int i = 0; item->prefix[i]; i++) {
+            if (prefix_match(item->prefix[i], key)) {
+                if (prefix) *prefix = item->prefix[i];
+                return item;
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 同route_find，并计入命中次数
+ */
+static route_item_t *route_lookup(route_t *route, const char *key) {
+    const char   *prefix = NULL;
+    route_item_t *item   = route_find(route, key, &prefix);
+
+    if (!item) {
+        metrics_count(_counter_route_miss, 1);
+        logfE("[route] " logFmtKey " match nothing", key);
+        return NULL;
+    }
+    logfV("[route] " logFmtKey " match " logFmtKey " of %s", key, prefix, item->storage.name);
+    atomic_fetch_add_explicit(&item->matches, 1, memory_order_relaxed);
+    return item;
+}
+
+/**
+ * @brief 经过熔断器和舱壁，增加表项的引用计数（Require holding route->rwlock for read, see `bulkhead_acquire`）
+ *
+ * @return int errno (EHOSTDOWN EBUSY)
+ */
+static int route_acquire(route_t *route, route_item_t *item, const char *key) {
+    if (!breaker_allow(route, item)) {
+        logfW("[route] " logFmtKey " fail fast since breaker of %s is open", key, item->storage.name);
+        return EHOSTDOWN;
+    }
+    if (bulkhead_acquire(route, item, true)) {
+        route_report(route, &item->storage, EAGAIN); /* 归还可能的探测机会 */
+        logfW("[route] " logFmtKey " rejected since %s is busy", key, item->storage.name);
+        return EBUSY;
+    }
+    return 0;
+}
+
 int route_match(void *_route, const char *key, const storage_ctx_t **storage) {
     route_t      *route = _route;
     int           ret   = 0;
@@ -182,27 +428,135 @@ int route_match(void *_route, const char *key, const storage_ctx_t **storage) {
 
     pthread_rwlock_rdlock(&route->rwlock);
 
+    item = route_lookup(route, key);
+    if (!item) {
+        ret = ENOENT;
+    } else if (storage) {
+        ret = route_acquire(route, item, key);
+        if (!ret) *storage = &item->storage;
+    }
+
+    pthread_rwlock_unlock(&route->rwlock);
+    return ret;
+}
+
+void route_match_batch(void *_route, int num, const char *const keys[], const storage_ctx_t *storages[],
+                       int results[]) {
+    route_t *route = _route;
+    int      oldstate;
+
+    for (int i = 0; i < num; i++) {
+        storages[i] = NULL;
+        results[i]  = -1; /* 尚未处理 */
+    }
+
+    /* 返回前已增加的引用计数不会被调用者释放 */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+    pthread_rwlock_rdlock(&route->rwlock);
+
+    for (int i = 0; i < num; i++) {
+        if (results[i] >= 0) continue; /* 已随前面同组的key处理 */
+
+        route_item_t *item = route_lookup(route, keys[i]);
+        if (!item) {
+            results[i] = ENOENT;
+            continue;
+        }
+        results[i] = route_acquire(route, item, keys[i]);
+        if (!results[i]) storages[i] = &item->storage;
+
+        /* 等待舱壁时可能释放过读锁，所以在获取之后才查找同组的key */
+        for (int j = i + 1; j < num; j++) {
+            if (results[j] >= 0 || route_find(route, keys[j], NULL) != item) continue;
+            atomic_fetch_add_explicit(&item->matches, 1, memory_order_relaxed);
+            results[j]  = results[i];
+            storages[j] = storages[i];
+        }
+    }
+
+    pthread_rwlock_unlock(&route->rwlock);
+    pthread_setcancelstate(oldstate, NULL);
+}
+
+/**
+ * @brief pattern（route的prefix）能否匹配以prefix开头的key
+ */
+static bool prefix_overlap(const char *pattern, const char *prefix) {
+    for (;; pattern++, prefix++) {
+        if (*pattern == '*' || *prefix == '\0') return true;
+        if (*pattern != *prefix) return false;
+    }
+}
+
+int route_match_prefix(void *_route, const char *prefix, const storage_ctx_t *storages[], int max, int *num) {
+    route_t      *route = _route;
+    int           ret   = 0;
+    route_item_t *item  = NULL;
+
+    *num = 0;
+    pthread_rwlock_rdlock(&route->rwlock);
+
     LIST_FOREACH(item, &route->list, entry) {
         for (int i = 0; item->prefix[i]; i++) {
-            if (prefix_match(item->prefix[i], key)) {
-                logfV("[route] " logFmtKey " match " logFmtKey " of %s", key, item->prefix[i], item->storage.name);
-                if (storage) {
-                    atomic_fetch_add(&item->nref, 1);
-                    *storage = &item->storage;
-                }
+            if (!prefix_overlap(item->prefix[i], prefix)) continue;
+            /* 跳过任何一个表项都会漏掉key，整个扫描失败 */
+            if (*num >= max) {
+                ret = E2BIG;
+                logfE("[route] " logFmtKey "* overlap more than %d items", prefix, max);
+                goto exit;
+            }
+            if (!breaker_allow(route, item)) {
+                ret = EHOSTDOWN;
+                logfW("[route] " logFmtKey "* fail fast since breaker of %s is open", prefix, item->storage.name);
+                goto exit;
+            }
+            if (bulkhead_acquire(route, item, false)) {
+                ret = EBUSY;
+                route_report(route, &item->storage, EAGAIN);
+                logfW("[route] " logFmtKey "* rejected since %s is busy", prefix, item->storage.name);
                 goto exit;
             }
+            logfV("[route] " logFmtKey "* overlap " logFmtKey " of %s", prefix, item->prefix[i], item->storage.name);
+            storages[(*num)++] = &item->storage;
+            break;
         }
     }
-    ret = ENOENT;
-    logfE("[route] " logFmtKey " match nothing", key);
+    if (!*num) ret = ENOENT;
 
 exit:
+    if (ret && ret != ENOENT) {
+        for (int i = 0; i < *num; i++) {
+            route_report(route, storages[i], EAGAIN); /* 归还已放行的探测机会 */
+            route_deref(route, storages[i]);
+        }
+        *num = 0;
+    }
     pthread_rwlock_unlock(&route->rwlock);
     return ret;
 }
 
-void route_deref(const storage_ctx_t *storage) {
-    route_item_t *item = (route_item_t *)((char *)storage - offsetof(route_item_t, storage));
+void route_deref(void *_route, const storage_ctx_t *storage) {
+    route_t      *route = _route;
+    route_item_t *item  = (route_item_t *)((char *)storage - offsetof(route_item_t, storage));
+
+    if (!route->bulkhead.max) {
+        atomic_fetch_sub(&item->nref, 1);
+        return;
+    }
+
+    pthread_mutex_lock(&item->bulkhead.mutex);
     atomic_fetch_sub(&item->nref, 1);
+    if (item->bulkhead.waiters) pthread_cond_signal(&item->bulkhead.cond);
+    pthread_mutex_unlock(&item->bulkhead.mutex);
+}
+
+void route_foreach_matches(void *_route, void (*fn)(void *arg, const char *name, uint64_t matches), void *arg) {
+    route_t      *route = _route;
+    route_item_t *item  = NULL;
+
+    pthread_rwlock_rdlock(&route->rwlock);
+    LIST_FOREACH(item, &route->list, entry) {
+        fn(arg, item->storage.name, atomic_load_explicit(&item->matches, memory_order_relaxed));
+    }
+    pthread_rwlock_unlock(&route->rwlock);
 }
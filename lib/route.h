@@ -32,14 +32,40 @@
 #define __PROPD_ROUTE_H
 
 #include "storage.h"
+#include <pthread.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/queue.h>
 
+enum route_breaker_state {
+    _breaker_closed = 0,
+    _breaker_open,      /* 快速失败（EHOSTDOWN） */
+    _breaker_half_open, /* 冷却结束，放行一个探测请求 */
+};
+
+struct route_breaker {
+    pthread_mutex_t          mutex;
+    enum route_breaker_state state;
+    bool                     probing;
+    uint32_t                 total;  /* closed时，当前窗口内的请求数 */
+    uint32_t                 failed; /* closed时，当前窗口内的失败数 */
+    timestamp_t              since;  /* closed：窗口的起点；open：打开的时刻；half_open：探测发出的时刻 */
+};
+
+struct route_bulkhead {
+    pthread_mutex_t mutex; /* 启用时，保护nref的增减 */
+    pthread_cond_t  cond;
+    atomic_uint     waiters; /* 非0时表项不会被注销，see `bulkhead_acquire` */
+};
+
 struct route_item {
-    storage_ctx_t storage; /* Note: cannot be a pointer, see `route_deref` */
-    const char  **prefix;
-    atomic_int    nref;
+    storage_ctx_t         storage; /* Note: cannot be a pointer, see `route_deref` */
+    const char          **prefix;
+    atomic_int            nref;    /* 同时也是进行中的请求数，see `route_set_bulkhead` */
+    atomic_uint_fast64_t  matches; /* 被route_match命中的次数 */
+    struct route_breaker  breaker;
+    struct route_bulkhead bulkhead;
     LIST_ENTRY(route_item) entry;
 };
 typedef struct route_item route_item_t;
@@ -74,6 +100,30 @@ void *route_create(void);
  * @param route 路由表对象 (maybe null)
  */
 void route_destroy(void *route);
+/**
+ * @brief 配置熔断器（对所有表项生效）
+ *
+ * 窗口内的请求数不少于min_requests，且失败（超时、连接错误等）的比例不低于ratio时打开熔断器，此后route_match快速失败；
+ * 经过cooldown后放行一个探测请求，探测成功则关闭，失败则重新打开
+ *
+ * @param route 路由表对象
+ * @param ratio unit: %（0 means disable）
+ * @param min_requests
+ * @param window unit: ms
+ * @param cooldown unit: ms
+ */
+void route_set_breaker(void *route, uint8_t ratio, uint32_t min_requests, timestamp_t window, timestamp_t cooldown);
+/**
+ * @brief 限制每个表项进行中的请求数（对所有表项生效，应在开始服务前调用）
+ *
+ * 达到上限时，route_match等待其他请求完成（等待期间不持有路由表的读锁），超过wait后以EBUSY拒绝；等待者也至多max个，
+ * 超出时立即拒绝。一个慢的存储至多占用2*max个线程，不会占满线程池
+ *
+ * @param route 路由表对象
+ * @param max 0 means no limit
+ * @param wait unit: ms（0 means reject immediately）
+ */
+void route_set_bulkhead(void *route, uint32_t max, timestamp_t wait);
 /**
  * @brief Initialize route
  *
@@ -107,16 +157,56 @@ int route_unregister(void *route, const char *name);
  * @param route 路由表对象
  * @param key
  * @param storage 返回存储上下文，并增加该表项的引用计数
- * @return int errno (ENOENT)
+ * @return int errno (ENOENT EHOSTDOWN 熔断器打开 EBUSY 进行中的请求数达到上限)
  */
 int route_match(void *route, const char *key, const storage_ctx_t **storage);
+/**
+ * @brief Get storages of the route items that match keys（同一表项的key为一组，每组只经过一次熔断器和舱壁）
+ *
+ * @param route 路由表对象
+ * @param num
+ * @param keys
+ * @param storages 返回各key的存储上下文（失败时为NULL）；每组只增加一次引用计数，route_report、route_deref也只需一次
+ * @param results 返回各key的errno（同route_match）
+ */
+void route_match_batch(void *route, int num, const char *const keys[], const storage_ctx_t *storages[],
+                       int results[]);
 
+/**
+ * @brief Get storages of the route items that may hold keys with prefix (in the order of matching)
+ *
+ * 任何一个表项的熔断器打开，或进行中的请求数达到上限时失败（不返回部分表项，避免扫描结果漏掉key）
+ *
+ * @param route 路由表对象
+ * @param prefix
+ * @param storages 返回存储上下文，并增加各表项的引用计数（失败时不返回任何存储）
+ * @param max
+ * @param num 返回的数量
+ * @return int errno (ENOENT E2BIG 超过max个表项 EHOSTDOWN 熔断器打开 EBUSY 进行中的请求数达到上限)
+ */
+int route_match_prefix(void *route, const char *prefix, const storage_ctx_t *storages[], int max, int *num);
+/**
+ * @brief 报告一次访问存储的结果，用于熔断
+ *
+ * @param route 路由表对象
+ * @param storage route_match返回的存储上下文（在route_deref之前）
+ * @param result errno。EAGAIN表示并未访问存储，不计入
+ */
+void route_report(void *route, const storage_ctx_t *storage, int result);
 /**
  * @brief 减少存储上下文所在表项的引用计数
  *
  * @param route
  * @param storage
  */
-void route_deref(const storage_ctx_t *storage);
+void route_deref(void *route, const storage_ctx_t *storage);
+/**
+ * @brief 遍历各表项被route_match命中的次数（持有路由表的读锁）
+ *
+ * @param route 路由表对象
+ * @param fn
+ * @param arg
+ */
+void route_foreach_matches(void *route, void (*fn)(void *arg, const char *name, uint64_t matches), void *arg);
 
 #endif /* __PROPD_ROUTE_H */
@@ -31,57 +31,168 @@
 #include "storage.h"
 #include "cache.h"
 #include "global.h"
+#include "trace.h"
 #include <errno.h>
 
 #define logFmtHead "[storage::%s] "
 #define logArgHead storage->name
 
+static void log_get(const storage_ctx_t *storage, const char *key, int ret, const value_t *value,
+                    timestamp_t duration) {
+    if (ret) {
+        logfE(logFmtHead "fail to get " logFmtKey logFmtErrno, logArgHead, key, logArgErrno_(ret));
+        return;
+    }
+
+    if (!logEnabled(MLOG_INFO)) return;
+    char buffer[256];
+    char buffer1[32];
+    logfI(logFmtHead "get " logFmtKey " is " logFmtValue " with duration %s", logArgHead, key,
+          value_fmt(buffer, sizeof(buffer), value, false), duration_fmt(buffer1, sizeof(buffer1), duration));
+}
+
 int storage_get(const storage_ctx_t *storage, const char *key, const value_t **value, timestamp_t *duration) {
     assert(key);
     assert(value);
     if (!storage->get) return EOPNOTSUPP;
 
     timestamp_t _duration;
+    timestamp_t since = trace_since();
 
     int ret = storage->get(storage->priv, key, value, &_duration);
-    if (ret) {
-        logfE(logFmtHead "fail to get " logFmtKey logFmtErrno, logArgHead, key, logArgErrno_(ret));
-        return ret;
+    trace_add(_trace_storage, since);
+    log_get(storage, key, ret, ret ? NULL : *value, _duration);
+    if (ret) return ret;
+
+    if (duration) *duration = _duration;
+    return 0;
+}
+
+int storage_get_buf(const storage_ctx_t *storage, const char *key, value_t **value, uint32_t *size,
+                    timestamp_t *duration) {
+    assert(key);
+    assert(value);
+    assert(size);
+
+    int         ret       = 0;
+    timestamp_t _duration = 0;
+
+    if (storage->get_buf) {
+        timestamp_t since = trace_since();
+        for (;;) {
+            uint32_t need = *size;
+            ret           = storage->get_buf(storage->priv, key, *value, &need, &_duration);
+            if (ret != ENOBUFS) break;
+            if (need <= *size) {
+                /* 没有要求更大的buffer，重试也不会成功 */
+                logfE(logFmtHead "get " logFmtKey " asks for %u bytes with %u bytes buffer", logArgHead, key, need,
+                      *size);
+                ret = EIO;
+                break;
+            }
+
+            value_t *buffer = realloc(*value, need);
+            if (!buffer) {
+                ret = errno;
+                break;
+            }
+            *value = buffer;
+            *size  = need;
+        }
+        trace_add(_trace_storage, since);
+        log_get(storage, key, ret, *value, _duration);
+        if (ret) return ret;
+    } else {
+        const value_t *_value = NULL;
+
+        ret = storage_get(storage, key, &_value, &_duration);
+        if (ret) return ret;
+        uint32_t need = sizeof(value_t) + _value->length;
+        if (*size < need) {
+            /* 容量不足时直接以取得的value作为buffer */
+            free(*value);
+            *value = (value_t *)_value;
+            *size  = need;
+        } else {
+            memcpy(*value, _value, need);
+            free((void *)_value);
+        }
     }
 
     if (duration) *duration = _duration;
-    char buffer[256] = {0};
-    char buffer1[32] = {0};
-    value_fmt(buffer, sizeof(buffer), *value, false);
-    duration_fmt(buffer1, sizeof(buffer1), _duration);
-    logfI(logFmtHead "get " logFmtKey " is " logFmtValue " with duration %s", logArgHead, key, buffer, buffer1);
     return 0;
 }
 
+struct async_ctx {
+    const storage_ctx_t *storage;
+    storage_done_t       done;
+    void                *arg;
+    char                 key[];
+};
+typedef struct async_ctx async_ctx_t;
+
+static void async_done(async_ctx_t *ctx, int result, const value_t *value, timestamp_t duration) {
+    const storage_ctx_t *storage = ctx->storage;
+    log_get(storage, ctx->key, result, value, duration);
+    ctx->done(ctx->arg, result, value, duration);
+    free(ctx);
+}
+
+int storage_get_async(const storage_ctx_t *storage, const char *key, storage_done_t done, void *arg) {
+    assert(key);
+    assert(done);
+
+    if (!storage->get_async) {
+        const value_t *value    = NULL;
+        timestamp_t    duration = 0;
+        int            ret      = storage_get(storage, key, &value, &duration);
+        done(arg, ret, ret ? NULL : value, duration);
+        return 0;
+    }
+
+    async_ctx_t *ctx = malloc(sizeof(async_ctx_t) + strlen(key) + 1);
+    if (!ctx) return errno;
+    ctx->storage = storage;
+    ctx->done    = done;
+    ctx->arg     = arg;
+    strcpy(ctx->key, key);
+
+    int ret = storage->get_async(storage->priv, key, (storage_done_t)async_done, ctx);
+    if (ret) {
+        logfE(logFmtHead "fail to submit get " logFmtKey logFmtErrno, logArgHead, key, logArgErrno_(ret));
+        free(ctx);
+    }
+    return ret;
+}
+
 int storage_set(const storage_ctx_t *storage, const char *key, const value_t *value) {
     assert(key);
     assert(value);
     if (!storage->set) return EOPNOTSUPP;
 
-    char buffer[256] = {0};
-    value_fmt(buffer, sizeof(buffer), value, false);
+    char        buffer[256];
+    timestamp_t since = trace_since();
 
     int ret = storage->set(storage->priv, key, value);
+    trace_add(_trace_storage, since);
     if (ret) {
-        logfE(logFmtHead "fail to set " logFmtKey " as " logFmtValue logFmtErrno, logArgHead, key, buffer,
-              logArgErrno_(ret));
+        logfE(logFmtHead "fail to set " logFmtKey " as " logFmtValue logFmtErrno, logArgHead, key,
+              value_fmt(buffer, sizeof(buffer), value, false), logArgErrno_(ret));
         return ret;
     }
 
-    logfI(logFmtHead "set " logFmtKey " as " logFmtValue, logArgHead, key, buffer);
+    logfI(logFmtHead "set " logFmtKey " as " logFmtValue, logArgHead, key,
+          value_fmt(buffer, sizeof(buffer), value, false));
     return 0;
 }
 
 int storage_del(const storage_ctx_t *storage, const char *key) {
     assert(key);
-    if (!storage->set) return EOPNOTSUPP;
+    if (!storage->del) return EOPNOTSUPP;
 
-    int ret = storage->del(storage->priv, key);
+    timestamp_t since = trace_since();
+    int         ret   = storage->del(storage->priv, key);
+    trace_add(_trace_storage, since);
     if (ret) {
         logfE(logFmtHead "fail to del " logFmtKey logFmtErrno, logArgHead, key, logArgErrno_(ret));
         return ret;
@@ -91,6 +202,154 @@ int storage_del(const storage_ctx_t *storage, const char *key) {
     return ret;
 }
 
+int storage_mget(const storage_ctx_t *storage, int num, const char *const keys[], const value_t *values[],
+                 timestamp_t durations[], int results[]) {
+    assert(keys);
+    assert(values);
+    assert(results);
+
+    if (!storage->mget) {
+        for (int i = 0; i < num; i++) {
+            values[i]  = NULL;
+            results[i] = storage_get(storage, keys[i], &values[i], durations ? &durations[i] : NULL);
+        }
+        return 0;
+    }
+
+    timestamp_t *_durations = durations ? durations : calloc(num, sizeof(timestamp_t));
+    if (!_durations) return errno;
+
+    for (int i = 0; i < num; i++)
+        values[i] = NULL;
+    timestamp_t since = trace_since();
+    int         ret   = storage->mget(storage->priv, num, keys, values, _durations, results);
+    trace_add(_trace_storage, since);
+    if (ret) {
+        logfE(logFmtHead "fail to get %d keys" logFmtErrno, logArgHead, num, logArgErrno_(ret));
+        for (int i = 0; i < num; i++) {
+            free((void *)values[i]);
+            values[i] = NULL;
+        }
+        goto exit;
+    }
+
+    for (int i = 0; i < num; i++) {
+        if (results[i]) {
+            logfE(logFmtHead "fail to get " logFmtKey logFmtErrno, logArgHead, keys[i], logArgErrno_(results[i]));
+            continue;
+        }
+        char buffer[256];
+        char buffer1[32];
+        logfI(logFmtHead "get " logFmtKey " is " logFmtValue " with duration %s", logArgHead, keys[i],
+              value_fmt(buffer, sizeof(buffer), values[i], false),
+              duration_fmt(buffer1, sizeof(buffer1), _durations[i]));
+    }
+
+exit:
+    if (!durations) free(_durations);
+    return ret;
+}
+
+int storage_mset(const storage_ctx_t *storage, int num, const char *const keys[], const value_t *const values[],
+                 int results[]) {
+    assert(keys);
+    assert(values);
+    assert(results);
+
+    if (!storage->mset) {
+        for (int i = 0; i < num; i++)
+            results[i] = storage_set(storage, keys[i], values[i]);
+        return 0;
+    }
+
+    timestamp_t since = trace_since();
+    int         ret   = storage->mset(storage->priv, num, keys, values, results);
+    trace_add(_trace_storage, since);
+    if (ret) {
+        logfE(logFmtHead "fail to set %d keys" logFmtErrno, logArgHead, num, logArgErrno_(ret));
+        return ret;
+    }
+
+    for (int i = 0; i < num; i++) {
+        char buffer[256];
+        if (results[i])
+            logfE(logFmtHead "fail to set " logFmtKey " as " logFmtValue logFmtErrno, logArgHead, keys[i],
+                  value_fmt(buffer, sizeof(buffer), values[i], false), logArgErrno_(results[i]));
+        else
+            logfI(logFmtHead "set " logFmtKey " as " logFmtValue, logArgHead, keys[i],
+                  value_fmt(buffer, sizeof(buffer), values[i], false));
+    }
+    return 0;
+}
+
+int storage_mdel(const storage_ctx_t *storage, int num, const char *const keys[], int results[]) {
+    assert(keys);
+    assert(results);
+
+    if (!storage->mdel) {
+        for (int i = 0; i < num; i++)
+            results[i] = storage_del(storage, keys[i]);
+        return 0;
+    }
+
+    timestamp_t since = trace_since();
+    int         ret   = storage->mdel(storage->priv, num, keys, results);
+    trace_add(_trace_storage, since);
+    if (ret) {
+        logfE(logFmtHead "fail to del %d keys" logFmtErrno, logArgHead, num, logArgErrno_(ret));
+        return ret;
+    }
+
+    for (int i = 0; i < num; i++) {
+        if (results[i])
+            logfE(logFmtHead "fail to del " logFmtKey logFmtErrno, logArgHead, keys[i], logArgErrno_(results[i]));
+        else logfI(logFmtHead "del " logFmtKey, logArgHead, keys[i]);
+    }
+    return 0;
+}
+
+int storage_scan(const storage_ctx_t *storage, const char *prefix, const char *cursor, int limit,
+                 storage_entry_t entries[], int *num) {
+    assert(prefix);
+    assert(entries);
+    assert(num);
+    if (!storage->scan) return EOPNOTSUPP;
+
+    timestamp_t since = trace_since();
+    *num              = 0;
+    int ret           = storage->scan(storage->priv, prefix, cursor ? cursor : "", limit, entries, num);
+    trace_add(_trace_storage, since);
+    if (ret) {
+        logfE(logFmtHead "fail to scan " logFmtKey " after " logFmtKey logFmtErrno, logArgHead, prefix,
+              cursor ? cursor : "", logArgErrno_(ret));
+        return ret;
+    }
+
+    logfI(logFmtHead "scan " logFmtKey " after " logFmtKey " got %d keys", logArgHead, prefix, cursor ? cursor : "",
+          *num);
+    return 0;
+}
+
+int storage_watch(const storage_ctx_t *storage, storage_changed_t changed, void *arg) {
+    assert(changed);
+    if (!storage->watch) return EOPNOTSUPP;
+
+    int ret = storage->watch(storage->priv, changed, arg);
+    if (ret) {
+        logfE(logFmtHead "fail to watch" logFmtErrno, logArgHead, logArgErrno_(ret));
+        return ret;
+    }
+    logfI(logFmtHead "watch changes outside", logArgHead);
+    return 0;
+}
+
+void storage_entries_free(storage_entry_t entries[], int num) {
+    for (int i = 0; i < num; i++) {
+        free((void *)entries[i].value);
+        entries[i].value = NULL;
+    }
+}
+
 void storage_destructor(const storage_ctx_t *storage) {
     if (storage->destructor) storage->destructor(storage->priv);
     free((void *)storage->name);
@@ -33,23 +33,84 @@
 
 #include "infra/timestamp.h"
 #include "value.h"
+#include <linux/limits.h>
 #include <sys/queue.h>
 
 /**
  * Requirements for IO functions:
- * - No persistent blocking (timeout needs to be implemented)
+ * - No persistent blocking (timeout needs to be implemented, return ETIMEDOUT, see g_io_timeout)
  * - Returns 0 on success, errno otherwise
  * - Need to consider concurrency when different keys
  * - Except for priv, none of the other arguments will ever be null
  *
+ * Batch functions (mget/mset/mdel) are optional, storage_mget/mset/mdel will fallback to get/set/del one by one:
+ * - Returns 0 when the batch has been processed, and errno of each key in results; errno otherwise (results are
+ *   meaningless)
+ * - The same key may appear more than once
+ *
+ * get_buf is optional, storage_get_buf will fallback to get (and copy, or take the value as the buffer if it is too
+ * small):
+ * - The second to last argument is the capacity of value in bytes (including value_t) on input, and the size used
+ *   (or needed, when returns ENOBUFS) on output
+ * - storage_get_buf grows the buffer and calls again on ENOBUFS
+ *
+ * scan is optional:
+ * - Fills entries whose key starts with prefix and is greater than cursor (NULL or "" means from the beginning), in
+ *   ascending order (strcmp), at most limit entries; less than limit means no more entries
+ *
+ * Async functions (get_async) are optional, storage_get_async will fallback to get and complete inline:
+ * - Returns 0 when the request has been submitted, errno otherwise (done will never be called)
+ * - done must be called exactly once, maybe before returning, maybe in another thread
+ *
+ * watch is optional:
+ * - Called at most once, before any IO. Afterwards, changed is called (maybe in another thread) with each key changed
+ *   by others than this storage, or with NULL when it cannot tell which keys are changed
+ * - changed must not be called after the destructor returns
+ *
  * The constructor is used to populate this context. It returns 0 on success, errno otherwise.
  */
+
+/**
+ * @brief Completion of async IO functions
+ *
+ * @param arg
+ * @param result errno
+ * @param value 仅当result为0时有效，所有权交给回调
+ * @param duration 仅当result为0时有效
+ */
+typedef void (*storage_done_t)(void *arg, int result, const value_t *value, timestamp_t duration);
+
+/**
+ * @brief Notification of keys changed outside
+ *
+ * @param arg
+ * @param key NULL表示无法确定哪些key发生了变化
+ */
+typedef void (*storage_changed_t)(void *arg, const char *key);
+
+/**
+ * @brief An entry of scan
+ */
+struct storage_entry {
+    char           key[NAME_MAX];
+    const value_t *value; /* allocated */
+    timestamp_t    duration;
+};
+typedef struct storage_entry storage_entry_t;
+
 struct storage_ctx {
     const char *name; /* duplicated in constructor, release in destructor */
     void       *priv; /* allocated in constructor, release in destructor */
     int (*get)(void *priv, const char *, const value_t **, timestamp_t *);
     int (*set)(void *priv, const char *, const value_t *);
     int (*del)(void *priv, const char *);
+    int (*get_buf)(void *priv, const char *, value_t *, uint32_t *, timestamp_t *);
+    int (*mget)(void *priv, int, const char *const *, const value_t **, timestamp_t *, int *);
+    int (*mset)(void *priv, int, const char *const *, const value_t *const *, int *);
+    int (*mdel)(void *priv, int, const char *const *, int *);
+    int (*get_async)(void *priv, const char *, storage_done_t, void *);
+    int (*scan)(void *priv, const char *, const char *, int, storage_entry_t *, int *);
+    int (*watch)(void *priv, storage_changed_t, void *);
     void (*destructor)(void *priv);
 };
 typedef struct storage_ctx storage_ctx_t;
@@ -81,6 +142,92 @@ int storage_set(const storage_ctx_t *storage, const char *key, const value_t *va
  * @return int errno (EOPNOTSUPP ...)
  */
 int storage_del(const storage_ctx_t *storage, const char *key);
+/**
+ * @brief Get key into caller's buffer (grow the buffer if it is too small)
+ *
+ * @param storage
+ * @param key
+ * @param value 调用者持有的buffer（*size为0时可以为NULL），容量不足时重新分配
+ * @param size *value的容量（字节，包括value_t）
+ * @param duration maybe null
+ * @return int errno (EOPNOTSUPP ENOMEM EIO ...)
+ */
+int storage_get_buf(const storage_ctx_t *storage, const char *key, value_t **value, uint32_t *size,
+                    timestamp_t *duration);
+/**
+ * @brief Get key asynchronously (fallback to get and complete inline if storage doesn't support)
+ *
+ * @param storage
+ * @param key
+ * @param done 完成时调用（可能在返回前，也可能在其他线程）
+ * @param arg
+ * @return int errno (ENOMEM ...)，非0时不会调用done
+ */
+int storage_get_async(const storage_ctx_t *storage, const char *key, storage_done_t done, void *arg);
+/**
+ * @brief Scan keys with prefix
+ *
+ * @param storage
+ * @param prefix
+ * @param cursor 从大于cursor的key开始（NULL或""表示从头开始），通常是上一次返回的最后一个key
+ * @param limit
+ * @param entries 至少limit个，value需要通过storage_entries_free释放
+ * @param num 返回的数量，小于limit时表示已经没有更多
+ * @return int errno (EOPNOTSUPP ...)
+ */
+int storage_scan(const storage_ctx_t *storage, const char *prefix, const char *cursor, int limit,
+                 storage_entry_t entries[], int *num);
+/**
+ * @brief Watch keys changed outside (e.g. by other processes)
+ *
+ * @param storage
+ * @param changed 每个发生变化的key都会调用一次（可能在其他线程）
+ * @param arg
+ * @return int errno (EOPNOTSUPP ...)
+ */
+int storage_watch(const storage_ctx_t *storage, storage_changed_t changed, void *arg);
+/**
+ * @brief Release values of entries
+ *
+ * @param entries
+ * @param num
+ */
+void storage_entries_free(storage_entry_t entries[], int num);
+/**
+ * @brief Get keys in batch
+ *
+ * @param storage
+ * @param num
+ * @param keys
+ * @param values 返回每个key的值（失败的为NULL）
+ * @param durations maybe null
+ * @param results 返回每个key的errno
+ * @return int errno (ENOMEM ...)，为0时以results为准
+ */
+int storage_mget(const storage_ctx_t *storage, int num, const char *const keys[], const value_t *values[],
+                 timestamp_t durations[], int results[]);
+/**
+ * @brief Set keys in batch
+ *
+ * @param storage
+ * @param num
+ * @param keys
+ * @param values
+ * @param results 返回每个key的errno
+ * @return int errno (...)，为0时以results为准
+ */
+int storage_mset(const storage_ctx_t *storage, int num, const char *const keys[], const value_t *const values[],
+                 int results[]);
+/**
+ * @brief Del keys in batch
+ *
+ * @param storage
+ * @param num
+ * @param keys
+ * @param results 返回每个key的errno
+ * @return int errno (...)，为0时以results为准
+ */
+int storage_mdel(const storage_ctx_t *storage, int num, const char *const keys[], int results[]);
 /**
  * @brief
  *
@@ -0,0 +1,154 @@
+/**
+ * @file trace.c
+ * @author kioz.wang (never.had@outlook.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright MIT License
+ *
+ *  Copyright (c) 2025 kioz.wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include "trace.h"
+#include "global.h"
+#include "metrics.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_RING 64 /* 保留最近的追踪记录数 */
+
+static struct {
+    atomic_uint     every;
+    atomic_uint     seq;
+    atomic_uint     next_id;
+    pthread_mutex_t mutex; /* 保护以下成员 */
+    uint32_t        head;  /* 下一个写入的位置 */
+    uint32_t        num;
+    trace_t         ring[TRACE_RING];
+} g_trace = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+__thread trace_t *t_trace;
+
+void trace_set_sampling(uint32_t every) {
+    atomic_store(&g_trace.every, every);
+    if (every) logfI("[trace] trace one of every %u requests", every);
+}
+
+bool trace_begin(trace_t *trace, const io_package_t *pkg, timestamp_t started) {
+    t_trace   = NULL;
+    trace->id = 0;
+
+    if (pkg->trace.id) {
+        trace->id  = pkg->trace.id;
+        trace->hop = pkg->trace.hop;
+    } else {
+        uint32_t every = atomic_load_explicit(&g_trace.every, memory_order_relaxed);
+        if (!every || atomic_fetch_add_explicit(&g_trace.seq, 1, memory_order_relaxed) % every) return false;
+        trace->id  = (uint64_t)getpid() << 32 | atomic_fetch_add(&g_trace.next_id, 1);
+        trace->hop = 0;
+    }
+    trace->type   = pkg->type;
+    trace->result = 0;
+    trace->start  = started;
+    trace->queue  = started - pkg->created;
+    trace->total  = 0;
+    trace->mark   = 0;
+    memset(trace->phases, 0, sizeof(trace->phases));
+    snprintf(trace->key, sizeof(trace->key), "%.*s", (int)sizeof(pkg->key), pkg->key);
+
+    t_trace = trace;
+    return true;
+}
+
+void trace_end(trace_t *trace, int result) {
+    if (t_trace == trace) t_trace = NULL;
+    if (!trace->id) return;
+
+    trace->result = result;
+    trace->total  = timestamp(true) - trace->start;
+    trace->mark   = 0;
+
+    pthread_mutex_lock(&g_trace.mutex);
+    g_trace.ring[g_trace.head] = *trace;
+    g_trace.head               = (g_trace.head + 1) % TRACE_RING;
+    if (g_trace.num < TRACE_RING) g_trace.num++;
+    pthread_mutex_unlock(&g_trace.mutex);
+
+    logfD("[trace] %016lx hop%u " logFmtKey " done in %ldns", trace->id, trace->hop, trace->key, trace->total);
+    trace->id = 0;
+}
+
+void trace_async_begin(trace_t *trace) {
+    if (trace->id) trace->mark = timestamp(true);
+}
+
+void trace_async_done(trace_t *trace) {
+    if (!trace->id) return;
+    if (trace->mark) trace->phases[_trace_storage] += timestamp(true) - trace->mark;
+    trace->mark = 0;
+}
+
+void *trace_dump(int *length) {
+    pthread_mutex_lock(&g_trace.mutex);
+    uint32_t num  = g_trace.num;
+    size_t   size = sizeof(uint32_t) + num * sizeof(trace_t);
+    char    *data = malloc(size);
+    if (data) {
+        memcpy(data, &num, sizeof(num));
+        trace_t *records = (trace_t *)(data + sizeof(num));
+        for (uint32_t i = 0; i < num; i++)
+            records[i] = g_trace.ring[(g_trace.head + TRACE_RING - num + i) % TRACE_RING];
+    }
+    pthread_mutex_unlock(&g_trace.mutex);
+
+    if (!data) return NULL;
+    *length = size;
+    return data;
+}
+
+int trace_render(FILE *fp, const void *data, int length) {
+    static const char *const types[] = {"get", "set", "del", "mget", "mset", "mdel", "scan"};
+    uint32_t                 num;
+
+    if (length < (int)sizeof(num)) return EPROTO;
+    memcpy(&num, data, sizeof(num));
+    if ((size_t)length != sizeof(num) + num * sizeof(trace_t)) return EPROTO;
+
+    for (uint32_t i = 0; i < num; i++) {
+        trace_t trace;
+        char    b[5][16];
+        memcpy(&trace, (const char *)data + sizeof(num) + i * sizeof(trace_t), sizeof(trace));
+        trace.key[NAME_MAX - 1] = '\0';
+        fprintf(fp, "%016lx hop%u %s " logFmtKey " (%d) queue %s lock %s storage %s send %s total %s\n", trace.id,
+                trace.hop, trace.type <= _io_scan ? types[trace.type] : "?", trace.key, trace.result,
+                latency_fmt(b[0], sizeof(b[0]), trace.queue),
+                latency_fmt(b[1], sizeof(b[1]), trace.phases[_trace_lock]),
+                latency_fmt(b[2], sizeof(b[2]), trace.phases[_trace_storage]),
+                latency_fmt(b[3], sizeof(b[3]), trace.phases[_trace_send]),
+                latency_fmt(b[4], sizeof(b[4]), trace.total));
+    }
+    return 0;
+}
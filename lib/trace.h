@@ -0,0 +1,152 @@
+/**
+ * @file trace.h
+ * @author kioz.wang (never.had@outlook.com)
+ * @brief
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright MIT License
+ *
+ *  Copyright (c) 2025 kioz.wang
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#ifndef __PROPD_TRACE_H
+#define __PROPD_TRACE_H
+
+#include "infra/timestamp.h"
+#include "io_server.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum trace_phase {
+    _trace_lock = 0, /* 等待named mutex */
+    _trace_storage,  /* 访问存储（转发给子节点时，包含子节点的全部耗时） */
+    _trace_send,     /* 发送应答（get的应答，或其他请求最后的result） */
+    _trace_phase_num,
+};
+
+/**
+ * @brief 一跳的追踪记录
+ */
+struct trace {
+    uint64_t    id;  /* 0 means not traced */
+    uint8_t     hop; /* 最先收到请求的节点为0 */
+    io_type_t   type;
+    int32_t     result;
+    timestamp_t start;                    /* 收到请求头的时刻（monotonic） */
+    timestamp_t queue;                    /* 从上一跳发出请求到收到请求头（含传输、线程池排队） */
+    timestamp_t phases[_trace_phase_num]; /* 各阶段的累计时长 */
+    timestamp_t total;                    /* 从收到请求头到发出应答 */
+    timestamp_t mark;                     /* 异步get提交的时刻，期间不累计各阶段 */
+    char        key[NAME_MAX];
+};
+typedef struct trace trace_t;
+
+extern __thread trace_t *t_trace; /* 当前线程正在处理的请求的追踪记录 */
+
+/**
+ * @brief 设定采样率（对所有线程生效）
+ *
+ * @param every 每every个请求追踪一个（0 means disable）。上一跳已追踪的请求总是继续追踪
+ */
+void trace_set_sampling(uint32_t every);
+/**
+ * @brief 开始处理一个请求，决定是否追踪；追踪时trace成为当前线程的追踪记录
+ *
+ * @param trace
+ * @param pkg 请求头
+ * @param started 收到请求头的时刻
+ * @return bool 是否追踪
+ */
+bool trace_begin(trace_t *trace, const io_package_t *pkg, timestamp_t started);
+/**
+ * @brief 完成请求的处理，保存追踪记录，并从当前线程解除
+ *
+ * @param trace maybe not traced
+ * @param result
+ */
+void trace_end(trace_t *trace, int result);
+/**
+ * @brief 提交异步get前调用，此后直到trace_async_done，底层不再累计各阶段
+ *
+ * @param trace maybe not traced
+ */
+void trace_async_begin(trace_t *trace);
+/**
+ * @brief 异步get完成时调用（可能在其他线程），计入存储时长
+ *
+ * @param trace maybe not traced
+ */
+void trace_async_done(trace_t *trace);
+/**
+ * @brief 恢复暂停的连接时调用，trace成为当前线程的追踪记录
+ *
+ * @param trace maybe not traced
+ */
+static inline void trace_attach(trace_t *trace) { t_trace = trace->id ? trace : NULL; }
+/**
+ * @brief 从当前线程解除追踪记录（不保存）
+ */
+static inline void trace_detach(void) { t_trace = NULL; }
+/**
+ * @brief 转发请求前，将追踪上下文写入请求头
+ *
+ * @param ctx
+ */
+static inline void trace_inject(io_trace_t *ctx) {
+    if (!t_trace) return;
+    ctx->id  = t_trace->id;
+    ctx->hop = t_trace->hop + 1;
+}
+/**
+ * @brief 阶段开始的时刻
+ *
+ * @return timestamp_t 当前线程没有追踪记录时返回0
+ */
+static inline timestamp_t trace_since(void) { return t_trace && !t_trace->mark ? timestamp(true) : 0; }
+/**
+ * @brief 累计阶段的时长
+ *
+ * @param phase
+ * @param since trace_since的返回值，为0时忽略
+ */
+static inline void trace_add(enum trace_phase phase, timestamp_t since) {
+    if (since && t_trace && !t_trace->mark) t_trace->phases[phase] += timestamp(true) - since;
+}
+/**
+ * @brief 编码最近的追踪记录（由旧到新）
+ *
+ * @param length 返回编码后的长度
+ * @return void* On error, return NULL and set errno
+ */
+void *trace_dump(int *length);
+/**
+ * @brief 将trace_dump的结果渲染为文本
+ *
+ * @param fp
+ * @param data
+ * @param length
+ * @return int errno (EPROTO)
+ */
+int trace_render(FILE *fp, const void *data, int length);
+
+#endif /* __PROPD_TRACE_H */
@@ -107,6 +107,7 @@ exit_inval:
 }
 
 const char *value_fmt(char *buffer, size_t length, const value_t *value, bool notype) {
+    buffer[0] = '\0';
     switch (value->type) {
     case _value_i32:
         snprintf(buffer, length, "%s%d", notype ? "" : "i32:", value_to_i32(value));